@@ -0,0 +1,216 @@
+#!/usr/bin/env bash
+
+############################################################################
+# bfs                                                                      #
+# Copyright (C) 2023 Tavian Barnes <tavianator@tavianator.com>             #
+#                                                                          #
+# Permission to use, copy, modify, and/or distribute this software for any #
+# purpose with or without fee is hereby granted.                           #
+#                                                                          #
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES #
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         #
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  #
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   #
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    #
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  #
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           #
+############################################################################
+
+set -eP
+umask 022
+
+export LC_ALL=C
+export TZ=UTC0
+
+export LS_COLORS=""
+unset BFS_COLORS
+
+if [ -t 2 ]; then
+    RED=$(printf '\033[01;31m')
+    GRN=$(printf '\033[01;32m')
+    YLW=$(printf '\033[01;33m')
+    BLU=$(printf '\033[01;34m')
+    MAG=$(printf '\033[01;35m')
+    RST=$(printf '\033[0m')
+fi
+
+function usage() {
+    local pad=$(printf "%*s" ${#0} "")
+    cat <<EOF
+Usage: ${GRN}$0${RST} [${BLU}--bfs${RST}=${MAG}path/to/bfs${RST}] [${BLU}--dir${RST}=${MAG}path${RST}] [${BLU}--size${RST}=${MAG}N${RST}] [${BLU}--runs${RST}=${MAG}N${RST}]
+       $pad [${BLU}--shapes${RST}=${MAG}wide,deep,small,links${RST}] [${BLU}--cold${RST}] [${BLU}--help${RST}]
+
+  ${BLU}--bfs${RST}=${MAG}path/to/bfs${RST}
+      Set the path to the bfs executable to benchmark (default: ${MAG}./bfs${RST})
+
+  ${BLU}--dir${RST}=${MAG}path${RST}
+      Where to generate the trees (default: a temporary directory)
+
+  ${BLU}--size${RST}=${MAG}N${RST}
+      The number of files in each tree (default: ${MAG}100000${RST})
+
+  ${BLU}--runs${RST}=${MAG}N${RST}
+      How many times to run each benchmark (default: ${MAG}5${RST})
+
+  ${BLU}--shapes${RST}=${MAG}SHAPE,...${RST}
+      Which tree shapes to generate (default: ${MAG}wide,deep,small,links${RST})
+
+  ${BLU}--cold${RST}
+      Also run each benchmark with a cold cache (requires writing to
+      ${MAG}/proc/sys/vm/drop_caches${RST})
+
+  ${BLU}--help${RST}
+      This message
+
+Results are written to standard output as tab-separated values, one line per
+benchmark, after a header line.  The columns are:
+
+  shape  size  benchmark  cache  runs  min  median  max
+
+with times in seconds.
+EOF
+}
+
+BFS=
+DIR=
+SIZE=100000
+RUNS=5
+SHAPES=wide,deep,small,links
+COLD=
+
+for arg; do
+    case "$arg" in
+        --bfs=*)
+            BFS="${arg#*=}"
+            ;;
+        --dir=*)
+            DIR="${arg#*=}"
+            ;;
+        --size=*)
+            SIZE="${arg#*=}"
+            ;;
+        --runs=*)
+            RUNS="${arg#*=}"
+            ;;
+        --shapes=*)
+            SHAPES="${arg#*=}"
+            ;;
+        --cold)
+            COLD=yes
+            ;;
+        --help)
+            usage
+            exit 0
+            ;;
+        *)
+            printf "${RED}error:${RST} Unrecognized option '%s'.\n\n" "$arg" >&2
+            usage >&2
+            exit 1
+            ;;
+    esac
+done
+
+ROOT=$(cd "$(dirname -- "$0")" && pwd)
+BFS="${BFS:-$ROOT/bfs}"
+MKTREE="$ROOT/tests/mktree"
+
+if [ -z "$DIR" ]; then
+    DIR=$(mktemp -d "${TMPDIR:-/tmp}"/bfs.bench.XXXXXXXXXX)
+    trap 'rm -rf "$DIR"' EXIT
+fi
+
+if [ "$COLD" ] && ! [ -w /proc/sys/vm/drop_caches ]; then
+    printf "${YLW}warning:${RST} Can't drop caches, skipping cold-cache runs.\n" >&2
+    COLD=
+fi
+
+CACHES=(warm)
+if [ "$COLD" ]; then
+    CACHES+=(cold)
+fi
+
+# Get the time in seconds
+function now() {
+    date +%s.%N
+}
+
+# Drop the page, dentry, and inode caches
+function drop_caches() {
+    sync
+    echo 3 >/proc/sys/vm/drop_caches
+}
+
+# Generate a tree of the current shape
+function mktree() {
+    rm -rf "$DIR/$shape"
+    "$MKTREE" "$shape" "$SIZE" "$DIR/$shape"
+}
+
+# Time one run of a benchmark, which may be preceded by a setup command
+function time_run() {
+    if [ "$setup" ]; then
+        $setup
+    fi
+
+    if [ "$cache" = cold ]; then
+        drop_caches
+    fi
+
+    local start=$(now)
+    "$@" >/dev/null
+    local end=$(now)
+
+    awk -v s="$start" -v e="$end" 'BEGIN { printf "%.6f\n", e - s }'
+}
+
+# Run a benchmark and print a line of results
+function bench() {
+    local name="$1"
+    shift
+
+    local cache
+    for cache in "${CACHES[@]}"; do
+        if [ "$cache" = warm ]; then
+            # Warm up the cache first
+            time_run "$@" >/dev/null
+        fi
+
+        local times=()
+        local i
+        for ((i = 0; i < RUNS; ++i)); do
+            times+=($(time_run "$@"))
+        done
+
+        printf '%s\n' "${times[@]}" | sort -n | awk \
+            -v shape="$shape" -v size="$SIZE" -v name="$name" -v cache="$cache" '
+            { t[NR] = $1 }
+            END {
+                printf "%s\t%s\t%s\t%s\t%d\t%s\t%s\t%s\n",
+                    shape, size, name, cache, NR, t[1], t[int((NR + 1) / 2)], t[NR]
+            }'
+    done
+}
+
+printf 'shape\tsize\tbenchmark\tcache\truns\tmin\tmedian\tmax\n'
+
+IFS=, read -ra shapes <<<"$SHAPES"
+for shape in "${shapes[@]}"; do
+    printf "${BLU}%s${RST}: generating %s files...\n" "$shape" "$SIZE" >&2
+    mktree
+
+    tree="$DIR/$shape"
+    setup=
+
+    for strategy in bfs dfs ids eds; do
+        bench "walk-$strategy" "$BFS" -S "$strategy" "$tree" -false
+    done
+
+    bench name "$BFS" "$tree" -name '*.c'
+    bench printf "$BFS" "$tree" -printf '%p %s %m %TY\n'
+    bench exec-plus "$BFS" "$tree" -exec true {} +
+
+    # -delete needs a fresh tree every time
+    setup=mktree
+    bench delete "$BFS" "$tree" -delete
+    setup=
+done
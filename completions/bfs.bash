@@ -25,6 +25,7 @@ _bfs() {
     local special=(
         -D
         -S
+        -by
         -exec
         -execdir
         -fprintf
@@ -33,7 +34,9 @@ _bfs() {
         -group
         -ok
         -okdir
+        -pipe-to
         -regextype
+        -summarize
         -type
         -uid
         -user
@@ -44,12 +47,17 @@ _bfs() {
     # (e.g. because they are numeric, glob, regexp, time, etc.)
     local nocomp=(
         -{a,B,c,m}{min,since,time}
+        -chmod
+        -chown
+        -delete-jobs
+        -exec-jobs
         -ilname
         -iname
         -inum
         -ipath
         -iregex
         -iwholename
+        -limit
         -links
         -lname
         -maxdepth
@@ -59,9 +67,16 @@ _bfs() {
         -path
         -perm
         -printf
+        -queue-limit
+        -readdir-buffer
         -regex
+        -root-jobs
+        -shard
+        -shard-depth
         -since
         -size
+        -summarize-depth
+        -top
         -used
         -wholename
         -xattrname
@@ -70,13 +85,20 @@ _bfs() {
     # Options whose value is a filename
     local filecomp=(
         -{a,B,c,m}newer
+        -copy-to
         -f
         -fls
         -fprint
         -fprint0
+        -fprintb
+        -fprintj
         -newer
         -newer{a,B,c,m}{a,B,c,m}
+        -opt-profile
         -samefile
+        -snapshot
+        -snapshot-check
+        -snapshot-save
     )
 
     local operators=(
@@ -102,6 +124,7 @@ _bfs() {
 
     # Options that take no arguments
     local nullary_options=(
+        -assume-dir-mtime
         -color
         -daystart
         -depth
@@ -148,10 +171,13 @@ _bfs() {
         -ls
         -print
         -print0
+        -printb
+        -printj
         -printx
         -prune
         -quit
         -rm
+        -touch
         -version
     )
 
@@ -174,7 +200,7 @@ _bfs() {
         fi
 
         case "${words[i]}" in
-            -exec|-execdir|-ok|-okdir)
+            -exec|-execdir|-ok|-okdir|-pipe-to)
                 offset=$((i + 1))
                 ;;
             \\\;|+)
@@ -220,7 +246,7 @@ _bfs() {
         -D)
             # -D FLAG
             #     Turn on a debugging flag (see -D help)
-            COMPREPLY=($(compgen -W 'help cost exec opt rates search stat tree all' -- "$cur"))
+            COMPREPLY=($(compgen -W 'help cost exec opt rates search stat tree startup all' -- "$cur"))
             return
             ;;
         -S)
@@ -230,6 +256,12 @@ _bfs() {
             COMPREPLY=($(compgen -W 'bfs dfs ids eds' -- "$cur"))
             return
             ;;
+        -by)
+            # -by size|mtime|atime
+            #     Rank the -top files by size or time (default: size)
+            COMPREPLY=($(compgen -W 'size mtime atime' -- "$cur"))
+            return
+            ;;
         -fstype)
             # -fstype TYPE
             #     Find files on file systems with the given TYPE
@@ -266,6 +298,17 @@ _bfs() {
             COMPREPLY=($(compgen -W 'help posix-basic posix-extended' -- "$cur"))
             return
             ;;
+        -summarize)
+            # -summarize FIELD[,FIELD...]
+            #     Print each directory's totals of size, count, or blocks
+            COMPREPLY=()
+            if [[ -n $cur ]] && ! [[ $cur =~ ,$ ]]; then
+                COMPREPLY+=("$cur")
+                cur+=,
+            fi
+            COMPREPLY+=("$cur"{size,count,blocks})
+            return
+            ;;
         -type|-xtype)
             # -type [bcdlpfswD]
             #     Find files of the given type
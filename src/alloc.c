@@ -0,0 +1,198 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+#include "alloc.h"
+#include "darray.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** The number of chunks in the first slab. */
+#define ARENA_SLAB_MIN 64
+
+/** Slabs stop growing after this many doublings. */
+#define ARENA_SLAB_SHIFT_MAX 12
+
+/** Round up to a multiple of an alignment. */
+static size_t align_ceil(size_t align, size_t size) {
+	return (size + align - 1) / align * align;
+}
+
+void arena_init(struct arena *arena, size_t align, size_t size) {
+	assert(align <= alignof(max_align_t));
+
+	// Free chunks hold a pointer to the next one
+	if (size < sizeof(void *)) {
+		size = sizeof(void *);
+	}
+	if (align < alignof(void *)) {
+		align = alignof(void *);
+	}
+
+	arena->free = NULL;
+	arena->slabs = NULL;
+	arena->size = align_ceil(align, size);
+	arena->live = 0;
+	arena->peak = 0;
+	arena->bytes = 0;
+}
+
+/** Allocate a new slab and add its chunks to the free list. */
+static int arena_grow(struct arena *arena) {
+	size_t shift = darray_length(arena->slabs);
+	if (shift > ARENA_SLAB_SHIFT_MAX) {
+		shift = ARENA_SLAB_SHIFT_MAX;
+	}
+
+	size_t count = (size_t)ARENA_SLAB_MIN << shift;
+	size_t bytes = count * arena->size;
+	char *slab = malloc(bytes);
+	if (!slab) {
+		return -1;
+	}
+
+	if (DARRAY_PUSH(&arena->slabs, &slab) != 0) {
+		free(slab);
+		return -1;
+	}
+
+	// Thread the chunks onto the free list in address order
+	for (size_t i = count; i-- > 0;) {
+		void **chunk = (void **)(slab + i * arena->size);
+		*chunk = arena->free;
+		arena->free = chunk;
+	}
+
+	arena->bytes += bytes;
+	return 0;
+}
+
+void *arena_alloc(struct arena *arena) {
+	if (!arena->free && arena_grow(arena) != 0) {
+		return NULL;
+	}
+
+	void **chunk = arena->free;
+	arena->free = *chunk;
+
+	if (++arena->live > arena->peak) {
+		arena->peak = arena->live;
+	}
+
+	return chunk;
+}
+
+void arena_free(struct arena *arena, void *ptr) {
+	assert(arena->live > 0);
+
+	void **chunk = ptr;
+	*chunk = arena->free;
+	arena->free = chunk;
+	--arena->live;
+}
+
+void arena_destroy(struct arena *arena) {
+	for (size_t i = 0; i < darray_length(arena->slabs); ++i) {
+		free(arena->slabs[i]);
+	}
+	darray_free(arena->slabs);
+
+	arena->free = NULL;
+	arena->slabs = NULL;
+	arena->live = 0;
+	arena->bytes = 0;
+}
+
+void varena_init(struct varena *varena, size_t align, size_t offset, size_t size) {
+	varena->align = align;
+	varena->offset = offset;
+	varena->size = size;
+	varena->arenas = NULL;
+	varena->narenas = 0;
+	varena->live = 0;
+	varena->peak = 0;
+}
+
+/** Get the size class for a flexible array length. */
+static size_t varena_size_class(size_t count) {
+	size_t i = 0;
+	while (((size_t)1 << i) < count) {
+		++i;
+	}
+	return i;
+}
+
+/** Get the arena for a size class, creating it if necessary. */
+static struct arena *varena_get(struct varena *varena, size_t count) {
+	size_t i = varena_size_class(count);
+
+	if (i >= varena->narenas) {
+		size_t narenas = i + 1;
+		struct arena *arenas = realloc(varena->arenas, narenas * sizeof(*arenas));
+		if (!arenas) {
+			return NULL;
+		}
+
+		for (size_t j = varena->narenas; j < narenas; ++j) {
+			size_t max = (size_t)1 << j;
+			arena_init(&arenas[j], varena->align, varena->offset + max * varena->size);
+		}
+
+		varena->arenas = arenas;
+		varena->narenas = narenas;
+	}
+
+	return &varena->arenas[i];
+}
+
+void *varena_alloc(struct varena *varena, size_t count) {
+	struct arena *arena = varena_get(varena, count);
+	if (!arena) {
+		return NULL;
+	}
+
+	void *ret = arena_alloc(arena);
+	if (ret && ++varena->live > varena->peak) {
+		varena->peak = varena->live;
+	}
+	return ret;
+}
+
+void varena_free(struct varena *varena, void *ptr, size_t count) {
+	size_t i = varena_size_class(count);
+	assert(i < varena->narenas);
+	arena_free(&varena->arenas[i], ptr);
+	--varena->live;
+}
+
+size_t varena_bytes(const struct varena *varena) {
+	size_t ret = 0;
+	for (size_t i = 0; i < varena->narenas; ++i) {
+		ret += varena->arenas[i].bytes;
+	}
+	return ret;
+}
+
+void varena_destroy(struct varena *varena) {
+	for (size_t i = 0; i < varena->narenas; ++i) {
+		arena_destroy(&varena->arenas[i]);
+	}
+	free(varena->arenas);
+
+	varena->arenas = NULL;
+	varena->narenas = 0;
+	varena->live = 0;
+}
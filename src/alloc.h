@@ -0,0 +1,169 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+/**
+ * Arena allocators for objects that are allocated and freed in bulk.
+ */
+
+#ifndef BFS_ALLOC_H
+#define BFS_ALLOC_H
+
+#include <stdalign.h>
+#include <stddef.h>
+
+/**
+ * An arena allocator for fixed-size objects.  Objects are carved out of slabs
+ * that grow geometrically, and freed objects are kept on a free list for
+ * reuse.  Memory is only returned to the system by arena_destroy().
+ */
+struct arena {
+	/** The list of free chunks. */
+	void *free;
+	/** The allocated slabs (a darray). */
+	void **slabs;
+	/** The size of each chunk. */
+	size_t size;
+
+	/** The number of live objects. */
+	size_t live;
+	/** The peak number of live objects. */
+	size_t peak;
+	/** The total number of bytes in all slabs. */
+	size_t bytes;
+};
+
+/**
+ * Initialize an arena.
+ *
+ * @param arena
+ *         The arena to initialize.
+ * @param align
+ *         The alignment of the objects, which must not exceed that of
+ *         max_align_t.
+ * @param size
+ *         The size of the objects.
+ */
+void arena_init(struct arena *arena, size_t align, size_t size);
+
+/**
+ * Initialize an arena for a particular type.
+ */
+#define ARENA_INIT(arena, type) \
+	arena_init((arena), alignof(type), sizeof(type))
+
+/**
+ * Allocate an object from an arena.
+ *
+ * @return
+ *         The allocated (uninitialized) object, or NULL on failure.
+ */
+void *arena_alloc(struct arena *arena);
+
+/**
+ * Return an object to an arena.
+ */
+void arena_free(struct arena *arena, void *ptr);
+
+/**
+ * Free all the memory in an arena, including any live objects.
+ */
+void arena_destroy(struct arena *arena);
+
+/**
+ * An arena allocator for structs with a flexible array member.  Allocations
+ * are grouped into power-of-two size classes, each with its own arena.
+ */
+struct varena {
+	/** The alignment of the struct. */
+	size_t align;
+	/** The offset of the flexible array. */
+	size_t offset;
+	/** The size of the flexible array elements. */
+	size_t size;
+
+	/** One arena for each size class. */
+	struct arena *arenas;
+	/** The number of size classes. */
+	size_t narenas;
+
+	/** The number of live objects. */
+	size_t live;
+	/** The peak number of live objects. */
+	size_t peak;
+};
+
+/**
+ * Initialize a varena.
+ *
+ * @param varena
+ *         The varena to initialize.
+ * @param align
+ *         The alignment of the struct.
+ * @param offset
+ *         The offset of the flexible array.
+ * @param size
+ *         The size of the flexible array elements.
+ */
+void varena_init(struct varena *varena, size_t align, size_t offset, size_t size);
+
+/**
+ * Initialize a varena for a struct with a flexible array.
+ *
+ * @param varena
+ *         The varena to initialize.
+ * @param type
+ *         The struct type.
+ * @param member
+ *         The name of the flexible array member.
+ */
+#define VARENA_INIT(varena, type, member) \
+	varena_init((varena), alignof(type), offsetof(type, member), sizeof(((type *)NULL)->member[0]))
+
+/**
+ * Allocate a flexible struct.
+ *
+ * @param varena
+ *         The varena to allocate from.
+ * @param count
+ *         The length of the flexible array.
+ * @return
+ *         The allocated struct, or NULL on failure.
+ */
+void *varena_alloc(struct varena *varena, size_t count);
+
+/**
+ * Free a flexible struct.
+ *
+ * @param varena
+ *         The varena it was allocated from.
+ * @param ptr
+ *         The struct to free.
+ * @param count
+ *         The length of the flexible array, as passed to varena_alloc().
+ */
+void varena_free(struct varena *varena, void *ptr, size_t count);
+
+/**
+ * Get the total number of bytes allocated by a varena.
+ */
+size_t varena_bytes(const struct varena *varena);
+
+/**
+ * Free all the memory in a varena, including any live objects.
+ */
+void varena_destroy(struct varena *varena);
+
+#endif // BFS_ALLOC_H
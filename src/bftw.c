@@ -21,32 +21,62 @@
  *   They have reference-counted links to their parents in the directory tree.
  *
  * - struct bftw_cache: An LRU list of bftw_file's with open file descriptors,
- *   used for openat() to minimize the amount of path re-traversals.
+ *   used for openat() to minimize the amount of path re-traversals.  It also
+ *   owns the arena that all the bftw_file's are allocated from.
  *
  * - struct bftw_queue: The queue of bftw_file's left to explore.  Implemented
  *   as a simple circular buffer.
  *
+ * - struct ioq: An optional queue of background threads that open directories
+ *   ahead of time and close them afterwards, so that their I/O overlaps with
+ *   the main traversal.
+ *
  * - struct bftw_state: Represents the current state of the traversal, allowing
  *   various helper functions to take fewer parameters.
  */
 
 #include "bftw.h"
+#include "alloc.h"
 #include "dir.h"
 #include "darray.h"
 #include "dstring.h"
+#include "ioq.h"
 #include "mtab.h"
+#include "prof.h"
 #include "stat.h"
 #include "trie.h"
 #include "util.h"
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <locale.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+/**
+ * The state of a file that is open, or being opened in the background.  Most
+ * queued files are never opened until they're popped, and the number that are
+ * open at once is bounded by the fd limit, so this is kept out of line.
+ */
+struct bftw_open {
+	/** The previous file in the LRU list. */
+	struct bftw_file *lru_prev;
+	/** The next file in the LRU list. */
+	struct bftw_file *lru_next;
+	/** Pin count, for files that must not be evicted from the cache. */
+	size_t pincount;
+
+	/** A directory opened in the background, if any. */
+	struct bfs_dir *dir;
+	/** Entries of that directory stat()'d in the background, if any. */
+	struct ioq_dirent *dirents;
+	/** The number of prefetched entries. */
+	size_t ndirents;
+};
+
 /**
  * A file.
  */
@@ -57,11 +87,8 @@ struct bftw_file {
 	struct bftw_file *root;
 	/** The next file in the queue, if any. */
 	struct bftw_file *next;
-
-	/** The previous file in the LRU list. */
-	struct bftw_file *lru_prev;
-	/** The next file in the LRU list. */
-	struct bftw_file *lru_next;
+	/** The open state of this file, if any (see bftw_file_promote()). */
+	struct bftw_open *open;
 
 	/** This file's depth in the walk. */
 	size_t depth;
@@ -70,9 +97,20 @@ struct bftw_file {
 
 	/** An open descriptor to this file, or -1. */
 	int fd;
-
 	/** This file's type, if known. */
 	enum bfs_type type;
+	/** Whether fd was opened with O_PATH, so it can only be used as a base. */
+	bool opath;
+	/** Whether an asynchronous opendir() is pending for this file. */
+	bool ioqueued;
+	/** Whether this directory's listing was replayed from an earlier walk. */
+	bool replayed;
+
+	/** This file's entry in the snapshot being read, if any. */
+	const struct bfs_snap_ent *snapent;
+	/** The number of entries in this directory, if it was read to the end, or SIZE_MAX. */
+	size_t nentries;
+
 	/** The device number, for cycle detection. */
 	dev_t dev;
 	/** The inode number, for cycle detection. */
@@ -98,6 +136,23 @@ struct bftw_cache {
 	struct bftw_file *tail;
 	/** The remaining capacity of the LRU list. */
 	size_t capacity;
+	/** The head of the queue, to avoid evicting directories it will need. */
+	struct bftw_file *const *queue;
+	/** The allocator for bftw_file's. */
+	struct varena files;
+	/** The allocator for their open state. */
+	struct arena opens;
+
+	/** The number of times a needed directory was already open. */
+	size_t hits;
+	/** The number of times a needed directory had to be opened. */
+	size_t misses;
+	/** The number of directories actually opened. */
+	size_t nopens;
+	/** The number of opens that re-traversed a path because a directory had been evicted. */
+	size_t reopens;
+	/** The number of directories evicted to make room for others. */
+	size_t evictions;
 };
 
 /** Initialize a cache. */
@@ -106,6 +161,15 @@ static void bftw_cache_init(struct bftw_cache *cache, size_t capacity) {
 	cache->target = NULL;
 	cache->tail = NULL;
 	cache->capacity = capacity;
+	cache->queue = NULL;
+	VARENA_INIT(&cache->files, struct bftw_file, name);
+	ARENA_INIT(&cache->opens, struct bftw_open);
+
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->nopens = 0;
+	cache->reopens = 0;
+	cache->evictions = 0;
 }
 
 /** Destroy a cache. */
@@ -113,30 +177,72 @@ static void bftw_cache_destroy(struct bftw_cache *cache) {
 	assert(!cache->tail);
 	assert(!cache->target);
 	assert(!cache->head);
+	assert(cache->files.live == 0);
+	assert(cache->opens.live == 0);
+
+	varena_destroy(&cache->files);
+	arena_destroy(&cache->opens);
 }
 
-/** Add a bftw_file to the cache. */
-static void bftw_cache_add(struct bftw_cache *cache, struct bftw_file *file) {
-	assert(cache->capacity > 0);
+/** Give a bftw_file an open state record, if it doesn't have one yet. */
+static int bftw_file_promote(struct bftw_cache *cache, struct bftw_file *file) {
+	if (file->open) {
+		return 0;
+	}
+
+	struct bftw_open *open = arena_alloc(&cache->opens);
+	if (!open) {
+		return -1;
+	}
+
+	open->lru_prev = NULL;
+	open->lru_next = NULL;
+	open->pincount = 0;
+	open->dir = NULL;
+	open->dirents = NULL;
+	open->ndirents = 0;
+
+	file->open = open;
+	return 0;
+}
+
+/** Release a bftw_file's open state record, once it's no longer needed. */
+static void bftw_file_demote(struct bftw_cache *cache, struct bftw_file *file) {
+	struct bftw_open *open = file->open;
+	if (!open || file->fd >= 0 || file->ioqueued || open->dir) {
+		return;
+	}
+
+	assert(open->pincount == 0);
+	assert(!open->lru_prev && !open->lru_next);
+
+	arena_free(&cache->opens, open);
+	file->open = NULL;
+}
+
+/** Add a bftw_file to the LRU list. */
+static void bftw_lru_add(struct bftw_cache *cache, struct bftw_file *file) {
 	assert(file->fd >= 0);
-	assert(!file->lru_prev);
-	assert(!file->lru_next);
+
+	struct bftw_open *open = file->open;
+	assert(!open->lru_prev);
+	assert(!open->lru_next);
 
 	if (cache->target) {
-		file->lru_prev = cache->target;
-		file->lru_next = cache->target->lru_next;
+		open->lru_prev = cache->target;
+		open->lru_next = cache->target->open->lru_next;
 	} else {
-		file->lru_next = cache->head;
+		open->lru_next = cache->head;
 	}
 
-	if (file->lru_prev) {
-		file->lru_prev->lru_next = file;
+	if (open->lru_prev) {
+		open->lru_prev->open->lru_next = file;
 	} else {
 		cache->head = file;
 	}
 
-	if (file->lru_next) {
-		file->lru_next->lru_prev = file;
+	if (open->lru_next) {
+		open->lru_next->open->lru_prev = file;
 	} else {
 		cache->tail = file;
 	}
@@ -145,41 +251,78 @@ static void bftw_cache_add(struct bftw_cache *cache, struct bftw_file *file) {
 	if (file->depth == 0) {
 		cache->target = file;
 	}
-
-	--cache->capacity;
 }
 
-/** Remove a bftw_file from the cache. */
-static void bftw_cache_remove(struct bftw_cache *cache, struct bftw_file *file) {
+/** Remove a bftw_file from the LRU list. */
+static void bftw_lru_remove(struct bftw_cache *cache, struct bftw_file *file) {
+	struct bftw_open *open = file->open;
+
 	if (cache->target == file) {
-		cache->target = file->lru_prev;
+		cache->target = open->lru_prev;
 	}
 
-	if (file->lru_prev) {
+	if (open->lru_prev) {
 		assert(cache->head != file);
-		file->lru_prev->lru_next = file->lru_next;
+		open->lru_prev->open->lru_next = open->lru_next;
 	} else {
 		assert(cache->head == file);
-		cache->head = file->lru_next;
+		cache->head = open->lru_next;
 	}
 
-	if (file->lru_next) {
+	if (open->lru_next) {
 		assert(cache->tail != file);
-		file->lru_next->lru_prev = file->lru_prev;
+		open->lru_next->open->lru_prev = open->lru_prev;
 	} else {
 		assert(cache->tail == file);
-		cache->tail = file->lru_prev;
+		cache->tail = open->lru_prev;
 	}
 
-	file->lru_prev = NULL;
-	file->lru_next = NULL;
+	open->lru_prev = NULL;
+	open->lru_next = NULL;
+}
+
+/** Add a bftw_file to the cache. */
+static void bftw_cache_add(struct bftw_cache *cache, struct bftw_file *file) {
+	assert(cache->capacity > 0);
+	assert(file->open->pincount == 0);
+
+	bftw_lru_add(cache, file);
+	--cache->capacity;
+}
+
+/** Remove a bftw_file from the cache. */
+static void bftw_cache_remove(struct bftw_cache *cache, struct bftw_file *file) {
+	assert(file->open->pincount == 0);
+
+	bftw_lru_remove(cache, file);
 	++cache->capacity;
 }
 
 /** Mark a cache entry as recently used. */
 static void bftw_cache_use(struct bftw_cache *cache, struct bftw_file *file) {
-	bftw_cache_remove(cache, file);
-	bftw_cache_add(cache, file);
+	// Pinned files aren't in the LRU list at all
+	if (file->open->pincount == 0) {
+		bftw_lru_remove(cache, file);
+		bftw_lru_add(cache, file);
+	}
+}
+
+/** Pin a cache entry, so it won't be closed until it is unpinned. */
+static void bftw_cache_pin(struct bftw_cache *cache, struct bftw_file *file) {
+	assert(file->fd >= 0);
+
+	if (file->open->pincount++ == 0) {
+		bftw_lru_remove(cache, file);
+	}
+}
+
+/** Unpin a cache entry. */
+static void bftw_cache_unpin(struct bftw_cache *cache, struct bftw_file *file) {
+	assert(file->open->pincount > 0);
+
+	if (--file->open->pincount == 0) {
+		bftw_lru_add(cache, file);
+	}
 }
 
 /** Close a bftw_file. */
@@ -190,12 +333,72 @@ static void bftw_file_close(struct bftw_cache *cache, struct bftw_file *file) {
 
 	xclose(file->fd);
 	file->fd = -1;
+	file->opath = false;
+	bftw_file_demote(cache, file);
+}
+
+/**
+ * How many queued files to protect the parents of, and how many LRU entries to
+ * consider for eviction.
+ */
+#define BFTW_EVICT_WINDOW 16
+
+/** Check whether a cached directory is the parent of a file queued soon. */
+static bool bftw_cache_wanted(const struct bftw_cache *cache, const struct bftw_file *file) {
+	if (!cache->queue) {
+		return false;
+	}
+
+	const struct bftw_file *next = *cache->queue;
+	for (size_t i = 0; next && i < BFTW_EVICT_WINDOW; next = next->next, ++i) {
+		if (next->parent == file) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Pick a directory to evict from the cache.  Among the least recently used
+ * entries, prefer ones that the next queued files won't need as a base for
+ * openat().  In breadth-first order, plain LRU would evict exactly those.
+ *
+ * @param cache
+ *         The cache in question.
+ * @param saved
+ *         A bftw_file that must be preserved.
+ * @return
+ *         The file to evict, or NULL if there is none.
+ */
+static struct bftw_file *bftw_cache_victim(const struct bftw_cache *cache, const struct bftw_file *saved) {
+	struct bftw_file *fallback = NULL;
+
+	struct bftw_file *file = cache->tail;
+	for (size_t i = 0; file && i < BFTW_EVICT_WINDOW; file = file->open->lru_prev, ++i) {
+		if (file == saved) {
+			continue;
+		} else if (!bftw_cache_wanted(cache, file)) {
+			return file;
+		} else if (!fallback) {
+			fallback = file;
+		}
+	}
+
+	return fallback;
+}
+
+/** Evict a directory from the cache. */
+static void bftw_cache_evict(struct bftw_cache *cache, struct bftw_file *file) {
+	++cache->evictions;
+	bftw_file_close(cache, file);
 }
 
 /** Pop a directory from the cache. */
 static void bftw_cache_pop(struct bftw_cache *cache) {
-	assert(cache->tail);
-	bftw_file_close(cache, cache->tail);
+	struct bftw_file *file = bftw_cache_victim(cache, NULL);
+	assert(file);
+	bftw_cache_evict(cache, file);
 }
 
 /**
@@ -209,23 +412,25 @@ static void bftw_cache_pop(struct bftw_cache *cache) {
  *         0 if successfully shrunk, otherwise -1.
  */
 static int bftw_cache_shrink(struct bftw_cache *cache, const struct bftw_file *saved) {
-	struct bftw_file *file = cache->tail;
+	struct bftw_file *file = bftw_cache_victim(cache, saved);
 	if (!file) {
 		return -1;
 	}
 
-	if (file == saved) {
-		file = file->lru_prev;
-		if (!file) {
-			return -1;
-		}
-	}
-
-	bftw_file_close(cache, file);
+	bftw_cache_evict(cache, file);
 	cache->capacity = 0;
 	return 0;
 }
 
+/** Record whether a needed directory was already open. */
+static void bftw_cache_count(struct bftw_cache *cache, const struct bftw_file *file) {
+	if (file->fd >= 0) {
+		++cache->hits;
+	} else {
+		++cache->misses;
+	}
+}
+
 /** Compute the name offset of a child path. */
 static size_t bftw_child_nameoff(const struct bftw_file *parent) {
 	size_t ret = parent->nameoff + parent->namelen;
@@ -236,11 +441,9 @@ static size_t bftw_child_nameoff(const struct bftw_file *parent) {
 }
 
 /** Create a new bftw_file. */
-static struct bftw_file *bftw_file_new(struct bftw_file *parent, const char *name) {
+static struct bftw_file *bftw_file_new(struct bftw_cache *cache, struct bftw_file *parent, const char *name) {
 	size_t namelen = strlen(name);
-	size_t size = BFS_FLEX_SIZEOF(struct bftw_file, name, namelen + 1);
-
-	struct bftw_file *file = malloc(size);
+	struct bftw_file *file = varena_alloc(&cache->files, namelen + 1);
 	if (!file) {
 		return NULL;
 	}
@@ -259,14 +462,17 @@ static struct bftw_file *bftw_file_new(struct bftw_file *parent, const char *nam
 	}
 
 	file->next = NULL;
-
-	file->lru_prev = NULL;
-	file->lru_next = NULL;
+	file->open = NULL;
 
 	file->refcount = 1;
 	file->fd = -1;
-
 	file->type = BFS_UNKNOWN;
+	file->opath = false;
+	file->ioqueued = false;
+	file->replayed = false;
+	file->snapent = NULL;
+	file->nentries = SIZE_MAX;
+
 	file->dev = -1;
 	file->ino = -1;
 
@@ -289,10 +495,12 @@ static struct bftw_file *bftw_file_new(struct bftw_file *parent, const char *nam
  *         The base file descriptor, AT_FDCWD if base == NULL.
  * @param at_path
  *         The relative path to the file.
+ * @param opath
+ *         Whether the file will only be used as a base for other *at() calls.
  * @return
  *         The opened file descriptor, or negative on error.
  */
-static int bftw_file_openat(struct bftw_cache *cache, struct bftw_file *file, struct bftw_file *base, const char *at_path) {
+static int bftw_file_openat(struct bftw_cache *cache, struct bftw_file *file, struct bftw_file *base, const char *at_path, bool opath) {
 	assert(file->fd < 0);
 
 	int at_fd = AT_FDCWD;
@@ -301,7 +509,23 @@ static int bftw_file_openat(struct bftw_cache *cache, struct bftw_file *file, st
 		at_fd = base->fd;
 	}
 
+	struct timespec start;
+	bool prof = bfs_prof_begin(&start);
+
 	int flags = O_RDONLY | O_CLOEXEC | O_DIRECTORY;
+#ifdef O_PATH
+	// O_PATH descriptors are cheaper to open, and don't need read permission
+	if (opath) {
+		flags = O_PATH | O_CLOEXEC | O_DIRECTORY;
+	}
+#else
+	opath = false;
+#endif
+
+	if (bftw_file_promote(cache, file) != 0) {
+		return -1;
+	}
+
 	int fd = openat(at_fd, at_path, flags);
 
 	if (fd < 0 && errno == EMFILE) {
@@ -310,13 +534,23 @@ static int bftw_file_openat(struct bftw_cache *cache, struct bftw_file *file, st
 		}
 	}
 
+	if (prof) {
+		bfs_prof_end(BFS_PROF_OPEN, &start);
+	}
+
 	if (fd >= 0) {
 		if (cache->capacity == 0) {
 			bftw_cache_pop(cache);
 		}
 
 		file->fd = fd;
+		file->opath = opath;
 		bftw_cache_add(cache, file);
+		++cache->nopens;
+	} else {
+		int error = errno;
+		bftw_file_demote(cache, file);
+		errno = error;
 	}
 
 	return fd;
@@ -331,10 +565,24 @@ static int bftw_file_openat(struct bftw_cache *cache, struct bftw_file *file, st
  *         The file to open.
  * @param path
  *         The full path to the file.
+ * @param opath
+ *         Whether the file will only be used as a base for other *at() calls.
  * @return
  *         The opened file descriptor, or negative on error.
  */
-static int bftw_file_open(struct bftw_cache *cache, struct bftw_file *file, const char *path) {
+static int bftw_file_open(struct bftw_cache *cache, struct bftw_file *file, const char *path, bool opath) {
+	struct bftw_file *parent = file->parent;
+	if (parent && parent->fd < 0 && !parent->replayed && bftw_cache_wanted(cache, parent)) {
+		// The next queued files will need the parent too, so reopen it
+		// rather than re-traversing the path for each of them.  Replayed
+		// parents are only ever used as a prefix, so leave them closed.
+		char *copy = strndup(path, parent->nameoff + parent->namelen);
+		if (copy) {
+			bftw_file_open(cache, parent, copy, true);
+			free(copy);
+		}
+	}
+
 	// Find the nearest open ancestor
 	struct bftw_file *base = file;
 	do {
@@ -346,7 +594,12 @@ static int bftw_file_open(struct bftw_cache *cache, struct bftw_file *file, cons
 		at_path += bftw_child_nameoff(base);
 	}
 
-	int fd = bftw_file_openat(cache, file, base, at_path);
+	// The parent was evicted, so more of the path has to be traversed again
+	if (base != file->parent) {
+		++cache->reopens;
+	}
+
+	int fd = bftw_file_openat(cache, file, base, at_path, opath);
 	if (fd >= 0 || errno != ENAMETOOLONG) {
 		return fd;
 	}
@@ -362,7 +615,7 @@ static int bftw_file_open(struct bftw_cache *cache, struct bftw_file *file, cons
 
 	// Open the files in the chain one by one
 	for (base = cur; base; base = base->next) {
-		fd = bftw_file_openat(cache, base, base->parent, base->name);
+		fd = bftw_file_openat(cache, base, base->parent, base->name, opath || base != file);
 		if (fd < 0 || base == file) {
 			break;
 		}
@@ -389,7 +642,22 @@ static int bftw_file_open(struct bftw_cache *cache, struct bftw_file *file, cons
  *         The opened directory, or NULL on error.
  */
 static struct bfs_dir *bftw_file_opendir(struct bftw_cache *cache, struct bftw_file *file, const char *path) {
-	int fd = bftw_file_open(cache, file, path);
+	bftw_cache_count(cache, file);
+
+	int fd = file->fd;
+	if (fd >= 0 && file->opath) {
+		// Reopen descriptors that were only used as a base for reading
+		fd = openat(file->fd, ".", O_RDONLY | O_CLOEXEC | O_DIRECTORY);
+		if (fd < 0) {
+			return NULL;
+		}
+		xclose(file->fd);
+		file->fd = fd;
+		file->opath = false;
+		++cache->nopens;
+	} else if (fd < 0) {
+		fd = bftw_file_open(cache, file, path, false);
+	}
 	if (fd < 0) {
 		return NULL;
 	}
@@ -400,12 +668,15 @@ static struct bfs_dir *bftw_file_opendir(struct bftw_cache *cache, struct bftw_f
 /** Free a bftw_file. */
 static void bftw_file_free(struct bftw_cache *cache, struct bftw_file *file) {
 	assert(file->refcount == 0);
+	assert(!file->ioqueued);
+	assert(!file->open || !file->open->dir);
 
 	if (file->fd >= 0) {
 		bftw_file_close(cache, file);
 	}
+	assert(!file->open);
 
-	free(file);
+	varena_free(&cache->files, file, file->namelen + 1);
 }
 
 /**
@@ -416,21 +687,32 @@ struct bftw_queue {
 	struct bftw_file *head;
 	/** The insertion target. */
 	struct bftw_file **target;
+	/** The end of the queue. */
+	struct bftw_file **tail;
+	/** The number of files in the queue. */
+	size_t size;
 };
 
 /** Initialize a bftw_queue. */
 static void bftw_queue_init(struct bftw_queue *queue) {
 	queue->head = NULL;
 	queue->target = &queue->head;
+	queue->tail = &queue->head;
+	queue->size = 0;
 }
 
 /** Add a file to a bftw_queue. */
 static void bftw_queue_push(struct bftw_queue *queue, struct bftw_file *file) {
 	assert(file->next == NULL);
 
+	if (queue->tail == queue->target) {
+		queue->tail = &file->next;
+	}
+
 	file->next = *queue->target;
 	*queue->target = file;
 	queue->target = &file->next;
+	++queue->size;
 }
 
 /** Pop the next file from the head of the queue. */
@@ -441,68 +723,83 @@ static struct bftw_file *bftw_queue_pop(struct bftw_queue *queue) {
 	if (queue->target == &file->next) {
 		queue->target = &queue->head;
 	}
+	if (queue->tail == &file->next) {
+		queue->tail = &queue->head;
+	}
+	--queue->size;
 	return file;
 }
 
-/** The split phase of mergesort. */
-static struct bftw_file **bftw_sort_split(struct bftw_file **head, struct bftw_file **tail) {
-	struct bftw_file **tortoise = head, **hare = head;
+/**
+ * A file being sorted.
+ */
+struct bftw_sort_ent {
+	/** The file itself. */
+	struct bftw_file *file;
+	/** The file's collation key. */
+	const char *key;
+	/** The offset of that key in the key buffer, if it was transformed. */
+	size_t keyoff;
+	/** The file's original position, to keep the sort stable. */
+	size_t index;
+};
 
-	while (*hare != *tail) {
-		tortoise = &(*tortoise)->next;
-		hare = &(*hare)->next;
-		if (*hare != *tail) {
-			hare = &(*hare)->next;
-		}
-	}
+/** qsort() comparison function for bftw_sort_ent's. */
+static int bftw_sort_cmp(const void *lptr, const void *rptr) {
+	const struct bftw_sort_ent *lhs = lptr;
+	const struct bftw_sort_ent *rhs = rptr;
 
-	return tortoise;
+	int ret = strcmp(lhs->key, rhs->key);
+	if (ret == 0) {
+		ret = (lhs->index > rhs->index) - (lhs->index < rhs->index);
+	}
+	return ret;
 }
 
-/** The merge phase of mergesort. */
-static struct bftw_file **bftw_sort_merge(struct bftw_file **head, struct bftw_file **mid, struct bftw_file **tail) {
-	struct bftw_file *left = *head, *right = *mid, *end = *tail;
-	*mid = NULL;
-	*tail = NULL;
-
-	while (left || right) {
-		struct bftw_file *next;
-		if (left && (!right || strcoll(left->name, right->name) <= 0)) {
-			next = left;
-			left = left->next;
-		} else {
-			next = right;
-			right = right->next;
-		}
-
-		*head = next;
-		head = &next->next;
-	}
+/** The most memory to spend on cached directory listings. */
+#define BFTW_LISTINGS_MAX (64 << 20)
 
-	*head = end;
-	return head;
-}
+/**
+ * A directory listing saved for later walks.
+ */
+struct bftw_listing {
+	/** The number of entries. */
+	size_t count;
+	/** The entries themselves, followed by their names. */
+	struct bfs_dirent entries[];
+};
 
 /**
- * Sort a (sub-)list of files.
- *
- * @param head
- *         The head of the (sub-)list to sort.
- * @param tail
- *         The tail of the (sub-)list to sort.
- * @return
- *         The new tail of the (sub-)list.
+ * A cache of directory listings, shared between the walks of an iterative
+ * deepening search so that shallow directories are only read once.
  */
-static struct bftw_file **bftw_sort_files(struct bftw_file **head, struct bftw_file **tail) {
-	struct bftw_file **mid = bftw_sort_split(head, tail);
-	if (*mid == *head || *mid == *tail) {
-		return tail;
-	}
+struct bftw_listings {
+	/** Maps directory paths to their listings. */
+	struct trie trie;
+	/** The number of bytes used by the cached listings. */
+	size_t bytes;
+};
 
-	mid = bftw_sort_files(head, mid);
-	tail = bftw_sort_files(mid, tail);
+/** Initialize a listing cache. */
+static void bftw_listings_init(struct bftw_listings *listings) {
+	trie_init(&listings->trie);
+	listings->bytes = 0;
+}
 
-	return bftw_sort_merge(head, mid, tail);
+/** Find the cached listing for a directory, if any. */
+static const struct bftw_listing *bftw_listings_find(const struct bftw_listings *listings, const char *path) {
+	const struct trie_leaf *leaf = trie_find_str(&listings->trie, path);
+	return leaf ? leaf->value : NULL;
+}
+
+/** Destroy a listing cache. */
+static void bftw_listings_destroy(struct bftw_listings *listings) {
+	struct trie_leaf *leaf;
+	while ((leaf = trie_first_leaf(&listings->trie))) {
+		free(leaf->value);
+		trie_remove(&listings->trie, leaf);
+	}
+	trie_destroy(&listings->trie);
 }
 
 /**
@@ -511,14 +808,26 @@ static struct bftw_file **bftw_sort_files(struct bftw_file **head, struct bftw_f
 struct bftw_state {
 	/** bftw() callback. */
 	bftw_callback *callback;
+	/** bftw() batch callback, if batches can be skipped. */
+	bftw_batch_callback *batch_callback;
 	/** bftw() callback data. */
 	void *ptr;
 	/** bftw() flags. */
 	enum bftw_flags flags;
 	/** Search strategy. */
 	enum bftw_strategy strategy;
+	/** The queue size past which to switch to depth-first order. */
+	size_t queue_limit;
+	/** The bfs_stat() fields to ask for. */
+	enum bfs_stat_field stat_fields;
 	/** The mount table. */
 	const struct bfs_mtab *mtab;
+	/** The root whose canonical path is cached in mount_root_path. */
+	char *mount_root_name;
+	/** The canonical path to that root, or NULL if it couldn't be found. */
+	char *mount_root_path;
+	/** Storage for canonical paths to check against the mount table. */
+	char *mount_path;
 
 	/** The appropriate errno value, if any. */
 	int error;
@@ -530,6 +839,13 @@ struct bftw_state {
 	/** The start of the current batch of files. */
 	struct bftw_file **batch;
 
+	/** The background I/O queue, if any. */
+	struct ioq *ioq;
+	/** The number of directories opened in the background but not yet read. */
+	size_t ioq_held;
+	/** The last queued file that was considered for background opening. */
+	struct bftw_file *ioq_last;
+
 	/** The current path. */
 	char *path;
 	/** The current file. */
@@ -545,21 +861,102 @@ struct bftw_state {
 	struct bfs_dirent de_storage;
 	/** Any error encountered while reading the directory. */
 	int direrror;
+	/** The number of entries read from the current directory so far. */
+	size_t direntcount;
+
+	/** Entries of the current directory that were stat()'d ahead of time. */
+	struct ioq_dirent *dirents;
+	/** The number of prefetched entries. */
+	size_t ndirents;
+	/** The index of the next prefetched entry. */
+	size_t direntpos;
+
+	/** Entries of the current directory, decoded in bulk by bfs_readdir_batch(). */
+	struct bfs_dirent direntbuf[64];
+	/** Which buffered entries the batch callback said to skip. */
+	bool direntskip[64];
+	/** The number of entries in the buffer. */
+	size_t ndirentbuf;
+	/** The index of the next entry in the buffer. */
+	size_t direntbufpos;
+	/** Whether the current entry can be skipped. */
+	bool de_skip;
+
+	/** The snapshot to read directories from, if any. */
+	const struct bfs_snap *snapshot;
+	/** The snapshot record for the current directory, if any. */
+	const struct bfs_snap_dir *snapdir;
+	/** The index of the next entry in that record. */
+	size_t snappos;
+	/** The snapshot entry for the current file, if any. */
+	const struct bfs_snap_ent *snapent;
+
+	/** The snapshot being recorded, if any. */
+	struct bfs_snap_writer *record;
+	/** Whether the current directory is being recorded. */
+	bool recording;
+
+	/** The directory listing cache, if any. */
+	struct bftw_listings *listings;
+	/** The cached listing for the current directory, if any. */
+	const struct bftw_listing *listing;
+	/** The index of the next entry in that listing. */
+	size_t listpos;
+	/** The cache slot for the listing being saved, if any. */
+	struct trie_leaf *saveleaf;
+	/** The types and names of the entries being saved. */
+	char *savebuf;
+	/** The number of entries being saved. */
+	size_t nsaved;
+	/** The number of directory listings replayed from the cache. */
+	size_t listing_hits;
+
+	/** Stat info for the current entry that is already known, if any. */
+	const struct bfs_stat *de_stat;
+	/** Storage for that stat info, if needed. */
+	struct bfs_stat de_stat_storage;
 
 	/** Extra data about the current file. */
 	struct BFTW ftwbuf;
+
+	/** Whether sorting needs strxfrm(), rather than just comparing bytes. */
+	bool sort_xfrm;
+	/** Storage for the files being sorted. */
+	struct bftw_sort_ent *sortents;
+	/** The capacity of that storage. */
+	size_t sortcap;
+	/** Storage for the transformed collation keys. */
+	char *sortkeys;
+
+	/** Where to accumulate statistics, if anywhere. */
+	struct bftw_stats *stats;
+	/** Where to publish progress, if anywhere. */
+	struct bftw_progress *progress;
 };
 
 /**
  * Initialize the bftw() state.
  */
-static int bftw_state_init(struct bftw_state *state, const struct bftw_args *args) {
+static int bftw_state_init(struct bftw_state *state, const struct bftw_args *args, struct bftw_listings *listings) {
 	state->callback = args->callback;
+	state->batch_callback = NULL;
 	state->ptr = args->ptr;
 	state->flags = args->flags;
 	state->strategy = args->strategy;
+	state->queue_limit = args->queue_limit;
 	state->mtab = args->mtab;
 
+	// Snapshots record everything
+	state->stat_fields = BFS_STAT_ALL;
+	if (args->stat_fields && !args->record) {
+		state->stat_fields = args->stat_fields | BFS_STAT_IDENTITY;
+	}
+	state->mount_root_name = NULL;
+	state->mount_root_path = NULL;
+	state->mount_path = NULL;
+	state->stats = args->stats;
+	state->progress = args->progress;
+
 	state->error = 0;
 
 	if (args->nopenfd < 1) {
@@ -574,8 +971,13 @@ static int bftw_state_init(struct bftw_state *state, const struct bftw_args *arg
 
 	bftw_cache_init(&state->cache, args->nopenfd);
 	bftw_queue_init(&state->queue);
+	state->cache.queue = &state->queue.head;
 	state->batch = NULL;
 
+	state->ioq = NULL;
+	state->ioq_held = 0;
+	state->ioq_last = NULL;
+
 	state->file = NULL;
 	state->previous = NULL;
 
@@ -583,44 +985,337 @@ static int bftw_state_init(struct bftw_state *state, const struct bftw_args *arg
 	state->de = NULL;
 	state->direrror = 0;
 
+	state->dirents = NULL;
+	state->ndirents = 0;
+	state->direntpos = 0;
+
+	state->ndirentbuf = 0;
+	state->direntbufpos = 0;
+	state->de_skip = false;
+
+	state->snapshot = args->snapshot;
+	state->snapdir = NULL;
+	state->snappos = 0;
+	state->snapent = NULL;
+
+	state->record = args->record;
+	state->recording = false;
+
+	// Snapshots have their own copies of the listings
+	state->listings = NULL;
+	if (!args->snapshot && !args->record) {
+		state->listings = listings;
+	}
+	state->listing = NULL;
+	state->listpos = 0;
+	state->saveleaf = NULL;
+	state->savebuf = NULL;
+	state->nsaved = 0;
+	state->listing_hits = 0;
+
+	state->de_stat = NULL;
+
+	state->ftwbuf.xattrs.names = NULL;
+	state->ftwbuf.xattrs.capacity = 0;
+	state->ftwbuf.link.target = NULL;
+	state->ftwbuf.link.capacity = 0;
+
+	// In the C locale, strcoll() is just strcmp()
+	state->sort_xfrm = false;
+	if (state->flags & BFTW_SORT) {
+		const char *locale = setlocale(LC_COLLATE, NULL);
+		state->sort_xfrm = locale && strcmp(locale, "C") != 0 && strcmp(locale, "POSIX") != 0;
+	}
+	state->sortents = NULL;
+	state->sortcap = 0;
+	state->sortkeys = NULL;
+
+	return 0;
+}
+
+/** The maximum number of directories to open in the background. */
+#define BFTW_IOQ_DEPTH 4096
+
+/** The maximum number of entries to stat() in the background per directory. */
+#define BFTW_PREFETCH_MAX 64
+
+/**
+ * Start the background I/O threads.
+ */
+static int bftw_ioq_init(struct bftw_state *state, size_t nthreads) {
+	// Directories found in a snapshot are never opened
+	if (nthreads == 0 || state->snapshot) {
+		return 0;
+	}
+
+	// Split the file descriptors between the cache and the I/O queue.  The
+	// queue gets strictly less than half, so each file pinned by a pending
+	// operation leaves at least one evictable entry in the cache.
+	size_t depth = (state->cache.capacity - 1)/2;
+	if (depth > BFTW_IOQ_DEPTH) {
+		depth = BFTW_IOQ_DEPTH;
+	}
+	if (depth == 0) {
+		return 0;
+	}
+
+	// Threads beyond the queue depth would never have anything to do
+	if (nthreads > depth) {
+		nthreads = depth;
+	}
+
+	state->ioq = ioq_create(depth, nthreads);
+	if (!state->ioq) {
+		state->error = errno;
+		return -1;
+	}
+
+	state->cache.capacity -= depth;
 	return 0;
 }
 
+/** Handle a completed background operation. */
+static void bftw_ioq_complete(struct bftw_state *state, struct ioq_ent *ent) {
+	if (ent->op != IOQ_OPENDIR) {
+		// Nothing to do for closes
+		ioq_free(state->ioq, ent);
+		return;
+	}
+
+	struct bftw_file *file = ent->ptr;
+	assert(file->ioqueued);
+	file->ioqueued = false;
+
+	if (file->parent) {
+		bftw_cache_unpin(&state->cache, file->parent);
+	}
+
+	// On failure, the directory will be opened again synchronously, which
+	// gives the usual error handling a chance to run
+	if (ent->ret == 0) {
+		struct bftw_open *open = file->open;
+		open->dir = ent->dir;
+		open->dirents = ent->dirents;
+		open->ndirents = ent->ndirents;
+		++state->ioq_held;
+		++state->cache.nopens;
+	} else {
+		bftw_file_demote(&state->cache, file);
+	}
+
+	ioq_free(state->ioq, ent);
+}
+
+/** Process any completed background operations. */
+static void bftw_ioq_poll(struct bftw_state *state) {
+	struct ioq_ent *ent;
+	while ((ent = ioq_trypop(state->ioq))) {
+		bftw_ioq_complete(state, ent);
+	}
+}
+
+/** Wait for a background operation on a file to complete. */
+static void bftw_ioq_wait(struct bftw_state *state, const struct bftw_file *file) {
+	while (file->ioqueued) {
+		struct ioq_ent *ent = ioq_pop(state->ioq);
+		assert(ent);
+		bftw_ioq_complete(state, ent);
+	}
+}
+
+/** Check whether the background threads can take another operation. */
+static bool bftw_ioq_ready(const struct bftw_state *state) {
+	// Directories held open in the background count towards the limit
+	return state->ioq && ioq_capacity(state->ioq) > state->ioq_held;
+}
+
+/** Close a file descriptor, in the background if possible. */
+static void bftw_close(struct bftw_state *state, int fd) {
+	if (bftw_ioq_ready(state) && ioq_close(state->ioq, fd, NULL) == 0) {
+		return;
+	}
+
+	xclose(fd);
+}
+
+/** Close a directory, in the background if possible. */
+static void bftw_closedir_async(struct bftw_state *state, struct bfs_dir *dir) {
+	if (bftw_ioq_ready(state) && ioq_closedir(state->ioq, dir, NULL) == 0) {
+		return;
+	}
+
+	bfs_closedir(dir);
+}
+
+/** Close a cached file descriptor, in the background if possible. */
+static void bftw_close_file(struct bftw_state *state, struct bftw_file *file) {
+	assert(file->fd >= 0);
+
+	bftw_cache_remove(&state->cache, file);
+
+	bftw_close(state, file->fd);
+	file->fd = -1;
+	file->opath = false;
+	bftw_file_demote(&state->cache, file);
+}
+
+/** Close a directory that was opened in the background. */
+static void bftw_ioq_closedir(struct bftw_state *state, struct bftw_file *file) {
+	struct bftw_open *open = file->open;
+	if (open && open->dir) {
+		// Release our hold first, so the close can reuse the slot
+		struct bfs_dir *dir = open->dir;
+		open->dir = NULL;
+		free(open->dirents);
+		open->dirents = NULL;
+		open->ndirents = 0;
+		--state->ioq_held;
+		bftw_file_demote(&state->cache, file);
+		bftw_closedir_async(state, dir);
+	}
+}
+
+/** Try to open a queued directory in the background. */
+static int bftw_ioq_opendir(struct bftw_state *state, struct bftw_file *file) {
+	struct bftw_file *parent = file->parent;
+
+	int dfd = AT_FDCWD;
+	if (parent) {
+		// Only open relative to an open parent, to avoid building paths
+		if (parent->fd < 0) {
+			return 0;
+		}
+		dfd = parent->fd;
+	} else if (state->listings && bftw_listings_find(state->listings, file->name)) {
+		// The root's listing will be replayed, so don't bother opening it
+		return 0;
+	}
+
+	// Promote the file first, so the completion has somewhere to go
+	if (bftw_file_promote(&state->cache, file) != 0) {
+		return -1;
+	}
+
+	int ret;
+	if (state->flags & BFTW_PREFETCH_STAT) {
+		enum bfs_stat_flags flags = BFS_STAT_NOFOLLOW;
+		if (state->flags & BFTW_FOLLOW_ALL) {
+			flags = BFS_STAT_TRYFOLLOW;
+		}
+		ret = ioq_opendir_stat(state->ioq, dfd, file->name, flags, state->stat_fields, BFTW_PREFETCH_MAX, file);
+	} else {
+		ret = ioq_opendir(state->ioq, dfd, file->name, file);
+	}
+	if (ret != 0) {
+		bftw_file_demote(&state->cache, file);
+		return -1;
+	}
+
+	file->ioqueued = true;
+	if (parent) {
+		bftw_cache_pin(&state->cache, parent);
+	}
+	return 0;
+}
+
+/** Submit as many queued directories to the background threads as possible. */
+static void bftw_ioq_submit(struct bftw_state *state) {
+	if (!state->ioq) {
+		return;
+	}
+
+	bftw_ioq_poll(state);
+
+	while (bftw_ioq_ready(state)) {
+		struct bftw_file *next = state->ioq_last ? state->ioq_last->next : state->queue.head;
+		if (!next) {
+			break;
+		}
+
+		if (bftw_ioq_opendir(state, next) != 0) {
+			break;
+		}
+		state->ioq_last = next;
+	}
+}
+
+/** Stop the background I/O threads. */
+static void bftw_ioq_destroy(struct bftw_state *state) {
+	if (!state->ioq) {
+		return;
+	}
+
+	ioq_cancel(state->ioq);
+
+	struct ioq_ent *ent;
+	while ((ent = ioq_pop(state->ioq))) {
+		bftw_ioq_complete(state, ent);
+	}
+
+	ioq_destroy(state->ioq);
+	state->ioq = NULL;
+}
+
 /** Cached bfs_stat(). */
-static const struct bfs_stat *bftw_stat_impl(struct BFTW *ftwbuf, struct bftw_stat *cache, enum bfs_stat_flags flags) {
-	if (!cache->buf) {
-		if (cache->error) {
-			errno = cache->error;
-		} else if (bfs_stat(ftwbuf->at_fd, ftwbuf->at_path, flags, &cache->storage) == 0) {
-			cache->buf = &cache->storage;
-		} else {
-			cache->error = errno;
+static const struct bfs_stat *bftw_stat_impl(struct BFTW *ftwbuf, struct bftw_stat *cache, enum bfs_stat_flags flags, enum bfs_stat_field fields) {
+	if (cache->buf) {
+		// Don't re-stat() for fields that were asked for but aren't
+		// supported
+		if ((cache->buf->mask & fields) == fields || (cache->fields & fields) == fields) {
+			return cache->buf;
 		}
+	} else if (cache->error) {
+		errno = cache->error;
+		return NULL;
+	}
+
+	fields |= cache->fields;
+
+	// Identity and type info can't go stale, so let network file systems
+	// answer from their caches
+	if (!(fields & ~BFS_STAT_IDENTITY)) {
+		flags |= BFS_STAT_NOSYNC;
+	}
+
+	if (bfs_stat_fields(ftwbuf->at_fd, ftwbuf->at_path, flags, fields, &cache->storage) == 0) {
+		cache->buf = &cache->storage;
+		cache->fields = fields;
+	} else if (!cache->buf) {
+		cache->error = errno;
+	} else {
+		// Keep the narrower info from before
+		return NULL;
 	}
 
 	return cache->buf;
 }
 
-const struct bfs_stat *bftw_stat(const struct BFTW *ftwbuf, enum bfs_stat_flags flags) {
+/** bftw_stat() for some particular fields. */
+static const struct bfs_stat *bftw_stat_fields(const struct BFTW *ftwbuf, enum bfs_stat_flags flags, enum bfs_stat_field fields) {
 	struct BFTW *mutbuf = (struct BFTW *)ftwbuf;
 	const struct bfs_stat *ret;
 
 	if (flags & BFS_STAT_NOFOLLOW) {
-		ret = bftw_stat_impl(mutbuf, &mutbuf->lstat_cache, BFS_STAT_NOFOLLOW);
-		if (ret && !S_ISLNK(ret->mode) && !mutbuf->stat_cache.buf) {
+		ret = bftw_stat_impl(mutbuf, &mutbuf->lstat_cache, BFS_STAT_NOFOLLOW, fields);
+		if (ret && !S_ISLNK(ret->mode) && (!mutbuf->stat_cache.buf || mutbuf->stat_cache.buf == ret)) {
 			// Non-link, so share stat info
 			mutbuf->stat_cache.buf = ret;
+			mutbuf->stat_cache.fields = mutbuf->lstat_cache.fields;
 		}
 	} else {
-		ret = bftw_stat_impl(mutbuf, &mutbuf->stat_cache, BFS_STAT_FOLLOW);
+		ret = bftw_stat_impl(mutbuf, &mutbuf->stat_cache, BFS_STAT_FOLLOW, fields);
 		if (!ret && (flags & BFS_STAT_TRYFOLLOW) && is_nonexistence_error(errno)) {
-			ret = bftw_stat_impl(mutbuf, &mutbuf->lstat_cache, BFS_STAT_NOFOLLOW);
+			ret = bftw_stat_impl(mutbuf, &mutbuf->lstat_cache, BFS_STAT_NOFOLLOW, fields);
 		}
 	}
 
 	return ret;
 }
 
+const struct bfs_stat *bftw_stat(const struct BFTW *ftwbuf, enum bfs_stat_flags flags) {
+	return bftw_stat_fields(ftwbuf, flags, ftwbuf->stat_fields);
+}
+
 const struct bfs_stat *bftw_cached_stat(const struct BFTW *ftwbuf, enum bfs_stat_flags flags) {
 	if (flags & BFS_STAT_NOFOLLOW) {
 		return ftwbuf->lstat_cache.buf;
@@ -658,6 +1353,47 @@ enum bfs_type bftw_type(const struct BFTW *ftwbuf, enum bfs_stat_flags flags) {
 	}
 }
 
+const char *bftw_readlink(const struct BFTW *ftwbuf) {
+	struct bftw_link *cache = (struct bftw_link *)&ftwbuf->link;
+	if (!cache->read) {
+		// Start with the size from lstat(), if we have it
+		const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
+		size_t size = statbuf && (statbuf->mask & BFS_STAT_SIZE) ? statbuf->size + 1 : 64;
+
+		while (true) {
+			if (size > cache->capacity) {
+				char *target = realloc(cache->target, size);
+				if (!target) {
+					cache->error = errno;
+					break;
+				}
+				cache->target = target;
+				cache->capacity = size;
+			}
+
+			ssize_t len = readlinkat(ftwbuf->at_fd, ftwbuf->at_path, cache->target, cache->capacity);
+			if (len < 0) {
+				cache->error = errno;
+				break;
+			} else if ((size_t)len < cache->capacity) {
+				cache->target[len] = '\0';
+				break;
+			}
+
+			size = 2 * cache->capacity;
+		}
+
+		cache->read = true;
+	}
+
+	if (cache->error) {
+		errno = cache->error;
+		return NULL;
+	}
+
+	return cache->target;
+}
+
 /**
  * Update the path for the current file.
  */
@@ -665,25 +1401,78 @@ static int bftw_update_path(struct bftw_state *state, const char *name) {
 	const struct bftw_file *file = state->file;
 	size_t length = file ? file->nameoff + file->namelen : 0;
 
-	assert(dstrlen(state->path) >= length);
-	dstresize(&state->path, length);
+	assert(dstrlen(state->path) >= length);
+	dstresize(&state->path, length);
+
+	if (name) {
+		if (length > 0 && state->path[length - 1] != '/') {
+			if (dstrapp(&state->path, '/') != 0) {
+				return -1;
+			}
+		}
+		if (dstrcat(&state->path, name) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Check the canonical path of the current file against the mount table, after
+ * its basename matched a mount point.  This avoids stat()ing every file named
+ * e.g. "hosts" in a container with /etc/hosts bind-mounted.
+ *
+ * @return
+ *         Whether the current file might be a mount point.
+ */
+static bool bftw_might_be_mount(struct bftw_state *state) {
+	// Paths below the root may go through symlinks with -L
+	const struct bftw_file *parent = state->file;
+	if (!parent || (state->flags & BFTW_FOLLOW_ALL)) {
+		return true;
+	}
+
+	const char *root = parent->root->name;
+	if (!state->mount_root_name || strcmp(state->mount_root_name, root) != 0) {
+		dstrfree(state->mount_root_name);
+		free(state->mount_root_path);
+		state->mount_root_path = NULL;
+
+		state->mount_root_name = dstrdup(root);
+		if (!state->mount_root_name) {
+			return true;
+		}
+		state->mount_root_path = realpath(root, NULL);
+	}
+
+	const char *canon = state->mount_root_path;
+	if (!canon) {
+		return true;
+	}
+
+	const char *rest = state->ftwbuf.path + strlen(root);
+	rest += strspn(rest, "/");
 
-	if (name) {
-		if (length > 0 && state->path[length - 1] != '/') {
-			if (dstrapp(&state->path, '/') != 0) {
-				return -1;
-			}
-		}
-		if (dstrcat(&state->path, name) != 0) {
-			return -1;
+	if (!state->mount_path) {
+		state->mount_path = dstralloc(0);
+		if (!state->mount_path) {
+			return true;
 		}
 	}
 
-	return 0;
+	if (dstresize(&state->mount_path, 0) != 0
+	    || dstrcat(&state->mount_path, canon) != 0
+	    || (strcmp(canon, "/") != 0 && dstrapp(&state->mount_path, '/') != 0)
+	    || dstrcat(&state->mount_path, rest) != 0) {
+		return true;
+	}
+
+	return bfs_is_mount_path(state->mtab, state->mount_path);
 }
 
 /** Check if a stat() call is needed for this visit. */
-static bool bftw_need_stat(const struct bftw_state *state) {
+static bool bftw_need_stat(struct bftw_state *state) {
 	if (state->flags & BFTW_STAT) {
 		return true;
 	}
@@ -708,7 +1497,7 @@ static bool bftw_need_stat(const struct bftw_state *state) {
 		// need to stat() to get the correct type.  We don't need to
 		// check for directories because they can only be mounted over
 		// by other directories.
-		if (bfs_might_be_mount(state->mtab, ftwbuf->path)) {
+		if (bfs_might_be_mount(state->mtab, ftwbuf->path) && bftw_might_be_mount(state)) {
 			return true;
 		}
 #endif
@@ -721,6 +1510,29 @@ static bool bftw_need_stat(const struct bftw_state *state) {
 static void bftw_stat_init(struct bftw_stat *cache) {
 	cache->buf = NULL;
 	cache->error = 0;
+	cache->fields = 0;
+}
+
+/**
+ * Fill the bftw_stat caches from stat info that is already known, either
+ * prefetched in the background or read from a snapshot.
+ */
+static void bftw_stat_fill(struct BFTW *ftwbuf, const struct bfs_stat *buf, enum bfs_stat_field fields) {
+	if (ftwbuf->stat_flags & BFS_STAT_NOFOLLOW) {
+		ftwbuf->lstat_cache.storage = *buf;
+		ftwbuf->lstat_cache.buf = &ftwbuf->lstat_cache.storage;
+		ftwbuf->lstat_cache.fields = fields;
+		if (!S_ISLNK(buf->mode)) {
+			ftwbuf->stat_cache.buf = ftwbuf->lstat_cache.buf;
+			ftwbuf->stat_cache.fields = fields;
+		}
+	} else if (!S_ISLNK(buf->mode)) {
+		// A link here means we only have lstat() info, so we leave the
+		// rest for the synchronous path
+		ftwbuf->stat_cache.storage = *buf;
+		ftwbuf->stat_cache.buf = &ftwbuf->stat_cache.storage;
+		ftwbuf->stat_cache.fields = fields;
+	}
 }
 
 /**
@@ -734,6 +1546,8 @@ static void bftw_stat_init(struct bftw_stat *cache) {
  *         The opened file descriptor, or -1 on error.
  */
 static int bftw_ensure_open(struct bftw_cache *cache, struct bftw_file *file, const char *path) {
+	bftw_cache_count(cache, file);
+
 	int ret = file->fd;
 
 	if (ret < 0) {
@@ -742,7 +1556,7 @@ static int bftw_ensure_open(struct bftw_cache *cache, struct bftw_file *file, co
 			return -1;
 		}
 
-		ret = bftw_file_open(cache, file, copy);
+		ret = bftw_file_open(cache, file, copy, true);
 		free(copy);
 	}
 
@@ -766,8 +1580,15 @@ static void bftw_init_ftwbuf(struct bftw_state *state, enum bftw_visit visit) {
 	ftwbuf->at_fd = AT_FDCWD;
 	ftwbuf->at_path = ftwbuf->path;
 	ftwbuf->stat_flags = BFS_STAT_NOFOLLOW;
+	ftwbuf->stat_fields = state->stat_fields;
+	ftwbuf->nentries = SIZE_MAX;
 	bftw_stat_init(&ftwbuf->lstat_cache);
 	bftw_stat_init(&ftwbuf->stat_cache);
+	ftwbuf->xattrs.listed = false;
+	ftwbuf->xattrs.error = 0;
+	ftwbuf->xattrs.len = 0;
+	ftwbuf->link.read = false;
+	ftwbuf->link.error = 0;
 
 	struct bftw_file *parent = NULL;
 	if (de) {
@@ -780,9 +1601,15 @@ static void bftw_init_ftwbuf(struct bftw_state *state, enum bftw_visit visit) {
 		ftwbuf->depth = file->depth;
 		ftwbuf->type = file->type;
 		ftwbuf->nameoff = file->nameoff;
+		if (visit == BFTW_POST) {
+			ftwbuf->nentries = file->nentries;
+		}
 	}
 
-	if (parent) {
+	if (parent && parent->fd < 0 && (state->snapshot || parent->replayed)) {
+		// Use the full path rather than opening directories that the
+		// snapshot or a replayed listing already covers
+	} else if (parent) {
 		// Try to ensure the immediate parent is open, to avoid ENAMETOOLONG
 		if (bftw_ensure_open(&state->cache, parent, state->path) >= 0) {
 			ftwbuf->at_fd = parent->fd;
@@ -811,9 +1638,29 @@ static void bftw_init_ftwbuf(struct bftw_state *state, enum bftw_visit visit) {
 		ftwbuf->stat_flags = BFS_STAT_TRYFOLLOW;
 	}
 
+	if (de) {
+		if (state->de_stat) {
+			// Snapshot entries are as complete as they'll ever be
+			enum bfs_stat_field fields = state->snapent ? BFS_STAT_ALL : state->stat_fields;
+			bftw_stat_fill(ftwbuf, state->de_stat, fields);
+		}
+	} else if (file && file->snapent) {
+		struct bfs_stat buf;
+		if (bfs_snap_ent_stat(file->snapent, &buf) == 0) {
+			bftw_stat_fill(ftwbuf, &buf, BFS_STAT_ALL);
+		}
+	}
+
 	const struct bfs_stat *statbuf = NULL;
 	if (bftw_need_stat(state)) {
-		statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+		// If the callback won't stat() every file anyway, we only need
+		// to know what kind of file this is
+		enum bfs_stat_field fields = BFS_STAT_IDENTITY;
+		if (state->flags & BFTW_STAT) {
+			fields = ftwbuf->stat_fields;
+		}
+
+		statbuf = bftw_stat_fields(ftwbuf, ftwbuf->stat_flags, fields);
 		if (statbuf) {
 			ftwbuf->type = bfs_mode_to_type(statbuf->mode);
 		} else {
@@ -847,7 +1694,7 @@ static bool bftw_is_mount(struct bftw_state *state, const char *name) {
 	}
 
 	const struct BFTW *ftwbuf = &state->ftwbuf;
-	const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+	const struct bfs_stat *statbuf = bftw_stat_fields(ftwbuf, ftwbuf->stat_flags, BFS_STAT_IDENTITY);
 	return statbuf && statbuf->dev != parent->dev;
 }
 
@@ -920,7 +1767,7 @@ done:
  */
 static int bftw_push(struct bftw_state *state, const char *name, bool fill_id) {
 	struct bftw_file *parent = state->file;
-	struct bftw_file *file = bftw_file_new(parent, name);
+	struct bftw_file *file = bftw_file_new(&state->cache, parent, name);
 	if (!file) {
 		state->error = errno;
 		return -1;
@@ -928,6 +1775,9 @@ static int bftw_push(struct bftw_state *state, const char *name, bool fill_id) {
 
 	if (state->de) {
 		file->type = state->de->type;
+		if (!(state->flags & BFTW_SNAPSHOT_CHECK)) {
+			file->snapent = state->snapent;
+		}
 	}
 
 	if (fill_id) {
@@ -935,6 +1785,7 @@ static int bftw_push(struct bftw_state *state, const char *name, bool fill_id) {
 	}
 
 	bftw_queue_push(&state->queue, file);
+	bftw_ioq_submit(state);
 
 	return 0;
 }
@@ -983,6 +1834,9 @@ static int bftw_pop(struct bftw_state *state) {
 	}
 
 	state->file = bftw_queue_pop(&state->queue);
+	if (state->ioq_last == state->file) {
+		state->ioq_last = NULL;
+	}
 
 	if (bftw_build_path(state) != 0) {
 		return -1;
@@ -991,6 +1845,173 @@ static int bftw_pop(struct bftw_state *state) {
 	return 1;
 }
 
+/**
+ * Start recording the current directory into the snapshot.
+ */
+static void bftw_record_begin(struct bftw_state *state) {
+	struct bfs_stat buf;
+	if (state->snapdir) {
+		bfs_snap_dir_stat(state->snapdir, &buf);
+	} else if (!state->dir || bfs_stat(bfs_dirfd(state->dir), NULL, 0, &buf) != 0) {
+		return;
+	}
+
+	state->recording = bfs_snap_begin(state->record, state->path, &buf) == 0;
+}
+
+/**
+ * Record the current directory entry into the snapshot.
+ */
+static void bftw_record_add(struct bftw_state *state) {
+	const struct bfs_dirent *de = state->de;
+
+	// Snapshots hold lstat() info, but prefetched entries may have followed
+	// links
+	if (!state->de_stat || (!state->snapent && (state->flags & BFTW_FOLLOW_ALL))) {
+		int dfd = state->dir ? bfs_dirfd(state->dir) : state->file->fd;
+		if (dfd >= 0 && bfs_stat(dfd, de->name, BFS_STAT_NOFOLLOW, &state->de_stat_storage) == 0) {
+			state->de_stat = &state->de_stat_storage;
+		} else {
+			state->de_stat = NULL;
+		}
+	}
+
+	if (bfs_snap_add(state->record, de, state->de_stat) != 0) {
+		state->recording = false;
+	}
+}
+
+/** Check if two timestamps are equal. */
+static bool bftw_time_eq(const struct timespec *lhs, const struct timespec *rhs) {
+	return lhs->tv_sec == rhs->tv_sec && lhs->tv_nsec == rhs->tv_nsec;
+}
+
+/**
+ * Check whether the current directory has changed since its snapshot record
+ * was saved.  Any change to the directory's entries updates its mtime and
+ * ctime, so if those match, the recorded listing is still accurate.
+ */
+static bool bftw_snap_changed(struct bftw_state *state) {
+	// Leave the directory open, for stat()ing its entries later
+	int fd = bftw_ensure_open(&state->cache, state->file, state->path);
+	if (fd < 0) {
+		return true;
+	}
+
+	struct bfs_stat buf;
+	if (bfs_stat(fd, NULL, 0, &buf) != 0) {
+		return true;
+	}
+
+	struct bfs_stat snap;
+	bfs_snap_dir_stat(state->snapdir, &snap);
+
+	enum bfs_stat_field mask = BFS_STAT_DEV | BFS_STAT_INO | BFS_STAT_CTIME | BFS_STAT_MTIME;
+	if ((buf.mask & mask) != mask || (snap.mask & mask) != mask) {
+		return true;
+	}
+
+	// File system timestamps are coarse, so a directory modified shortly
+	// before the snapshot was started may be modified again without its
+	// timestamps changing.  Don't trust records that are that recent.  Any
+	// later modification sets the mtime to the current time, so an older (or
+	// backdated) mtime is enough to tell.
+	struct timespec time;
+	bfs_snap_time(state->snapshot, &time);
+	if (snap.mtime.tv_sec >= time.tv_sec - 1) {
+		return true;
+	}
+
+	return buf.dev != snap.dev
+		|| buf.ino != snap.ino
+		|| !bftw_time_eq(&buf.mtime, &snap.mtime)
+		|| !bftw_time_eq(&buf.ctime, &snap.ctime);
+}
+
+/**
+ * Start saving the current directory's listing, if there's room.
+ */
+static void bftw_listing_begin(struct bftw_state *state) {
+	struct bftw_listings *listings = state->listings;
+	if (listings->bytes >= BFTW_LISTINGS_MAX) {
+		return;
+	}
+
+	if (!state->savebuf) {
+		state->savebuf = dstralloc(0);
+		if (!state->savebuf) {
+			return;
+		}
+	}
+
+	// The cache is just an optimization, so failures are ignored
+	state->saveleaf = trie_insert_str(&listings->trie, state->path);
+	dstresize(&state->savebuf, 0);
+	state->nsaved = 0;
+}
+
+/**
+ * Stop saving the current directory's listing.
+ */
+static void bftw_listing_abort(struct bftw_state *state) {
+	if (state->saveleaf) {
+		trie_remove(&state->listings->trie, state->saveleaf);
+		state->saveleaf = NULL;
+	}
+}
+
+/**
+ * Save the current directory entry, as a type byte followed by the name.
+ */
+static void bftw_listing_add(struct bftw_state *state) {
+	const struct bfs_dirent *de = state->de;
+	if (dstrapp(&state->savebuf, (char)de->type) != 0
+	    || dstrcat(&state->savebuf, de->name) != 0
+	    || dstrapp(&state->savebuf, '\0') != 0) {
+		bftw_listing_abort(state);
+		return;
+	}
+
+	++state->nsaved;
+}
+
+/**
+ * Finish saving the current directory's listing.
+ */
+static void bftw_listing_commit(struct bftw_state *state) {
+	struct bftw_listings *listings = state->listings;
+	size_t count = state->nsaved;
+	size_t namelen = dstrlen(state->savebuf) - count;
+	size_t size = sizeof(struct bftw_listing) + count * sizeof(struct bfs_dirent) + namelen;
+
+	struct bftw_listing *listing = NULL;
+	if (listings->bytes + size <= BFTW_LISTINGS_MAX) {
+		listing = malloc(size);
+	}
+	if (!listing) {
+		bftw_listing_abort(state);
+		return;
+	}
+
+	listing->count = count;
+	char *names = (char *)(listing->entries + count);
+	const char *buf = state->savebuf;
+	for (size_t i = 0; i < count; ++i) {
+		struct bfs_dirent *de = &listing->entries[i];
+		de->type = (signed char)*buf++;
+
+		size_t len = strlen(buf) + 1;
+		memcpy(names, buf, len);
+		de->name = names;
+		names += len;
+		buf += len;
+	}
+
+	state->saveleaf->value = listing;
+	state->saveleaf = NULL;
+	listings->bytes += size;
+}
+
 /**
  * Open the current directory.
  */
@@ -999,10 +2020,117 @@ static void bftw_opendir(struct bftw_state *state) {
 	assert(!state->de);
 
 	state->direrror = 0;
+	state->direntcount = 0;
+
+	struct bftw_progress *progress = state->progress;
+	if (progress) {
+		atomic_fetch_add_explicit(&progress->dirs, 1, memory_order_relaxed);
+		atomic_store_explicit(&progress->queued, state->queue.size, memory_order_relaxed);
+	}
+
+	struct bftw_file *file = state->file;
+	if (state->snapshot) {
+		state->snapdir = bfs_snap_find(state->snapshot, state->path);
+		state->snappos = 0;
+
+		if (state->snapdir && (state->flags & BFTW_SNAPSHOT_CHECK) && bftw_snap_changed(state)) {
+			state->snapdir = NULL;
+		}
+	}
+
+	if (state->listings) {
+		state->listing = bftw_listings_find(state->listings, state->path);
+		state->listpos = 0;
+	}
+
+	if (state->ioq) {
+		bftw_ioq_wait(state, file);
+	}
+
+	if (state->listing) {
+		// Replay the entries from an earlier walk instead
+		bftw_ioq_closedir(state, file);
+		file->replayed = true;
+		++state->listing_hits;
+	} else if (state->snapdir) {
+		// Read the entries from the snapshot instead
+	} else if (file->open && file->open->dir) {
+		struct bftw_cache *cache = &state->cache;
+		struct bftw_open *open = file->open;
+
+		state->dir = open->dir;
+		open->dir = NULL;
+		--state->ioq_held;
+
+		state->dirents = open->dirents;
+		state->ndirents = open->ndirents;
+		state->direntpos = 0;
+		open->dirents = NULL;
+		open->ndirents = 0;
+
+		bftw_cache_count(cache, file);
+		if (cache->capacity == 0) {
+			struct bftw_file *victim = bftw_cache_victim(cache, NULL);
+			assert(victim);
+			++cache->evictions;
+			bftw_close_file(state, victim);
+		}
+
+		file->fd = bfs_dirfd(state->dir);
+		bftw_cache_add(cache, file);
+	} else {
+		state->dir = bftw_file_opendir(&state->cache, file, state->path);
+		if (!state->dir) {
+			state->direrror = errno;
+		}
+	}
+
+	if (state->record) {
+		bftw_record_begin(state);
+	}
+
+	if (state->listings && !state->listing && state->dir) {
+		bftw_listing_begin(state);
+	}
+
+	bftw_ioq_submit(state);
+}
+
+/**
+ * Let the batch callback screen the buffered entries.
+ */
+static void bftw_screen_batch(struct bftw_state *state) {
+	const struct bftw_file *file = state->file;
+
+	memset(state->direntskip, 0, sizeof(state->direntskip));
+
+	struct bftw_batch batch = {
+		.root = file->root->name,
+		.depth = file->depth + 1,
+		.at_fd = file->fd,
+		.entries = state->direntbuf,
+		.count = state->ndirentbuf,
+	};
+	state->batch_callback(&batch, state->direntskip, state->ptr);
+}
+
+/**
+ * Check if the current entry can be skipped without visiting it.
+ */
+static bool bftw_can_skip(const struct bftw_state *state) {
+	if (!state->de_skip || (state->flags & BFTW_STAT)) {
+		return false;
+	}
 
-	state->dir = bftw_file_opendir(&state->cache, state->file, state->path);
-	if (!state->dir) {
-		state->direrror = errno;
+	// Only skip files that we definitely won't descend into
+	switch (state->de->type) {
+	case BFS_UNKNOWN:
+	case BFS_DIR:
+		return false;
+	case BFS_LNK:
+		return !(state->flags & BFTW_FOLLOW_ALL);
+	default:
+		return true;
 	}
 }
 
@@ -1010,18 +2138,89 @@ static void bftw_opendir(struct bftw_state *state) {
  * Read an entry from the current directory.
  */
 static int bftw_readdir(struct bftw_state *state) {
-	if (!state->dir) {
+	state->de_stat = NULL;
+	state->snapent = NULL;
+	state->de_skip = false;
+
+	int ret;
+	if (state->listing) {
+		if (state->listpos < state->listing->count) {
+			state->de_storage = state->listing->entries[state->listpos++];
+			ret = 1;
+		} else {
+			ret = 0;
+		}
+	} else if (state->snapdir) {
+		if (state->snappos < bfs_snap_dir_size(state->snapdir)) {
+			state->snapent = bfs_snap_dir_read(state->snapdir, state->snappos++, &state->de_storage);
+
+			// Unchanged directories can still have modified entries, so
+			// we only trust the names and types when checking
+			if (!(state->flags & BFTW_SNAPSHOT_CHECK) && bfs_snap_ent_stat(state->snapent, &state->de_stat_storage) == 0) {
+				state->de_stat = &state->de_stat_storage;
+			}
+			ret = 1;
+		} else {
+			ret = 0;
+		}
+	} else if (!state->dir) {
 		return -1;
+	} else if (state->direntpos < state->ndirents) {
+		// Return the prefetched entries first.  Failures are retried
+		// synchronously, to report errors normally.
+		const struct ioq_dirent *dirent = &state->dirents[state->direntpos++];
+		state->de_storage = dirent->de;
+		if (dirent->ret == 0) {
+			state->de_stat = &dirent->buf;
+		}
+		ret = 1;
+	} else {
+		if (state->direntbufpos >= state->ndirentbuf) {
+			size_t n = sizeof(state->direntbuf)/sizeof(state->direntbuf[0]);
+			ret = bfs_readdir_batch(state->dir, state->direntbuf, n);
+			state->ndirentbuf = ret > 0 ? ret : 0;
+			state->direntbufpos = 0;
+			if (ret > 0 && state->batch_callback) {
+				bftw_screen_batch(state);
+			}
+		}
+
+		if (state->direntbufpos < state->ndirentbuf) {
+			if (state->batch_callback) {
+				state->de_skip = state->direntskip[state->direntbufpos];
+			}
+			state->de_storage = state->direntbuf[state->direntbufpos++];
+			ret = 1;
+		}
 	}
 
-	int ret = bfs_readdir(state->dir, &state->de_storage);
 	if (ret > 0) {
 		state->de = &state->de_storage;
-	} else if (ret == 0) {
-		state->de = NULL;
+		++state->direntcount;
+		if (state->progress) {
+			atomic_fetch_add_explicit(&state->progress->entries, 1, memory_order_relaxed);
+		}
+		if (state->recording) {
+			bftw_record_add(state);
+		}
+		if (state->saveleaf) {
+			bftw_listing_add(state);
+		}
 	} else {
 		state->de = NULL;
-		state->direrror = errno;
+		if (ret < 0) {
+			state->direrror = errno;
+		} else {
+			state->file->nentries = state->direntcount;
+			if (state->recording) {
+				// Only complete listings are recorded
+				bfs_snap_commit(state->record);
+				state->recording = false;
+			}
+		}
+		if (ret == 0 && state->saveleaf) {
+			bftw_listing_commit(state);
+		}
 	}
 
 	return ret;
@@ -1051,22 +2250,56 @@ static enum bftw_action bftw_closedir(struct bftw_state *state, enum bftw_gc_fla
 	if (state->dir) {
 		assert(file->fd >= 0);
 
+#if !__linux__
+		// bfs_freedir() may change the file descriptor on this platform,
+		// so make sure no background operations are still using it
+		while (file->open->pincount > 0) {
+			struct ioq_ent *ent = ioq_pop(state->ioq);
+			assert(ent);
+			bftw_ioq_complete(state, ent);
+		}
+#endif
+
 		if (file->refcount > 1) {
 			// Keep the fd around if any subdirectories exist
 			file->fd = bfs_freedir(state->dir);
+			if (file->fd < 0) {
+				bftw_cache_remove(&state->cache, file);
+				bftw_file_demote(&state->cache, file);
+			}
 		} else {
-			bfs_closedir(state->dir);
+			// Free the cache slot first, so the close can run in the
+			// background
+			bftw_cache_remove(&state->cache, file);
 			file->fd = -1;
+			bftw_file_demote(&state->cache, file);
+			bftw_closedir_async(state, state->dir);
 		}
+	}
 
-		if (file->fd < 0) {
-			bftw_cache_remove(&state->cache, file);
-		}
+	if (state->recording) {
+		bfs_snap_abort(state->record);
+		state->recording = false;
 	}
 
+	bftw_listing_abort(state);
+	state->listing = NULL;
+
 	state->de = NULL;
 	state->dir = NULL;
 
+	free(state->dirents);
+	state->dirents = NULL;
+	state->ndirents = 0;
+	state->direntpos = 0;
+
+	state->ndirentbuf = 0;
+	state->direntbufpos = 0;
+
+	state->snapdir = NULL;
+	state->snapent = NULL;
+	state->de_stat = NULL;
+
 	if (state->direrror != 0) {
 		if (flags & BFTW_VISIT_FILE) {
 			ret = bftw_visit(state, NULL, BFTW_PRE);
@@ -1107,6 +2340,10 @@ static enum bftw_action bftw_gc_file(struct bftw_state *state, enum bftw_gc_flag
 		if (state->previous == file) {
 			state->previous = parent;
 		}
+		bftw_ioq_closedir(state, file);
+		if (file->fd >= 0) {
+			bftw_close_file(state, file);
+		}
 		bftw_file_free(&state->cache, file);
 		state->file = parent;
 	}
@@ -1132,12 +2369,43 @@ static void bftw_drain_queue(struct bftw_state *state, struct bftw_queue *queue)
  */
 static int bftw_state_destroy(struct bftw_state *state) {
 	dstrfree(state->path);
+	dstrfree(state->mount_path);
+	free(state->mount_root_path);
+	dstrfree(state->mount_root_name);
+	dstrfree(state->savebuf);
+	free(state->sortents);
+	dstrfree(state->sortkeys);
+	free(state->ftwbuf.xattrs.names);
+	free(state->ftwbuf.link.target);
+
+	bftw_ioq_destroy(state);
 
 	bftw_closedir(state, BFTW_VISIT_NONE);
 
 	bftw_gc_file(state, BFTW_VISIT_NONE);
 	bftw_drain_queue(state, &state->queue);
 
+	struct bftw_stats *stats = state->stats;
+	if (stats) {
+		const struct varena *files = &state->cache.files;
+		size_t bytes = varena_bytes(files);
+		if (files->peak > stats->peak_files) {
+			stats->peak_files = files->peak;
+		}
+		if (bytes > stats->peak_bytes) {
+			stats->peak_bytes = bytes;
+		}
+		++stats->nwalks;
+
+		const struct bftw_cache *cache = &state->cache;
+		stats->cache_hits += cache->hits;
+		stats->cache_misses += cache->misses;
+		stats->cache_opens += cache->nopens;
+		stats->cache_reopens += cache->reopens;
+		stats->cache_evictions += cache->evictions;
+		stats->listing_hits += state->listing_hits;
+	}
+
 	bftw_cache_destroy(&state->cache);
 
 	errno = state->error;
@@ -1146,30 +2414,154 @@ static int bftw_state_destroy(struct bftw_state *state) {
 
 /** Start a batch of files. */
 static void bftw_batch_start(struct bftw_state *state) {
-	if (state->strategy == BFTW_DFS) {
+	bool dfs = state->strategy == BFTW_DFS;
+
+	// Past the queue limit, push children to the front to stop the queue
+	// from growing any further
+	if (state->queue_limit && state->queue.size >= state->queue_limit) {
+		dfs = true;
+	}
+
+	if (dfs) {
 		state->queue.target = &state->queue.head;
+	} else {
+		state->queue.target = state->queue.tail;
 	}
 	state->batch = state->queue.target;
 }
 
+/** Compute the collation key for a file being sorted. */
+static int bftw_sort_key(struct bftw_state *state, struct bftw_sort_ent *ent) {
+	const char *name = ent->file->name;
+	if (!state->sort_xfrm) {
+		ent->key = name;
+		return 0;
+	}
+
+	// Transform the name once, rather than on every strcoll()
+	size_t offset = dstrlen(state->sortkeys);
+	size_t size = ent->file->namelen + 1;
+	while (true) {
+		if (dstresize(&state->sortkeys, offset + size) != 0) {
+			return -1;
+		}
+
+		size_t len = strxfrm(state->sortkeys + offset, name, size);
+		if (len < size) {
+			// Trim the key to its actual length, keeping its terminator
+			dstresize(&state->sortkeys, offset + len + 1);
+			break;
+		}
+
+		// The key didn't fit, so grow the buffer and try again
+		size = len + 1;
+	}
+
+	ent->keyoff = offset;
+	return 0;
+}
+
+/** Sort the current batch of files. */
+static int bftw_sort_batch(struct bftw_state *state) {
+	struct bftw_file **head = state->batch;
+	struct bftw_file *end = *state->queue.target;
+
+	size_t count = 0;
+	for (struct bftw_file *file = *head; file != end; file = file->next) {
+		++count;
+	}
+	if (count < 2) {
+		return 0;
+	}
+
+	if (count > state->sortcap) {
+		size_t cap = state->sortcap ? state->sortcap : 64;
+		while (cap < count) {
+			cap *= 2;
+		}
+
+		struct bftw_sort_ent *ents = realloc(state->sortents, cap * sizeof(*ents));
+		if (!ents) {
+			return -1;
+		}
+		state->sortents = ents;
+		state->sortcap = cap;
+	}
+
+	if (state->sort_xfrm) {
+		if (!state->sortkeys) {
+			state->sortkeys = dstralloc(0);
+			if (!state->sortkeys) {
+				return -1;
+			}
+		}
+		dstresize(&state->sortkeys, 0);
+	}
+
+	struct bftw_sort_ent *ents = state->sortents;
+	struct bftw_file *file = *head;
+	for (size_t i = 0; i < count; ++i) {
+		ents[i].file = file;
+		ents[i].index = i;
+		if (bftw_sort_key(state, &ents[i]) != 0) {
+			return -1;
+		}
+		file = file->next;
+	}
+
+	// The key buffer may have moved while it was filled
+	if (state->sort_xfrm) {
+		for (size_t i = 0; i < count; ++i) {
+			ents[i].key = state->sortkeys + ents[i].keyoff;
+		}
+	}
+
+	qsort(ents, count, sizeof(*ents), bftw_sort_cmp);
+
+	for (size_t i = 0; i < count; ++i) {
+		*head = ents[i].file;
+		head = &ents[i].file->next;
+	}
+	*head = end;
+
+	struct bftw_queue *queue = &state->queue;
+	if (queue->target == queue->tail) {
+		queue->tail = head;
+	}
+	queue->target = head;
+	return 0;
+}
+
 /** Finish adding a batch of files. */
-static void bftw_batch_finish(struct bftw_state *state) {
-	if (state->flags & BFTW_SORT) {
-		state->queue.target = bftw_sort_files(state->batch, state->queue.target);
+static int bftw_batch_finish(struct bftw_state *state) {
+	if ((state->flags & BFTW_SORT) && bftw_sort_batch(state) != 0) {
+		state->error = errno;
+		return -1;
 	}
+
+	return 0;
 }
 
 /**
  * Streaming mode: visit files as they are encountered.
  */
-static int bftw_stream(const struct bftw_args *args) {
+static int bftw_stream(const struct bftw_args *args, struct bftw_listings *listings) {
 	struct bftw_state state;
-	if (bftw_state_init(&state, args) != 0) {
+	if (bftw_state_init(&state, args, listings) != 0) {
 		return -1;
 	}
 
 	assert(!(state.flags & (BFTW_SORT | BFTW_BUFFER)));
 
+	// Only streaming mode reads directories in queue order, so it's the
+	// only mode that can open them ahead of time
+	if (bftw_ioq_init(&state, args->nthreads) != 0) {
+		goto done;
+	}
+
+	// It's also the only mode that visits entries as they're read
+	state.batch_callback = args->batch_callback;
+
 	bftw_batch_start(&state);
 	for (size_t i = 0; i < args->npaths; ++i) {
 		const char *path = args->paths[i];
@@ -1187,13 +2579,19 @@ static int bftw_stream(const struct bftw_args *args) {
 			goto done;
 		}
 	}
-	bftw_batch_finish(&state);
+	if (bftw_batch_finish(&state) != 0) {
+		goto done;
+	}
 
 	while (bftw_pop(&state) > 0) {
 		bftw_opendir(&state);
 
 		bftw_batch_start(&state);
 		while (bftw_readdir(&state) > 0) {
+			if (bftw_can_skip(&state)) {
+				continue;
+			}
+
 			const char *name = state.de->name;
 
 			switch (bftw_visit(&state, name, BFTW_PRE)) {
@@ -1209,7 +2607,9 @@ static int bftw_stream(const struct bftw_args *args) {
 				goto done;
 			}
 		}
-		bftw_batch_finish(&state);
+		if (bftw_batch_finish(&state) != 0) {
+			goto done;
+		}
 
 		if (bftw_closedir(&state, BFTW_VISIT_ALL) == BFTW_STOP) {
 			goto done;
@@ -1226,9 +2626,9 @@ done:
 /**
  * Batching mode: queue up all children before visiting them.
  */
-static int bftw_batch(const struct bftw_args *args) {
+static int bftw_batch(const struct bftw_args *args, struct bftw_listings *listings) {
 	struct bftw_state state;
-	if (bftw_state_init(&state, args) != 0) {
+	if (bftw_state_init(&state, args, listings) != 0) {
 		return -1;
 	}
 
@@ -1238,7 +2638,9 @@ static int bftw_batch(const struct bftw_args *args) {
 			goto done;
 		}
 	}
-	bftw_batch_finish(&state);
+	if (bftw_batch_finish(&state) != 0) {
+		goto done;
+	}
 
 	while (bftw_pop(&state) > 0) {
 		enum bftw_gc_flags gcflags = BFTW_VISIT_ALL;
@@ -1261,7 +2663,9 @@ static int bftw_batch(const struct bftw_args *args) {
 				goto done;
 			}
 		}
-		bftw_batch_finish(&state);
+		if (bftw_batch_finish(&state) != 0) {
+			goto done;
+		}
 
 		if (bftw_closedir(&state, gcflags) == BFTW_STOP) {
 			goto done;
@@ -1278,11 +2682,11 @@ done:
 }
 
 /** Select bftw_stream() or bftw_batch() appropriately. */
-static int bftw_auto(const struct bftw_args *args) {
+static int bftw_auto(const struct bftw_args *args, struct bftw_listings *listings) {
 	if (args->flags & (BFTW_SORT | BFTW_BUFFER)) {
-		return bftw_batch(args);
+		return bftw_batch(args, listings);
 	} else {
-		return bftw_stream(args);
+		return bftw_stream(args, listings);
 	}
 }
 
@@ -1304,6 +2708,8 @@ struct bftw_ids_state {
 	size_t max_depth;
 	/** The set of pruned paths. */
 	struct trie pruned;
+	/** Directory listings saved from earlier walks. */
+	struct bftw_listings listings;
 	/** An error code to report. */
 	int error;
 	/** Whether the bottom has been found. */
@@ -1379,6 +2785,7 @@ static void bftw_ids_init(const struct bftw_args *args, struct bftw_ids_state *s
 	state->min_depth = 0;
 	state->max_depth = 1;
 	trie_init(&state->pruned);
+	bftw_listings_init(&state->listings);
 	state->error = 0;
 	state->bottom = false;
 	state->quit = false;
@@ -1386,6 +2793,8 @@ static void bftw_ids_init(const struct bftw_args *args, struct bftw_ids_state *s
 	*ids_args = *args;
 	ids_args->callback = bftw_ids_callback;
 	ids_args->ptr = state;
+	// Files are visited multiple times, so the delegate must see them all
+	ids_args->batch_callback = NULL;
 	ids_args->flags &= ~BFTW_POST_ORDER;
 	ids_args->strategy = BFTW_DFS;
 }
@@ -1401,6 +2810,7 @@ static int bftw_ids_finish(struct bftw_ids_state *state) {
 	}
 
 	trie_destroy(&state->pruned);
+	bftw_listings_destroy(&state->listings);
 
 	errno = state->error;
 	return ret;
@@ -1417,7 +2827,7 @@ static int bftw_ids(const struct bftw_args *args) {
 	while (!state.quit && !state.bottom) {
 		state.bottom = true;
 
-		if (bftw_auto(&ids_args) != 0) {
+		if (bftw_auto(&ids_args, &state.listings) != 0) {
 			state.error = errno;
 			state.quit = true;
 		}
@@ -1434,7 +2844,7 @@ static int bftw_ids(const struct bftw_args *args) {
 			--state.max_depth;
 			--state.min_depth;
 
-			if (bftw_auto(&ids_args) != 0) {
+			if (bftw_auto(&ids_args, &state.listings) != 0) {
 				state.error = errno;
 				state.quit = true;
 			}
@@ -1455,7 +2865,7 @@ static int bftw_eds(const struct bftw_args *args) {
 	while (!state.quit && !state.bottom) {
 		state.bottom = true;
 
-		if (bftw_auto(&ids_args) != 0) {
+		if (bftw_auto(&ids_args, &state.listings) != 0) {
 			state.error = errno;
 			state.quit = true;
 		}
@@ -1469,7 +2879,7 @@ static int bftw_eds(const struct bftw_args *args) {
 		state.min_depth = 0;
 		ids_args.flags |= BFTW_POST_ORDER;
 
-		if (bftw_auto(&ids_args) != 0) {
+		if (bftw_auto(&ids_args, &state.listings) != 0) {
 			state.error = errno;
 		}
 	}
@@ -1480,9 +2890,9 @@ static int bftw_eds(const struct bftw_args *args) {
 int bftw(const struct bftw_args *args) {
 	switch (args->strategy) {
 	case BFTW_BFS:
-		return bftw_auto(args);
+		return bftw_auto(args, NULL);
 	case BFTW_DFS:
-		return bftw_batch(args);
+		return bftw_batch(args, NULL);
 	case BFTW_IDS:
 		return bftw_ids(args);
 	case BFTW_EDS:
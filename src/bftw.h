@@ -22,8 +22,12 @@
 #define BFS_BFTW_H
 
 #include "dir.h"
+#include "snapshot.h"
 #include "stat.h"
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /**
  * Possible visit occurrences.
@@ -45,6 +49,38 @@ struct bftw_stat {
 	struct bfs_stat storage;
 	/** The cached error code, if any. */
 	int error;
+	/** The fields that were asked for when the buffer was filled. */
+	enum bfs_stat_field fields;
+};
+
+/**
+ * Cached extended attribute names for a file (see fsade.h).
+ */
+struct bftw_xattrs {
+	/** Whether the names have been listed yet. */
+	bool listed;
+	/** The cached error code, if listing failed. */
+	int error;
+	/** The NUL-separated list of names. */
+	char *names;
+	/** The length of the list. */
+	size_t len;
+	/** The capacity of the names buffer, which is reused between files. */
+	size_t capacity;
+};
+
+/**
+ * A cached symbolic link target.
+ */
+struct bftw_link {
+	/** Whether the link has been read yet. */
+	bool read;
+	/** The cached error code, if reading failed. */
+	int error;
+	/** The link target. */
+	char *target;
+	/** The capacity of the target buffer, which is reused between files. */
+	size_t capacity;
 };
 
 /**
@@ -75,15 +111,28 @@ struct BFTW {
 
 	/** Flags for bfs_stat(). */
 	enum bfs_stat_flags stat_flags;
+	/** The bfs_stat() fields that bftw_stat() will ask for. */
+	enum bfs_stat_field stat_fields;
 	/** Cached bfs_stat() info for BFS_STAT_NOFOLLOW. */
 	struct bftw_stat lstat_cache;
 	/** Cached bfs_stat() info for BFS_STAT_FOLLOW. */
 	struct bftw_stat stat_cache;
+	/** Cached extended attribute names. */
+	struct bftw_xattrs xattrs;
+	/** Cached symbolic link target. */
+	struct bftw_link link;
+
+	/**
+	 * The number of entries bftw() read from this directory, for post-order
+	 * visits of directories that were read to the end.  Otherwise SIZE_MAX.
+	 */
+	size_t nentries;
 };
 
 /**
  * Get bfs_stat() info for a file encountered during bftw(), caching the result
- * whenever possible.
+ * whenever possible.  At least the fields in ftwbuf->stat_fields are asked
+ * for; the cached info is only refreshed if it was filled with fewer fields.
  *
  * @param ftwbuf
  *         bftw() data for the file to stat.
@@ -121,6 +170,18 @@ const struct bfs_stat *bftw_cached_stat(const struct BFTW *ftwbuf, enum bfs_stat
  */
 enum bfs_type bftw_type(const struct BFTW *ftwbuf, enum bfs_stat_flags flags);
 
+/**
+ * Read the target of a symbolic link encountered during bftw(), caching the
+ * result.
+ *
+ * @param ftwbuf
+ *         bftw() data for the link to read.
+ * @return
+ *         The link target, valid until the next file is visited, or NULL on
+ *         failure.
+ */
+const char *bftw_readlink(const struct BFTW *ftwbuf);
+
 /**
  * Walk actions returned by the bftw() callback.
  */
@@ -145,6 +206,38 @@ enum bftw_action {
  */
 typedef enum bftw_action bftw_callback(const struct BFTW *ftwbuf, void *ptr);
 
+/**
+ * A batch of entries from the same directory.
+ */
+struct bftw_batch {
+	/** The root path the entries were found under. */
+	const char *root;
+	/** The depth of the entries in the traversal. */
+	size_t depth;
+	/** A file descriptor for the parent directory, or -1 if it isn't open. */
+	int at_fd;
+	/** The entries themselves. */
+	const struct bfs_dirent *entries;
+	/** The number of entries. */
+	size_t count;
+};
+
+/**
+ * Callback function type for screening a whole batch of directory entries
+ * before they are visited.
+ *
+ * @param batch
+ *         The entries to screen.
+ * @param[out] skip
+ *         An array of batch->count flags, initially false.  Setting skip[i]
+ *         means the regular callback would do nothing for entry i, so bftw()
+ *         may skip visiting it.  The flag is ignored for entries that bftw()
+ *         might descend into.
+ * @param ptr
+ *         The pointer passed to bftw().
+ */
+typedef void bftw_batch_callback(const struct bftw_batch *batch, bool *skip, void *ptr);
+
 /**
  * Flags that control bftw() behavior.
  */
@@ -169,6 +262,10 @@ enum bftw_flags {
 	BFTW_SORT          = 1 << 8,
 	/** Read each directory into memory before processing its children. */
 	BFTW_BUFFER        = 1 << 9,
+	/** stat() files ahead of time in the background, if possible. */
+	BFTW_PREFETCH_STAT = 1 << 10,
+	/** Only use snapshot records for directories that haven't changed. */
+	BFTW_SNAPSHOT_CHECK = 1 << 11,
 };
 
 /**
@@ -185,6 +282,42 @@ enum bftw_strategy {
 	BFTW_EDS,
 };
 
+/**
+ * Statistics collected by bftw(), for debugging.
+ */
+struct bftw_stats {
+	/** The number of walks (more than one for iterative deepening). */
+	size_t nwalks;
+	/** The peak number of queued or open files. */
+	size_t peak_files;
+	/** The peak number of bytes allocated for those files. */
+	size_t peak_bytes;
+	/** The number of times a needed directory was already open. */
+	size_t cache_hits;
+	/** The number of times a needed directory had to be opened. */
+	size_t cache_misses;
+	/** The number of directories actually opened. */
+	size_t cache_opens;
+	/** The number of opens that re-traversed a path because a directory had been closed to save fds. */
+	size_t cache_reopens;
+	/** The number of directories closed to save fds. */
+	size_t cache_evictions;
+	/** The number of directory listings replayed from memory instead of read again. */
+	size_t listing_hits;
+};
+
+/**
+ * Progress counters kept up to date by bftw(), which other threads may read.
+ */
+struct bftw_progress {
+	/** The number of directories opened. */
+	atomic_size_t dirs;
+	/** The number of directory entries read. */
+	atomic_size_t entries;
+	/** The number of files in the queue, as of the last directory opened. */
+	atomic_size_t queued;
+};
+
 /**
  * Structure for holding the arguments passed to bftw().
  */
@@ -195,16 +328,32 @@ struct bftw_args {
 	size_t npaths;
 	/** The callback to invoke. */
 	bftw_callback *callback;
-	/** A pointer which is passed to the callback. */
+	/** A callback to screen batches of directory entries with, or NULL. */
+	bftw_batch_callback *batch_callback;
+	/** A pointer which is passed to the callbacks. */
 	void *ptr;
 	/** The maximum number of file descriptors to keep open. */
 	int nopenfd;
+	/** The number of background threads to open directories with. */
+	size_t nthreads;
 	/** Flags that control bftw() behaviour. */
 	enum bftw_flags flags;
 	/** The search strategy to use. */
 	enum bftw_strategy strategy;
+	/** The bfs_stat() fields the callback needs (0 for all of them). */
+	enum bfs_stat_field stat_fields;
+	/** Switch to depth-first order when this many files are queued (0 for no limit). */
+	size_t queue_limit;
 	/** The parsed mount table, if available. */
 	const struct bfs_mtab *mtab;
+	/** Where to accumulate statistics, or NULL. */
+	struct bftw_stats *stats;
+	/** Counters to publish progress to, or NULL. */
+	struct bftw_progress *progress;
+	/** A snapshot to read directories from instead of the file system, or NULL. */
+	const struct bfs_snap *snapshot;
+	/** A snapshot to record the directories that are read into, or NULL. */
+	struct bfs_snap_writer *record;
 };
 
 /**
@@ -16,6 +16,7 @@
 
 #include "color.h"
 #include "bftw.h"
+#include "darray.h"
 #include "dir.h"
 #include "dstring.h"
 #include "expr.h"
@@ -23,6 +24,7 @@
 #include "stat.h"
 #include "trie.h"
 #include "util.h"
+#include "writer.h"
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -34,6 +36,20 @@
 #include <time.h>
 #include <unistd.h>
 
+/**
+ * A color for a file extension.
+ */
+struct ext_color {
+	/** The transformed extension (see extxfrm()), or NULL if overridden. */
+	char *ext;
+	/** The length of the extension. */
+	size_t len;
+	/** The hash of the transformed extension. */
+	size_t hash;
+	/** The color itself. */
+	char *color;
+};
+
 struct colors {
 	char *reset;
 	char *leftcode;
@@ -82,8 +98,19 @@ struct colors {
 	/** A mapping from color names (fi, di, ln, etc.) to struct fields. */
 	struct trie names;
 
-	/** A mapping from file extensions to colors. */
-	struct trie ext_colors;
+	/** The extension colors, in the order they were defined (a darray). */
+	struct ext_color *ext_list;
+	/** A hash table of extension colors, keyed by transformed extension. */
+	struct ext_color **ext_table;
+	/** The size of ext_table, minus one. */
+	size_t ext_mask;
+	/** The distinct lengths of the extensions, in ascending order (a darray). */
+	size_t *ext_lens;
+
+	/** Whether regular files need to be stat()ed to pick their color. */
+	bool reg_needs_stat;
+	/** Whether directories need to be stat()ed to pick their color. */
+	bool dir_needs_stat;
 };
 
 /** Initialize a color in the table. */
@@ -128,70 +155,184 @@ static int set_color(struct colors *colors, const char *name, char *value) {
 	}
 }
 
+/**
+ * Lowercase an ASCII character.
+ *
+ * What's internationalization?  Doesn't matter, this is what GNU ls does.
+ * Luckily, since there's no standard C way to casefold.  Not using tolower()
+ * here since it respects the current locale, which GNU ls doesn't do.
+ */
+static char ext_lower(char c) {
+	if (c >= 'A' && c <= 'Z') {
+		c += 'a' - 'A';
+	}
+	return c;
+}
+
+/** The initial value of an extension hash (32-bit FNV-1a). */
+#define EXT_HASH_INIT ((size_t)2166136261U)
+
+/** Add one transformed byte to an extension hash. */
+static size_t ext_hash(size_t hash, char c) {
+	return (hash ^ (unsigned char)c) * 16777619U;
+}
+
 /**
  * Transform a file extension for fast lookups, by reversing and lowercasing it.
  */
 static void extxfrm(char *ext) {
 	size_t len = strlen(ext);
 	for (size_t i = 0; i < len - i; ++i) {
-		char a = ext[i];
-		char b = ext[len - i - 1];
-
-		// What's internationalization?  Doesn't matter, this is what
-		// GNU ls does.  Luckily, since there's no standard C way to
-		// casefold.  Not using tolower() here since it respects the
-		// current locale, which GNU ls doesn't do.
-		if (a >= 'A' && a <= 'Z') {
-			a += 'a' - 'A';
-		}
-		if (b >= 'A' && b <= 'Z') {
-			b += 'a' - 'A';
-		}
-
+		char a = ext_lower(ext[i]);
+		char b = ext_lower(ext[len - i - 1]);
 		ext[i] = b;
 		ext[len - i - 1] = a;
 	}
 }
 
 /**
- * Set the color for an extension.
+ * Set the color for an extension.  Takes ownership of the key and value on
+ * success.
  */
-static int set_ext_color(struct colors *colors, char *key, const char *value) {
+static int set_ext_color(struct colors *colors, char *key, char *value) {
 	extxfrm(key);
+	size_t len = strlen(key);
 
 	// A later *.x should override any earlier *.x, *.y.x, etc.
-	struct trie_leaf *match;
-	while ((match = trie_find_postfix(&colors->ext_colors, key))) {
-		dstrfree(match->value);
-		trie_remove(&colors->ext_colors, match);
+	for (size_t i = 0; i < darray_length(colors->ext_list); ++i) {
+		struct ext_color *ext = &colors->ext_list[i];
+		if (ext->ext && ext->len >= len && memcmp(ext->ext, key, len) == 0) {
+			dstrfree(ext->color);
+			dstrfree(ext->ext);
+			ext->ext = NULL;
+		}
 	}
 
-	struct trie_leaf *leaf = trie_insert_str(&colors->ext_colors, key);
-	if (leaf) {
-		leaf->value = (char *)value;
+	size_t hash = EXT_HASH_INIT;
+	for (size_t i = 0; i < len; ++i) {
+		hash = ext_hash(hash, key[i]);
+	}
+
+	struct ext_color ext = {
+		.ext = key,
+		.len = len,
+		.hash = hash,
+		.color = value,
+	};
+	return DARRAY_PUSH(&colors->ext_list, &ext);
+}
+
+/** qsort() callback for sorting extension lengths. */
+static int ext_len_cmp(const void *a, const void *b) {
+	size_t x = *(const size_t *)a;
+	size_t y = *(const size_t *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Build the extension hash table, once all the colors are known.
+ */
+static int compile_ext_colors(struct colors *colors) {
+	size_t count = 0;
+	for (size_t i = 0; i < darray_length(colors->ext_list); ++i) {
+		struct ext_color *ext = &colors->ext_list[i];
+		if (!ext->ext) {
+			continue;
+		}
+		++count;
+
+		bool found = false;
+		for (size_t j = 0; j < darray_length(colors->ext_lens); ++j) {
+			if (colors->ext_lens[j] == ext->len) {
+				found = true;
+				break;
+			}
+		}
+		if (!found && DARRAY_PUSH(&colors->ext_lens, &ext->len) != 0) {
+			return -1;
+		}
+	}
+
+	if (count == 0) {
 		return 0;
-	} else {
+	}
+
+	qsort(colors->ext_lens, darray_length(colors->ext_lens), sizeof(size_t), ext_len_cmp);
+
+	// Keep the load factor at or below 1/2
+	size_t size = 1;
+	while (size < 2*count) {
+		size *= 2;
+	}
+
+	colors->ext_table = calloc(size, sizeof(*colors->ext_table));
+	if (!colors->ext_table) {
 		return -1;
 	}
+	colors->ext_mask = size - 1;
+
+	for (size_t i = 0; i < darray_length(colors->ext_list); ++i) {
+		struct ext_color *ext = &colors->ext_list[i];
+		if (ext->ext) {
+			size_t j = ext->hash & colors->ext_mask;
+			while (colors->ext_table[j]) {
+				j = (j + 1) & colors->ext_mask;
+			}
+			colors->ext_table[j] = ext;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Check if an extension matches the end of a filename, without transforming the
+ * filename.
+ */
+static bool ext_matches(const struct ext_color *ext, const char *suffix) {
+	for (size_t i = 0; i < ext->len; ++i) {
+		if (ext->ext[i] != ext_lower(suffix[ext->len - i - 1])) {
+			return false;
+		}
+	}
+	return true;
 }
 
 /**
  * Find a color by an extension.
  */
 static const char *get_ext_color(const struct colors *colors, const char *filename) {
-	char *xfrm = strdup(filename);
-	if (!xfrm) {
+	if (!colors->ext_table) {
 		return NULL;
 	}
-	extxfrm(xfrm);
 
-	const struct trie_leaf *leaf = trie_find_prefix(&colors->ext_colors, xfrm);
-	free(xfrm);
-	if (leaf) {
-		return leaf->value;
-	} else {
-		return NULL;
+	size_t namelen = strlen(filename);
+
+	// Hash the reversed filename incrementally, probing at each length that
+	// some extension has, so the longest match wins
+	const char *color = NULL;
+	size_t hash = EXT_HASH_INIT;
+	size_t hashed = 0;
+	for (size_t i = 0; i < darray_length(colors->ext_lens); ++i) {
+		size_t len = colors->ext_lens[i];
+		if (len > namelen) {
+			break;
+		}
+
+		for (; hashed < len; ++hashed) {
+			hash = ext_hash(hash, ext_lower(filename[namelen - hashed - 1]));
+		}
+
+		for (size_t j = hash & colors->ext_mask; colors->ext_table[j]; j = (j + 1) & colors->ext_mask) {
+			const struct ext_color *ext = colors->ext_table[j];
+			if (ext->hash == hash && ext->len == len && ext_matches(ext, filename + namelen - len)) {
+				color = ext->color;
+				break;
+			}
+		}
 	}
+
+	return color;
 }
 
 /**
@@ -365,13 +506,10 @@ static void parse_gnu_ls_colors(struct colors *colors, const char *ls_colors) {
 			}
 
 			char *value = unescape(next, ':', &next);
-			if (value) {
-				if (set_ext_color(colors, key, value) != 0) {
-					dstrfree(value);
-				}
+			if (!value || set_ext_color(colors, key, value) != 0) {
+				dstrfree(value);
+				dstrfree(key);
 			}
-
-			dstrfree(key);
 		} else {
 			const char *equals = strchr(chunk, '=');
 			if (!equals) {
@@ -421,7 +559,10 @@ struct colors *parse_colors() {
 	}
 
 	trie_init(&colors->names);
-	trie_init(&colors->ext_colors);
+	colors->ext_list = NULL;
+	colors->ext_table = NULL;
+	colors->ext_mask = 0;
+	colors->ext_lens = NULL;
 
 	int ret = 0;
 
@@ -481,18 +622,31 @@ struct colors *parse_colors() {
 	parse_gnu_ls_colors(colors, getenv("LS_COLORS"));
 	parse_gnu_ls_colors(colors, getenv("BFS_COLORS"));
 
+	if (compile_ext_colors(colors) != 0) {
+		free_colors(colors);
+		return NULL;
+	}
+
+	colors->reg_needs_stat = colors->setuid || colors->setgid || colors->executable || colors->multi_hard;
+	colors->dir_needs_stat = colors->sticky_other_writable || colors->other_writable || colors->sticky;
+
 	return colors;
 }
 
 void free_colors(struct colors *colors) {
 	if (colors) {
-		struct trie_leaf *leaf;
-		while ((leaf = trie_first_leaf(&colors->ext_colors))) {
-			dstrfree(leaf->value);
-			trie_remove(&colors->ext_colors, leaf);
+		for (size_t i = 0; i < darray_length(colors->ext_list); ++i) {
+			struct ext_color *ext = &colors->ext_list[i];
+			if (ext->ext) {
+				dstrfree(ext->color);
+				dstrfree(ext->ext);
+			}
 		}
-		trie_destroy(&colors->ext_colors);
+		darray_free(colors->ext_list);
+		darray_free(colors->ext_lens);
+		free(colors->ext_table);
 
+		struct trie_leaf *leaf;
 		while ((leaf = trie_first_leaf(&colors->names))) {
 			char **field = leaf->value;
 			dstrfree(*field);
@@ -517,6 +671,7 @@ CFILE *cfwrap(FILE *file, const struct colors *colors, bool close) {
 	}
 
 	cfile->file = file;
+	cfile->writer = NULL;
 	cfile->close = close;
 
 	if (isatty(fileno(file))) {
@@ -528,6 +683,14 @@ CFILE *cfwrap(FILE *file, const struct colors *colors, bool close) {
 	return cfile;
 }
 
+int cfileno(const CFILE *cfile) {
+	if (cfile->writer) {
+		return bfs_writer_fd(cfile->writer);
+	} else {
+		return fileno(cfile->file);
+	}
+}
+
 int cfclose(CFILE *cfile) {
 	int ret = 0;
 
@@ -547,7 +710,8 @@ int cfclose(CFILE *cfile) {
 /** Check if a symlink is broken. */
 static bool is_link_broken(const struct BFTW *ftwbuf) {
 	if (ftwbuf->stat_flags & BFS_STAT_NOFOLLOW) {
-		return xfaccessat(ftwbuf->at_fd, ftwbuf->at_path, F_OK) != 0;
+		// Go through the stat() cache, so the rest of the visit can share it
+		return !bftw_stat(ftwbuf, BFS_STAT_FOLLOW);
 	} else {
 		return true;
 	}
@@ -565,7 +729,7 @@ static const char *file_color(const struct colors *colors, const char *filename,
 
 	switch (type) {
 	case BFS_REG:
-		if (colors->setuid || colors->setgid || colors->executable || colors->multi_hard) {
+		if (colors->reg_needs_stat) {
 			statbuf = bftw_stat(ftwbuf, flags);
 			if (!statbuf) {
 				goto error;
@@ -595,7 +759,7 @@ static const char *file_color(const struct colors *colors, const char *filename,
 		break;
 
 	case BFS_DIR:
-		if (colors->sticky_other_writable || colors->other_writable || colors->sticky) {
+		if (colors->dir_needs_stat) {
 			statbuf = bftw_stat(ftwbuf, flags);
 			if (!statbuf) {
 				goto error;
@@ -847,29 +1011,18 @@ static int print_path(CFILE *cfile, const struct BFTW *ftwbuf) {
 
 /** Print a link target with the appropriate colors. */
 static int print_link_target(CFILE *cfile, const struct BFTW *ftwbuf) {
-	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
-	size_t len = statbuf ? statbuf->size : 0;
-
-	char *target = xreadlinkat(ftwbuf->at_fd, ftwbuf->at_path, len);
+	const char *target = bftw_readlink(ftwbuf);
 	if (!target) {
 		return -1;
 	}
 
-	int ret;
 	if (cfile->colors) {
-		ret = print_path_colored(cfile, target, ftwbuf, BFS_STAT_FOLLOW);
+		return print_path_colored(cfile, target, ftwbuf, BFS_STAT_FOLLOW);
 	} else {
-		ret = dstrcat(&cfile->buffer, target);
+		return dstrcat(&cfile->buffer, target);
 	}
-
-	free(target);
-	return ret;
 }
 
-/** Format some colored output to the buffer. */
-BFS_FORMATTER(2, 3)
-static int cbuff(CFILE *cfile, const char *format, ...);
-
 /** Dump a parsed expression tree, for debugging. */
 static int print_expr(CFILE *cfile, const struct bfs_expr *expr, bool verbose) {
 	if (dstrcat(&cfile->buffer, "(") != 0) {
@@ -973,6 +1126,16 @@ static int cvbuff(CFILE *cfile, const char *format, va_list args) {
 				}
 				break;
 
+			case 'l':
+				if (i[1] != 'l' || i[2] != 'd') {
+					goto invalid;
+				}
+				i += 2;
+				if (dstrcatf(&cfile->buffer, "%lld", va_arg(args, long long)) != 0) {
+					return -1;
+				}
+				break;
+
 			case 's':
 				if (dstrcat(&cfile->buffer, va_arg(args, const char *)) != 0) {
 					return -1;
@@ -1093,7 +1256,7 @@ invalid:
 	return -1;
 }
 
-static int cbuff(CFILE *cfile, const char *format, ...) {
+int cbuff(CFILE *cfile, const char *format, ...) {
 	va_list args;
 	va_start(args, format);
 	int ret = cvbuff(cfile, format, args);
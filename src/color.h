@@ -26,6 +26,8 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+struct bfs_writer;
+
 /**
  * A color scheme.
  */
@@ -56,6 +58,8 @@ typedef struct CFILE {
 	const struct colors *colors;
 	/** A buffer for colored formatting. */
 	char *buffer;
+	/** The background writer behind the stream, if any. */
+	struct bfs_writer *writer;
 	/** Whether to close the underlying stream. */
 	bool close;
 } CFILE;
@@ -74,6 +78,11 @@ typedef struct CFILE {
  */
 CFILE *cfwrap(FILE *file, const struct colors *colors, bool close);
 
+/**
+ * Get the file descriptor that a colored file writes to.
+ */
+int cfileno(const CFILE *cfile);
+
 /**
  * Close a colored file.
  *
@@ -95,6 +104,7 @@ int cfclose(CFILE *cfile);
  *         %c: A single character
  *         %d: An integer
  *         %g: A double
+ *         %lld: A long long
  *         %s: A string
  *         %zu: A size_t
  *         %m: strerror(errno)
@@ -112,6 +122,12 @@ int cfclose(CFILE *cfile);
 BFS_FORMATTER(2, 3)
 int cfprintf(CFILE *cfile, const char *format, ...);
 
+/**
+ * Like cfprintf(), but append the output to cfile->buffer without writing it.
+ */
+BFS_FORMATTER(2, 3)
+int cbuff(CFILE *cfile, const char *format, ...);
+
 /**
  * cfprintf() variant that takes a va_list.
  */
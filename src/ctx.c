@@ -18,16 +18,22 @@
 #include "color.h"
 #include "darray.h"
 #include "diag.h"
+#include "dir.h"
 #include "expr.h"
 #include "mtab.h"
+#include "opt.h"
 #include "pwcache.h"
+#include "snapshot.h"
 #include "stat.h"
 #include "trie.h"
+#include "writer.h"
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 const char *debug_flag_name(enum debug_flags flag) {
 	switch (flag) {
@@ -45,6 +51,10 @@ const char *debug_flag_name(enum debug_flags flag) {
 		return "stat";
 	case DEBUG_TREE:
 		return "tree";
+	case DEBUG_PROF:
+		return "prof";
+	case DEBUG_STARTUP:
+		return "startup";
 
 	case DEBUG_ALL:
 		break;
@@ -66,11 +76,30 @@ struct bfs_ctx *bfs_ctx_new(void) {
 	ctx->exclude = NULL;
 
 	ctx->mindepth = 0;
+	ctx->queue_limit = 0;
+	ctx->limit = 0;
+	ctx->top = 0;
+	ctx->top_field = BFS_STAT_SIZE;
+	ctx->readdir_min = BFS_DIR_BUF_MIN >> 10;
+	ctx->readdir_max = BFS_DIR_BUF_MAX >> 10;
+	ctx->nsummary_fields = 0;
+	ctx->summary_depth = -1;
 	ctx->maxdepth = INT_MAX;
 	ctx->flags = BFTW_RECOVER;
 	ctx->strategy = BFTW_BFS;
+	ctx->stat_fields = BFS_STAT_ALL;
+	ctx->nmemo = 0;
+	ctx->dir_mtime_min = LLONG_MIN;
 	ctx->optlevel = 3;
+	ctx->threads = 0;
+	ctx->exec_jobs = 1;
+	ctx->delete_jobs = 1;
+	ctx->root_jobs = 1;
+	ctx->shard_index = 0;
+	ctx->shard_count = 1;
+	ctx->shard_depth = 1;
 	ctx->debug = 0;
+	ctx->assume_dir_mtime = false;
 	ctx->ignore_races = false;
 	ctx->posixly_correct = false;
 	ctx->status = false;
@@ -91,6 +120,14 @@ struct bfs_ctx *bfs_ctx_new(void) {
 	ctx->mtab = NULL;
 	ctx->mtab_error = 0;
 
+	ctx->snapshot_path = NULL;
+	ctx->snapshot = NULL;
+	ctx->snapshot_save_path = NULL;
+	ctx->snapshot_save = NULL;
+
+	ctx->opt_profile_path = NULL;
+	ctx->opt_profile = NULL;
+
 	trie_init(&ctx->files);
 	ctx->nfiles = 0;
 
@@ -106,13 +143,28 @@ struct bfs_ctx *bfs_ctx_new(void) {
 	return ctx;
 }
 
+const struct colors *bfs_ctx_colors(const struct bfs_ctx *ctx) {
+	struct bfs_ctx *mut = (struct bfs_ctx *)ctx;
+
+	if (mut->colors_error) {
+		errno = mut->colors_error;
+	} else if (!mut->colors) {
+		mut->colors = parse_colors();
+		if (!mut->colors) {
+			mut->colors_error = errno;
+		}
+	}
+
+	return mut->colors;
+}
+
 const struct bfs_users *bfs_ctx_users(const struct bfs_ctx *ctx) {
 	struct bfs_ctx *mut = (struct bfs_ctx *)ctx;
 
 	if (mut->users_error) {
 		errno = mut->users_error;
 	} else if (!mut->users) {
-		mut->users = bfs_users_parse();
+		mut->users = bfs_users_new();
 		if (!mut->users) {
 			mut->users_error = errno;
 		}
@@ -127,7 +179,7 @@ const struct bfs_groups *bfs_ctx_groups(const struct bfs_ctx *ctx) {
 	if (mut->groups_error) {
 		errno = mut->groups_error;
 	} else if (!mut->groups) {
-		mut->groups = bfs_groups_parse();
+		mut->groups = bfs_groups_new();
 		if (!mut->groups) {
 			mut->groups_error = errno;
 		}
@@ -163,7 +215,7 @@ struct bfs_ctx_file {
 
 CFILE *bfs_ctx_dedup(struct bfs_ctx *ctx, CFILE *cfile, const char *path) {
 	struct bfs_stat sb;
-	if (bfs_stat(fileno(cfile->file), NULL, 0, &sb) != 0) {
+	if (bfs_stat(cfileno(cfile), NULL, 0, &sb) != 0) {
 		return NULL;
 	}
 
@@ -206,6 +258,40 @@ void bfs_ctx_flush(const struct bfs_ctx *ctx) {
 	// We do not check errors here, but they will be caught at cleanup time
 	// with ferror().
 	fflush(NULL);
+
+	// Output handed off to a background writer has to actually reach the
+	// file before anything else runs
+	if (ctx->cout->writer) {
+		bfs_writer_drain(ctx->cout->writer);
+	}
+}
+
+void bfs_ctx_start_writer(const struct bfs_ctx *ctx) {
+	CFILE *cout = ctx->cout;
+	if (cout->writer || cout->file != stdout || isatty(STDOUT_FILENO)) {
+		return;
+	}
+
+	struct bfs_stat sb;
+	if (bfs_stat(STDOUT_FILENO, NULL, 0, &sb) != 0) {
+		return;
+	}
+	if (!S_ISFIFO(sb.mode) && !S_ISSOCK(sb.mode)) {
+		return;
+	}
+
+	// Anything already buffered has to come out first
+	if (fflush(stdout) != 0) {
+		return;
+	}
+
+	// If the writer can't be started, just keep using stdout
+	struct bfs_writer *writer = bfs_writer_open(STDOUT_FILENO, false);
+	if (writer) {
+		cout->file = bfs_writer_file(writer);
+		cout->writer = writer;
+		cout->close = true;
+	}
 }
 
 /** Flush a file and report any errors. */
@@ -219,6 +305,10 @@ static int bfs_ctx_fflush(CFILE *cfile) {
 		ret = -1;
 		error = errno;
 	}
+	if (cfile->writer && bfs_writer_drain(cfile->writer) != 0) {
+		ret = -1;
+		error = errno;
+	}
 
 	errno = error;
 	return ret;
@@ -267,6 +357,11 @@ int bfs_ctx_free(struct bfs_ctx *ctx) {
 
 		bfs_mtab_free(ctx->mtab);
 
+		bfs_snap_close(ctx->snapshot);
+		bfs_snap_free(ctx->snapshot_save);
+
+		bfs_opt_profile_free(ctx->opt_profile);
+
 		bfs_groups_free(ctx->groups);
 		bfs_users_free(ctx->users);
 
@@ -31,21 +31,25 @@
  */
 enum debug_flags {
 	/** Print cost estimates. */
-	DEBUG_COST   = 1 << 0,
+	DEBUG_COST    = 1 << 0,
 	/** Print executed command details. */
-	DEBUG_EXEC   = 1 << 1,
+	DEBUG_EXEC    = 1 << 1,
 	/** Print optimization details. */
-	DEBUG_OPT    = 1 << 2,
+	DEBUG_OPT     = 1 << 2,
 	/** Print rate information. */
-	DEBUG_RATES  = 1 << 3,
+	DEBUG_RATES   = 1 << 3,
 	/** Trace the filesystem traversal. */
-	DEBUG_SEARCH = 1 << 4,
+	DEBUG_SEARCH  = 1 << 4,
 	/** Trace all stat() calls. */
-	DEBUG_STAT   = 1 << 5,
+	DEBUG_STAT    = 1 << 5,
 	/** Print the parse tree. */
-	DEBUG_TREE   = 1 << 6,
+	DEBUG_TREE    = 1 << 6,
+	/** Print a profiling report. */
+	DEBUG_PROF    = 1 << 7,
+	/** Print startup timing. */
+	DEBUG_STARTUP = 1 << 8,
 	/** All debug flags. */
-	DEBUG_ALL    = (1 << 7) - 1,
+	DEBUG_ALL     = (1 << 9) - 1,
 };
 
 /**
@@ -53,6 +57,20 @@ enum debug_flags {
  */
 const char *debug_flag_name(enum debug_flags flag);
 
+/**
+ * The totals that -summarize can print.
+ */
+enum bfs_summary_field {
+	/** The total size in bytes. */
+	BFS_SUMMARY_SIZE,
+	/** The number of files. */
+	BFS_SUMMARY_COUNT,
+	/** The disk usage in 512-byte blocks. */
+	BFS_SUMMARY_BLOCKS,
+	/** The number of summary fields. */
+	BFS_SUMMARY_MAX,
+};
+
 /**
  * The execution context for bfs.
  */
@@ -73,16 +91,56 @@ struct bfs_ctx {
 	int mindepth;
 	/** -maxdepth option. */
 	int maxdepth;
+	/** -queue-limit option. */
+	int queue_limit;
+	/** Stop after this many files match (-limit), or 0 for no limit. */
+	int limit;
+	/** Only output the files with the largest -by keys (-top), or 0 for all. */
+	int top;
+	/** The field to rank the -top files by (-by). */
+	enum bfs_stat_field top_field;
+	/** The smallest directory read buffer, in KiB (-readdir-buffer). */
+	int readdir_min;
+	/** The largest directory read buffer, in KiB (-readdir-buffer). */
+	int readdir_max;
+	/** The totals to print for each directory (-summarize). */
+	enum bfs_summary_field summary_fields[BFS_SUMMARY_MAX];
+	/** The number of summary_fields, or 0 without -summarize. */
+	size_t nsummary_fields;
+	/** The deepest directories to print totals for (-summarize-depth), or -1 for all. */
+	int summary_depth;
 
 	/** bftw() flags. */
 	enum bftw_flags flags;
 	/** bftw() search strategy. */
 	enum bftw_strategy strategy;
+	/** The bfs_stat() fields the expression needs (computed by bfs_optimize()). */
+	enum bfs_stat_field stat_fields;
+	/** The number of memoized subexpressions (computed by bfs_optimize()). */
+	size_t nmemo;
+	/** Directories with older mtimes are pruned (computed by bfs_optimize() under -assume-dir-mtime). */
+	long long dir_mtime_min;
 
 	/** Optimization level (-O). */
 	int optlevel;
+	/** The number of background threads for directory I/O (-j). */
+	int threads;
+	/** The number of -exec ... + commands to run at once (-exec-jobs). */
+	int exec_jobs;
+	/** The number of background threads for -delete (-delete-jobs). */
+	int delete_jobs;
+	/** The number of root paths to walk at once (-root-jobs). */
+	int root_jobs;
+	/** Which shard of the search to run, counting from 0 (-shard). */
+	int shard_index;
+	/** The number of shards the search is split into (-shard). */
+	int shard_count;
+	/** The depth at which the search is split into shards (-shard-depth). */
+	int shard_depth;
 	/** Debugging flags (-D). */
 	enum debug_flags debug;
+	/** Whether directory mtimes bound the mtimes beneath them (-assume-dir-mtime). */
+	bool assume_dir_mtime;
 	/** Whether to ignore deletions that race with bfs (-ignore_readdir_race). */
 	bool ignore_races;
 	/** Whether to follow POSIXisms more closely ($POSIXLY_CORRECT). */
@@ -96,7 +154,7 @@ struct bfs_ctx {
 	/** Whether to only handle paths with xargs-safe characters (-X). */
 	bool xargs_safe;
 
-	/** Color data. */
+	/** Color data (see bfs_ctx_colors()). */
 	struct colors *colors;
 	/** The error that occurred parsing the color table, if any. */
 	int colors_error;
@@ -119,6 +177,20 @@ struct bfs_ctx {
 	/** The error that occurred parsing the mount table, if any. */
 	int mtab_error;
 
+	/** The path to the snapshot to read (-snapshot). */
+	const char *snapshot_path;
+	/** The snapshot to read directories from. */
+	struct bfs_snap *snapshot;
+	/** The path to the snapshot to write (-snapshot-save). */
+	const char *snapshot_save_path;
+	/** The snapshot to record directories into. */
+	struct bfs_snap_writer *snapshot_save;
+
+	/** The path to the optimizer profile (-opt-profile). */
+	const char *opt_profile_path;
+	/** The optimizer profile loaded from that path. */
+	struct bfs_opt_profile *opt_profile;
+
 	/** All the files owned by the context. */
 	struct trie files;
 	/** The number of files owned by the context. */
@@ -136,6 +208,16 @@ struct bfs_ctx {
  */
 struct bfs_ctx *bfs_ctx_new(void);
 
+/**
+ * Get the color table.
+ *
+ * @param ctx
+ *         The bfs context.
+ * @return
+ *         The cached color table, or NULL on failure.
+ */
+const struct colors *bfs_ctx_colors(const struct bfs_ctx *ctx);
+
 /**
  * Get the users table.
  *
@@ -189,6 +271,16 @@ struct CFILE *bfs_ctx_dedup(struct bfs_ctx *ctx, struct CFILE *cfile, const char
  */
 void bfs_ctx_flush(const struct bfs_ctx *ctx);
 
+/**
+ * Hand standard output off to a background writer thread if it's a pipe or a
+ * socket, so a slow reader doesn't stall the search.  This starts a thread, so
+ * it must come after any fork() that runs more bfs code in the child.
+ *
+ * @param ctx
+ *         The bfs context.
+ */
+void bfs_ctx_start_writer(const struct bfs_ctx *ctx);
+
 /**
  * Dump the parsed command line.
  *
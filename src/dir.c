@@ -15,11 +15,14 @@
  ****************************************************************************/
 
 #include "dir.h"
+#include "prof.h"
 #include "util.h"
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -90,15 +93,110 @@ struct linux_dirent64 {
 	char d_name[];
 };
 
-// Make the whole allocation 64k
-#define BUF_SIZE ((64 << 10) - 8)
+/** The smallest getdents() buffer that's always big enough for one entry. */
+#define DIR_BUF_FLOOR 1024
+
+/** The range of getdents() buffer sizes (see bfs_dir_bufsize()). */
+static size_t dir_buf_min = BFS_DIR_BUF_MIN;
+static size_t dir_buf_max = BFS_DIR_BUF_MAX;
+
+/** The most free buffers to keep of each size. */
+#define DIR_POOL_DEPTH 8
+/** The number of power-of-two buffer sizes. */
+#define DIR_POOL_CLASSES (sizeof(size_t) * 8)
+
+/**
+ * A pool of free getdents() buffers, shared between all directories (and the
+ * background threads that open them), with a free list for each size.
+ */
+static struct {
+	pthread_mutex_t mutex;
+	void *free[DIR_POOL_CLASSES];
+	size_t count[DIR_POOL_CLASSES];
+} dir_pool = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/** Get the size class of a power-of-two buffer size. */
+static size_t dir_pool_class(size_t size) {
+	size_t class = 0;
+	while (size > 1) {
+		size >>= 1;
+		++class;
+	}
+	return class;
+}
+
+/** Get a buffer of a given size, from the pool if possible. */
+static char *dir_pool_get(size_t size) {
+	size_t class = dir_pool_class(size);
+
+	pthread_mutex_lock(&dir_pool.mutex);
+	void **buf = dir_pool.free[class];
+	if (buf) {
+		dir_pool.free[class] = *buf;
+		--dir_pool.count[class];
+	}
+	pthread_mutex_unlock(&dir_pool.mutex);
+
+	if (!buf) {
+		buf = malloc(size);
+	}
+	return (char *)buf;
+}
+
+/** Return a buffer to the pool. */
+static void dir_pool_put(char *buf, size_t size) {
+	size_t class = dir_pool_class(size);
+
+	pthread_mutex_lock(&dir_pool.mutex);
+	bool kept = dir_pool.count[class] < DIR_POOL_DEPTH;
+	if (kept) {
+		*(void **)buf = dir_pool.free[class];
+		dir_pool.free[class] = buf;
+		++dir_pool.count[class];
+	}
+	pthread_mutex_unlock(&dir_pool.mutex);
+
+	if (!kept) {
+		free(buf);
+	}
+}
+
+/** Round a buffer size up to a power of two, no smaller than DIR_BUF_FLOOR. */
+static size_t dir_buf_round(size_t size) {
+	size_t ret = DIR_BUF_FLOOR;
+	while (ret < size && ret <= SIZE_MAX / 4) {
+		ret *= 2;
+	}
+	return ret;
+}
+#endif // __linux__
+
+void bfs_dir_bufsize(size_t min, size_t max) {
+#if __linux__
+	min = dir_buf_round(min);
+	max = dir_buf_round(max);
+	if (max < min) {
+		max = min;
+	}
+
+	dir_buf_min = min;
+	dir_buf_max = max;
 #endif
+}
 
 struct bfs_dir {
 #if __linux__
 	int fd;
-	unsigned short pos;
-	unsigned short size;
+	/** Whether the last getdents() (nearly) filled the buffer. */
+	bool full;
+	/** The getdents() buffer. */
+	char *buf;
+	/** The size of the buffer. */
+	size_t bufsize;
+	size_t pos;
+	size_t size;
 #else
 	DIR *dir;
 	struct dirent *de;
@@ -106,33 +204,49 @@ struct bfs_dir {
 };
 
 struct bfs_dir *bfs_opendir(int at_fd, const char *at_path) {
-#if __linux__
-	struct bfs_dir *dir = malloc(sizeof(*dir) + BUF_SIZE);
-#else
 	struct bfs_dir *dir = malloc(sizeof(*dir));
-#endif
 	if (!dir) {
 		return NULL;
 	}
 
+#if __linux__
+	// Start small, and grow the buffer if the directory turns out to be big
+	dir->bufsize = dir_buf_min;
+	dir->buf = dir_pool_get(dir->bufsize);
+	if (!dir->buf) {
+		free(dir);
+		return NULL;
+	}
+#endif
+
 	int fd;
 	if (at_path) {
+		struct timespec start;
+		bool prof = bfs_prof_begin(&start);
 		fd = openat(at_fd, at_path, O_RDONLY | O_CLOEXEC | O_DIRECTORY);
+		if (prof) {
+			bfs_prof_end(BFS_PROF_OPEN, &start);
+		}
 	} else if (at_fd >= 0) {
 		fd = at_fd;
 	} else {
-		free(dir);
+		fd = -1;
 		errno = EBADF;
-		return NULL;
 	}
 
 	if (fd < 0) {
+#if __linux__
+		int error = errno;
+		dir_pool_put(dir->buf, dir->bufsize);
+		errno = error;
+#endif
 		free(dir);
 		return NULL;
 	}
 
 #if __linux__
 	dir->fd = fd;
+	dir->full = false;
 	dir->pos = 0;
 	dir->size = 0;
 #else
@@ -161,50 +275,45 @@ int bfs_dirfd(const struct bfs_dir *dir) {
 
 /** Convert a dirent type to a bfs_type. */
 static enum bfs_type translate_type(int d_type) {
-	switch (d_type) {
+	static const enum bfs_type types[] = {
+		[0] = BFS_UNKNOWN,
 #ifdef DT_BLK
-	case DT_BLK:
-		return BFS_BLK;
+		[DT_BLK] = BFS_BLK,
 #endif
 #ifdef DT_CHR
-	case DT_CHR:
-		return BFS_CHR;
+		[DT_CHR] = BFS_CHR,
 #endif
 #ifdef DT_DIR
-	case DT_DIR:
-		return BFS_DIR;
+		[DT_DIR] = BFS_DIR,
 #endif
 #ifdef DT_DOOR
-	case DT_DOOR:
-		return BFS_DOOR;
+		[DT_DOOR] = BFS_DOOR,
 #endif
 #ifdef DT_FIFO
-	case DT_FIFO:
-		return BFS_FIFO;
+		[DT_FIFO] = BFS_FIFO,
 #endif
 #ifdef DT_LNK
-	case DT_LNK:
-		return BFS_LNK;
+		[DT_LNK] = BFS_LNK,
 #endif
 #ifdef DT_PORT
-	case DT_PORT:
-		return BFS_PORT;
+		[DT_PORT] = BFS_PORT,
 #endif
 #ifdef DT_REG
-	case DT_REG:
-		return BFS_REG;
+		[DT_REG] = BFS_REG,
 #endif
 #ifdef DT_SOCK
-	case DT_SOCK:
-		return BFS_SOCK;
+		[DT_SOCK] = BFS_SOCK,
 #endif
 #ifdef DT_WHT
-	case DT_WHT:
-		return BFS_WHT;
+		[DT_WHT] = BFS_WHT,
 #endif
-	}
+	};
 
-	return BFS_UNKNOWN;
+	if (d_type >= 0 && (size_t)d_type < sizeof(types)/sizeof(types[0])) {
+		return types[d_type];
+	} else {
+		return BFS_UNKNOWN;
+	}
 }
 
 #if !__linux__
@@ -223,25 +332,48 @@ static bool is_dot(const char *name) {
 	return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
 }
 
-int bfs_readdir(struct bfs_dir *dir, struct bfs_dirent *de) {
-	while (true) {
 #if __linux__
-		char *buf = (char *)(dir + 1);
+/** Refill the getdents() buffer. */
+static ssize_t bfs_getdents(struct bfs_dir *dir) {
+	// A big directory will need more reads, so make each one bigger
+	if (dir->full && dir->bufsize < dir_buf_max) {
+		char *buf = dir_pool_get(2 * dir->bufsize);
+		if (buf) {
+			dir_pool_put(dir->buf, dir->bufsize);
+			dir->buf = buf;
+			dir->bufsize *= 2;
+		}
+	}
+
+	char *buf = dir->buf;
 
-		if (dir->pos >= dir->size) {
 #if BFS_HAS_FEATURE(memory_sanitizer, false)
-			// Make sure msan knows the buffer is initialized
-			memset(buf, 0, BUF_SIZE);
+	// Make sure msan knows the buffer is initialized
+	memset(buf, 0, dir->bufsize);
 #endif
 
-			ssize_t size = syscall(__NR_getdents64, dir->fd, buf, BUF_SIZE);
-			if (size <= 0) {
-				return size;
-			}
-			dir->pos = 0;
-			dir->size = size;
-		}
+	struct timespec start;
+	bool prof = bfs_prof_begin(&start);
+	ssize_t size = syscall(__NR_getdents64, dir->fd, buf, dir->bufsize);
+	if (prof) {
+		bfs_prof_end(BFS_PROF_READDIR, &start);
+	}
 
+	if (size > 0) {
+		dir->pos = 0;
+		dir->size = size;
+		// The kernel stops when the next entry won't fit, so a read
+		// that used more than half the buffer probably wasn't the last
+		dir->full = (size_t)size > dir->bufsize / 2;
+	}
+	return size;
+}
+
+/** Read an entry from the getdents() buffer, if any are left. */
+static bool bfs_nextdent(struct bfs_dir *dir, struct bfs_dirent *de) {
+	char *buf = dir->buf;
+
+	while (dir->pos < dir->size) {
 		const struct linux_dirent64 *lde = (void *)(buf + dir->pos);
 		dir->pos += lde->d_reclen;
 
@@ -254,10 +386,32 @@ int bfs_readdir(struct bfs_dir *dir, struct bfs_dirent *de) {
 			de->name = lde->d_name;
 		}
 
-		return 1;
+		return true;
+	}
+
+	return false;
+}
+#endif
+
+int bfs_readdir(struct bfs_dir *dir, struct bfs_dirent *de) {
+#if __linux__
+	while (!bfs_nextdent(dir, de)) {
+		ssize_t size = bfs_getdents(dir);
+		if (size <= 0) {
+			return size;
+		}
+	}
+
+	return 1;
 #else // !__linux__
+	while (true) {
+		struct timespec start;
+		bool prof = bfs_prof_begin(&start);
 		errno = 0;
 		dir->de = readdir(dir->dir);
+		if (prof) {
+			bfs_prof_end(BFS_PROF_READDIR, &start);
+		}
 		if (dir->de) {
 			if (is_dot(dir->de->d_name)) {
 				continue;
@@ -272,13 +426,61 @@ int bfs_readdir(struct bfs_dir *dir, struct bfs_dirent *de) {
 		} else {
 			return 0;
 		}
+	}
 #endif // !__linux__
+}
+
+int bfs_readdir_batch(struct bfs_dir *dir, struct bfs_dirent *des, size_t n) {
+#if __linux__
+	while (true) {
+		size_t count = 0;
+		while (count < n && bfs_nextdent(dir, &des[count])) {
+			++count;
+		}
+		if (count > 0) {
+			return count;
+		}
+
+		ssize_t size = bfs_getdents(dir);
+		if (size <= 0) {
+			return size;
+		}
+	}
+#else
+	// readdir() may overwrite the previous entry's name, so only read one
+	if (n == 0) {
+		return 0;
 	}
+	return bfs_readdir(dir, des);
+#endif
+}
+
+int bfs_readdir_buffered(struct bfs_dir *dir, struct bfs_dirent *de) {
+#if __linux__
+	return bfs_nextdent(dir, de);
+#else
+	// readdir() doesn't tell us whether it will block
+	return 0;
+#endif
+}
+
+int bfs_polldir(struct bfs_dir *dir) {
+#if __linux__
+	if (dir->pos < dir->size) {
+		return 0;
+	}
+
+	return bfs_getdents(dir) < 0 ? -1 : 0;
+#else
+	// readdir() gives us no way to fill the buffer without consuming an entry
+	return 0;
+#endif
 }
 
 int bfs_closedir(struct bfs_dir *dir) {
 #if __linux__
 	int ret = xclose(dir->fd);
+	dir_pool_put(dir->buf, dir->bufsize);
 #else
 	int ret = closedir(dir->dir);
 #endif
@@ -289,6 +491,7 @@ int bfs_closedir(struct bfs_dir *dir) {
 int bfs_freedir(struct bfs_dir *dir) {
 #if __linux__
 	int ret = dir->fd;
+	dir_pool_put(dir->buf, dir->bufsize);
 	free(dir);
 	return ret;
 #elif __FreeBSD__
@@ -73,6 +73,24 @@ struct bfs_dirent {
 	const char *name;
 };
 
+/** The default smallest buffer for reading directory entries. */
+#define BFS_DIR_BUF_MIN (8 << 10)
+/** The default largest buffer for reading directory entries. */
+#define BFS_DIR_BUF_MAX (1 << 20)
+
+/**
+ * Set the range of buffer sizes used to read directory entries.  Each directory
+ * starts with the smallest size, and the buffer doubles as long as reads keep
+ * filling it.  Sizes are rounded up to powers of two.  Directories that are
+ * already open are unaffected.
+ *
+ * @param min
+ *         The initial buffer size, in bytes.
+ * @param max
+ *         The largest buffer size, in bytes.
+ */
+void bfs_dir_bufsize(size_t min, size_t max);
+
 /**
  * Open a directory.
  *
@@ -103,6 +121,48 @@ int bfs_dirfd(const struct bfs_dir *dir);
  */
 int bfs_readdir(struct bfs_dir *dir, struct bfs_dirent *de);
 
+/**
+ * Read a batch of directory entries.  All the returned entries come from the
+ * same internal buffer, so their names stay valid until the next call that
+ * reads from this directory.
+ *
+ * @param dir
+ *         The directory to read.
+ * @param[out] des
+ *         The directory entries to populate.
+ * @param n
+ *         The maximum number of entries to read.
+ * @return
+ *         The number of entries read (at least one, unless n is 0), 0 on EOF,
+ *         or -1 on failure.
+ */
+int bfs_readdir_batch(struct bfs_dir *dir, struct bfs_dirent *des, size_t n);
+
+/**
+ * Read a directory entry, but only if it is already buffered.  Names returned
+ * by this function stay valid until the next call to bfs_readdir().
+ *
+ * @param dir
+ *         The directory to read.
+ * @param[out] dirent
+ *         The directory entry to populate.
+ * @return
+ *         1 on success, or 0 if no more entries are buffered.
+ */
+int bfs_readdir_buffered(struct bfs_dir *dir, struct bfs_dirent *de);
+
+/**
+ * Fill the directory's internal buffer ahead of time, without returning any
+ * entries.  This lets another thread perform the I/O for a directory that will
+ * be read later.
+ *
+ * @param dir
+ *         The directory to fill.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int bfs_polldir(struct bfs_dir *dir);
+
 /**
  * Close a directory.
  *
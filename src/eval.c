@@ -19,6 +19,7 @@
  */
 
 #include "eval.h"
+#include "alloc.h"
 #include "bar.h"
 #include "bftw.h"
 #include "color.h"
@@ -28,10 +29,16 @@
 #include "dir.h"
 #include "dstring.h"
 #include "exec.h"
+#include "export.h"
 #include "expr.h"
 #include "fsade.h"
+#include "glob.h"
+#include "idset.h"
+#include "ioq.h"
 #include "mtab.h"
+#include "opt.h"
 #include "printf.h"
+#include "prof.h"
 #include "pwcache.h"
 #include "stat.h"
 #include "trie.h"
@@ -41,31 +48,139 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <fnmatch.h>
 #include <grp.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include <wchar.h>
 
+/**
+ * A memoized subexpression result.
+ */
+struct eval_memo {
+	/** The file number the result is for. */
+	size_t file;
+	/** The result itself. */
+	bool result;
+};
+
+/**
+ * A directory that -delete-jobs is unlinking files from.  It counts the
+ * unlinks still pending inside it, so that its own removal (its post-order
+ * -delete) can be queued exactly once, as soon as everything beneath it is gone.
+ */
+struct eval_delete_dir {
+	/** The next open directory. */
+	struct eval_delete_dir *next;
+	/** Our own copy of the directory's fd, kept open until the unlinks finish. */
+	int fd;
+	/** The directory's path, up to the names of its children (a dstring). */
+	char *prefix;
+	/** The number of unlinks still pending in this directory. */
+	size_t refs;
+	/** The removal of this directory, waiting for refs to reach 0. */
+	struct eval_unlink *rmdir;
+};
+
+/**
+ * A file being unlinked in the background.
+ */
+struct eval_unlink {
+	/** The directory containing the file. */
+	struct eval_delete_dir *dir;
+	/** The depth of the file, for -ignore_readdir_race. */
+	size_t depth;
+	/** The unlinkat() flags. */
+	int flags;
+	/** The path relative to dir->fd, pointing into path. */
+	const char *at_path;
+	/** The full path, for error messages. */
+	char path[];
+};
+
+/** The most operations the -delete-jobs queue holds at once. */
+#define EVAL_DELETE_DEPTH 4096
+/** The most directories held open by pending unlinks. */
+#define EVAL_DELETE_MAX_DIRS 16
+
+/**
+ * Background -delete state, for -delete-jobs.
+ */
+struct eval_deleter {
+	/** The bfs context. */
+	const struct bfs_ctx *ctx;
+	/** The queue of pending unlinks. */
+	struct ioq *ioq;
+	/** All the open eval_delete_dir's. */
+	struct eval_delete_dir *dirs;
+	/** The directory most recently deleted from, if any. */
+	struct eval_delete_dir *dir;
+	/** The number of open eval_delete_dir's. */
+	size_t ndirs;
+	/** Where to record failures. */
+	int *ret;
+};
+
+/**
+ * The running totals for a directory, for -summarize.
+ */
+struct eval_totals {
+	/** The value of each field, indexed by enum bfs_summary_field. */
+	unsigned long long values[BFS_SUMMARY_MAX];
+};
+
+/**
+ * -summarize state.  Each directory's totals live in the trie until its
+ * post-order visit, when they are printed and added to its parent's.
+ */
+struct eval_summary {
+	/** The eval_totals for each open directory, keyed by its children's path prefix. */
+	struct trie dirs;
+	/** Allocator for the eval_totals. */
+	struct arena totals;
+	/** A buffer for building keys (a dstring). */
+	char *key;
+	/** The length of the root part of key. */
+	size_t rootlen;
+};
+
 struct bfs_eval {
 	/** Data about the current file. */
 	const struct BFTW *ftwbuf;
+	/** The number of the current file. */
+	size_t file;
+	/** Memoized subexpression results (see bfs_expr::memo). */
+	struct eval_memo *memo;
 	/** The bfs context. */
 	const struct bfs_ctx *ctx;
 	/** The bftw() callback return value. */
 	enum bftw_action action;
 	/** The bfs_eval() return value. */
 	int *ret;
+	/** Background deletions, for -delete-jobs. */
+	struct eval_deleter *deleter;
+	/** Per-directory totals, for -summarize. */
+	struct eval_summary *summary;
+	/** Whether bftw()'s directory entry counts are still accurate when visited. */
+	bool nentries_ok;
 	/** Whether to quit immediately. */
 	bool quit;
+	/** Whether to time the expressions evaluated for this file. */
+	bool sample;
+	/** A buffer for the name of a root with trailing slashes. */
+	char **root_name;
 };
 
 /**
@@ -314,7 +429,13 @@ bool eval_nogroup(const struct bfs_expr *expr, struct bfs_eval *state) {
 		return false;
 	}
 
-	return bfs_getgrgid(groups, statbuf->gid) == NULL;
+	int ret = bfs_groups_exist(groups, statbuf->gid);
+	if (ret < 0) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return ret == 0;
 }
 
 /**
@@ -332,267 +453,915 @@ bool eval_nouser(const struct bfs_expr *expr, struct bfs_eval *state) {
 		return false;
 	}
 
-	return bfs_getpwuid(users, statbuf->uid) == NULL;
-}
+	int ret = bfs_users_exist(users, statbuf->uid);
+	if (ret < 0) {
+		eval_report_error(state);
+		return false;
+	}
 
-/**
- * -delete action.
- */
-bool eval_delete(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct BFTW *ftwbuf = state->ftwbuf;
+	return ret == 0;
+}
 
-	// Don't try to delete the current directory
-	if (strcmp(ftwbuf->path, ".") == 0) {
-		return true;
+/** Free an eval_delete_dir. */
+static void eval_delete_dir_free(struct eval_deleter *deleter, struct eval_delete_dir *dir) {
+	struct eval_delete_dir **link = &deleter->dirs;
+	while (*link != dir) {
+		link = &(*link)->next;
 	}
+	*link = dir->next;
 
-	int flag = 0;
+	if (deleter->dir == dir) {
+		deleter->dir = NULL;
+	}
 
-	// We need to know the actual type of the path, not what it points to
-	enum bfs_type type = bftw_type(ftwbuf, BFS_STAT_NOFOLLOW);
-	if (type == BFS_DIR) {
-		flag |= AT_REMOVEDIR;
-	} else if (type == BFS_ERROR) {
-		eval_report_error(state);
-		return false;
+	if (dir->fd != AT_FDCWD) {
+		xclose(dir->fd);
 	}
+	dstrfree(dir->prefix);
+	free(dir->rmdir);
+	free(dir);
+	--deleter->ndirs;
+}
 
-	if (unlinkat(ftwbuf->at_fd, ftwbuf->at_path, flag) != 0) {
-		eval_report_error(state);
-		return false;
+static void eval_unlink_submit(struct eval_deleter *deleter, struct eval_unlink *unlink);
+
+/** Drop a reference to an eval_delete_dir, freeing it if it's unused. */
+static void eval_delete_dir_release(struct eval_deleter *deleter, struct eval_delete_dir *dir) {
+	--dir->refs;
+	if (dir->refs > 0) {
+		return;
 	}
 
-	return true;
+	struct eval_unlink *rmdir = dir->rmdir;
+	if (rmdir) {
+		// Everything beneath the directory is gone, so it can go too
+		dir->rmdir = NULL;
+		eval_delete_dir_free(deleter, dir);
+		eval_unlink_submit(deleter, rmdir);
+	} else if (dir != deleter->dir) {
+		eval_delete_dir_free(deleter, dir);
+	}
 }
 
-/** Finish any pending -exec ... + operations. */
-static int eval_exec_finish(const struct bfs_expr *expr, const struct bfs_ctx *ctx) {
-	int ret = 0;
+/** Handle a completed unlink. */
+static void eval_unlink_done(struct eval_deleter *deleter, struct eval_unlink *unlink, int ret, int error) {
+	const struct bfs_ctx *ctx = deleter->ctx;
 
-	if (expr->eval_fn == eval_exec) {
-		if (bfs_exec_finish(expr->exec) != 0) {
-			if (errno != 0) {
-				bfs_error(ctx, "%s %s: %m.\n", expr->argv[0], expr->argv[1]);
-			}
-			ret = -1;
-		}
-	} else if (bfs_expr_has_children(expr)) {
-		if (expr->lhs && eval_exec_finish(expr->lhs, ctx) != 0) {
-			ret = -1;
-		}
-		if (expr->rhs && eval_exec_finish(expr->rhs, ctx) != 0) {
-			ret = -1;
-		}
+	if (ret != 0 && !(ctx->ignore_races && is_nonexistence_error(error) && unlink->depth > 0)) {
+		*deleter->ret = EXIT_FAILURE;
+		errno = error;
+		bfs_error(ctx, "%s: %m.\n", unlink->path);
 	}
 
-	return ret;
+	struct eval_delete_dir *dir = unlink->dir;
+	free(unlink);
+	eval_delete_dir_release(deleter, dir);
 }
 
-/**
- * -exec[dir]/-ok[dir] actions.
- */
-bool eval_exec(const struct bfs_expr *expr, struct bfs_eval *state) {
-	bool ret = bfs_exec(expr->exec, state->ftwbuf) == 0;
-	if (errno != 0) {
-		eval_error(state, "%s %s: %m.\n", expr->argv[0], expr->argv[1]);
+/** Handle a completed background unlink. */
+static void eval_unlink_finish(struct eval_deleter *deleter, struct ioq_ent *ent) {
+	struct eval_unlink *unlink = ent->ptr;
+	int ret = ent->ret;
+	int error = ent->error;
+	ioq_free(deleter->ioq, ent);
+
+	eval_unlink_done(deleter, unlink, ret, error);
+}
+
+/** Start an unlink in the background, or finish it now if we can't. */
+static void eval_unlink_submit(struct eval_deleter *deleter, struct eval_unlink *unlink) {
+	struct ioq *ioq = deleter->ioq;
+
+	// Make room for a new operation
+	while (ioq_capacity(ioq) == 0) {
+		eval_unlink_finish(deleter, ioq_pop(ioq));
+	}
+
+	if (ioq_unlinkat(ioq, unlink->dir->fd, unlink->at_path, unlink->flags, unlink) != 0) {
+		int ret = unlinkat(unlink->dir->fd, unlink->at_path, unlink->flags);
+		eval_unlink_done(deleter, unlink, ret, errno);
 	}
-	return ret;
 }
 
-/**
- * -exit action.
- */
-bool eval_exit(const struct bfs_expr *expr, struct bfs_eval *state) {
-	state->action = BFTW_STOP;
-	*state->ret = expr->num;
-	state->quit = true;
-	return true;
+/** Wait for all the pending background unlinks. */
+static void eval_delete_drain(struct eval_deleter *deleter) {
+	struct ioq_ent *ent;
+	while ((ent = ioq_pop(deleter->ioq))) {
+		eval_unlink_finish(deleter, ent);
+	}
 }
 
-/**
- * -depth N test.
- */
-bool eval_depth(const struct bfs_expr *expr, struct bfs_eval *state) {
-	return bfs_expr_cmp(expr, state->ftwbuf->depth);
+/** Find the open eval_delete_dir with the given prefix, if any. */
+static struct eval_delete_dir *eval_delete_dir_find(const struct eval_deleter *deleter, const char *prefix, size_t len) {
+	for (struct eval_delete_dir *dir = deleter->dirs; dir; dir = dir->next) {
+		if (dstrlen(dir->prefix) == len && memcmp(dir->prefix, prefix, len) == 0) {
+			return dir;
+		}
+	}
+
+	return NULL;
 }
 
-/**
- * -empty test.
- */
-bool eval_empty(const struct bfs_expr *expr, struct bfs_eval *state) {
-	bool ret = false;
-	const struct BFTW *ftwbuf = state->ftwbuf;
+/** Get the eval_delete_dir for the parent of the current file. */
+static struct eval_delete_dir *eval_delete_dir_get(struct eval_deleter *deleter, const struct BFTW *ftwbuf) {
+	size_t len = ftwbuf->nameoff;
 
-	if (ftwbuf->type == BFS_DIR) {
-		struct bfs_dir *dir = bfs_opendir(ftwbuf->at_fd, ftwbuf->at_path);
+	struct eval_delete_dir *prev = deleter->dir;
+	if (prev && dstrlen(prev->prefix) == len && memcmp(prev->prefix, ftwbuf->path, len) == 0) {
+		return prev;
+	}
+
+	struct eval_delete_dir *dir = eval_delete_dir_find(deleter, ftwbuf->path, len);
+	if (!dir) {
+		// Don't hold on to too many file descriptors
+		if (deleter->ndirs >= EVAL_DELETE_MAX_DIRS) {
+			eval_delete_drain(deleter);
+		}
+
+		dir = malloc(sizeof(*dir));
 		if (!dir) {
-			eval_report_error(state);
-			goto done;
+			return NULL;
 		}
 
-		int did_read = bfs_readdir(dir, NULL);
-		if (did_read < 0) {
-			eval_report_error(state);
-		} else {
-			ret = !did_read;
+		dir->prefix = dstrndup(ftwbuf->path, len);
+		if (!dir->prefix) {
+			free(dir);
+			return NULL;
 		}
 
-		bfs_closedir(dir);
-	} else if (ftwbuf->type == BFS_REG) {
-		const struct bfs_stat *statbuf = eval_stat(state);
-		if (statbuf) {
-			ret = statbuf->size == 0;
+		if (ftwbuf->at_fd == AT_FDCWD) {
+			dir->fd = AT_FDCWD;
+		} else {
+			dir->fd = dup_cloexec(ftwbuf->at_fd);
+			if (dir->fd < 0) {
+				dstrfree(dir->prefix);
+				free(dir);
+				return NULL;
+			}
 		}
+
+		dir->refs = 0;
+		dir->rmdir = NULL;
+		dir->next = deleter->dirs;
+		deleter->dirs = dir;
+		++deleter->ndirs;
 	}
 
-done:
-	return ret;
+	deleter->dir = dir;
+	if (prev && prev->refs == 0 && !prev->rmdir) {
+		eval_delete_dir_free(deleter, prev);
+	}
+	return dir;
 }
 
-/**
- * -flags test.
- */
-bool eval_flags(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct bfs_stat *statbuf = eval_stat(state);
-	if (!statbuf) {
-		return false;
+/** Get the eval_delete_dir for the children of a directory, if it's still open. */
+static struct eval_delete_dir *eval_delete_dir_children(const struct eval_deleter *deleter, const struct BFTW *ftwbuf) {
+	const char *path = ftwbuf->path;
+	size_t len = strlen(path);
+	if (len > 0 && path[len - 1] == '/') {
+		return eval_delete_dir_find(deleter, path, len);
 	}
 
-	if (!(statbuf->mask & BFS_STAT_ATTRS)) {
-		eval_error(state, "Couldn't get file %s.\n", bfs_stat_field_name(BFS_STAT_ATTRS));
-		return false;
+	for (struct eval_delete_dir *dir = deleter->dirs; dir; dir = dir->next) {
+		if (dstrlen(dir->prefix) == len + 1 && memcmp(dir->prefix, path, len) == 0) {
+			return dir;
+		}
 	}
 
-	unsigned long flags = statbuf->attrs;
-	unsigned long set = expr->set_flags;
-	unsigned long clear = expr->clear_flags;
+	return NULL;
+}
 
-	switch (expr->flags_cmp) {
-	case BFS_MODE_EQUAL:
-		return flags == set && !(flags & clear);
+/** Delete a file in the background. */
+static int eval_delete_async(struct eval_deleter *deleter, const struct BFTW *ftwbuf, int flags) {
+	struct ioq *ioq = deleter->ioq;
 
-	case BFS_MODE_ALL:
-		return (flags & set) == set && !(flags & clear);
+	// Report any finished unlinks
+	struct ioq_ent *ent;
+	while ((ent = ioq_trypop(ioq))) {
+		eval_unlink_finish(deleter, ent);
+	}
 
-	case BFS_MODE_ANY:
-		return (flags & set) || (flags & clear) != clear;
+	// Only files reached directly from their parent's fd are tracked
+	if (ftwbuf->at_path != ftwbuf->path + ftwbuf->nameoff) {
+		return -1;
 	}
 
-	assert(!"Invalid comparison mode");
-	return false;
-}
+	struct eval_delete_dir *dir = eval_delete_dir_get(deleter, ftwbuf);
+	if (!dir) {
+		return -1;
+	}
 
-/**
- * -fstype test.
- */
-bool eval_fstype(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct bfs_stat *statbuf = eval_stat(state);
-	if (!statbuf) {
-		return false;
+	size_t size = strlen(ftwbuf->path) + 1;
+	struct eval_unlink *unlink = malloc(sizeof(*unlink) + size);
+	if (!unlink) {
+		return -1;
 	}
 
-	const struct bfs_mtab *mtab = bfs_ctx_mtab(state->ctx);
-	if (!mtab) {
-		eval_report_error(state);
-		return false;
+	unlink->dir = dir;
+	unlink->depth = ftwbuf->depth;
+	unlink->flags = flags;
+	memcpy(unlink->path, ftwbuf->path, size);
+	unlink->at_path = unlink->path + ftwbuf->nameoff;
+	++dir->refs;
+
+	if (flags & AT_REMOVEDIR) {
+		// Post-order: wait for the directory's children to be gone first
+		struct eval_delete_dir *children = eval_delete_dir_children(deleter, ftwbuf);
+		if (children && children->refs > 0) {
+			children->rmdir = unlink;
+			return 0;
+		}
 	}
 
-	const char *type = bfs_fstype(mtab, statbuf);
-	return strcmp(type, expr->argv[1]) == 0;
+	eval_unlink_submit(deleter, unlink);
+	return 0;
 }
 
 /**
- * -hidden test.
+ * -delete action.
  */
-bool eval_hidden(const struct bfs_expr *expr, struct bfs_eval *state) {
+bool eval_delete(const struct bfs_expr *expr, struct bfs_eval *state) {
 	const struct BFTW *ftwbuf = state->ftwbuf;
-	const char *name = ftwbuf->path + ftwbuf->nameoff;
 
-	// Don't treat "." or ".." as hidden directories.  Otherwise we'd filter
-	// out everything when given
-	//
-	//     $ bfs . -nohidden
-	//     $ bfs .. -nohidden
-	return name[0] == '.' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
-}
+	// Don't try to delete the current directory
+	if (strcmp(ftwbuf->path, ".") == 0) {
+		return true;
+	}
 
-/**
- * -inum test.
- */
-bool eval_inum(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct bfs_stat *statbuf = eval_stat(state);
-	if (!statbuf) {
+	int flag = 0;
+
+	// We need to know the actual type of the path, not what it points to
+	enum bfs_type type = bftw_type(ftwbuf, BFS_STAT_NOFOLLOW);
+	if (type == BFS_DIR) {
+		flag |= AT_REMOVEDIR;
+	} else if (type == BFS_ERROR) {
+		eval_report_error(state);
 		return false;
 	}
 
-	return bfs_expr_cmp(expr, statbuf->ino);
-}
+	struct eval_deleter *deleter = state->deleter;
+	if (deleter) {
+		if (eval_delete_async(deleter, ftwbuf, flag) == 0) {
+			return true;
+		} else if (flag & AT_REMOVEDIR) {
+			// Post-order: the directory's children must be gone first
+			eval_delete_drain(deleter);
+		}
+	}
 
-/**
- * -links test.
- */
-bool eval_links(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct bfs_stat *statbuf = eval_stat(state);
-	if (!statbuf) {
+	if (unlinkat(ftwbuf->at_fd, ftwbuf->at_path, flag) != 0) {
+		eval_report_error(state);
 		return false;
 	}
 
-	return bfs_expr_cmp(expr, statbuf->nlink);
+	return true;
 }
 
 /**
- * -i?lname test.
+ * Make the -summarize key for a directory, which is the same prefix that bftw()
+ * gives its children.  For the current file's parent, that's just the path up
+ * to nameoff.  Keys start with the root and a NUL byte, so overlapping roots
+ * stay separate, and end with the dstring's own NUL byte, so no key is a
+ * prefix of another.
  */
-bool eval_lname(const struct bfs_expr *expr, struct bfs_eval *state) {
-	bool ret = false;
-	char *name = NULL;
+static const char *eval_summary_key(struct eval_summary *summary, const struct BFTW *ftwbuf, bool parent, size_t *keylen) {
+	if (!summary->key || strcmp(summary->key, ftwbuf->root) != 0) {
+		dstrfree(summary->key);
+		summary->key = dstrdup(ftwbuf->root);
+		if (!summary->key || dstrapp(&summary->key, '\0') != 0) {
+			dstrfree(summary->key);
+			summary->key = NULL;
+			return NULL;
+		}
+		summary->rootlen = dstrlen(summary->key);
+	}
 
-	const struct BFTW *ftwbuf = state->ftwbuf;
-	if (ftwbuf->type != BFS_LNK) {
-		goto done;
+	const char *path = ftwbuf->path;
+	size_t len = parent ? ftwbuf->nameoff : strlen(path);
+	if (dstresize(&summary->key, summary->rootlen) != 0 || dstrncat(&summary->key, path, len) != 0) {
+		return NULL;
+	}
+
+	if (!parent && len > 0 && path[len - 1] != '/' && dstrapp(&summary->key, '/') != 0) {
+		return NULL;
 	}
 
-	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
-	size_t len = statbuf ? statbuf->size : 0;
+	*keylen = dstrlen(summary->key) + 1;
+	return summary->key;
+}
 
-	name = xreadlinkat(ftwbuf->at_fd, ftwbuf->at_path, len);
-	if (!name) {
-		eval_report_error(state);
-		goto done;
+/** Get the -summarize totals for a directory, creating them if necessary. */
+static struct eval_totals *eval_summary_get(struct eval_summary *summary, const struct BFTW *ftwbuf, bool parent) {
+	size_t len;
+	const char *key = eval_summary_key(summary, ftwbuf, parent, &len);
+	if (!key) {
+		return NULL;
 	}
 
-	ret = fnmatch(expr->argv[1], name, expr->num) == 0;
+	struct trie_leaf *leaf = trie_insert_mem(&summary->dirs, key, len);
+	if (!leaf) {
+		return NULL;
+	}
 
-done:
-	free(name);
-	return ret;
+	if (!leaf->value) {
+		struct eval_totals *totals = arena_alloc(&summary->totals);
+		if (!totals) {
+			trie_remove(&summary->dirs, leaf);
+			return NULL;
+		}
+		*totals = (struct eval_totals){0};
+		leaf->value = totals;
+	}
+
+	return leaf->value;
 }
 
-/**
- * -i?name test.
- */
-bool eval_name(const struct bfs_expr *expr, struct bfs_eval *state) {
+/** Add a file's stats to some -summarize totals. */
+static void eval_totals_add(struct eval_totals *totals, const struct bfs_stat *statbuf) {
+	totals->values[BFS_SUMMARY_SIZE] += statbuf->size;
+	totals->values[BFS_SUMMARY_COUNT] += 1;
+	totals->values[BFS_SUMMARY_BLOCKS] += ((unsigned long long)statbuf->blocks * BFS_STAT_BLKSIZE + 511) / 512;
+}
+
+/** Add some -summarize totals to another. */
+static void eval_totals_merge(struct eval_totals *dest, const struct eval_totals *src) {
+	for (int i = 0; i < BFS_SUMMARY_MAX; ++i) {
+		dest->values[i] += src->values[i];
+	}
+}
+
+/**
+ * -summarize action.
+ */
+bool eval_summarize(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	struct eval_summary *summary = state->summary;
+
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	// Directories with a post-order visit keep their own totals until then,
+	// while everything else counts towards its parent
+	struct eval_totals *totals;
+	if (ftwbuf->type == BFS_DIR && ftwbuf->visit == BFTW_POST) {
+		totals = eval_summary_get(summary, ftwbuf, false);
+	} else if (ftwbuf->depth > 0) {
+		totals = eval_summary_get(summary, ftwbuf, true);
+	} else {
+		return true;
+	}
+
+	if (!totals) {
+		eval_report_error(state);
+		return false;
+	}
+
+	eval_totals_add(totals, statbuf);
+	return true;
+}
+
+/** Print a directory's -summarize totals and pass them up to its parent. */
+static void eval_summary_finish_dir(struct bfs_eval *state) {
+	const struct bfs_ctx *ctx = state->ctx;
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	struct eval_summary *summary = state->summary;
+
+	struct eval_totals totals = {0};
+	size_t len;
+	const char *key = eval_summary_key(summary, ftwbuf, false, &len);
+	if (!key) {
+		eval_report_error(state);
+		return;
+	}
+
+	struct trie_leaf *leaf = trie_find_mem(&summary->dirs, key, len);
+	if (leaf) {
+		struct eval_totals *value = leaf->value;
+		totals = *value;
+		arena_free(&summary->totals, value);
+		trie_remove(&summary->dirs, leaf);
+	}
+
+	if (ctx->summary_depth < 0 || ftwbuf->depth <= (size_t)ctx->summary_depth) {
+		CFILE *cout = ctx->cout;
+		for (size_t i = 0; i < ctx->nsummary_fields; ++i) {
+			unsigned long long value = totals.values[ctx->summary_fields[i]];
+			if (cfprintf(cout, "%lld\t", (long long)value) < 0) {
+				eval_report_error(state);
+				return;
+			}
+		}
+		if (cfprintf(cout, "%pP\n", ftwbuf) < 0) {
+			eval_report_error(state);
+			return;
+		}
+	}
+
+	if (ftwbuf->depth > 0) {
+		struct eval_totals *parent = eval_summary_get(summary, ftwbuf, true);
+		if (!parent) {
+			eval_report_error(state);
+			return;
+		}
+		eval_totals_merge(parent, &totals);
+	}
+}
+
+/** Initialize the -summarize state. */
+static void eval_summary_init(struct eval_summary *summary) {
+	trie_init(&summary->dirs);
+	ARENA_INIT(&summary->totals, struct eval_totals);
+	summary->key = NULL;
+	summary->rootlen = 0;
+}
+
+/** Free the -summarize state, including any totals left behind by an early exit. */
+static void eval_summary_destroy(struct eval_summary *summary) {
+	trie_destroy(&summary->dirs);
+	arena_destroy(&summary->totals);
+	dstrfree(summary->key);
+}
+
+/** Apply a -chmod mode to a file's permissions. */
+static mode_t eval_chmod_apply(const struct bfs_chmod_clause *clauses, mode_t mode, bool dir) {
+	for (size_t i = 0; i < darray_length(clauses); ++i) {
+		const struct bfs_chmod_clause *clause = &clauses[i];
+
+		mode_t bits = clause->perms;
+		if (clause->cond_exec && (dir || (mode & 0111))) {
+			bits |= 0111;
+		}
+
+		mode_t copy;
+		switch (clause->copy) {
+		case 'u':
+			copy = (mode >> 6) & 07;
+			bits |= copy * 0111;
+			break;
+		case 'g':
+			copy = (mode >> 3) & 07;
+			bits |= copy * 0111;
+			break;
+		case 'o':
+			copy = mode & 07;
+			bits |= copy * 0111;
+			break;
+		}
+
+		// Like chmod(1), directories keep their setuid/setgid bits unless
+		// they're named explicitly
+		mode_t keep = 0;
+		if (dir) {
+			keep = (S_ISUID | S_ISGID) & ~clause->mentioned;
+		}
+
+		bits &= clause->who & ~keep;
+
+		switch (clause->op) {
+		case '+':
+			mode |= bits;
+			break;
+		case '-':
+			mode &= ~bits;
+			break;
+		case '=':
+			mode = (mode & ~(clause->clear & ~keep)) | bits;
+			break;
+		}
+	}
+
+	return mode;
+}
+
+/**
+ * -chmod action.
+ */
+bool eval_chmod(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	// Like chmod -R, leave symbolic links alone (they have no permissions)
+	if (S_ISLNK(statbuf->mode)) {
+		return true;
+	}
+
+	mode_t old_mode = statbuf->mode & 07777;
+	mode_t new_mode = eval_chmod_apply(expr->chmod, old_mode, S_ISDIR(statbuf->mode));
+	if (new_mode == old_mode) {
+		return true;
+	}
+
+	if (fchmodat(ftwbuf->at_fd, ftwbuf->at_path, new_mode, 0) != 0) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return true;
+}
+
+/** Get the *at() flags for modifying the file itself, as bfs sees it. */
+static int eval_at_flags(const struct BFTW *ftwbuf) {
+	if (bftw_type(ftwbuf, ftwbuf->stat_flags) == BFS_LNK) {
+		return AT_SYMLINK_NOFOLLOW;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * -chown action.
+ */
+bool eval_chown(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+
+	// Skip the syscall if the ownership wouldn't change
+	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, ftwbuf->stat_flags);
+	if (statbuf) {
+		if ((expr->chown_uid == (uid_t)-1 || expr->chown_uid == statbuf->uid)
+		    && (expr->chown_gid == (gid_t)-1 || expr->chown_gid == statbuf->gid)) {
+			return true;
+		}
+	}
+
+	if (fchownat(ftwbuf->at_fd, ftwbuf->at_path, expr->chown_uid, expr->chown_gid, eval_at_flags(ftwbuf)) != 0) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * -touch action.
+ */
+bool eval_touch(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+
+	if (utimensat(ftwbuf->at_fd, ftwbuf->at_path, NULL, eval_at_flags(ftwbuf)) != 0) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return true;
+}
+
+/** Copy the contents of one file to another. */
+static int eval_copy_data(int in_fd, int out_fd) {
+#if __linux__
+	while (true) {
+		ssize_t ret = copy_file_range(in_fd, NULL, out_fd, NULL, SSIZE_MAX, 0);
+		if (ret == 0) {
+			return 0;
+		} else if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			} else if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+				// Fall back to read()/write()
+				break;
+			} else {
+				return -1;
+			}
+		}
+	}
+#endif
+
+	char buf[64 * 1024];
+	while (true) {
+		errno = 0;
+		size_t nread = xread(in_fd, buf, sizeof(buf));
+		int error = errno;
+
+		if (nread > 0 && xwrite(out_fd, buf, nread) != nread) {
+			return -1;
+		}
+
+		if (nread < sizeof(buf)) {
+			errno = error;
+			return error ? -1 : 0;
+		}
+	}
+}
+
+/**
+ * -copy-to action.
+ */
+bool eval_copy_to(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+
+	enum bfs_type type = bftw_type(ftwbuf, BFS_STAT_FOLLOW);
+	if (type == BFS_ERROR) {
+		eval_report_error(state);
+		return false;
+	} else if (type != BFS_REG) {
+		errno = type == BFS_DIR ? EISDIR : EINVAL;
+		eval_error(state, "Can only copy regular files: %m.\n");
+		return false;
+	}
+
+	bool ret = false;
+
+	int in_fd = openat(ftwbuf->at_fd, ftwbuf->at_path, O_RDONLY | O_CLOEXEC);
+	if (in_fd < 0) {
+		eval_report_error(state);
+		goto done;
+	}
+
+	struct bfs_stat in_stat;
+	if (bfs_stat(in_fd, NULL, 0, &in_stat) != 0) {
+		eval_report_error(state);
+		goto close_in;
+	}
+
+	// Don't truncate the destination until we know it's a different file,
+	// and don't write through a symbolic link someone planted there
+	const char *name = ftwbuf->path + ftwbuf->nameoff;
+	int out_fd = openat(expr->copy_fd, name, O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, in_stat.mode & 07777);
+	if (out_fd < 0) {
+		eval_error(state, "%s/%s: %m.\n", expr->argv[1], name);
+		goto close_in;
+	}
+
+	struct bfs_stat out_stat;
+	if (bfs_stat(out_fd, NULL, 0, &out_stat) != 0) {
+		eval_error(state, "%s/%s: %m.\n", expr->argv[1], name);
+		goto close_out;
+	}
+
+	if (in_stat.dev == out_stat.dev && in_stat.ino == out_stat.ino) {
+		eval_error(state, "Can't copy a file onto itself.\n");
+		goto close_out;
+	}
+
+	if (ftruncate(out_fd, 0) != 0 || eval_copy_data(in_fd, out_fd) != 0) {
+		eval_error(state, "%s/%s: %m.\n", expr->argv[1], name);
+		goto close_out;
+	}
+
+	ret = true;
+
+close_out:
+	if (xclose(out_fd) != 0 && ret) {
+		eval_error(state, "%s/%s: %m.\n", expr->argv[1], name);
+		ret = false;
+	}
+close_in:
+	close_quietly(in_fd);
+done:
+	return ret;
+}
+
+/** Finish any pending -exec ... + operations. */
+static int eval_exec_finish(const struct bfs_expr *expr, const struct bfs_ctx *ctx) {
+	int ret = 0;
+
+	if (expr->eval_fn == eval_exec) {
+		if (bfs_exec_finish(expr->exec) != 0) {
+			if (errno != 0) {
+				bfs_error(ctx, "%s %s: %m.\n", expr->argv[0], expr->argv[1]);
+			}
+			ret = -1;
+		}
+	} else if (bfs_expr_has_children(expr)) {
+		if (expr->lhs && eval_exec_finish(expr->lhs, ctx) != 0) {
+			ret = -1;
+		}
+		if (expr->rhs && eval_exec_finish(expr->rhs, ctx) != 0) {
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * -exec[dir]/-ok[dir] actions.
+ */
+bool eval_exec(const struct bfs_expr *expr, struct bfs_eval *state) {
+	bool ret = bfs_exec(expr->exec, state->ftwbuf) == 0;
+	if (errno != 0) {
+		eval_error(state, "%s %s: %m.\n", expr->argv[0], expr->argv[1]);
+	}
+	return ret;
+}
+
+/**
+ * -exit action.
+ */
+bool eval_exit(const struct bfs_expr *expr, struct bfs_eval *state) {
+	state->action = BFTW_STOP;
+	*state->ret = expr->num;
+	state->quit = true;
+	return true;
+}
+
+/**
+ * -depth N test.
+ */
+bool eval_depth(const struct bfs_expr *expr, struct bfs_eval *state) {
+	return bfs_expr_cmp(expr, state->ftwbuf->depth);
+}
+
+/**
+ * -empty test.
+ */
+bool eval_empty(const struct bfs_expr *expr, struct bfs_eval *state) {
+	bool ret = false;
+	const struct BFTW *ftwbuf = state->ftwbuf;
+
+	if (ftwbuf->type == BFS_DIR && ftwbuf->nentries != SIZE_MAX && state->nentries_ok) {
+		// bftw() just read the whole directory, no need to read it again
+		ret = ftwbuf->nentries == 0;
+	} else if (ftwbuf->type == BFS_DIR) {
+		struct bfs_dir *dir = bfs_opendir(ftwbuf->at_fd, ftwbuf->at_path);
+		if (!dir) {
+			eval_report_error(state);
+			goto done;
+		}
+
+		int did_read = bfs_readdir(dir, NULL);
+		if (did_read < 0) {
+			eval_report_error(state);
+		} else {
+			ret = !did_read;
+		}
+
+		bfs_closedir(dir);
+	} else if (ftwbuf->type == BFS_REG) {
+		const struct bfs_stat *statbuf = eval_stat(state);
+		if (statbuf) {
+			ret = statbuf->size == 0;
+		}
+	}
+
+done:
+	return ret;
+}
+
+/**
+ * -flags test.
+ */
+bool eval_flags(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	if (!(statbuf->mask & BFS_STAT_ATTRS)) {
+		eval_error(state, "Couldn't get file %s.\n", bfs_stat_field_name(BFS_STAT_ATTRS));
+		return false;
+	}
+
+	unsigned long flags = statbuf->attrs;
+	unsigned long set = expr->set_flags;
+	unsigned long clear = expr->clear_flags;
+
+	switch (expr->flags_cmp) {
+	case BFS_MODE_EQUAL:
+		return flags == set && !(flags & clear);
+
+	case BFS_MODE_ALL:
+		return (flags & set) == set && !(flags & clear);
+
+	case BFS_MODE_ANY:
+		return (flags & set) || (flags & clear) != clear;
+	}
+
+	assert(!"Invalid comparison mode");
+	return false;
+}
+
+/**
+ * -fstype test.
+ */
+bool eval_fstype(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	const struct bfs_mtab *mtab = bfs_ctx_mtab(state->ctx);
+	if (!mtab) {
+		eval_report_error(state);
+		return false;
+	}
+
+	const char *type = bfs_fstype(mtab, statbuf);
+	return strcmp(type, expr->argv[1]) == 0;
+}
+
+/**
+ * -hidden test.
+ */
+bool eval_hidden(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	const char *name = ftwbuf->path + ftwbuf->nameoff;
+
+	// Don't treat "." or ".." as hidden directories.  Otherwise we'd filter
+	// out everything when given
+	//
+	//     $ bfs . -nohidden
+	//     $ bfs .. -nohidden
+	return name[0] == '.' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+/**
+ * -inum test.
+ */
+bool eval_inum(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	return bfs_expr_cmp(expr, statbuf->ino);
+}
+
+/**
+ * -links test.
+ */
+bool eval_links(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	return bfs_expr_cmp(expr, statbuf->nlink);
+}
+
+/**
+ * -i?lname test.
+ */
+bool eval_lname(const struct bfs_expr *expr, struct bfs_eval *state) {
+	if (state->ftwbuf->type != BFS_LNK) {
+		return false;
+	}
+
+	const char *name = bftw_readlink(state->ftwbuf);
+	if (!name) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return bfs_glob_match(expr->glob, name);
+}
+
+/**
+ * -i?name test.
+ */
+static const char *eval_get_name(struct bfs_eval *state) {
 	const struct BFTW *ftwbuf = state->ftwbuf;
 
 	const char *name = ftwbuf->path + ftwbuf->nameoff;
-	char *copy = NULL;
 	if (ftwbuf->depth == 0) {
 		// Any trailing slashes are not part of the name.  This can only
 		// happen for the root path.
 		const char *slash = strchr(name, '/');
 		if (slash && slash > name) {
-			copy = strndup(name, slash - name);
-			if (!copy) {
-				eval_report_error(state);
-				return false;
+			size_t len = slash - name;
+			char **copy = state->root_name;
+			if (*copy) {
+				if (dstresize(copy, 0) != 0 || dstrncat(copy, name, len) != 0) {
+					eval_report_error(state);
+					return NULL;
+				}
+			} else {
+				*copy = dstrndup(name, len);
+				if (!*copy) {
+					eval_report_error(state);
+					return NULL;
+				}
 			}
-			name = copy;
+			name = *copy;
 		}
 	}
 
-	bool ret = fnmatch(expr->argv[1], name, expr->num) == 0;
-	free(copy);
-	return ret;
+	return name;
+}
+
+bool eval_name(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const char *name = eval_get_name(state);
+	if (!name) {
+		return false;
+	}
+
+	return bfs_glob_match(expr->glob, name);
+}
+
+/**
+ * Fused -i?name -o -i?name ... test.
+ */
+bool eval_name_set(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const char *name = eval_get_name(state);
+	if (!name) {
+		return false;
+	}
+
+	return bfs_globset_match(expr->globset, name);
 }
 
 /**
@@ -600,7 +1369,7 @@ bool eval_name(const struct bfs_expr *expr, struct bfs_eval *state) {
  */
 bool eval_path(const struct bfs_expr *expr, struct bfs_eval *state) {
 	const struct BFTW *ftwbuf = state->ftwbuf;
-	return fnmatch(expr->argv[1], ftwbuf->path, expr->num) == 0;
+	return bfs_glob_match(expr->glob, ftwbuf->path);
 }
 
 /**
@@ -744,9 +1513,21 @@ error:
  * -f?print action.
  */
 bool eval_fprint(const struct bfs_expr *expr, struct bfs_eval *state) {
-	if (cfprintf(expr->cfile, "%pP\n", state->ftwbuf) < 0) {
-		eval_report_error(state);
+	CFILE *cfile = expr->cfile;
+
+	if (cfile->colors) {
+		if (cfprintf(cfile, "%pP\n", state->ftwbuf) < 0) {
+			eval_report_error(state);
+		}
+	} else {
+		// Without colors, skip the format string parsing
+		const char *path = state->ftwbuf->path;
+		if (fputs(path, cfile->file) == EOF || putc('\n', cfile->file) == EOF) {
+			eval_report_error(state);
+		}
+		bfs_prof_output(strlen(path) + 1);
 	}
+
 	return true;
 }
 
@@ -759,6 +1540,7 @@ bool eval_fprint0(const struct bfs_expr *expr, struct bfs_eval *state) {
 	if (fwrite(path, 1, length, expr->cfile->file) != length) {
 		eval_report_error(state);
 	}
+	bfs_prof_output(length);
 	return true;
 }
 
@@ -773,6 +1555,28 @@ bool eval_fprintf(const struct bfs_expr *expr, struct bfs_eval *state) {
 	return true;
 }
 
+/**
+ * -f?printj action.
+ */
+bool eval_fprintj(const struct bfs_expr *expr, struct bfs_eval *state) {
+	if (bfs_export_json(expr->cfile, state->ftwbuf) != 0) {
+		eval_report_error(state);
+	}
+
+	return true;
+}
+
+/**
+ * -f?printb action.
+ */
+bool eval_fprintb(const struct bfs_expr *expr, struct bfs_eval *state) {
+	if (bfs_export_binary(expr->cfile, state->ftwbuf) != 0) {
+		eval_report_error(state);
+	}
+
+	return true;
+}
+
 /**
  * -printx action.
  */
@@ -785,6 +1589,7 @@ bool eval_fprintx(const struct bfs_expr *expr, struct bfs_eval *state) {
 		if (fwrite(path, 1, span, file) != span) {
 			goto error;
 		}
+		bfs_prof_output(span);
 		path += span;
 
 		char c = path[0];
@@ -796,13 +1601,14 @@ bool eval_fprintx(const struct bfs_expr *expr, struct bfs_eval *state) {
 		if (fwrite(escaped, 1, sizeof(escaped), file) != sizeof(escaped)) {
 			goto error;
 		}
+		bfs_prof_output(sizeof(escaped));
 		++path;
 	}
 
-
 	if (fputc('\n', file) == EOF) {
 		goto error;
 	}
+	bfs_prof_output(1);
 
 	return true;
 
@@ -982,25 +1788,56 @@ static void timespec_elapsed(struct timespec *elapsed, const struct timespec *st
 	}
 }
 
+/** Check if an expression is a printing action, for profiling. */
+static bool eval_is_output(const struct bfs_expr *expr) {
+	return expr->eval_fn == eval_fls
+		|| expr->eval_fn == eval_fprint
+		|| expr->eval_fn == eval_fprint0
+		|| expr->eval_fn == eval_fprintb
+		|| expr->eval_fn == eval_fprintf
+		|| expr->eval_fn == eval_fprintj
+		|| expr->eval_fn == eval_fprintx;
+}
+
 /**
  * Evaluate an expression.
  */
 static bool eval_expr(struct bfs_expr *expr, struct bfs_eval *state) {
 	struct timespec start, end;
-	bool time = state->ctx->debug & DEBUG_RATES;
+	bool time = (state->ctx->debug & DEBUG_RATES) || state->sample;
 	if (time) {
 		if (eval_gettime(state, &start) != 0) {
 			time = false;
 		}
 	}
 
-	assert(!state->quit);
-
-	bool ret = expr->eval_fn(expr, state);
+	struct timespec prof_start;
+	bool prof = (state->ctx->debug & DEBUG_PROF) && eval_is_output(expr) && bfs_prof_begin(&prof_start);
+
+	assert(!state->quit);
+
+	struct eval_memo *memo = expr->memo ? &state->memo[expr->memo - 1] : NULL;
+	bool ret;
+	if (memo && memo->file == state->file) {
+		// Already evaluated for this file, so don't time it again
+		ret = memo->result;
+		time = false;
+	} else {
+		ret = expr->eval_fn(expr, state);
+		if (memo) {
+			memo->file = state->file;
+			memo->result = ret;
+		}
+	}
+
+	if (prof) {
+		bfs_prof_end(BFS_PROF_OUTPUT, &prof_start);
+	}
 
 	if (time) {
 		if (eval_gettime(state, &end) == 0) {
 			timespec_elapsed(&expr->elapsed, &start, &end);
+			++expr->timed;
 		}
 	}
 
@@ -1069,48 +1906,234 @@ bool eval_comma(const struct bfs_expr *expr, struct bfs_eval *state) {
 	return eval_expr(expr->rhs, state);
 }
 
-/** Update the status bar. */
-static void eval_status(struct bfs_eval *state, struct bfs_bar *bar, struct timespec *last_status, size_t count) {
-	struct timespec now;
-	if (eval_gettime(state, &now) == 0) {
-		struct timespec elapsed = {0};
-		timespec_elapsed(&elapsed, last_status, &now);
+/**
+ * An instruction in a flattened expression.  Each instruction evaluates a
+ * single expression and jumps to one of two places depending on the result.
+ */
+struct eval_insn {
+	/** The expression to evaluate. */
+	struct bfs_expr *expr;
+	/** The instruction to jump to if it returns true. */
+	size_t if_true;
+	/** The instruction to jump to if it returns false. */
+	size_t if_false;
+};
+
+/** Jump target for a whole program returning true. */
+#define EVAL_RETURN_TRUE SIZE_MAX
+/** Jump target for a whole program returning false. */
+#define EVAL_RETURN_FALSE (SIZE_MAX - 1)
+
+/**
+ * State for flattening an expression.  Jumps are emitted with label numbers
+ * as targets, and resolved to instruction indices once every label is placed.
+ */
+struct eval_compiler {
+	/** The instructions so far (a darray). */
+	struct eval_insn *insns;
+	/** The instruction index of each label (a darray). */
+	size_t *labels;
+};
+
+/** Create a new label, to be placed later. */
+static int eval_new_label(struct eval_compiler *compiler, size_t *label) {
+	*label = darray_length(compiler->labels);
+	return DARRAY_PUSH(&compiler->labels, label);
+}
+
+/** Place a label before the next instruction. */
+static void eval_place_label(struct eval_compiler *compiler, size_t label) {
+	compiler->labels[label] = darray_length(compiler->insns);
+}
+
+/**
+ * Flatten an expression into short-circuiting jumps.
+ *
+ * @param expr
+ *         The expression to flatten.
+ * @param on_true, on_false
+ *         The labels to jump to once the expression's value is known.
+ */
+static int eval_compile(struct eval_compiler *compiler, struct bfs_expr *expr, size_t on_true, size_t on_false) {
+	bfs_eval_fn *eval_fn = expr->eval_fn;
+
+	// Memoized operators stay whole, so their results can be shared
+	if (!expr->memo) {
+		if (eval_fn == eval_not) {
+			return eval_compile(compiler, expr->rhs, on_false, on_true);
+		}
+
+		if (eval_fn == eval_and || eval_fn == eval_or || eval_fn == eval_comma) {
+			size_t rhs;
+			if (eval_new_label(compiler, &rhs) != 0) {
+				return -1;
+			}
+
+			int ret;
+			if (eval_fn == eval_and) {
+				ret = eval_compile(compiler, expr->lhs, rhs, on_false);
+			} else if (eval_fn == eval_or) {
+				ret = eval_compile(compiler, expr->lhs, on_true, rhs);
+			} else {
+				ret = eval_compile(compiler, expr->lhs, rhs, rhs);
+			}
+			if (ret != 0) {
+				return -1;
+			}
+
+			eval_place_label(compiler, rhs);
+			return eval_compile(compiler, expr->rhs, on_true, on_false);
+		}
+	}
+
+	struct eval_insn insn = {
+		.expr = expr,
+		.if_true = on_true,
+		.if_false = on_false,
+	};
+	return DARRAY_PUSH(&compiler->insns, &insn);
+}
 
-		// Update every 0.1s
-		if (elapsed.tv_sec > 0 || elapsed.tv_nsec >= 100000000L) {
-			*last_status = now;
+/**
+ * Flatten an expression tree into a program for eval_program().
+ *
+ * @return
+ *         The program (a darray), or NULL on failure.
+ */
+static struct eval_insn *eval_flatten(struct bfs_expr *expr) {
+	struct eval_compiler compiler = {
+		.insns = NULL,
+		.labels = NULL,
+	};
+
+	size_t on_true, on_false;
+	if (eval_new_label(&compiler, &on_true) != 0 || eval_new_label(&compiler, &on_false) != 0) {
+		goto fail;
+	}
+
+	if (eval_compile(&compiler, expr, on_true, on_false) != 0) {
+		goto fail;
+	}
+
+	compiler.labels[on_true] = EVAL_RETURN_TRUE;
+	compiler.labels[on_false] = EVAL_RETURN_FALSE;
+
+	for (size_t i = 0; i < darray_length(compiler.insns); ++i) {
+		struct eval_insn *insn = &compiler.insns[i];
+		insn->if_true = compiler.labels[insn->if_true];
+		insn->if_false = compiler.labels[insn->if_false];
+	}
+
+	darray_free(compiler.labels);
+	return compiler.insns;
+
+fail:
+	darray_free(compiler.labels);
+	darray_free(compiler.insns);
+	return NULL;
+}
+
+/**
+ * Evaluate a flattened expression.  This has the same semantics as
+ * eval_expr() on the original tree, but doesn't keep any statistics.
+ */
+static bool eval_program(const struct eval_insn *program, struct bfs_eval *state) {
+	assert(!state->quit);
+
+	size_t count = darray_length(program);
+	size_t pc = 0;
+	while (pc < count) {
+		const struct eval_insn *insn = &program[pc];
+		const struct bfs_expr *expr = insn->expr;
+
+		struct eval_memo *memo = expr->memo ? &state->memo[expr->memo - 1] : NULL;
+		bool ret;
+		if (memo && memo->file == state->file) {
+			ret = memo->result;
 		} else {
-			return;
+			ret = expr->eval_fn(expr, state);
+			if (memo) {
+				memo->file = state->file;
+				memo->result = ret;
+			}
+		}
+
+		if (state->quit) {
+			return false;
 		}
+
+		assert(!expr->always_true || ret);
+		assert(!expr->always_false || !ret);
+
+		pc = ret ? insn->if_true : insn->if_false;
 	}
 
-	size_t width = bfs_bar_width(bar);
-	if (width < 3) {
+	assert(pc == EVAL_RETURN_TRUE || pc == EVAL_RETURN_FALSE);
+	return pc == EVAL_RETURN_TRUE;
+}
+
+/**
+ * Status bar state, shared with the thread that draws it.
+ */
+struct eval_status {
+	/** The status bar. */
+	struct bfs_bar *bar;
+	/** Progress counters published by bftw(). */
+	struct bftw_progress progress;
+	/** Set by the status thread when it wants a fresh path. */
+	atomic_bool want_path;
+
+	/** Protects the fields below. */
+	pthread_mutex_t mutex;
+	/** Signalled to stop the status thread. */
+	pthread_cond_t stopped;
+	/** Whether the status thread should exit. */
+	bool stop;
+	/** The most recently published path (a dstring). */
+	char *path;
+	/** The depth of that path. */
+	size_t depth;
+
+	/** The status thread. */
+	pthread_t thread;
+};
+
+/** Publish the current path for the status bar, if it wants one. */
+static void eval_status_publish(struct eval_status *status, const struct BFTW *ftwbuf) {
+	if (!atomic_load_explicit(&status->want_path, memory_order_relaxed)) {
 		return;
 	}
 
-	const struct BFTW *ftwbuf = state->ftwbuf;
+	size_t pathlen = ftwbuf->nameoff;
+	if (ftwbuf->depth == 0) {
+		pathlen = strlen(ftwbuf->path);
+	}
+
+	pthread_mutex_lock(&status->mutex);
+	if (dstresize(&status->path, 0) == 0 && dstrncat(&status->path, ftwbuf->path, pathlen) == 0) {
+		status->depth = ftwbuf->depth;
+	}
+	pthread_mutex_unlock(&status->mutex);
+
+	atomic_store_explicit(&status->want_path, false, memory_order_relaxed);
+}
 
-	char *rhs = dstrprintf(" (visited: %zu, depth: %2zu)", count, ftwbuf->depth);
-	if (!rhs) {
+/** Draw the status bar. */
+static void eval_status_draw(struct bfs_bar *bar, const char *path, size_t pathlen, const char *rhs) {
+	size_t width = bfs_bar_width(bar);
+	if (width < 3) {
 		return;
 	}
 
-	size_t rhslen = dstrlen(rhs);
+	size_t rhslen = strlen(rhs);
 	if (3 + rhslen > width) {
-		dstresize(&rhs, 0);
+		rhs = "";
 		rhslen = 0;
 	}
 
 	char *status = dstralloc(0);
 	if (!status) {
-		goto out_rhs;
-	}
-
-	const char *path = ftwbuf->path;
-	size_t pathlen = ftwbuf->nameoff;
-	if (ftwbuf->depth == 0) {
-		pathlen = strlen(path);
+		return;
 	}
 
 	// Try to make sure even wide characters fit in the status bar
@@ -1143,7 +2166,7 @@ static void eval_status(struct bfs_eval *state, struct bfs_bar *bar, struct time
 		}
 
 		if (dstrncat(&status, path, len) != 0) {
-			goto out_rhs;
+			goto out;
 		}
 
 		path += len;
@@ -1152,48 +2175,181 @@ static void eval_status(struct bfs_eval *state, struct bfs_bar *bar, struct time
 	}
 
 	if (dstrcat(&status, "...") != 0) {
-		goto out_rhs;
+		goto out;
 	}
 
 	while (pathwidth < pathmax) {
 		if (dstrapp(&status, ' ') != 0) {
-			goto out_rhs;
+			goto out;
 		}
 		++pathwidth;
 	}
 
 	if (dstrcat(&status, rhs) != 0) {
-		goto out_rhs;
+		goto out;
 	}
 
 	bfs_bar_update(bar, status);
 
+out:
 	dstrfree(status);
-out_rhs:
-	dstrfree(rhs);
+}
+
+/** Add some nanoseconds to a timespec. */
+static void timespec_add_ns(struct timespec *ts, long ns) {
+	ts->tv_nsec += ns;
+	while (ts->tv_nsec >= 1000000000L) {
+		ts->tv_nsec -= 1000000000L;
+		++ts->tv_sec;
+	}
+}
+
+/** Status bar update interval (0.1s). */
+#define STATUS_INTERVAL_NS 100000000L
+
+/** Status thread entry point.  Redraws the bar periodically from the counters. */
+static void *eval_status_work(void *ptr) {
+	struct eval_status *status = ptr;
+	const struct bftw_progress *progress = &status->progress;
+
+	struct timespec last;
+	clock_gettime(CLOCK_REALTIME, &last);
+	size_t last_entries = 0;
+	size_t rate = 0;
+
+	pthread_mutex_lock(&status->mutex);
+
+	while (!status->stop) {
+		struct timespec deadline = last;
+		timespec_add_ns(&deadline, STATUS_INTERVAL_NS);
+		if (pthread_cond_timedwait(&status->stopped, &status->mutex, &deadline) != ETIMEDOUT) {
+			continue;
+		}
+
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		struct timespec elapsed = {0};
+		timespec_elapsed(&elapsed, &last, &now);
+		last = now;
+
+		size_t entries = atomic_load_explicit(&progress->entries, memory_order_relaxed);
+		size_t dirs = atomic_load_explicit(&progress->dirs, memory_order_relaxed);
+		size_t queued = atomic_load_explicit(&progress->queued, memory_order_relaxed);
+
+		double secs = elapsed.tv_sec + elapsed.tv_nsec / 1.0e9;
+		if (secs > 0.0) {
+			rate = (entries - last_entries) / secs;
+		}
+		last_entries = entries;
+
+		char *rhs = dstrprintf(" (entries: %zu, %zu/s, dirs: %zu, queued: %zu, depth: %2zu)",
+			entries, rate, dirs, queued, status->depth);
+		if (rhs) {
+			const char *path = status->path;
+			eval_status_draw(status->bar, path, dstrlen(path), rhs);
+			dstrfree(rhs);
+		}
+
+		atomic_store_explicit(&status->want_path, true, memory_order_relaxed);
+	}
+
+	pthread_mutex_unlock(&status->mutex);
+	return NULL;
+}
+
+/** Show the status bar and start the thread that updates it. */
+static struct eval_status *eval_status_start(void) {
+	struct eval_status *status = malloc(sizeof(*status));
+	if (!status) {
+		return NULL;
+	}
+
+	int ret = 0;
+
+	atomic_init(&status->progress.dirs, 0);
+	atomic_init(&status->progress.entries, 0);
+	atomic_init(&status->progress.queued, 0);
+	atomic_init(&status->want_path, true);
+	status->stop = false;
+	status->depth = 0;
+
+	status->path = dstralloc(0);
+	if (!status->path) {
+		goto fail_free;
+	}
+
+	ret = pthread_mutex_init(&status->mutex, NULL);
+	if (ret != 0) {
+		goto fail_path;
+	}
+
+	ret = pthread_cond_init(&status->stopped, NULL);
+	if (ret != 0) {
+		goto fail_mutex;
+	}
+
+	status->bar = bfs_bar_show();
+	if (!status->bar) {
+		goto fail_cond;
+	}
+
+	ret = pthread_create(&status->thread, NULL, eval_status_work, status);
+	if (ret != 0) {
+		bfs_bar_hide(status->bar);
+		goto fail_cond;
+	}
+
+	return status;
+
+fail_cond:
+	pthread_cond_destroy(&status->stopped);
+fail_mutex:
+	pthread_mutex_destroy(&status->mutex);
+fail_path:
+	dstrfree(status->path);
+fail_free:
+	free(status);
+	if (ret != 0) {
+		errno = ret;
+	}
+	return NULL;
+}
+
+/** Stop the status thread and hide the bar. */
+static void eval_status_stop(struct eval_status *status) {
+	if (!status) {
+		return;
+	}
+
+	pthread_mutex_lock(&status->mutex);
+	status->stop = true;
+	pthread_cond_signal(&status->stopped);
+	pthread_mutex_unlock(&status->mutex);
+	pthread_join(status->thread, NULL);
+
+	bfs_bar_hide(status->bar);
+
+	pthread_cond_destroy(&status->stopped);
+	pthread_mutex_destroy(&status->mutex);
+	dstrfree(status->path);
+	free(status);
 }
 
 /** Check if we've seen a file before. */
-static bool eval_file_unique(struct bfs_eval *state, struct trie *seen) {
+static bool eval_file_unique(struct bfs_eval *state, struct bfs_idset *seen) {
 	const struct bfs_stat *statbuf = eval_stat(state);
 	if (!statbuf) {
 		return false;
 	}
 
-	bfs_file_id id;
-	bfs_stat_id(statbuf, &id);
-
-	struct trie_leaf *leaf = trie_insert_mem(seen, id, sizeof(id));
-	if (!leaf) {
+	int ret = bfs_idset_insert(seen, statbuf->dev, statbuf->ino);
+	if (ret < 0) {
 		eval_report_error(state);
 		return false;
-	}
-
-	if (leaf->value) {
+	} else if (ret == 0) {
 		state->action = BFTW_PRUNE;
 		return false;
 	} else {
-		leaf->value = leaf;
 		return true;
 	}
 }
@@ -1309,6 +2465,43 @@ static const char *dump_bftw_action(enum bftw_action action) {
 	return actions[action];
 }
 
+/**
+ * A file's output, kept by -top.
+ */
+struct eval_top_ent {
+	/** The sort key (a size, or the seconds of a time). */
+	long long key;
+	/** The nanoseconds of a time key. */
+	long nsec;
+	/** The order the file was found in, to break ties. */
+	size_t seq;
+	/** The output for the file. */
+	char *text;
+	/** The length of the output. */
+	size_t len;
+};
+
+/**
+ * -top state.  While it's active, standard output is redirected to a memory
+ * stream, so whatever the expression prints for each file can be ranked.
+ */
+struct eval_top {
+	/** The real standard output stream. */
+	FILE *out;
+	/** The memory stream capturing the current file's output. */
+	FILE *capture;
+	/** The capture stream's buffer. */
+	char *buf;
+	/** The capture stream's size. */
+	size_t size;
+	/** A min-heap of the best files so far. */
+	struct eval_top_ent *heap;
+	/** The number of files in the heap. */
+	size_t count;
+	/** The number of files ranked so far. */
+	size_t seq;
+};
+
 /**
  * Type passed as the argument to the bftw() callback.
  */
@@ -1316,20 +2509,273 @@ struct callback_args {
 	/** The bfs context. */
 	const struct bfs_ctx *ctx;
 
-	/** The status bar. */
-	struct bfs_bar *bar;
-	/** The time of the last status update. */
-	struct timespec last_status;
+	/** The status bar, if shown. */
+	struct eval_status *status;
 	/** The number of files visited so far. */
 	size_t count;
+	/** The file count at which to next re-order the expression tree. */
+	size_t reorder_at;
 
 	/** The set of seen files. */
-	struct trie *seen;
+	struct bfs_idset *seen;
+	/** Memoized subexpression results, one per bfs_ctx::nmemo. */
+	struct eval_memo *memo;
+	/** The flattened exclude expression, if the tree interpreter isn't needed. */
+	struct eval_insn *exclude_program;
+	/** The flattened main expression, if the tree interpreter isn't needed. */
+	struct eval_insn *expr_program;
+
+	/** The leading conjuncts of the expression that only need a bfs_dirent (a darray). */
+	const struct bfs_expr **filters;
+
+	/** Background -delete state, if the queue exists. */
+	struct eval_deleter deleter;
+	/** Whether the expression leaves directory contents alone. */
+	bool nentries_ok;
+
+	/** A buffer for the name of a root with trailing slashes. */
+	char *root_name;
+
+	/** The number of files that matched, for -limit. */
+	size_t matches;
+	/** -top state. */
+	struct eval_top top;
+	/** -summarize state. */
+	struct eval_summary summary;
 
 	/** Eventual return value from bfs_eval(). */
 	int ret;
 };
 
+/** Time one out of every this many files for adaptive optimization. */
+#define SAMPLE_INTERVAL 16
+/** Re-order the expression tree for the first time after this many files. */
+#define MIN_REORDER_INTERVAL 1024
+/** The most files between re-orderings of the expression tree. */
+#define MAX_REORDER_INTERVAL (1 << 20)
+
+/**
+ * Check whether a directory is too old for anything beneath it to match, under
+ * -assume-dir-mtime.  The directory itself is still evaluated as usual.
+ */
+static bool eval_dir_is_stale(const struct bfs_eval *state) {
+	const struct bfs_ctx *ctx = state->ctx;
+	if (ctx->dir_mtime_min == LLONG_MIN) {
+		return false;
+	}
+
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	if (ftwbuf->type != BFS_DIR) {
+		return false;
+	}
+
+	// Don't report errors here; they'll be reported by the expression if needed
+	const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+	if (!statbuf || !(statbuf->mask & BFS_STAT_MTIME)) {
+		return false;
+	}
+
+	return statbuf->mtime.tv_sec < ctx->dir_mtime_min;
+}
+
+/** Check whether to measure expression costs at runtime. */
+static bool eval_should_sample(const struct bfs_ctx *ctx) {
+	return ctx->optlevel >= 4 || ctx->opt_profile_path;
+}
+
+/** Check whether the per-expression statistics are needed. */
+static bool eval_needs_stats(const struct bfs_ctx *ctx) {
+	return eval_should_sample(ctx) || (ctx->debug & (DEBUG_PROF | DEBUG_RATES));
+}
+
+/** Evaluate a top-level expression, using its flattened form if available. */
+static bool eval_root(struct bfs_expr *expr, const struct eval_insn *program, struct bfs_eval *state) {
+	if (program) {
+		return eval_program(program, state);
+	} else {
+		return eval_expr(expr, state);
+	}
+}
+
+/**
+ * Check if the current shard owns a file at -shard-depth.  Files are assigned
+ * by a hash of their path relative to the root, so every node agrees on the
+ * split without coordinating, even if they mount the tree in different places.
+ */
+static bool eval_shard_owns(const struct bfs_ctx *ctx, const struct BFTW *ftwbuf) {
+	const char *path = ftwbuf->path;
+	if (ftwbuf->depth > 0) {
+		// Skip the separator too, whether or not the root ends with one
+		path += strlen(ftwbuf->root);
+		path += strspn(path, "/");
+	}
+
+	// FNV-1a
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	for (const char *c = path; *c; ++c) {
+		hash ^= (unsigned char)*c;
+		hash *= UINT64_C(0x100000001b3);
+	}
+
+	return hash % ctx->shard_count == (uint64_t)ctx->shard_index;
+}
+
+/** Compare -top entries, ranking better ones higher. */
+static int eval_top_cmp(const struct eval_top_ent *lhs, const struct eval_top_ent *rhs) {
+	if (lhs->key != rhs->key) {
+		return lhs->key < rhs->key ? -1 : 1;
+	} else if (lhs->nsec != rhs->nsec) {
+		return lhs->nsec < rhs->nsec ? -1 : 1;
+	} else if (lhs->seq != rhs->seq) {
+		// Earlier files win ties
+		return lhs->seq < rhs->seq ? 1 : -1;
+	} else {
+		return 0;
+	}
+}
+
+/** Restore the heap property below a -top heap entry. */
+static void eval_top_sift_down(struct eval_top_ent *heap, size_t count, size_t i) {
+	while (true) {
+		size_t min = i;
+		size_t left = 2 * i + 1;
+		size_t right = left + 1;
+		if (left < count && eval_top_cmp(&heap[left], &heap[min]) < 0) {
+			min = left;
+		}
+		if (right < count && eval_top_cmp(&heap[right], &heap[min]) < 0) {
+			min = right;
+		}
+		if (min == i) {
+			break;
+		}
+
+		struct eval_top_ent tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+/** Restore the heap property above a -top heap entry. */
+static void eval_top_sift_up(struct eval_top_ent *heap, size_t i) {
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (eval_top_cmp(&heap[i], &heap[parent]) >= 0) {
+			break;
+		}
+
+		struct eval_top_ent tmp = heap[i];
+		heap[i] = heap[parent];
+		heap[parent] = tmp;
+		i = parent;
+	}
+}
+
+/** Start capturing standard output for -top. */
+static int eval_top_start(const struct bfs_ctx *ctx, struct eval_top *top) {
+	top->heap = malloc(ctx->top * sizeof(*top->heap));
+	if (!top->heap) {
+		bfs_perror(ctx, "malloc()");
+		return -1;
+	}
+
+	top->capture = open_memstream(&top->buf, &top->size);
+	if (!top->capture) {
+		bfs_perror(ctx, "open_memstream()");
+		return -1;
+	}
+
+	fflush(ctx->cout->file);
+	top->out = ctx->cout->file;
+	ctx->cout->file = top->capture;
+	return 0;
+}
+
+/** Rank the output of the current file for -top. */
+static void eval_top_record(struct eval_top *top, struct bfs_eval *state) {
+	const struct bfs_ctx *ctx = state->ctx;
+
+	if (fflush(top->capture) != 0) {
+		return;
+	}
+	off_t len = ftello(top->capture);
+	if (len <= 0) {
+		return;
+	}
+	rewind(top->capture);
+
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return;
+	}
+
+	struct eval_top_ent ent = {
+		.seq = top->seq++,
+		.len = len,
+	};
+	if (ctx->top_field == BFS_STAT_SIZE) {
+		ent.key = statbuf->size;
+	} else {
+		const struct timespec *time = bfs_stat_time(statbuf, ctx->top_field);
+		if (!time) {
+			eval_report_error(state);
+			return;
+		}
+		ent.key = time->tv_sec;
+		ent.nsec = time->tv_nsec;
+	}
+
+	size_t max = ctx->top;
+	if (top->count == max && eval_top_cmp(&ent, &top->heap[0]) <= 0) {
+		return;
+	}
+
+	ent.text = malloc(ent.len);
+	if (!ent.text) {
+		eval_report_error(state);
+		return;
+	}
+	memcpy(ent.text, top->buf, ent.len);
+
+	if (top->count < max) {
+		top->heap[top->count] = ent;
+		eval_top_sift_up(top->heap, top->count++);
+	} else {
+		free(top->heap[0].text);
+		top->heap[0] = ent;
+		eval_top_sift_down(top->heap, top->count, 0);
+	}
+}
+
+/** Stop capturing standard output, and print the -top files, best first. */
+static void eval_top_finish(const struct bfs_ctx *ctx, struct eval_top *top) {
+	if (top->capture) {
+		ctx->cout->file = top->out;
+		fclose(top->capture);
+		free(top->buf);
+	}
+
+	if (!top->heap) {
+		return;
+	}
+
+	// Heapsort the entries, leaving the best ones first
+	for (size_t n = top->count; n > 1; --n) {
+		struct eval_top_ent tmp = top->heap[0];
+		top->heap[0] = top->heap[n - 1];
+		top->heap[n - 1] = tmp;
+		eval_top_sift_down(top->heap, n - 1, 0);
+	}
+
+	for (size_t i = 0; i < top->count; ++i) {
+		struct eval_top_ent *ent = &top->heap[i];
+		fwrite(ent->text, 1, ent->len, ctx->cout->file);
+		free(ent->text);
+	}
+	free(top->heap);
+}
+
 /**
  * bftw() callback.
  */
@@ -1339,15 +2785,49 @@ static enum bftw_action eval_callback(const struct BFTW *ftwbuf, void *ptr) {
 
 	const struct bfs_ctx *ctx = args->ctx;
 
+	struct timespec prof_start;
+	bool prof = (ctx->debug & DEBUG_PROF) && bfs_prof_begin(&prof_start);
+	if (prof && bfs_prof_requested()) {
+		bfs_prof_dump(stderr);
+	}
+
 	struct bfs_eval state;
 	state.ftwbuf = ftwbuf;
+	state.file = args->count;
+	state.memo = args->memo;
 	state.ctx = ctx;
 	state.action = BFTW_CONTINUE;
 	state.ret = &args->ret;
+	state.deleter = args->deleter.ioq ? &args->deleter : NULL;
+	state.summary = ctx->nsummary_fields > 0 ? &args->summary : NULL;
+	state.nentries_ok = args->nentries_ok;
 	state.quit = false;
+	state.sample = false;
+	state.root_name = &args->root_name;
+
+	if (eval_should_sample(ctx)) {
+		state.sample = args->count % SAMPLE_INTERVAL == 0;
+		if (ctx->optlevel >= 4 && args->count == args->reorder_at) {
+			bfs_reoptimize(ctx);
+			args->reorder_at += args->reorder_at < MAX_REORDER_INTERVAL ? args->reorder_at : MAX_REORDER_INTERVAL;
+		}
+	}
+
+	if (args->status) {
+		eval_status_publish(args->status, ftwbuf);
+	}
 
-	if (args->bar) {
-		eval_status(&state, args->bar, &args->last_status, args->count);
+	// Every shard walks down to -shard-depth, but only the first one
+	// evaluates the files above it
+	bool in_shard = true;
+	if (ctx->shard_count > 1) {
+		size_t shard_depth = ctx->shard_depth;
+		if (ftwbuf->depth == shard_depth && !eval_shard_owns(ctx, ftwbuf)) {
+			state.action = BFTW_PRUNE;
+			goto done;
+		} else if (ftwbuf->depth < shard_depth) {
+			in_shard = ctx->shard_index == 0;
+		}
 	}
 
 	if (ftwbuf->type == BFS_ERROR) {
@@ -1358,13 +2838,24 @@ static enum bftw_action eval_callback(const struct BFTW *ftwbuf, void *ptr) {
 		goto done;
 	}
 
-	if (ctx->unique && ftwbuf->visit == BFTW_PRE) {
+	// In -depth mode, only handle directories on the BFTW_POST visit
+	enum bftw_visit expected_visit = BFTW_PRE;
+	if ((ctx->flags & BFTW_POST_ORDER)
+	    && (ctx->strategy == BFTW_IDS || ftwbuf->type == BFS_DIR)
+	    && ftwbuf->depth < (size_t)ctx->maxdepth) {
+		expected_visit = BFTW_POST;
+	}
+
+	// Directories must be checked before they're descended into, but other
+	// files only once they're evaluated, since -S ids visits them twice
+	enum bftw_visit unique_visit = ftwbuf->type == BFS_DIR ? BFTW_PRE : expected_visit;
+	if (ctx->unique && ftwbuf->visit == unique_visit) {
 		if (!eval_file_unique(&state, args->seen)) {
 			goto done;
 		}
 	}
 
-	if (eval_expr(ctx->exclude, &state)) {
+	if (eval_root(ctx->exclude, args->exclude_program, &state)) {
 		state.action = BFTW_PRUNE;
 		goto done;
 	}
@@ -1379,21 +2870,36 @@ static enum bftw_action eval_callback(const struct BFTW *ftwbuf, void *ptr) {
 		state.action = BFTW_PRUNE;
 	}
 
-	// In -depth mode, only handle directories on the BFTW_POST visit
-	enum bftw_visit expected_visit = BFTW_PRE;
-	if ((ctx->flags & BFTW_POST_ORDER)
-	    && (ctx->strategy == BFTW_IDS || ftwbuf->type == BFS_DIR)
-	    && ftwbuf->depth < (size_t)ctx->maxdepth) {
-		expected_visit = BFTW_POST;
+	if (ftwbuf->visit == BFTW_PRE && eval_dir_is_stale(&state)) {
+		state.action = BFTW_PRUNE;
 	}
 
-	if (ftwbuf->visit == expected_visit
+	if (in_shard
+	    && ftwbuf->visit == expected_visit
 	    && ftwbuf->depth >= (size_t)ctx->mindepth
 	    && ftwbuf->depth <= (size_t)ctx->maxdepth) {
-		eval_expr(ctx->expr, &state);
+		bool match = eval_root(ctx->expr, args->expr_program, &state);
+
+		if (args->top.capture) {
+			eval_top_record(&args->top, &state);
+		}
+
+		// -limit: stop once enough files have matched
+		if (match && ctx->limit > 0 && ++args->matches >= (size_t)ctx->limit) {
+			state.action = BFTW_STOP;
+		}
+	}
+
+	// -summarize: every directory's totals are complete after its post-order visit
+	if (state.summary && ftwbuf->type == BFS_DIR && ftwbuf->visit == BFTW_POST) {
+		eval_summary_finish_dir(&state);
 	}
 
 done:
+	if (prof) {
+		bfs_prof_end(BFS_PROF_CALLBACK, &prof_start);
+	}
+
 	debug_stats(ctx, ftwbuf);
 
 	if (bfs_debug(ctx, DEBUG_SEARCH, "eval_callback({\n")) {
@@ -1409,6 +2915,102 @@ done:
 	return state.action;
 }
 
+/** Check if an expression can be evaluated with only a directory entry. */
+static bool eval_dirent_ok(const struct bfs_expr *expr) {
+	if (expr->eval_fn == eval_and || expr->eval_fn == eval_or) {
+		return eval_dirent_ok(expr->lhs) && eval_dirent_ok(expr->rhs);
+	} else if (expr->eval_fn == eval_not) {
+		return eval_dirent_ok(expr->rhs);
+	} else {
+		return expr->eval_fn == eval_true
+			|| expr->eval_fn == eval_false
+			|| expr->eval_fn == eval_name
+			|| expr->eval_fn == eval_name_set
+			|| expr->eval_fn == eval_type;
+	}
+}
+
+/** Evaluate an expression for a directory entry, without a full visit. */
+static bool eval_dirent(const struct bfs_expr *expr, const struct bfs_dirent *de) {
+	if (expr->eval_fn == eval_and) {
+		return eval_dirent(expr->lhs, de) && eval_dirent(expr->rhs, de);
+	} else if (expr->eval_fn == eval_or) {
+		return eval_dirent(expr->lhs, de) || eval_dirent(expr->rhs, de);
+	} else if (expr->eval_fn == eval_not) {
+		return !eval_dirent(expr->rhs, de);
+	} else if (expr->eval_fn == eval_name) {
+		return bfs_glob_match(expr->glob, de->name);
+	} else if (expr->eval_fn == eval_name_set) {
+		return bfs_globset_match(expr->globset, de->name);
+	} else if (expr->eval_fn == eval_type) {
+		return (1 << de->type) & expr->num;
+	} else {
+		return expr->eval_fn == eval_true;
+	}
+}
+
+/**
+ * Collect the leading conjuncts of an expression that can be evaluated with
+ * only a directory entry.
+ *
+ * @return
+ *         Whether the whole expression was collected.
+ */
+static bool eval_collect_filters(const struct bfs_expr *expr, const struct bfs_expr ***filters) {
+	if (expr->eval_fn == eval_and) {
+		return eval_collect_filters(expr->lhs, filters) && eval_collect_filters(expr->rhs, filters);
+	} else if (eval_dirent_ok(expr)) {
+		return DARRAY_PUSH(filters, &expr) == 0;
+	} else {
+		return false;
+	}
+}
+
+/**
+ * bftw() batch callback.  Entries that fail one of the leading pure
+ * conjuncts can't do anything when visited, so they are skipped.  The
+ * conjuncts are applied one at a time across the whole batch.
+ */
+static void eval_batch_callback(const struct bftw_batch *batch, bool *skip, void *ptr) {
+	const struct callback_args *args = ptr;
+	const struct bfs_ctx *ctx = args->ctx;
+
+	if (batch->depth < (size_t)ctx->mindepth) {
+		for (size_t i = 0; i < batch->count; ++i) {
+			skip[i] = true;
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < darray_length(args->filters); ++i) {
+		const struct bfs_expr *filter = args->filters[i];
+		for (size_t j = 0; j < batch->count; ++j) {
+			if (!skip[j]) {
+				skip[j] = !eval_dirent(filter, &batch->entries[j]);
+			}
+		}
+	}
+}
+
+/** Check whether eval_callback() can be skipped for files that do nothing. */
+static bool eval_can_batch(const struct bfs_ctx *ctx, const struct callback_args *args) {
+	if (ctx->exclude != &bfs_false || ctx->unique || ctx->xargs_safe || ctx->shard_count > 1) {
+		return false;
+	}
+
+	// Skipped files don't show up in the debugging output
+	if (ctx->debug & (DEBUG_RATES | DEBUG_SEARCH | DEBUG_STAT)) {
+		return false;
+	}
+
+	// The optimizer profile should measure every evaluation
+	if (ctx->opt_profile_path) {
+		return false;
+	}
+
+	return darray_length(args->filters) > 0 || ctx->mindepth > 1;
+}
+
 /** Check if an rlimit value is infinite. */
 static bool rlim_isinf(rlim_t r) {
 	// Consider RLIM_{INFINITY,SAVED_{CUR,MAX}} all equally infinite
@@ -1464,16 +3066,24 @@ static int raise_fdlimit(const struct bfs_ctx *ctx) {
 	return ret;
 }
 
+/** Only count the open file descriptors when the limit is below this. */
+#define EVAL_FDLIMIT_SCAN 4096
+
 /** Infer the number of file descriptors available to bftw(). */
 static int infer_fdlimit(const struct bfs_ctx *ctx, int limit) {
 	// 3 for std{in,out,err}
 	int nopen = 3 + ctx->nfiles;
 
 	// Check /proc/self/fd for the current number of open fds, if possible
-	// (we may have inherited more than just the standard ones)
-	struct bfs_dir *dir = bfs_opendir(AT_FDCWD, "/proc/self/fd");
-	if (!dir) {
-		dir = bfs_opendir(AT_FDCWD, "/dev/fd");
+	// (we may have inherited more than just the standard ones).  That's
+	// only worth the syscalls when the limit is tight, since bftw() backs
+	// off from EMFILE anyway.
+	struct bfs_dir *dir = NULL;
+	if (limit < EVAL_FDLIMIT_SCAN) {
+		dir = bfs_opendir(AT_FDCWD, "/proc/self/fd");
+		if (!dir) {
+			dir = bfs_opendir(AT_FDCWD, "/dev/fd");
+		}
 	}
 	if (dir) {
 		// Account for 'dir' itself
@@ -1490,6 +3100,11 @@ static int infer_fdlimit(const struct bfs_ctx *ctx, int limit) {
 	ret -= ctx->expr->persistent_fds;
 	ret -= ctx->expr->ephemeral_fds;
 
+	// -delete-jobs keeps some directories open for its pending unlinks
+	if (ctx->delete_jobs > 1) {
+		ret -= EVAL_DELETE_MAX_DIRS;
+	}
+
 	// bftw() needs at least 2 available fds
 	if (ret < 2) {
 		ret = 2;
@@ -1513,6 +3128,8 @@ static void dump_bftw_flags(enum bftw_flags flags) {
 	DEBUG_FLAG(flags, BFTW_PRUNE_MOUNTS);
 	DEBUG_FLAG(flags, BFTW_SORT);
 	DEBUG_FLAG(flags, BFTW_BUFFER);
+	DEBUG_FLAG(flags, BFTW_PREFETCH_STAT);
+	DEBUG_FLAG(flags, BFTW_SNAPSHOT_CHECK);
 
 	assert(!flags);
 }
@@ -1530,6 +3147,25 @@ static const char *dump_bftw_strategy(enum bftw_strategy strategy) {
 	return strategies[strategy];
 }
 
+/** Check if an expression could add or remove directory entries itself. */
+static bool eval_may_mutate(const struct bfs_expr *expr) {
+	if (expr->eval_fn == eval_delete || expr->eval_fn == eval_exec || expr->eval_fn == eval_copy_to) {
+		return true;
+	}
+
+	if (bfs_expr_has_children(expr)) {
+		if (expr->lhs && eval_may_mutate(expr->lhs)) {
+			return true;
+		}
+
+		if (expr->rhs && eval_may_mutate(expr->rhs)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 /** Check if we need to enable BFTW_BUFFER. */
 static bool eval_must_buffer(const struct bfs_expr *expr) {
 #if __FreeBSD__
@@ -1541,66 +3177,190 @@ static bool eval_must_buffer(const struct bfs_expr *expr) {
 	//
 	// https://bugs.freebsd.org/bugzilla/show_bug.cgi?id=57696
 	// https://github.com/tavianator/bfs/issues/67
+	return eval_may_mutate(expr);
+#else
+	return false;
+#endif
+}
 
-	if (expr->eval_fn == eval_delete || expr->eval_fn == eval_exec) {
+/** Check if an expression contains -delete. */
+static bool eval_has_delete(const struct bfs_expr *expr) {
+	if (expr->eval_fn == eval_delete) {
 		return true;
 	}
 
 	if (bfs_expr_has_children(expr)) {
-		if (expr->lhs && eval_must_buffer(expr->lhs)) {
+		if (expr->lhs && eval_has_delete(expr->lhs)) {
 			return true;
 		}
 
-		if (expr->rhs && eval_must_buffer(expr->rhs)) {
+		if (expr->rhs && eval_has_delete(expr->rhs)) {
 			return true;
 		}
 	}
-#endif // __FreeBSD__
 
 	return false;
 }
 
-int bfs_eval(const struct bfs_ctx *ctx) {
-	if (!ctx->expr) {
-		return EXIT_SUCCESS;
+/** Check if an expression is likely to need stat() info. */
+static bool eval_must_stat(const struct bfs_expr *expr) {
+	static bfs_eval_fn *const stat_fns[] = {
+		eval_empty,
+		eval_flags,
+		eval_fls,
+		eval_fprintb,
+		eval_fprintj,
+		eval_fstype,
+		eval_gid,
+		eval_inum,
+		eval_links,
+		eval_newer,
+		eval_nogroup,
+		eval_nouser,
+		eval_perm,
+		eval_samefile,
+		eval_size,
+		eval_sparse,
+		eval_summarize,
+		eval_time,
+		eval_uid,
+		eval_used,
+	};
+	static const size_t n_stat_fns = sizeof(stat_fns)/sizeof(stat_fns[0]);
+
+	for (size_t i = 0; i < n_stat_fns; ++i) {
+		if (expr->eval_fn == stat_fns[i]) {
+			return true;
+		}
+	}
+
+	if (bfs_expr_has_children(expr)) {
+		if (expr->lhs && eval_must_stat(expr->lhs)) {
+			return true;
+		}
+
+		if (expr->rhs && eval_must_stat(expr->rhs)) {
+			return true;
+		}
 	}
 
+	return false;
+}
+
+/** Search some root paths in this process. */
+static int eval_walk(const struct bfs_ctx *ctx, const char **paths, size_t npaths) {
 	struct callback_args args = {
 		.ctx = ctx,
+		.reorder_at = MIN_REORDER_INTERVAL,
 		.ret = EXIT_SUCCESS,
 	};
+	eval_summary_init(&args.summary);
+
+	if (ctx->unique) {
+		args.seen = bfs_idset_new();
+		if (!args.seen) {
+			bfs_perror(ctx, "bfs_idset_new()");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (ctx->nmemo > 0) {
+		// Files are numbered from 1, so zeroed entries don't match any file
+		args.memo = calloc(ctx->nmemo, sizeof(*args.memo));
+		if (!args.memo) {
+			bfs_perror(ctx, "calloc()");
+			args.ret = EXIT_FAILURE;
+			goto done;
+		}
+	}
+
+	if (!eval_needs_stats(ctx)) {
+		args.exclude_program = eval_flatten(ctx->exclude);
+		args.expr_program = eval_flatten(ctx->expr);
+		if (!args.exclude_program || !args.expr_program) {
+			bfs_perror(ctx, "eval_flatten()");
+			args.ret = EXIT_FAILURE;
+			goto done;
+		}
+	}
+
+	// -delete and friends can empty a directory before its post-order visit
+	args.nentries_ok = !eval_may_mutate(ctx->expr);
+
+	if (ctx->delete_jobs > 1 && eval_has_delete(ctx->expr)) {
+		args.deleter.ctx = ctx;
+		args.deleter.ret = &args.ret;
+		args.deleter.ioq = ioq_create(EVAL_DELETE_DEPTH, ctx->delete_jobs);
+		if (!args.deleter.ioq) {
+			bfs_perror(ctx, "ioq_create()");
+			args.ret = EXIT_FAILURE;
+			goto done;
+		}
+	}
 
 	if (ctx->status) {
-		args.bar = bfs_bar_show();
-		if (!args.bar) {
+		args.status = eval_status_start();
+		if (!args.status) {
 			bfs_warning(ctx, "Couldn't show status bar: %m.\n\n");
 		}
 	}
 
-	struct trie seen;
-	if (ctx->unique) {
-		trie_init(&seen);
-		args.seen = &seen;
+	if (ctx->top > 0 && eval_top_start(ctx, &args.top) != 0) {
+		args.ret = EXIT_FAILURE;
+		goto done;
+	}
+
+	if (ctx->debug & DEBUG_PROF) {
+		bfs_prof_enable();
 	}
 
+	bfs_dir_bufsize((size_t)ctx->readdir_min << 10, (size_t)ctx->readdir_max << 10);
+
 	int fdlimit = raise_fdlimit(ctx);
 	fdlimit = infer_fdlimit(ctx, fdlimit);
 
 	struct bftw_args bftw_args = {
-		.paths = ctx->paths,
-		.npaths = darray_length(ctx->paths),
+		.paths = paths,
+		.npaths = npaths,
 		.callback = eval_callback,
 		.ptr = &args,
 		.nopenfd = fdlimit,
+		.nthreads = ctx->threads,
 		.flags = ctx->flags,
 		.strategy = ctx->strategy,
-		.mtab = bfs_ctx_mtab(ctx),
+		.stat_fields = ctx->stat_fields,
+		.queue_limit = ctx->queue_limit,
+		.snapshot = ctx->snapshot,
+		.record = ctx->snapshot_save,
 	};
 
+	if (args.status) {
+		bftw_args.progress = &args.status->progress;
+	}
+
+	struct bftw_stats stats = {0};
+	if (ctx->debug & DEBUG_SEARCH) {
+		bftw_args.stats = &stats;
+	}
+
 	if (eval_must_buffer(ctx->expr)) {
 		bftw_args.flags |= BFTW_BUFFER;
 	}
 
+	if (ctx->unique || eval_must_stat(ctx->expr)) {
+		bftw_args.flags |= BFTW_PREFETCH_STAT;
+	}
+
+	// bftw() only needs the mount table to know when it can trust d_type
+	if (!(bftw_args.flags & BFTW_STAT)) {
+		bftw_args.mtab = bfs_ctx_mtab(ctx);
+	}
+
+	eval_collect_filters(ctx->expr, &args.filters);
+	if (eval_can_batch(ctx, &args)) {
+		bftw_args.batch_callback = eval_batch_callback;
+	}
+
 	if (bfs_debug(ctx, DEBUG_SEARCH, "bftw({\n")) {
 		fprintf(stderr, "\t.paths = {\n");
 		for (size_t i = 0; i < bftw_args.npaths; ++i) {
@@ -1609,18 +3369,24 @@ int bfs_eval(const struct bfs_ctx *ctx) {
 		fprintf(stderr, "\t},\n");
 		fprintf(stderr, "\t.npaths = %zu,\n", bftw_args.npaths);
 		fprintf(stderr, "\t.callback = eval_callback,\n");
+		fprintf(stderr, "\t.batch_callback = %s,\n", bftw_args.batch_callback ? "eval_batch_callback" : "NULL");
 		fprintf(stderr, "\t.ptr = &args,\n");
 		fprintf(stderr, "\t.nopenfd = %d,\n", bftw_args.nopenfd);
+		fprintf(stderr, "\t.nthreads = %zu,\n", bftw_args.nthreads);
 		fprintf(stderr, "\t.flags = ");
 		dump_bftw_flags(bftw_args.flags);
 		fprintf(stderr, ",\n\t.strategy = %s,\n", dump_bftw_strategy(bftw_args.strategy));
+		fprintf(stderr, "\t.stat_fields = 0x%X,\n", (unsigned int)bftw_args.stat_fields);
+		fprintf(stderr, "\t.queue_limit = %zu,\n", bftw_args.queue_limit);
 		fprintf(stderr, "\t.mtab = ");
 		if (bftw_args.mtab) {
 			fprintf(stderr, "ctx->mtab");
 		} else {
 			fprintf(stderr, "NULL");
 		}
-		fprintf(stderr, ",\n})\n");
+		fprintf(stderr, ",\n\t.snapshot = %s,\n", bftw_args.snapshot ? "ctx->snapshot" : "NULL");
+		fprintf(stderr, "\t.record = %s,\n", bftw_args.record ? "ctx->snapshot_save" : "NULL");
+		fprintf(stderr, "})\n");
 	}
 
 	if (bftw(&bftw_args) != 0) {
@@ -1628,17 +3394,365 @@ int bfs_eval(const struct bfs_ctx *ctx) {
 		bfs_perror(ctx, "bftw()");
 	}
 
+	if (args.deleter.ioq) {
+		eval_delete_drain(&args.deleter);
+	}
+
+	if (ctx->snapshot_save && bfs_snap_finish(ctx->snapshot_save) != 0) {
+		args.ret = EXIT_FAILURE;
+		bfs_error(ctx, "'%s': %m.\n", ctx->snapshot_save_path);
+	}
+
+	if (bfs_debug(ctx, DEBUG_SEARCH, "bftw_stats = {\n")) {
+		fprintf(stderr, "\t.nwalks = %zu,\n", stats.nwalks);
+		fprintf(stderr, "\t.peak_files = %zu,\n", stats.peak_files);
+		fprintf(stderr, "\t.peak_bytes = %zu,\n", stats.peak_bytes);
+		fprintf(stderr, "\t.cache_hits = %zu,\n", stats.cache_hits);
+		fprintf(stderr, "\t.cache_misses = %zu,\n", stats.cache_misses);
+		fprintf(stderr, "\t.cache_opens = %zu,\n", stats.cache_opens);
+		fprintf(stderr, "\t.cache_reopens = %zu,\n", stats.cache_reopens);
+		fprintf(stderr, "\t.cache_evictions = %zu,\n", stats.cache_evictions);
+		fprintf(stderr, "\t.listing_hits = %zu,\n", stats.listing_hits);
+		fprintf(stderr, "}\n");
+	}
+
 	if (eval_exec_finish(ctx->expr, ctx) != 0) {
 		args.ret = EXIT_FAILURE;
 	}
 
-	bfs_ctx_dump(ctx, DEBUG_RATES);
+	if (ctx->debug & DEBUG_PROF) {
+		bfs_prof_dump(stderr);
+	}
 
-	if (ctx->unique) {
-		trie_destroy(&seen);
+	if (ctx->opt_profile_path && bfs_opt_profile_save(ctx) != 0) {
+		args.ret = EXIT_FAILURE;
+		bfs_error(ctx, "'%s': %m.\n", ctx->opt_profile_path);
 	}
 
-	bfs_bar_hide(args.bar);
+	bfs_ctx_dump(ctx, DEBUG_RATES);
+
+done:
+	eval_top_finish(ctx, &args.top);
+	eval_summary_destroy(&args.summary);
+	while (args.deleter.dirs) {
+		eval_delete_dir_free(&args.deleter, args.deleter.dirs);
+	}
+	ioq_destroy(args.deleter.ioq);
+	darray_free(args.expr_program);
+	darray_free(args.exclude_program);
+	free(args.memo);
+	bfs_idset_free(args.seen);
+	darray_free(args.filters);
+	dstrfree(args.root_name);
+	eval_status_stop(args.status);
 
 	return args.ret;
 }
+
+/** Check if an expression can be split up between processes, one per root. */
+static bool eval_can_fork(const struct bfs_ctx *ctx, const struct bfs_expr *expr) {
+	// Actions whose effects span the whole search
+	if (expr->eval_fn == eval_quit || expr->eval_fn == eval_exit) {
+		return false;
+	}
+
+	// -ok and -okdir read from the terminal
+	if (expr->eval_fn == eval_exec && (expr->exec->flags & BFS_EXEC_CONFIRM)) {
+		return false;
+	}
+
+	// Output to anything but stdout/stderr would be interleaved arbitrarily
+	static bfs_eval_fn *const print_fns[] = {
+		eval_fls,
+		eval_fprint,
+		eval_fprint0,
+		eval_fprintb,
+		eval_fprintf,
+		eval_fprintj,
+		eval_fprintx,
+	};
+	static const size_t n_print_fns = sizeof(print_fns)/sizeof(print_fns[0]);
+
+	for (size_t i = 0; i < n_print_fns; ++i) {
+		if (expr->eval_fn == print_fns[i]) {
+			return expr->cfile == ctx->cout || expr->cfile == ctx->cerr;
+		}
+	}
+
+	if (bfs_expr_has_children(expr)) {
+		if (expr->lhs && !eval_can_fork(ctx, expr->lhs)) {
+			return false;
+		}
+
+		if (expr->rhs && !eval_can_fork(ctx, expr->rhs)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Check if we can search the roots in parallel (-root-jobs). */
+static bool eval_can_fork_roots(const struct bfs_ctx *ctx) {
+	if (ctx->root_jobs <= 1 || darray_length(ctx->paths) <= 1) {
+		return false;
+	}
+
+	// These all accumulate state across every root
+	if (ctx->unique || ctx->status || ctx->snapshot_save || ctx->opt_profile_path) {
+		return false;
+	}
+
+	// -limit and -top count or rank the results of every root together
+	if (ctx->limit > 0 || ctx->top > 0) {
+		return false;
+	}
+
+	if (ctx->debug & DEBUG_PROF) {
+		return false;
+	}
+
+	return eval_can_fork(ctx, ctx->exclude) && eval_can_fork(ctx, ctx->expr);
+}
+
+/**
+ * A root path being searched by a child process, for -root-jobs.
+ */
+struct eval_root {
+	/** The child process. */
+	pid_t pid;
+	/** The read end of the child's output pipe, or -1 once it's closed. */
+	int fd;
+	/** Output held back until the earlier roots are done (a dstring). */
+	char *output;
+	/** Whether the child has finished. */
+	bool done;
+};
+
+/** Search one root in a child process. */
+static int eval_root_spawn(const struct bfs_ctx *ctx, struct eval_root *roots, size_t i) {
+	int pipefd[2];
+	if (pipe_cloexec(pipefd) != 0) {
+		return -1;
+	}
+
+	// Anything still buffered would be written again by the child
+	bfs_ctx_flush(ctx);
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		close_quietly(pipefd[1]);
+		close_quietly(pipefd[0]);
+		return -1;
+	} else if (pid > 0) {
+		close_quietly(pipefd[1]);
+		roots[i].pid = pid;
+		roots[i].fd = pipefd[0];
+		return 0;
+	}
+
+	// Child
+	close_quietly(pipefd[0]);
+	for (size_t j = 0; j < i; ++j) {
+		if (roots[j].fd >= 0) {
+			close_quietly(roots[j].fd);
+		}
+	}
+
+	// Replace standard output with the pipe, underneath stdio too, so that
+	// commands run by -exec and -pipe-to write to it as well
+	if (pipefd[1] != STDOUT_FILENO) {
+		if (dup2(pipefd[1], STDOUT_FILENO) < 0) {
+			bfs_perror(ctx, "dup2()");
+			_exit(EXIT_FAILURE);
+		}
+		close_quietly(pipefd[1]);
+	}
+
+	// The background writer only starts after deciding not to fork
+	assert(!ctx->cout->writer);
+	FILE *file = ctx->cout->file;
+
+	int ret = eval_walk(ctx, &ctx->paths[i], 1);
+
+	if (fflush(file) != 0 || ferror(file)) {
+		bfs_perror(ctx, "(standard output)");
+		ret = EXIT_FAILURE;
+	}
+
+	_exit(ret);
+}
+
+/** Reap a finished child, returning its contribution to the exit status. */
+static int eval_root_reap(const struct bfs_ctx *ctx, struct eval_root *root) {
+	close_quietly(root->fd);
+	root->fd = -1;
+	root->done = true;
+
+	int wstatus;
+	pid_t pid;
+	do {
+		pid = waitpid(root->pid, &wstatus, 0);
+	} while (pid < 0 && errno == EINTR);
+
+	if (pid < 0) {
+		bfs_perror(ctx, "waitpid()");
+		return EXIT_FAILURE;
+	}
+
+	if (WIFEXITED(wstatus)) {
+		return WEXITSTATUS(wstatus) == EXIT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+	} else if (WIFSIGNALED(wstatus)) {
+		int sig = WTERMSIG(wstatus);
+		bfs_error(ctx, "Search of a root path terminated by signal %d (%s).\n", sig, strsignal(sig));
+	}
+
+	return EXIT_FAILURE;
+}
+
+/** Write some child output to our standard output. */
+static int eval_root_output(const struct bfs_ctx *ctx, const char *buf, size_t len) {
+	if (len > 0 && fwrite(buf, 1, len, ctx->cout->file) != len) {
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Search the roots in parallel, one child process each, and merge their output
+ * in order.  The earliest unfinished root's output is passed straight through,
+ * and the rest is buffered until its turn.
+ */
+static int eval_roots(const struct bfs_ctx *ctx) {
+	size_t nroots = darray_length(ctx->paths);
+	size_t njobs = ctx->root_jobs;
+
+	int ret = EXIT_SUCCESS;
+
+	struct eval_root *roots = calloc(nroots, sizeof(*roots));
+	struct pollfd *pfds = calloc(njobs, sizeof(*pfds));
+	size_t *indices = calloc(njobs, sizeof(*indices));
+	char *buf = malloc(BUFSIZ);
+	if (!roots || !pfds || !indices || !buf) {
+		bfs_perror(ctx, "calloc()");
+		ret = EXIT_FAILURE;
+		goto done;
+	}
+
+	for (size_t i = 0; i < nroots; ++i) {
+		roots[i].fd = -1;
+	}
+
+	size_t head = 0, next = 0, running = 0;
+	while (head < nroots) {
+		while (next < nroots && running < njobs) {
+			if (eval_root_spawn(ctx, roots, next) == 0) {
+				++running;
+			} else {
+				bfs_error(ctx, "'%s': Couldn't start a search process: %m.\n", ctx->paths[next]);
+				roots[next].done = true;
+				ret = EXIT_FAILURE;
+			}
+			++next;
+		}
+
+		// Flush the output of any finished roots, in order
+		while (head < nroots && roots[head].done) {
+			++head;
+			if (head < nroots && roots[head].output) {
+				if (eval_root_output(ctx, roots[head].output, dstrlen(roots[head].output)) != 0) {
+					bfs_perror(ctx, "(standard output)");
+					ret = EXIT_FAILURE;
+				}
+				dstrfree(roots[head].output);
+				roots[head].output = NULL;
+			}
+		}
+
+		if (running == 0) {
+			continue;
+		}
+
+		size_t npfds = 0;
+		for (size_t i = head; i < next; ++i) {
+			if (roots[i].fd >= 0) {
+				pfds[npfds].fd = roots[i].fd;
+				pfds[npfds].events = POLLIN;
+				indices[npfds] = i;
+				++npfds;
+			}
+		}
+
+		if (poll(pfds, npfds, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			bfs_perror(ctx, "poll()");
+			ret = EXIT_FAILURE;
+			break;
+		}
+
+		for (size_t i = 0; i < npfds; ++i) {
+			if (!pfds[i].revents) {
+				continue;
+			}
+
+			struct eval_root *root = &roots[indices[i]];
+			ssize_t len = read(root->fd, buf, BUFSIZ);
+			if (len < 0 && errno == EINTR) {
+				continue;
+			} else if (len <= 0) {
+				if (len < 0) {
+					bfs_perror(ctx, "read()");
+				}
+				if (eval_root_reap(ctx, root) != EXIT_SUCCESS || len < 0) {
+					ret = EXIT_FAILURE;
+				}
+				--running;
+			} else if (indices[i] == head) {
+				if (eval_root_output(ctx, buf, len) != 0) {
+					bfs_perror(ctx, "(standard output)");
+					ret = EXIT_FAILURE;
+				}
+			} else {
+				if (!root->output) {
+					root->output = dstralloc(len);
+				}
+				if (!root->output || dstrncat(&root->output, buf, len) != 0) {
+					bfs_perror(ctx, "dstrncat()");
+					ret = EXIT_FAILURE;
+				}
+			}
+		}
+	}
+
+done:
+	if (roots) {
+		// Only reached early on errors; don't leave children behind
+		for (size_t i = 0; i < nroots; ++i) {
+			if (roots[i].fd >= 0) {
+				eval_root_reap(ctx, &roots[i]);
+			}
+			dstrfree(roots[i].output);
+		}
+	}
+	free(buf);
+	free(indices);
+	free(pfds);
+	free(roots);
+	return ret;
+}
+
+int bfs_eval(const struct bfs_ctx *ctx) {
+	if (!ctx->expr) {
+		return EXIT_SUCCESS;
+	}
+
+	// The children mustn't inherit any threads, so this comes after forking
+	if (eval_can_fork_roots(ctx)) {
+		return eval_roots(ctx);
+	}
+
+	bfs_ctx_start_writer(ctx);
+	return eval_walk(ctx, ctx->paths, darray_length(ctx->paths));
+}
@@ -90,19 +90,27 @@ bool eval_xtype(const struct bfs_expr *expr, struct bfs_eval *state);
 
 bool eval_lname(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_name(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_name_set(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_path(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_regex(const struct bfs_expr *expr, struct bfs_eval *state);
 
+bool eval_chmod(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_chown(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_copy_to(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_delete(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_exec(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_exit(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fls(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fprint(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fprint0(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_fprintb(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fprintf(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_fprintj(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fprintx(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_prune(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_quit(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_summarize(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_touch(const struct bfs_expr *expr, struct bfs_eval *state);
 
 // Operator evaluation functions
 bool eval_not(const struct bfs_expr *expr, struct bfs_eval *state);
@@ -20,11 +20,15 @@
 #include "color.h"
 #include "diag.h"
 #include "dstring.h"
+#include "prof.h"
 #include "util.h"
+#include "writer.h"
 #include "xspawn.h"
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -43,7 +47,9 @@ static void bfs_exec_debug(const struct bfs_exec *execbuf, const char *format, .
 		return;
 	}
 
-	if (execbuf->flags & BFS_EXEC_CONFIRM) {
+	if (execbuf->flags & BFS_EXEC_PIPE) {
+		fputs("-pipe-to", stderr);
+	} else if (execbuf->flags & BFS_EXEC_CONFIRM) {
 		fputs("-ok", stderr);
 	} else {
 		fputs("-exec", stderr);
@@ -151,18 +157,25 @@ struct bfs_exec *bfs_exec_parse(const struct bfs_ctx *ctx, char **argv, enum bfs
 	execbuf->argv = NULL;
 	execbuf->argc = 0;
 	execbuf->argv_cap = 0;
+	execbuf->path_buf = NULL;
+	execbuf->arg_bufs = NULL;
 	execbuf->arg_size = 0;
 	execbuf->arg_max = 0;
 	execbuf->arg_min = 0;
 	execbuf->wd_fd = -1;
 	execbuf->wd_path = NULL;
 	execbuf->wd_len = 0;
+	execbuf->jobs = NULL;
+	execbuf->njobs = 0;
+	execbuf->pipes = NULL;
+	execbuf->next_pipe = 0;
+	execbuf->pipe_direct = false;
 	execbuf->ret = 0;
 
 	while (true) {
 		const char *arg = execbuf->tmpl_argv[execbuf->tmpl_argc];
 		if (!arg) {
-			if (execbuf->flags & BFS_EXEC_CONFIRM) {
+			if (execbuf->flags & (BFS_EXEC_CONFIRM | BFS_EXEC_PIPE)) {
 				bfs_exec_parse_error(ctx, execbuf);
 				bfs_error(ctx, "Expected '... ;'.\n");
 			} else {
@@ -174,7 +187,7 @@ struct bfs_exec *bfs_exec_parse(const struct bfs_ctx *ctx, char **argv, enum bfs
 			break;
 		} else if (strcmp(arg, "+") == 0) {
 			const char *prev = execbuf->tmpl_argv[execbuf->tmpl_argc - 1];
-			if (!(execbuf->flags & BFS_EXEC_CONFIRM) && strcmp(prev, "{}") == 0) {
+			if (!(execbuf->flags & (BFS_EXEC_CONFIRM | BFS_EXEC_PIPE)) && strcmp(prev, "{}") == 0) {
 				execbuf->flags |= BFS_EXEC_MULTI;
 				break;
 			}
@@ -196,7 +209,19 @@ struct bfs_exec *bfs_exec_parse(const struct bfs_ctx *ctx, char **argv, enum bfs
 		goto fail;
 	}
 
-	if (execbuf->flags & BFS_EXEC_MULTI) {
+	if (execbuf->flags & BFS_EXEC_PIPE) {
+		for (size_t i = 0; i < execbuf->tmpl_argc; ++i) {
+			char *arg = execbuf->tmpl_argv[i];
+			if (strstr(arg, "{}")) {
+				bfs_exec_parse_error(ctx, execbuf);
+				bfs_error(ctx, "'{}' is not supported; the paths are written to standard input.\n");
+				goto fail;
+			}
+			execbuf->argv[i] = arg;
+		}
+		execbuf->argc = execbuf->tmpl_argc;
+		execbuf->argv[execbuf->argc] = NULL;
+	} else if (execbuf->flags & BFS_EXEC_MULTI) {
 		for (size_t i = 0; i < execbuf->tmpl_argc - 1; ++i) {
 			char *arg = execbuf->tmpl_argv[i];
 			if (strstr(arg, "{}")) {
@@ -210,6 +235,12 @@ struct bfs_exec *bfs_exec_parse(const struct bfs_ctx *ctx, char **argv, enum bfs
 
 		execbuf->arg_max = bfs_exec_arg_max(execbuf);
 		execbuf->arg_min = execbuf->arg_max;
+	} else {
+		execbuf->arg_bufs = calloc(execbuf->tmpl_argc, sizeof(*execbuf->arg_bufs));
+		if (!execbuf->arg_bufs) {
+			bfs_perror(ctx, "calloc()");
+			goto fail;
+		}
 	}
 
 	return execbuf;
@@ -219,72 +250,73 @@ fail:
 	return NULL;
 }
 
-/** Format the current path for use as a command line argument. */
-static char *bfs_exec_format_path(const struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
+/** Clear a reusable dstring buffer, allocating it the first time. */
+static int bfs_exec_clear_buf(char **buf) {
+	if (!*buf) {
+		*buf = dstralloc(0);
+		if (!*buf) {
+			return -1;
+		}
+	}
+
+	return dstresize(buf, 0);
+}
+
+/**
+ * Format the current path for use as a command line argument.  The result is
+ * only valid until the next call.
+ */
+static const char *bfs_exec_format_path(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
 	if (!(execbuf->flags & BFS_EXEC_CHDIR)) {
-		return strdup(ftwbuf->path);
+		return ftwbuf->path;
 	}
 
 	const char *name = ftwbuf->path + ftwbuf->nameoff;
 
 	if (name[0] == '/') {
 		// Must be a root path ("/", "//", etc.)
-		return strdup(name);
+		return name;
 	}
 
 	// For compatibility with GNU find, use './name' instead of just 'name'
-	char *path = malloc(2 + strlen(name) + 1);
-	if (!path) {
+	if (bfs_exec_clear_buf(&execbuf->path_buf) != 0
+	    || dstrcat(&execbuf->path_buf, "./") != 0
+	    || dstrcat(&execbuf->path_buf, name) != 0) {
 		return NULL;
 	}
 
-	strcpy(path, "./");
-	strcpy(path + 2, name);
-
-	return path;
+	return execbuf->path_buf;
 }
 
-/** Format an argument, expanding "{}" to the current path. */
-static char *bfs_exec_format_arg(char *arg, const char *path) {
+/** Format an argument into a reusable buffer, expanding "{}" to the current path. */
+static char *bfs_exec_format_arg(char *arg, const char *path, char **buf) {
 	char *match = strstr(arg, "{}");
 	if (!match) {
 		return arg;
 	}
 
-	char *ret = dstralloc(0);
-	if (!ret) {
+	if (bfs_exec_clear_buf(buf) != 0) {
 		return NULL;
 	}
 
 	char *last = arg;
 	do {
-		if (dstrncat(&ret, last, match - last) != 0) {
-			goto err;
+		if (dstrncat(buf, last, match - last) != 0) {
+			return NULL;
 		}
-		if (dstrcat(&ret, path) != 0) {
-			goto err;
+		if (dstrcat(buf, path) != 0) {
+			return NULL;
 		}
 
 		last = match + 2;
 		match = strstr(last, "{}");
 	} while (match);
 
-	if (dstrcat(&ret, last) != 0) {
-		goto err;
+	if (dstrcat(buf, last) != 0) {
+		return NULL;
 	}
 
-	return ret;
-
-err:
-	dstrfree(ret);
-	return NULL;
-}
-
-/** Free a formatted argument. */
-static void bfs_exec_free_arg(char *arg, const char *tmpl) {
-	if (arg != tmpl) {
-		dstrfree(arg);
-	}
+	return *buf;
 }
 
 /** Open a file to use as the working directory. */
@@ -349,8 +381,8 @@ static void bfs_exec_closewd(struct bfs_exec *execbuf, const struct BFTW *ftwbuf
 	}
 }
 
-/** Actually spawn the process. */
-static int bfs_exec_spawn(const struct bfs_exec *execbuf) {
+/** Actually spawn the process, without waiting for it, optionally with a new standard input. */
+static pid_t bfs_exec_start(const struct bfs_exec *execbuf, int in_fd) {
 	if (execbuf->flags & BFS_EXEC_CONFIRM) {
 		for (size_t i = 0; i < execbuf->argc; ++i) {
 			if (fprintf(stderr, "%s ", execbuf->argv[i]) < 0) {
@@ -370,7 +402,10 @@ static int bfs_exec_spawn(const struct bfs_exec *execbuf) {
 	// Flush cached state for consistency with the external process
 	bfs_ctx_flush(execbuf->ctx);
 
-	if (execbuf->flags & BFS_EXEC_MULTI) {
+	if (execbuf->flags & BFS_EXEC_PIPE) {
+		bfs_exec_debug(execbuf, "Executing '%s' ... [%zu arguments] (paths on standard input)\n",
+		               execbuf->argv[0], execbuf->argc - 1);
+	} else if (execbuf->flags & BFS_EXEC_MULTI) {
 		bfs_exec_debug(execbuf, "Executing '%s' ... [%zu arguments] (size %zu)\n",
 		               execbuf->argv[0], execbuf->argc - 1, execbuf->arg_size);
 	} else {
@@ -404,17 +439,31 @@ static int bfs_exec_spawn(const struct bfs_exec *execbuf) {
 		}
 	}
 
+	if (in_fd >= 0) {
+		if (bfs_spawn_adddup2(&ctx, in_fd, STDIN_FILENO) != 0) {
+			goto fail;
+		}
+	}
+
 	pid = bfs_spawn(execbuf->argv[0], &ctx, execbuf->argv, NULL);
 fail:
 	error = errno;
 	bfs_spawn_destroy(&ctx);
-	if (pid < 0) {
-		errno = error;
-		return -1;
-	}
+	errno = error;
+	return pid;
+}
+
+/** Wait for a spawned process to exit. */
+static int bfs_exec_wait(const struct bfs_exec *execbuf, pid_t pid) {
+	struct timespec start;
+	bool prof = bfs_prof_begin(&start);
 
 	int wstatus;
-	if (waitpid(pid, &wstatus, 0) < 0) {
+	int wret = waitpid(pid, &wstatus, 0);
+	if (prof) {
+		bfs_prof_end(BFS_PROF_EXEC, &start);
+	}
+	if (wret < 0) {
 		return -1;
 	}
 
@@ -442,18 +491,77 @@ fail:
 	return ret;
 }
 
+/** Spawn the process and wait for it. */
+static int bfs_exec_spawn(const struct bfs_exec *execbuf) {
+	pid_t pid = bfs_exec_start(execbuf, -1);
+	if (pid < 0) {
+		return -1;
+	}
+
+	return bfs_exec_wait(execbuf, pid);
+}
+
+/** Check if commands from this execbuf may run in the background. */
+static bool bfs_exec_parallel(const struct bfs_exec *execbuf) {
+	return (execbuf->flags & BFS_EXEC_MULTI) && execbuf->ctx->exec_jobs > 1;
+}
+
+/** Wait for the oldest background command. */
+static void bfs_exec_reap(struct bfs_exec *execbuf) {
+	assert(execbuf->njobs > 0);
+
+	if (bfs_exec_wait(execbuf, execbuf->jobs[0]) != 0) {
+		execbuf->ret = -1;
+	}
+
+	--execbuf->njobs;
+	memmove(execbuf->jobs, execbuf->jobs + 1, execbuf->njobs*sizeof(*execbuf->jobs));
+}
+
+/**
+ * Spawn the process in the background, first waiting for the oldest command if
+ * too many are already running.  The spawned command's argument list may be
+ * freed as soon as this returns, since bfs_spawn() only returns once exec()
+ * has succeeded or failed.
+ */
+static int bfs_exec_background(struct bfs_exec *execbuf) {
+	size_t max = execbuf->ctx->exec_jobs;
+
+	if (!execbuf->jobs) {
+		execbuf->jobs = malloc(max*sizeof(*execbuf->jobs));
+		if (!execbuf->jobs) {
+			return -1;
+		}
+	}
+
+	while (execbuf->njobs >= max) {
+		bfs_exec_reap(execbuf);
+	}
+
+	pid_t pid = bfs_exec_start(execbuf, -1);
+	if (pid < 0) {
+		return -1;
+	}
+
+	execbuf->jobs[execbuf->njobs++] = pid;
+	bfs_exec_debug(execbuf, "Started '%s' in the background [%zu/%zu jobs]\n",
+	               execbuf->argv[0], execbuf->njobs, max);
+	errno = 0;
+	return 0;
+}
+
 /** exec() a command for a single file. */
 static int bfs_exec_single(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
 	int ret = -1, error = 0;
 
-	char *path = bfs_exec_format_path(execbuf, ftwbuf);
+	const char *path = bfs_exec_format_path(execbuf, ftwbuf);
 	if (!path) {
 		goto out;
 	}
 
 	size_t i;
 	for (i = 0; i < execbuf->tmpl_argc; ++i) {
-		execbuf->argv[i] = bfs_exec_format_arg(execbuf->tmpl_argv[i], path);
+		execbuf->argv[i] = bfs_exec_format_arg(execbuf->tmpl_argv[i], path, &execbuf->arg_bufs[i]);
 		if (!execbuf->argv[i]) {
 			goto out_free;
 		}
@@ -474,12 +582,6 @@ out_free:
 
 	bfs_exec_closewd(execbuf, ftwbuf);
 
-	for (size_t j = 0; j < i; ++j) {
-		bfs_exec_free_arg(execbuf->argv[j], execbuf->tmpl_argv[j]);
-	}
-
-	free(path);
-
 	errno = error;
 
 out:
@@ -550,7 +652,11 @@ static int bfs_exec_flush(struct bfs_exec *execbuf) {
 	size_t orig_argc = execbuf->argc;
 	while (bfs_exec_args_remain(execbuf)) {
 		execbuf->argv[execbuf->argc] = NULL;
-		ret = bfs_exec_spawn(execbuf);
+		if (bfs_exec_parallel(execbuf)) {
+			ret = bfs_exec_background(execbuf);
+		} else {
+			ret = bfs_exec_spawn(execbuf);
+		}
 		error = errno;
 		if (ret == 0) {
 			bfs_exec_update_min(execbuf);
@@ -643,7 +749,9 @@ static int bfs_exec_push(struct bfs_exec *execbuf, char *arg) {
 static int bfs_exec_multi(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
 	int ret = 0;
 
-	char *arg = bfs_exec_format_path(execbuf, ftwbuf);
+	// The argument has to outlive this call, so copy it
+	const char *path = bfs_exec_format_path(execbuf, ftwbuf);
+	char *arg = path ? strdup(path) : NULL;
 	if (!arg) {
 		ret = -1;
 		goto out;
@@ -679,8 +787,197 @@ out:
 	return ret;
 }
 
+/** Block SIGPIPE on this thread, around writes to a -pipe-to command. */
+static void bfs_exec_block_sigpipe(sigset_t *old_mask) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &mask, old_mask);
+}
+
+/** Discard any SIGPIPE raised while it was blocked, then restore the mask. */
+static void bfs_exec_unblock_sigpipe(const sigset_t *old_mask) {
+	sigset_t pending;
+	if (!sigismember(old_mask, SIGPIPE) && sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE)) {
+		// Ignoring a pending signal discards it
+		struct sigaction ignore = {
+			.sa_handler = SIG_IGN,
+		};
+		sigemptyset(&ignore.sa_mask);
+
+		struct sigaction old;
+		if (sigaction(SIGPIPE, &ignore, &old) == 0) {
+			sigaction(SIGPIPE, &old, NULL);
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, old_mask, NULL);
+}
+
+/** Close a -pipe-to command's standard input. */
+static int bfs_exec_pipe_close(struct bfs_exec *execbuf, FILE *file) {
+	if (!execbuf->pipe_direct) {
+		return fclose(file);
+	}
+
+	sigset_t old_mask;
+	bfs_exec_block_sigpipe(&old_mask);
+	int ret = fclose(file);
+	int error = errno;
+	bfs_exec_unblock_sigpipe(&old_mask);
+	errno = error;
+	return ret;
+}
+
+/** Start another -pipe-to command, with a pipe to its standard input. */
+static int bfs_exec_pipe_start(struct bfs_exec *execbuf) {
+	int pipefd[2];
+	if (pipe_cloexec(pipefd) != 0) {
+		return -1;
+	}
+
+	pid_t pid = bfs_exec_start(execbuf, pipefd[0]);
+	int error = errno;
+	xclose(pipefd[0]);
+	if (pid < 0) {
+		xclose(pipefd[1]);
+		errno = error;
+		return -1;
+	}
+
+	// Hand the writes off to a background thread if we can, so a slow
+	// command doesn't stall the search until its pipe is full.  The thread
+	// inherits a blocked SIGPIPE, so a command that exits without reading
+	// everything just gets EPIPE rather than killing us.  Without a thread,
+	// each write blocks SIGPIPE itself.
+	sigset_t old_mask;
+	bfs_exec_block_sigpipe(&old_mask);
+	struct bfs_writer *writer = bfs_writer_open(pipefd[1], true);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+	FILE *file;
+	if (writer) {
+		file = bfs_writer_file(writer);
+	} else {
+		file = fdopen(pipefd[1], "w");
+		execbuf->pipe_direct = true;
+	}
+	if (!file) {
+		error = errno;
+		xclose(pipefd[1]);
+		waitpid(pid, NULL, 0);
+		errno = error;
+		return -1;
+	}
+
+	execbuf->jobs[execbuf->njobs] = pid;
+	execbuf->pipes[execbuf->njobs] = file;
+	++execbuf->njobs;
+	bfs_exec_debug(execbuf, "Started '%s' in the background [%zu/%d jobs]\n",
+	               execbuf->argv[0], execbuf->njobs, execbuf->ctx->exec_jobs);
+	return 0;
+}
+
+/** Write a path to one of the -pipe-to commands. */
+static int bfs_exec_pipe(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
+	size_t max = execbuf->ctx->exec_jobs;
+
+	// Don't report the same failure for every file
+	if (execbuf->ret != 0) {
+		errno = 0;
+		return -1;
+	}
+
+	if (!execbuf->jobs) {
+		execbuf->jobs = malloc(max*sizeof(*execbuf->jobs));
+		if (!execbuf->jobs) {
+			return -1;
+		}
+	}
+
+	if (!execbuf->pipes) {
+		execbuf->pipes = malloc(max*sizeof(*execbuf->pipes));
+		if (!execbuf->pipes) {
+			return -1;
+		}
+	}
+
+	// Start the commands lazily, and then take turns between them
+	FILE *file;
+	if (execbuf->njobs < max) {
+		if (bfs_exec_pipe_start(execbuf) != 0) {
+			return -1;
+		}
+		file = execbuf->pipes[execbuf->njobs - 1];
+	} else {
+		file = execbuf->pipes[execbuf->next_pipe];
+		execbuf->next_pipe = (execbuf->next_pipe + 1) % max;
+	}
+
+	// Write the path with its terminating NUL
+	sigset_t old_mask;
+	if (execbuf->pipe_direct) {
+		bfs_exec_block_sigpipe(&old_mask);
+	}
+
+	// Like bfs_exec_pipe_finish(), a command that stops reading (EPIPE) only
+	// fails if its exit status says so
+	size_t len = strlen(ftwbuf->path) + 1;
+	int ret = 0;
+	if (fwrite(ftwbuf->path, 1, len, file) != len && errno != EPIPE) {
+		ret = -1;
+	}
+
+	if (execbuf->pipe_direct) {
+		int error = errno;
+		bfs_exec_unblock_sigpipe(&old_mask);
+		errno = error;
+	}
+
+	return ret;
+}
+
+/**
+ * Close the -pipe-to commands' standard inputs, and wait for them.  errno is
+ * left set to the first write error, if any.  A command that exits without
+ * reading all its input (EPIPE) only fails if its exit status says so.
+ */
+static void bfs_exec_pipe_finish(struct bfs_exec *execbuf) {
+	int error = 0;
+
+	if (execbuf->pipes) {
+		for (size_t i = 0; i < execbuf->njobs; ++i) {
+			if (bfs_exec_pipe_close(execbuf, execbuf->pipes[i]) != 0 && errno != EPIPE) {
+				execbuf->ret = -1;
+				if (!error) {
+					error = errno;
+				}
+			}
+		}
+		free(execbuf->pipes);
+		execbuf->pipes = NULL;
+	}
+
+	if (execbuf->njobs > 0) {
+		bfs_exec_debug(execbuf, "Waiting for %zu background command(s)\n", execbuf->njobs);
+	}
+	while (execbuf->njobs > 0) {
+		bfs_exec_reap(execbuf);
+	}
+
+	errno = error;
+}
+
 int bfs_exec(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
-	if (execbuf->flags & BFS_EXEC_MULTI) {
+	if (execbuf->flags & BFS_EXEC_PIPE) {
+		if (bfs_exec_pipe(execbuf, ftwbuf) == 0) {
+			errno = 0;
+		} else {
+			execbuf->ret = -1;
+		}
+		// -pipe-to never returns false
+		return 0;
+	} else if (execbuf->flags & BFS_EXEC_MULTI) {
 		if (bfs_exec_multi(execbuf, ftwbuf) == 0) {
 			errno = 0;
 		} else {
@@ -694,11 +991,24 @@ int bfs_exec(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
 }
 
 int bfs_exec_finish(struct bfs_exec *execbuf) {
-	if (execbuf->flags & BFS_EXEC_MULTI) {
+	if (execbuf->flags & BFS_EXEC_PIPE) {
+		bfs_exec_pipe_finish(execbuf);
+		if (execbuf->ret != 0) {
+			int error = errno;
+			bfs_exec_debug(execbuf, "One or more executions of '%s' failed\n", execbuf->argv[0]);
+			errno = error;
+		}
+	} else if (execbuf->flags & BFS_EXEC_MULTI) {
 		bfs_exec_debug(execbuf, "Finishing execution, executing buffered command\n");
 		while (bfs_exec_args_remain(execbuf)) {
 			execbuf->ret |= bfs_exec_flush(execbuf);
 		}
+		if (execbuf->njobs > 0) {
+			bfs_exec_debug(execbuf, "Waiting for %zu background command(s)\n", execbuf->njobs);
+		}
+		while (execbuf->njobs > 0) {
+			bfs_exec_reap(execbuf);
+		}
 		if (execbuf->ret != 0) {
 			bfs_exec_debug(execbuf, "One or more executions of '%s' failed\n", execbuf->argv[0]);
 		}
@@ -709,6 +1019,28 @@ int bfs_exec_finish(struct bfs_exec *execbuf) {
 void bfs_exec_free(struct bfs_exec *execbuf) {
 	if (execbuf) {
 		bfs_exec_closewd(execbuf, NULL);
+
+		// -pipe-to commands won't exit until their input is closed
+		if (execbuf->pipes) {
+			for (size_t i = 0; i < execbuf->njobs; ++i) {
+				bfs_exec_pipe_close(execbuf, execbuf->pipes[i]);
+			}
+			free(execbuf->pipes);
+		}
+
+		// Don't leave zombies behind if bfs_exec_finish() was skipped
+		for (size_t i = 0; i < execbuf->njobs; ++i) {
+			int wstatus;
+			waitpid(execbuf->jobs[i], &wstatus, 0);
+		}
+		free(execbuf->jobs);
+		if (execbuf->arg_bufs) {
+			for (size_t i = 0; i < execbuf->tmpl_argc; ++i) {
+				dstrfree(execbuf->arg_bufs[i]);
+			}
+			free(execbuf->arg_bufs);
+		}
+		dstrfree(execbuf->path_buf);
 		free(execbuf->argv);
 		free(execbuf);
 	}
@@ -15,13 +15,16 @@
  ****************************************************************************/
 
 /**
- * Implementation of -exec/-execdir/-ok/-okdir.
+ * Implementation of -exec/-execdir/-ok/-okdir/-pipe-to.
  */
 
 #ifndef BFS_EXEC_H
 #define BFS_EXEC_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
 
 struct BFTW;
 struct bfs_ctx;
@@ -36,6 +39,8 @@ enum bfs_exec_flags {
 	BFS_EXEC_CHDIR   = 1 << 1,
 	/** Pass multiple files at once to the command (-exec ... {} +). */
 	BFS_EXEC_MULTI   = 1 << 2,
+	/** Write the paths to the standard input of long-running commands (-pipe-to). */
+	BFS_EXEC_PIPE    = 1 << 3,
 };
 
 /**
@@ -59,6 +64,11 @@ struct bfs_exec {
 	/** Capacity of argv. */
 	size_t argv_cap;
 
+	/** Reused buffer for the formatted path (a dstring). */
+	char *path_buf;
+	/** Reused buffers for the formatted arguments (dstrings, one per template argument). */
+	char **arg_bufs;
+
 	/** Current size of all arguments. */
 	size_t arg_size;
 	/** Maximum arg_size before E2BIG. */
@@ -73,6 +83,17 @@ struct bfs_exec {
 	/** Length of the working directory path. */
 	size_t wd_len;
 
+	/** Commands still running in the background, oldest first (-exec-jobs). */
+	pid_t *jobs;
+	/** The number of background commands. */
+	size_t njobs;
+	/** The standard input of each background command, for BFS_EXEC_PIPE. */
+	FILE **pipes;
+	/** The next command to write a path to, for BFS_EXEC_PIPE. */
+	size_t next_pipe;
+	/** Whether the pipes are written from this thread, without a bfs_writer. */
+	bool pipe_direct;
+
 	/** The ultimate return value for bfs_exec_finish(). */
 	int ret;
 };
@@ -100,12 +121,15 @@ struct bfs_exec *bfs_exec_parse(const struct bfs_ctx *ctx, char **argv, enum bfs
  *         The bftw() data for the current file.
  * @return 0 if the command succeeded, -1 if it failed.  If the command could
  *         be executed, -1 is returned, and errno will be non-zero.  For
- *         BFS_EXEC_MULTI, errors will not be reported until bfs_exec_finish().
+ *         BFS_EXEC_MULTI and BFS_EXEC_PIPE, errors will not be reported until
+ *         bfs_exec_finish().  With -exec-jobs, BFS_EXEC_MULTI commands may
+ *         still be running when this function returns, and BFS_EXEC_PIPE
+ *         commands always are.
  */
 int bfs_exec(struct bfs_exec *execbuf, const struct BFTW *ftwbuf);
 
 /**
- * Finish executing any commands.
+ * Finish executing any commands, and wait for any background commands.
  *
  * @param execbuf
  *         The parsed exec action.
@@ -0,0 +1,376 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+#include "export.h"
+#include "bftw.h"
+#include "color.h"
+#include "dir.h"
+#include "dstring.h"
+#include "printf.h"
+#include "stat.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/** Get the -printf %y letter for a file type. */
+static char export_type(enum bfs_type type) {
+	switch (type) {
+	case BFS_BLK:
+		return 'b';
+	case BFS_CHR:
+		return 'c';
+	case BFS_DIR:
+		return 'd';
+	case BFS_DOOR:
+		return 'D';
+	case BFS_FIFO:
+		return 'p';
+	case BFS_LNK:
+		return 'l';
+	case BFS_REG:
+		return 'f';
+	case BFS_SOCK:
+		return 's';
+	default:
+		return 'U';
+	}
+}
+
+/** Append a JSON key/unsigned value pair. */
+static int json_uint(char **buf, const char *key, uintmax_t n) {
+	char num[BFS_PRINTF_UINT_SIZE];
+	if (dstrcat(buf, key) != 0) {
+		return -1;
+	}
+	return dstrcat(buf, bfs_printf_utoa(num, n));
+}
+
+/** Append a JSON key/signed value pair. */
+static int json_int(char **buf, const char *key, intmax_t n) {
+	if (n < 0) {
+		if (dstrcat(buf, key) != 0 || dstrapp(buf, '-') != 0) {
+			return -1;
+		}
+		char num[BFS_PRINTF_UINT_SIZE];
+		return dstrcat(buf, bfs_printf_utoa(num, -(uintmax_t)n));
+	} else {
+		return json_uint(buf, key, n);
+	}
+}
+
+/** Append a JSON key/timestamp pair, as fractional seconds. */
+static int json_time(char **buf, const char *key, const struct timespec *ts) {
+	// The nanoseconds are always positive, e.g. {-2, 500000000} is -1.5s
+	bool neg = ts->tv_sec < 0;
+	uintmax_t sec;
+	long nsec = ts->tv_nsec;
+	if (neg) {
+		sec = -(uintmax_t)ts->tv_sec;
+		if (nsec > 0) {
+			--sec;
+			nsec = 1000000000L - nsec;
+		}
+	} else {
+		sec = ts->tv_sec;
+	}
+
+	if (dstrcat(buf, key) != 0) {
+		return -1;
+	}
+	if (neg && dstrapp(buf, '-') != 0) {
+		return -1;
+	}
+
+	char num[BFS_PRINTF_UINT_SIZE];
+	if (dstrcat(buf, bfs_printf_utoa(num, sec)) != 0) {
+		return -1;
+	}
+
+	char frac[11];
+	frac[0] = '.';
+	for (int i = 9; i > 0; --i) {
+		frac[i] = '0' + nsec % 10;
+		nsec /= 10;
+	}
+	frac[10] = '\0';
+	return dstrcat(buf, frac);
+}
+
+/** Get the length of a valid UTF-8 sequence, or 0 if it's invalid. */
+static size_t utf8_len(const unsigned char *str) {
+	unsigned char c = str[0];
+	if (c < 0x80) {
+		return 1;
+	}
+
+	size_t len;
+	unsigned char min = 0x80, max = 0xBF;
+	if (c >= 0xC2 && c <= 0xDF) {
+		len = 2;
+	} else if (c >= 0xE0 && c <= 0xEF) {
+		len = 3;
+		if (c == 0xE0) {
+			min = 0xA0;
+		} else if (c == 0xED) {
+			// No surrogates
+			max = 0x9F;
+		}
+	} else if (c >= 0xF0 && c <= 0xF4) {
+		len = 4;
+		if (c == 0xF0) {
+			min = 0x90;
+		} else if (c == 0xF4) {
+			max = 0x8F;
+		}
+	} else {
+		return 0;
+	}
+
+	if (str[1] < min || str[1] > max) {
+		return 0;
+	}
+	for (size_t i = 2; i < len; ++i) {
+		if (str[i] < 0x80 || str[i] > 0xBF) {
+			return 0;
+		}
+	}
+
+	return len;
+}
+
+/** Append a quoted JSON string. */
+static int json_str(char **buf, const char *key, const char *str) {
+	static const char hex[] = "0123456789abcdef";
+
+	if (dstrcat(buf, key) != 0 || dstrapp(buf, '"') != 0) {
+		return -1;
+	}
+
+	const unsigned char *run = (const unsigned char *)str;
+	const unsigned char *i = run;
+	while (*i) {
+		unsigned char c = *i;
+		size_t len = utf8_len(i);
+		if (len > 0 && c != '"' && c != '\\' && c >= 0x20) {
+			i += len;
+			continue;
+		}
+
+		if (dstrncat(buf, (const char *)run, i - run) != 0) {
+			return -1;
+		}
+
+		char esc[7] = "\\";
+		switch (c) {
+		case '"':
+		case '\\':
+			esc[1] = c;
+			break;
+		case '\b':
+			esc[1] = 'b';
+			break;
+		case '\f':
+			esc[1] = 'f';
+			break;
+		case '\n':
+			esc[1] = 'n';
+			break;
+		case '\r':
+			esc[1] = 'r';
+			break;
+		case '\t':
+			esc[1] = 't';
+			break;
+		default:
+			// Control characters are \u00XX, invalid bytes are \udcXX
+			esc[1] = 'u';
+			esc[2] = len > 0 ? '0' : 'd';
+			esc[3] = len > 0 ? '0' : 'c';
+			esc[4] = hex[c >> 4];
+			esc[5] = hex[c & 0xF];
+			break;
+		}
+		if (dstrcat(buf, esc) != 0) {
+			return -1;
+		}
+
+		run = ++i;
+	}
+
+	if (dstrncat(buf, (const char *)run, i - run) != 0) {
+		return -1;
+	}
+	return dstrapp(buf, '"');
+}
+
+int bfs_export_json(CFILE *cfile, const struct BFTW *ftwbuf) {
+	assert(dstrlen(cfile->buffer) == 0);
+
+	char **buf = &cfile->buffer;
+	const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+	int error = statbuf ? 0 : errno;
+
+	char type[] = "?";
+	type[0] = export_type(ftwbuf->type);
+	if (json_str(buf, "{\"path\":", ftwbuf->path) != 0) {
+		goto fail;
+	}
+	if (json_str(buf, ",\"type\":", type) != 0) {
+		goto fail;
+	}
+
+	enum bfs_stat_field mask = statbuf ? statbuf->mask : 0;
+
+	if ((mask & BFS_STAT_DEV) && json_uint(buf, ",\"dev\":", statbuf->dev) != 0) {
+		goto fail;
+	}
+	if ((mask & BFS_STAT_INO) && json_uint(buf, ",\"ino\":", statbuf->ino) != 0) {
+		goto fail;
+	}
+	if ((mask & BFS_STAT_MODE) && json_uint(buf, ",\"mode\":", statbuf->mode & 07777) != 0) {
+		goto fail;
+	}
+	if ((mask & BFS_STAT_NLINK) && json_uint(buf, ",\"nlink\":", statbuf->nlink) != 0) {
+		goto fail;
+	}
+	if ((mask & BFS_STAT_UID) && json_uint(buf, ",\"uid\":", statbuf->uid) != 0) {
+		goto fail;
+	}
+	if ((mask & BFS_STAT_GID) && json_uint(buf, ",\"gid\":", statbuf->gid) != 0) {
+		goto fail;
+	}
+	if ((mask & BFS_STAT_SIZE) && json_int(buf, ",\"size\":", statbuf->size) != 0) {
+		goto fail;
+	}
+	if ((mask & BFS_STAT_BLOCKS) && json_int(buf, ",\"blocks\":", statbuf->blocks) != 0) {
+		goto fail;
+	}
+	if ((mask & BFS_STAT_RDEV) && json_uint(buf, ",\"rdev\":", statbuf->rdev) != 0) {
+		goto fail;
+	}
+	if ((mask & BFS_STAT_ATTRS) && json_uint(buf, ",\"attrs\":", statbuf->attrs) != 0) {
+		goto fail;
+	}
+	if ((mask & BFS_STAT_ATIME) && json_time(buf, ",\"atime\":", &statbuf->atime) != 0) {
+		goto fail;
+	}
+	if ((mask & BFS_STAT_BTIME) && json_time(buf, ",\"btime\":", &statbuf->btime) != 0) {
+		goto fail;
+	}
+	if ((mask & BFS_STAT_CTIME) && json_time(buf, ",\"ctime\":", &statbuf->ctime) != 0) {
+		goto fail;
+	}
+	if ((mask & BFS_STAT_MTIME) && json_time(buf, ",\"mtime\":", &statbuf->mtime) != 0) {
+		goto fail;
+	}
+
+	if (dstrcat(buf, "}\n") != 0) {
+		goto fail;
+	}
+
+	if (bfs_printf_write(cfile) != 0) {
+		return -1;
+	}
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+
+fail:
+	dstresize(buf, 0);
+	return -1;
+}
+
+/** Store a little-endian integer. */
+static unsigned char *put_le(unsigned char *ptr, uint64_t n, size_t size) {
+	for (size_t i = 0; i < size; ++i) {
+		ptr[i] = n & 0xFF;
+		n >>= 8;
+	}
+	return ptr + size;
+}
+
+/** Store a little-endian timestamp. */
+static unsigned char *put_time(unsigned char *ptr, const struct timespec *ts) {
+	ptr = put_le(ptr, (int64_t)ts->tv_sec, 8);
+	ptr = put_le(ptr, ts->tv_nsec, 4);
+	return put_le(ptr, 0, 4);
+}
+
+/** The size of a binary record header, excluding the path. */
+#define EXPORT_HEADER_SIZE 152
+
+int bfs_export_binary(CFILE *cfile, const struct BFTW *ftwbuf) {
+	assert(dstrlen(cfile->buffer) == 0);
+
+	const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+	int error = statbuf ? 0 : errno;
+
+	struct bfs_stat zero = {0};
+	if (!statbuf) {
+		statbuf = &zero;
+	}
+
+	size_t pathlen = strlen(ftwbuf->path);
+	if (pathlen > UINT32_MAX - EXPORT_HEADER_SIZE) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if (dstresize(&cfile->buffer, EXPORT_HEADER_SIZE + pathlen) != 0) {
+		return -1;
+	}
+
+	enum bfs_stat_field mask = statbuf->mask;
+	unsigned char *start = (unsigned char *)cfile->buffer;
+	unsigned char *ptr = start;
+	ptr = put_le(ptr, EXPORT_HEADER_SIZE - 4 + pathlen, 4);
+	ptr = put_le(ptr, mask, 4);
+	ptr = put_le(ptr, export_type(ftwbuf->type), 4);
+	ptr = put_le(ptr, (mask & BFS_STAT_DEV) ? statbuf->dev : 0, 8);
+	ptr = put_le(ptr, (mask & BFS_STAT_INO) ? statbuf->ino : 0, 8);
+	ptr = put_le(ptr, (mask & BFS_STAT_MODE) ? statbuf->mode : 0, 4);
+	ptr = put_le(ptr, (mask & BFS_STAT_UID) ? statbuf->uid : 0, 4);
+	ptr = put_le(ptr, (mask & BFS_STAT_GID) ? statbuf->gid : 0, 4);
+	ptr = put_le(ptr, 0, 4);
+	ptr = put_le(ptr, (mask & BFS_STAT_NLINK) ? statbuf->nlink : 0, 8);
+	ptr = put_le(ptr, (mask & BFS_STAT_SIZE) ? (int64_t)statbuf->size : 0, 8);
+	ptr = put_le(ptr, (mask & BFS_STAT_BLOCKS) ? (int64_t)statbuf->blocks : 0, 8);
+	ptr = put_le(ptr, (mask & BFS_STAT_RDEV) ? statbuf->rdev : 0, 8);
+	ptr = put_le(ptr, (mask & BFS_STAT_ATTRS) ? statbuf->attrs : 0, 8);
+	ptr = put_time(ptr, (mask & BFS_STAT_ATIME) ? &statbuf->atime : &zero.atime);
+	ptr = put_time(ptr, (mask & BFS_STAT_BTIME) ? &statbuf->btime : &zero.btime);
+	ptr = put_time(ptr, (mask & BFS_STAT_CTIME) ? &statbuf->ctime : &zero.ctime);
+	ptr = put_time(ptr, (mask & BFS_STAT_MTIME) ? &statbuf->mtime : &zero.mtime);
+	ptr = put_le(ptr, pathlen, 4);
+	assert(ptr - start == EXPORT_HEADER_SIZE);
+	memcpy(ptr, ftwbuf->path, pathlen);
+
+	if (bfs_printf_write(cfile) != 0) {
+		return -1;
+	}
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
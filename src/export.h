@@ -0,0 +1,81 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+/**
+ * Machine-readable metadata export, for -printj and -printb.
+ *
+ * -printj writes one JSON object per line (NDJSON), like
+ *
+ *     {"path":"./foo","type":"f","dev":2049,"ino":1234,...,"mtime":1656000000.123456789}
+ *
+ * Only the bfs_stat() fields that are actually available are included, and
+ * "mode" holds just the permission bits (the type is separate).  Paths
+ * that aren't valid UTF-8 have their invalid bytes encoded as lone surrogate
+ * escapes \udc80-\udcff, like Python's "surrogateescape" error handler, so
+ * they can be recovered exactly.
+ *
+ * -printb writes length-prefixed binary records.  All integers are
+ * little-endian:
+ *
+ *     u32 length     The number of bytes in the rest of the record
+ *     u32 mask       The available fields (enum bfs_stat_field)
+ *     u8  type       The file type, with the same letters as -printf %y
+ *     u8  pad[3]
+ *     u64 dev, ino
+ *     u32 mode, uid, gid           (mode includes the S_IFMT bits)
+ *     u32 pad
+ *     u64 nlink
+ *     i64 size, blocks
+ *     u64 rdev, attrs
+ *     i64 sec; u32 nsec; u32 pad   (for each of atime, btime, ctime, mtime)
+ *     u32 pathlen
+ *     u8  path[pathlen]
+ *
+ * Fields that are missing from the mask are zero.
+ */
+
+#ifndef BFS_EXPORT_H
+#define BFS_EXPORT_H
+
+#include "color.h"
+
+struct BFTW;
+
+/**
+ * Print a file's metadata as a line of JSON.
+ *
+ * @param cfile
+ *         The file to print to.
+ * @param ftwbuf
+ *         The bftw() data for the current file.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_export_json(CFILE *cfile, const struct BFTW *ftwbuf);
+
+/**
+ * Print a file's metadata as a binary record.
+ *
+ * @param cfile
+ *         The file to print to.
+ * @param ftwbuf
+ *         The bftw() data for the current file.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_export_binary(CFILE *cfile, const struct BFTW *ftwbuf);
+
+#endif // BFS_EXPORT_H
@@ -24,6 +24,7 @@
 #include "color.h"
 #include "eval.h"
 #include "stat.h"
+#include "xregex.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <sys/types.h>
@@ -53,6 +54,26 @@ enum bfs_mode_cmp {
 	BFS_MODE_ANY,
 };
 
+/**
+ * A single operation from a -chmod mode, like the "u+x" in "u+x,go-w".
+ */
+struct bfs_chmod_clause {
+	/** The bits this clause may set (from u, g, o, a, or the umask). */
+	mode_t who;
+	/** The bits cleared by '=' (from u, g, o, or all of them). */
+	mode_t clear;
+	/** The bits named explicitly, which may change setuid/setgid on directories. */
+	mode_t mentioned;
+	/** The operation ('+', '-', or '='). */
+	char op;
+	/** The permission bits to change, before masking by who. */
+	mode_t perms;
+	/** Whether to add execute permission for directories and executables (X). */
+	bool cond_exec;
+	/** The class to copy permissions from ('u', 'g', 'o'), or 0. */
+	char copy;
+};
+
 /**
  * Possible time units.
  */
@@ -112,6 +133,8 @@ struct bfs_expr {
 	bool always_false;
 	/** Whether this expression doesn't appear on the command line. */
 	bool synthetic;
+	/** This expression's slot in the per-file memo table, plus one (0 if it isn't memoized). */
+	size_t memo;
 
 	/** Estimated cost. */
 	float cost;
@@ -121,6 +144,8 @@ struct bfs_expr {
 	size_t evaluations;
 	/** Number of times this predicate succeeded. */
 	size_t successes;
+	/** Number of evaluations that were timed. */
+	size_t timed;
 	/** Total time spent running this predicate. */
 	struct timespec elapsed;
 
@@ -189,8 +214,30 @@ struct bfs_expr {
 			mode_t dir_mode;
 		};
 
+		/** -chmod data (a darray). */
+		struct bfs_chmod_clause *chmod;
+		/** -chown data. */
+		struct {
+			/** The new owner, or -1 to leave it unchanged. */
+			uid_t chown_uid;
+			/** The new group, or -1 to leave it unchanged. */
+			gid_t chown_gid;
+		};
+		/** -copy-to destination directory. */
+		int copy_fd;
+		/** -name/-path/-lname data. */
+		struct bfs_glob *glob;
+
+		/** Fused -name patterns. */
+		struct bfs_globset *globset;
+
 		/** -regex data. */
-		struct bfs_regex *regex;
+		struct {
+			/** The compiled regex. */
+			struct bfs_regex *regex;
+			/** The regex flavor it was compiled with. */
+			enum bfs_regex_type regex_type;
+		};
 
 		/** -samefile data. */
 		struct {
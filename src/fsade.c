@@ -22,6 +22,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #if BFS_CAN_CHECK_ACL
@@ -38,6 +40,9 @@
 #	include <sys/xattr.h>
 #endif
 
+// listxattr() gives every name at once, so one call can answer several tests
+#define BFS_CAN_LIST_XATTRS (BFS_HAS_SYS_XATTR && !BFS_HAS_SYS_EXTATTR)
+
 #if BFS_CAN_CHECK_ACL || BFS_CAN_CHECK_CAPABILITIES || BFS_CAN_CHECK_XATTRS
 
 /**
@@ -126,6 +131,92 @@ static bool is_absence_error(int error) {
 
 #endif // BFS_CAN_CHECK_ACL || BFS_CAN_CHECK_CAPABILITIES || BFS_CAN_CHECK_XATTRS
 
+#if BFS_CAN_LIST_XATTRS
+
+/** listxattr(), without following the file if it's a link. */
+static ssize_t bfs_listxattr(const struct BFTW *ftwbuf, const char *path, char *buf, size_t size) {
+#if __APPLE__
+	int options = ftwbuf->type == BFS_LNK ? XATTR_NOFOLLOW : 0;
+	return listxattr(path, buf, size, options);
+#else
+	if (ftwbuf->type == BFS_LNK) {
+		return llistxattr(path, buf, size);
+	} else {
+		return listxattr(path, buf, size);
+	}
+#endif
+}
+
+/**
+ * List the names of a file's extended attributes, at most once per file.
+ *
+ * @param ftwbuf
+ *         The file to check.
+ * @return
+ *         The cached list of names, or NULL if an error occurred.
+ */
+static const struct bftw_xattrs *bfs_list_xattrs(const struct BFTW *ftwbuf) {
+	struct bftw_xattrs *xattrs = (struct bftw_xattrs *)&ftwbuf->xattrs;
+	if (xattrs->listed) {
+		goto out;
+	}
+
+	const char *path = fake_at(ftwbuf);
+
+	while (true) {
+		// Without a buffer, this just asks for the size, which is enough
+		// for the many files with no xattrs at all
+		ssize_t len = bfs_listxattr(ftwbuf, path, xattrs->names, xattrs->capacity);
+		if (len < 0 && errno == ERANGE) {
+			len = bfs_listxattr(ftwbuf, path, NULL, 0);
+		} else if (len >= 0 && (xattrs->capacity > 0 || len == 0)) {
+			xattrs->len = len;
+			break;
+		}
+
+		if (len < 0) {
+			xattrs->error = errno;
+			break;
+		}
+
+		size_t capacity = 2 * xattrs->capacity;
+		if (capacity < (size_t)len) {
+			capacity = len;
+		}
+
+		char *names = realloc(xattrs->names, capacity);
+		if (!names) {
+			xattrs->error = errno;
+			break;
+		}
+		xattrs->names = names;
+		xattrs->capacity = capacity;
+	}
+
+	free_fake_at(ftwbuf, path);
+	xattrs->listed = true;
+
+out:
+	if (xattrs->error) {
+		errno = xattrs->error;
+		return NULL;
+	}
+	return xattrs;
+}
+
+/** Check if a listed xattr name is present. */
+static bool bfs_has_xattr(const struct bftw_xattrs *xattrs, const char *name) {
+	const char *end = xattrs->names + xattrs->len;
+	for (const char *cur = xattrs->names; cur < end; cur += strlen(cur) + 1) {
+		if (strcmp(cur, name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif // BFS_CAN_LIST_XATTRS
+
 #if BFS_CAN_CHECK_ACL
 
 /** Check if a POSIX.1e ACL is non-trivial. */
@@ -211,6 +302,16 @@ int bfs_check_acl(const struct BFTW *ftwbuf) {
 		return 0;
 	}
 
+#if __linux__ && BFS_CAN_LIST_XATTRS
+	// Linux stores ACLs as xattrs, so skip files that don't have them
+	const struct bftw_xattrs *xattrs = bfs_list_xattrs(ftwbuf);
+	if (xattrs
+	    && !bfs_has_xattr(xattrs, "system.posix_acl_access")
+	    && !bfs_has_xattr(xattrs, "system.posix_acl_default")) {
+		return 0;
+	}
+#endif
+
 	const char *path = fake_at(ftwbuf);
 
 	int ret = -1, error = 0;
@@ -258,6 +359,14 @@ int bfs_check_capabilities(const struct BFTW *ftwbuf) {
 		return 0;
 	}
 
+#if BFS_CAN_LIST_XATTRS
+	// File capabilities are stored in an xattr
+	const struct bftw_xattrs *xattrs = bfs_list_xattrs(ftwbuf);
+	if (xattrs && !bfs_has_xattr(xattrs, "security.capability")) {
+		return 0;
+	}
+#endif
+
 	int ret = -1, error;
 	const char *path = fake_at(ftwbuf);
 
@@ -300,10 +409,15 @@ int bfs_check_capabilities(const struct BFTW *ftwbuf) {
 #if BFS_CAN_CHECK_XATTRS
 
 int bfs_check_xattrs(const struct BFTW *ftwbuf) {
-	const char *path = fake_at(ftwbuf);
 	ssize_t len;
 
-#if BFS_HAS_SYS_EXTATTR
+#if BFS_CAN_LIST_XATTRS
+	const struct bftw_xattrs *xattrs = bfs_list_xattrs(ftwbuf);
+	len = xattrs ? (ssize_t)xattrs->len : -1;
+	int error = errno;
+#else
+	const char *path = fake_at(ftwbuf);
+
 	ssize_t (*extattr_list)(const char *, int, void*, size_t) =
 		ftwbuf->type == BFS_LNK ? extattr_list_link : extattr_list_file;
 
@@ -311,20 +425,11 @@ int bfs_check_xattrs(const struct BFTW *ftwbuf) {
 	if (len <= 0) {
 		len = extattr_list(path, EXTATTR_NAMESPACE_USER, NULL, 0);
 	}
-#elif __APPLE__
-	int options = ftwbuf->type == BFS_LNK ? XATTR_NOFOLLOW : 0;
-	len = listxattr(path, NULL, 0, options);
-#else
-	if (ftwbuf->type == BFS_LNK) {
-		len = llistxattr(path, NULL, 0);
-	} else {
-		len = listxattr(path, NULL, 0);
-	}
-#endif
 
 	int error = errno;
 
 	free_fake_at(ftwbuf, path);
+#endif
 
 	if (len > 0) {
 		return 1;
@@ -339,6 +444,21 @@ int bfs_check_xattrs(const struct BFTW *ftwbuf) {
 }
 
 int bfs_check_xattr_named(const struct BFTW *ftwbuf, const char *name) {
+#if BFS_CAN_LIST_XATTRS
+	// Share the list with any other xattr tests, unless it's too big
+	const struct bftw_xattrs *xattrs = bfs_list_xattrs(ftwbuf);
+	if (xattrs) {
+		return bfs_has_xattr(xattrs, name);
+	} else if (errno != E2BIG) {
+		int error = errno;
+		if (is_absence_error(error)) {
+			return 0;
+		}
+		errno = error;
+		return -1;
+	}
+#endif
+
 	const char *path = fake_at(ftwbuf);
 	ssize_t len;
 
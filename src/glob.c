@@ -0,0 +1,408 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+
+#include "glob.h"
+#include "darray.h"
+#include "trie.h"
+#include <fnmatch.h>
+#include <langinfo.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * A literal part of a pattern.
+ */
+struct glob_seg {
+	/** The unescaped text. */
+	const char *str;
+	/** The length of the text. */
+	size_t len;
+};
+
+struct bfs_glob {
+	/** The original pattern, for fnmatch(). */
+	char *pattern;
+	/** The fnmatch() flags. */
+	int flags;
+	/** Whether to use fnmatch() for everything. */
+	bool fnmatch;
+	/** Whether the pattern contains any '*'s. */
+	bool star;
+
+	/** The segment before the first '*' (or the whole literal). */
+	struct glob_seg head;
+	/** The segment after the last '*'. */
+	struct glob_seg tail;
+	/** The segments between, to be found in order. */
+	struct glob_seg *middle;
+	/** The number of middle segments. */
+	size_t nmiddle;
+
+	/** Storage for the unescaped segments. */
+	char buf[];
+};
+
+/**
+ * Check whether byte-by-byte matching agrees with fnmatch() in the current
+ * locale.  That holds for single-byte encodings and for UTF-8, which is
+ * self-synchronizing, but not for other multi-byte encodings.
+ */
+static bool glob_bytewise(void) {
+	if (MB_CUR_MAX == 1) {
+		return true;
+	}
+
+	const char *charmap = nl_langinfo(CODESET);
+	return charmap && (strcmp(charmap, "UTF-8") == 0 || strcmp(charmap, "utf8") == 0);
+}
+
+/** Compile the fast paths, returning false if the pattern is too complex. */
+static bool glob_compile_fast(struct bfs_glob *glob, const char *pattern) {
+	// Patterns with ranges or '?' need to know about multi-byte characters
+	if (glob->flags != 0 || !glob_bytewise()) {
+		return false;
+	}
+
+	char *out = glob->buf;
+	struct glob_seg seg = {.str = out, .len = 0};
+	size_t nsegs = 0;
+
+	for (const char *c = pattern; *c; ++c) {
+		switch (*c) {
+		case '?':
+		case '[':
+			return false;
+
+		case '*':
+			if (nsegs == 0) {
+				glob->head = seg;
+			} else {
+				glob->middle[nsegs - 1] = seg;
+			}
+			++nsegs;
+			glob->star = true;
+
+			// Collapse runs of '*'
+			while (c[1] == '*') {
+				++c;
+			}
+
+			seg.str = out;
+			seg.len = 0;
+			break;
+
+		case '\\':
+			++c;
+			if (!*c) {
+				return false;
+			}
+			// Fallthrough
+		default:
+			*out++ = *c;
+			++seg.len;
+			break;
+		}
+	}
+
+	if (nsegs == 0) {
+		glob->head = seg;
+	} else {
+		glob->tail = seg;
+		glob->nmiddle = nsegs - 1;
+	}
+
+	return true;
+}
+
+struct bfs_glob *bfs_glob_compile(const char *pattern, int flags) {
+	size_t len = strlen(pattern);
+
+	// Every '*' ends a segment, so there are at most len segments
+	struct bfs_glob *glob = malloc(sizeof(*glob) + len);
+	if (!glob) {
+		return NULL;
+	}
+
+	glob->pattern = strdup(pattern);
+	glob->middle = malloc((len + 1) * sizeof(*glob->middle));
+	if (!glob->pattern || !glob->middle) {
+		goto fail;
+	}
+
+	glob->flags = flags;
+	glob->star = false;
+	glob->head.len = 0;
+	glob->tail.len = 0;
+	glob->nmiddle = 0;
+	glob->fnmatch = !glob_compile_fast(glob, pattern);
+	return glob;
+
+fail:
+	bfs_glob_free(glob);
+	return NULL;
+}
+
+/** Find a segment in a string. */
+static const char *glob_find(const char *str, const char *end, const struct glob_seg *seg) {
+	if (seg->len == 0) {
+		return str;
+	}
+
+	char first = seg->str[0];
+	while ((size_t)(end - str) >= seg->len) {
+		str = memchr(str, first, end - str - seg->len + 1);
+		if (!str) {
+			break;
+		}
+		if (memcmp(str, seg->str, seg->len) == 0) {
+			return str;
+		}
+		++str;
+	}
+
+	return NULL;
+}
+
+bool bfs_glob_match(const struct bfs_glob *glob, const char *str) {
+	if (glob->fnmatch) {
+		return fnmatch(glob->pattern, str, glob->flags) == 0;
+	}
+
+	const struct glob_seg *head = &glob->head;
+	if (strncmp(str, head->str, head->len) != 0) {
+		return false;
+	}
+
+	if (!glob->star) {
+		return str[head->len] == '\0';
+	}
+
+	const struct glob_seg *tail = &glob->tail;
+	if (glob->nmiddle == 0 && tail->len == 0) {
+		// "prefix*"
+		return true;
+	}
+
+	size_t len = strlen(str);
+	if (len < head->len + tail->len) {
+		return false;
+	}
+
+	const char *end = str + len - tail->len;
+	if (memcmp(end, tail->str, tail->len) != 0) {
+		return false;
+	}
+
+	// With only '*' wildcards, the leftmost match of each segment is best
+	const char *cur = str + head->len;
+	for (size_t i = 0; i < glob->nmiddle; ++i) {
+		const struct glob_seg *seg = &glob->middle[i];
+		cur = glob_find(cur, end, seg);
+		if (!cur) {
+			return false;
+		}
+		cur += seg->len;
+	}
+
+	return true;
+}
+
+bool bfs_glob_is_fnmatch(const struct bfs_glob *glob) {
+	return glob->fnmatch;
+}
+
+int bfs_glob_flags(const struct bfs_glob *glob) {
+	return glob->flags;
+}
+
+void bfs_glob_free(struct bfs_glob *glob) {
+	if (glob) {
+		free(glob->middle);
+		free(glob->pattern);
+		free(glob);
+	}
+}
+
+/**
+ * The "*suffix" patterns of a single length.  Keeping each length in its own
+ * trie means no key is a prefix of another.
+ */
+struct globset_suffixes {
+	/** The length of the suffixes. */
+	size_t len;
+	/** The suffixes themselves. */
+	struct trie trie;
+};
+
+struct bfs_globset {
+	/** The fnmatch() flags. */
+	int flags;
+	/** Whether any pattern matches everything. */
+	bool all;
+	/** Literal patterns. */
+	struct trie literals;
+	/** The literal parts of "prefix*" patterns. */
+	struct trie prefixes;
+	/** The literal parts of "*suffix" patterns, by increasing length (a darray). */
+	struct globset_suffixes *suffixes;
+	/** Every other pattern (a darray). */
+	struct bfs_glob **others;
+};
+
+struct bfs_globset *bfs_globset_new(int flags) {
+	struct bfs_globset *set = malloc(sizeof(*set));
+	if (!set) {
+		return NULL;
+	}
+
+	set->flags = flags;
+	set->all = false;
+	trie_init(&set->literals);
+	trie_init(&set->prefixes);
+	set->suffixes = NULL;
+	set->others = NULL;
+	return set;
+}
+
+/** Get the suffix trie for a particular length, creating it if necessary. */
+static struct trie *globset_suffix_trie(struct bfs_globset *set, size_t len) {
+	size_t n = darray_length(set->suffixes);
+	size_t i;
+	for (i = 0; i < n; ++i) {
+		if (set->suffixes[i].len == len) {
+			return &set->suffixes[i].trie;
+		} else if (set->suffixes[i].len > len) {
+			break;
+		}
+	}
+
+	struct globset_suffixes new = {.len = len};
+	if (DARRAY_PUSH(&set->suffixes, &new) != 0) {
+		return NULL;
+	}
+
+	memmove(set->suffixes + i + 1, set->suffixes + i, (n - i)*sizeof(new));
+	set->suffixes[i].len = len;
+	trie_init(&set->suffixes[i].trie);
+	return &set->suffixes[i].trie;
+}
+
+/** Insert a segment into a trie, as a string. */
+static struct trie_leaf *globset_insert_str(struct trie *trie, const struct glob_seg *seg) {
+	char *str = strndup(seg->str, seg->len);
+	if (!str) {
+		return NULL;
+	}
+
+	struct trie_leaf *leaf = trie_insert_str(trie, str);
+	free(str);
+	return leaf;
+}
+
+int bfs_globset_add(struct bfs_globset *set, const char *pattern) {
+	struct bfs_glob *glob = bfs_glob_compile(pattern, set->flags);
+	if (!glob) {
+		return -1;
+	}
+
+	const struct glob_seg *head = &glob->head;
+	const struct glob_seg *tail = &glob->tail;
+	struct trie_leaf *leaf = NULL;
+
+	if (glob->fnmatch || glob->nmiddle > 0 || (head->len > 0 && tail->len > 0)) {
+		if (DARRAY_PUSH(&set->others, &glob) != 0) {
+			goto fail;
+		}
+		return 0;
+	} else if (!glob->star) {
+		leaf = globset_insert_str(&set->literals, head);
+	} else if (head->len == 0 && tail->len == 0) {
+		set->all = true;
+		bfs_glob_free(glob);
+		return 0;
+	} else if (tail->len == 0) {
+		leaf = globset_insert_str(&set->prefixes, head);
+	} else {
+		struct trie *trie = globset_suffix_trie(set, tail->len);
+		if (trie) {
+			leaf = trie_insert_mem(trie, tail->str, tail->len);
+		}
+	}
+
+	if (!leaf) {
+		goto fail;
+	}
+
+	bfs_glob_free(glob);
+	return 0;
+
+fail:
+	bfs_glob_free(glob);
+	return -1;
+}
+
+bool bfs_globset_match(const struct bfs_globset *set, const char *str) {
+	if (set->all) {
+		return true;
+	}
+
+	if (trie_find_str(&set->literals, str)) {
+		return true;
+	}
+
+	if (trie_find_prefix(&set->prefixes, str)) {
+		return true;
+	}
+
+	size_t len = strlen(str);
+	for (size_t i = 0; i < darray_length(set->suffixes); ++i) {
+		const struct globset_suffixes *suffixes = &set->suffixes[i];
+		if (suffixes->len > len) {
+			break;
+		}
+		if (trie_find_mem(&suffixes->trie, str + len - suffixes->len, suffixes->len)) {
+			return true;
+		}
+	}
+
+	for (size_t i = 0; i < darray_length(set->others); ++i) {
+		if (bfs_glob_match(set->others[i], str)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void bfs_globset_free(struct bfs_globset *set) {
+	if (set) {
+		for (size_t i = 0; i < darray_length(set->others); ++i) {
+			bfs_glob_free(set->others[i]);
+		}
+		darray_free(set->others);
+
+		for (size_t i = 0; i < darray_length(set->suffixes); ++i) {
+			trie_destroy(&set->suffixes[i].trie);
+		}
+		darray_free(set->suffixes);
+
+		trie_destroy(&set->prefixes);
+		trie_destroy(&set->literals);
+		free(set);
+	}
+}
@@ -0,0 +1,118 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+
+/**
+ * Compiled fnmatch() patterns.
+ *
+ * Most -name and -path patterns are simple, like "*.c", "foo*", or plain
+ * literals.  These are compiled into a list of literal segments separated by
+ * wildcards, which can be matched with memcmp() and memchr() instead of the
+ * general fnmatch() machinery.  Anything more complicated falls back to
+ * fnmatch().
+ */
+
+#ifndef BFS_GLOB_H
+#define BFS_GLOB_H
+
+#include <stdbool.h>
+
+/**
+ * A compiled glob pattern.
+ */
+struct bfs_glob;
+
+/**
+ * Compile a glob pattern.
+ *
+ * @param pattern
+ *         The pattern to compile.
+ * @param flags
+ *         The flags to pass to fnmatch().
+ * @return
+ *         The compiled pattern, or NULL on failure.
+ */
+struct bfs_glob *bfs_glob_compile(const char *pattern, int flags);
+
+/**
+ * Match a string against a compiled pattern.
+ *
+ * @param glob
+ *         The compiled pattern.
+ * @param str
+ *         The string to match.
+ * @return
+ *         Whether the pattern matched, like fnmatch(pattern, str, flags) == 0.
+ */
+bool bfs_glob_match(const struct bfs_glob *glob, const char *str);
+
+/**
+ * Check whether a compiled pattern uses the fnmatch() fallback.
+ */
+bool bfs_glob_is_fnmatch(const struct bfs_glob *glob);
+
+/**
+ * Get the fnmatch() flags a pattern was compiled with.
+ */
+int bfs_glob_flags(const struct bfs_glob *glob);
+
+/**
+ * Free a compiled pattern.
+ */
+void bfs_glob_free(struct bfs_glob *glob);
+
+/**
+ * A set of glob patterns, matched all at once.
+ *
+ * Literal patterns and simple "prefix*" and "*suffix" patterns are stored in
+ * tries, so matching a string against the whole set takes a few trie lookups
+ * rather than one match per pattern.  Other patterns are matched one by one.
+ */
+struct bfs_globset;
+
+/**
+ * Create an empty glob set.
+ *
+ * @param flags
+ *         The flags to pass to fnmatch() for every pattern in the set.
+ * @return
+ *         The new glob set, or NULL on failure.
+ */
+struct bfs_globset *bfs_globset_new(int flags);
+
+/**
+ * Add a pattern to a glob set.
+ *
+ * @param set
+ *         The glob set to modify.
+ * @param pattern
+ *         The pattern to add.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_globset_add(struct bfs_globset *set, const char *pattern);
+
+/**
+ * Check whether a string matches any pattern in a glob set.
+ */
+bool bfs_globset_match(const struct bfs_globset *set, const char *str);
+
+/**
+ * Free a glob set.
+ */
+void bfs_globset_free(struct bfs_globset *set);
+
+#endif // BFS_GLOB_H
@@ -0,0 +1,166 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2023 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+#include "idset.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/** The number of inodes covered by each bitmap. */
+#define IDSET_BITS 64
+
+/**
+ * A slot in the hash table.
+ */
+struct idset_slot {
+	/** The device number. */
+	dev_t dev;
+	/** The first inode number covered by the bitmap. */
+	ino_t base;
+	/** The bitmap of present inodes (0 for an empty slot). */
+	uint64_t bits;
+};
+
+struct bfs_idset {
+	/** The hash table. */
+	struct idset_slot *slots;
+	/** The number of slots, always a power of two. */
+	size_t capacity;
+	/** The number of non-empty slots. */
+	size_t used;
+	/** The number of IDs in the set. */
+	size_t size;
+};
+
+/** The initial number of slots. */
+#define IDSET_MIN_CAPACITY 64
+
+struct bfs_idset *bfs_idset_new(void) {
+	struct bfs_idset *set = malloc(sizeof(*set));
+	if (!set) {
+		return NULL;
+	}
+
+	set->slots = calloc(IDSET_MIN_CAPACITY, sizeof(*set->slots));
+	if (!set->slots) {
+		free(set);
+		return NULL;
+	}
+
+	set->capacity = IDSET_MIN_CAPACITY;
+	set->used = 0;
+	set->size = 0;
+	return set;
+}
+
+/** Hash a (device, inode base) pair. */
+static size_t idset_hash(dev_t dev, ino_t base) {
+	uint64_t hash = (uint64_t)dev * 0x9E3779B97F4A7C15ULL;
+	hash ^= (uint64_t)base / IDSET_BITS;
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+/** Find the slot for a (device, inode base) pair, which may be empty. */
+static struct idset_slot *idset_find(const struct bfs_idset *set, dev_t dev, ino_t base) {
+	size_t mask = set->capacity - 1;
+	for (size_t i = idset_hash(dev, base) & mask;; i = (i + 1) & mask) {
+		struct idset_slot *slot = &set->slots[i];
+		if (!slot->bits || (slot->dev == dev && slot->base == base)) {
+			return slot;
+		}
+	}
+}
+
+/** Double the size of the hash table. */
+static int idset_grow(struct bfs_idset *set) {
+	size_t old_capacity = set->capacity;
+	struct idset_slot *old_slots = set->slots;
+
+	size_t new_capacity = 2 * old_capacity;
+	if (new_capacity < old_capacity || new_capacity > SIZE_MAX / sizeof(*old_slots)) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	struct idset_slot *new_slots = calloc(new_capacity, sizeof(*new_slots));
+	if (!new_slots) {
+		return -1;
+	}
+
+	set->slots = new_slots;
+	set->capacity = new_capacity;
+
+	for (size_t i = 0; i < old_capacity; ++i) {
+		struct idset_slot *old = &old_slots[i];
+		if (old->bits) {
+			*idset_find(set, old->dev, old->base) = *old;
+		}
+	}
+
+	free(old_slots);
+	return 0;
+}
+
+int bfs_idset_insert(struct bfs_idset *set, dev_t dev, ino_t ino) {
+	ino_t base = ino - ino % IDSET_BITS;
+	uint64_t bit = UINT64_C(1) << (ino % IDSET_BITS);
+
+	struct idset_slot *slot = idset_find(set, dev, base);
+	if (slot->bits & bit) {
+		return 0;
+	}
+
+	if (!slot->bits) {
+		// Keep the load factor below 3/4
+		if (4 * (set->used + 1) > 3 * set->capacity) {
+			if (idset_grow(set) != 0) {
+				return -1;
+			}
+			slot = idset_find(set, dev, base);
+		}
+
+		slot->dev = dev;
+		slot->base = base;
+		++set->used;
+	}
+
+	slot->bits |= bit;
+	++set->size;
+	return 1;
+}
+
+bool bfs_idset_contains(const struct bfs_idset *set, dev_t dev, ino_t ino) {
+	ino_t base = ino - ino % IDSET_BITS;
+	uint64_t bit = UINT64_C(1) << (ino % IDSET_BITS);
+
+	const struct idset_slot *slot = idset_find(set, dev, base);
+	return slot->bits & bit;
+}
+
+size_t bfs_idset_size(const struct bfs_idset *set) {
+	return set->size;
+}
+
+void bfs_idset_free(struct bfs_idset *set) {
+	if (set) {
+		free(set->slots);
+		free(set);
+	}
+}
@@ -0,0 +1,76 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2023 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+/**
+ * A set of file IDs, i.e. (device, inode) pairs.
+ *
+ * The set is an open-addressing hash table with linear probing.  Rather than
+ * one inode per slot, each slot holds a bitmap of 64 consecutive inode numbers
+ * on the same device.  Inode numbers tend to be allocated densely, so this
+ * takes much less memory than a slot per file for large trees, while still
+ * staying compact for sparse inode ranges.
+ */
+
+#ifndef BFS_IDSET_H
+#define BFS_IDSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * A set of (device, inode) pairs.
+ */
+struct bfs_idset;
+
+/**
+ * Create an empty ID set.
+ *
+ * @return
+ *         The new set, or NULL on failure.
+ */
+struct bfs_idset *bfs_idset_new(void);
+
+/**
+ * Add a file ID to a set.
+ *
+ * @param set
+ *         The set to modify.
+ * @param dev
+ *         The file's device number.
+ * @param ino
+ *         The file's inode number.
+ * @return
+ *         1 if the ID was added, 0 if it was already present, or -1 on failure.
+ */
+int bfs_idset_insert(struct bfs_idset *set, dev_t dev, ino_t ino);
+
+/**
+ * Check whether a set contains a file ID.
+ */
+bool bfs_idset_contains(const struct bfs_idset *set, dev_t dev, ino_t ino);
+
+/**
+ * Get the number of IDs in a set.
+ */
+size_t bfs_idset_size(const struct bfs_idset *set);
+
+/**
+ * Free an ID set.
+ */
+void bfs_idset_free(struct bfs_idset *set);
+
+#endif // BFS_IDSET_H
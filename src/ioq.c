@@ -0,0 +1,411 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+#include "ioq.h"
+#include "dir.h"
+#include "stat.h"
+#include "util.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * A simple linked list of ioq_ent's.
+ */
+struct ioq_list {
+	/** The head of the list. */
+	struct ioq_ent *head;
+	/** The tail of the list. */
+	struct ioq_ent **tail;
+};
+
+/** Initialize an ioq_list. */
+static void ioq_list_init(struct ioq_list *list) {
+	list->head = NULL;
+	list->tail = &list->head;
+}
+
+/** Append an entry to an ioq_list. */
+static void ioq_list_push(struct ioq_list *list, struct ioq_ent *ent) {
+	ent->next = NULL;
+	*list->tail = ent;
+	list->tail = &ent->next;
+}
+
+/** Remove the first entry from an ioq_list. */
+static struct ioq_ent *ioq_list_pop(struct ioq_list *list) {
+	struct ioq_ent *ent = list->head;
+	if (ent) {
+		list->head = ent->next;
+		if (!list->head) {
+			list->tail = &list->head;
+		}
+		ent->next = NULL;
+	}
+	return ent;
+}
+
+struct ioq {
+	/** Protects the rest of the fields. */
+	pthread_mutex_t mutex;
+	/** Signalled when a new operation is submitted. */
+	pthread_cond_t submitted;
+	/** Signalled when an operation completes. */
+	pthread_cond_t completed;
+
+	/** Operations waiting for a worker thread. */
+	struct ioq_list pending;
+	/** Completed operations. */
+	struct ioq_list ready;
+
+	/** The maximum number of operations in flight. */
+	size_t depth;
+	/** The number of operations submitted but not yet popped. */
+	size_t size;
+
+	/** Whether to cancel pending operations. */
+	bool cancel;
+	/** Whether the worker threads should exit. */
+	bool stop;
+
+	/** The number of worker threads. */
+	size_t nthreads;
+	/** The worker threads. */
+	pthread_t threads[];
+};
+
+/** Read and stat() the buffered entries of a directory. */
+static void ioq_prefetch(struct ioq_ent *ent) {
+	struct ioq_dirent *dirents = malloc(ent->nstat*sizeof(*dirents));
+	if (!dirents) {
+		return;
+	}
+
+	size_t n = 0;
+	int dfd = bfs_dirfd(ent->dir);
+	while (n < ent->nstat) {
+		struct ioq_dirent *dirent = &dirents[n];
+		if (bfs_readdir_buffered(ent->dir, &dirent->de) <= 0) {
+			break;
+		}
+
+		dirent->ret = bfs_stat_fields(dfd, dirent->de.name, ent->stat_flags, ent->stat_fields, &dirent->buf);
+		dirent->error = dirent->ret == 0 ? 0 : errno;
+		++n;
+	}
+
+	if (n > 0) {
+		ent->dirents = dirents;
+		ent->ndirents = n;
+	} else {
+		free(dirents);
+	}
+}
+
+/** Perform a single I/O operation. */
+static void ioq_handle(struct ioq_ent *ent) {
+	switch (ent->op) {
+	case IOQ_OPENDIR:
+		ent->dir = bfs_opendir(ent->dfd, ent->path);
+		if (ent->dir) {
+			// The buffered entries are still useful even if this fails
+			bfs_polldir(ent->dir);
+			if (ent->nstat > 0) {
+				ioq_prefetch(ent);
+			}
+			ent->ret = 0;
+		} else {
+			ent->ret = -1;
+		}
+		break;
+
+	case IOQ_CLOSE:
+		ent->ret = xclose(ent->dfd);
+		break;
+
+	case IOQ_CLOSEDIR:
+		ent->ret = bfs_closedir(ent->dir);
+		ent->dir = NULL;
+		break;
+
+	case IOQ_UNLINKAT:
+		ent->ret = unlinkat(ent->dfd, ent->path, ent->at_flags);
+		break;
+	}
+
+	ent->error = ent->ret == 0 ? 0 : errno;
+}
+
+/** Background thread entry point. */
+static void *ioq_work(void *ptr) {
+	struct ioq *ioq = ptr;
+
+	pthread_mutex_lock(&ioq->mutex);
+
+	while (true) {
+		struct ioq_ent *ent = ioq_list_pop(&ioq->pending);
+		if (!ent) {
+			if (ioq->stop) {
+				break;
+			}
+			pthread_cond_wait(&ioq->submitted, &ioq->mutex);
+			continue;
+		}
+
+		bool cancel = ioq->cancel && ent->op == IOQ_OPENDIR;
+		pthread_mutex_unlock(&ioq->mutex);
+
+		if (cancel) {
+			ent->ret = -1;
+			ent->error = EINTR;
+		} else {
+			ioq_handle(ent);
+		}
+
+		pthread_mutex_lock(&ioq->mutex);
+		ioq_list_push(&ioq->ready, ent);
+		pthread_cond_signal(&ioq->completed);
+	}
+
+	pthread_mutex_unlock(&ioq->mutex);
+	return NULL;
+}
+
+struct ioq *ioq_create(size_t depth, size_t nthreads) {
+	struct ioq *ioq = malloc(sizeof(*ioq) + nthreads*sizeof(ioq->threads[0]));
+	if (!ioq) {
+		return NULL;
+	}
+
+	ioq_list_init(&ioq->pending);
+	ioq_list_init(&ioq->ready);
+	ioq->depth = depth;
+	ioq->size = 0;
+	ioq->cancel = false;
+	ioq->stop = false;
+	ioq->nthreads = 0;
+
+	int ret = pthread_mutex_init(&ioq->mutex, NULL);
+	if (ret != 0) {
+		goto fail_free;
+	}
+
+	ret = pthread_cond_init(&ioq->submitted, NULL);
+	if (ret != 0) {
+		goto fail_mutex;
+	}
+
+	ret = pthread_cond_init(&ioq->completed, NULL);
+	if (ret != 0) {
+		goto fail_submitted;
+	}
+
+	for (size_t i = 0; i < nthreads; ++i) {
+		ret = pthread_create(&ioq->threads[i], NULL, ioq_work, ioq);
+		if (ret != 0 && ioq->nthreads > 0) {
+			// Make do with the threads we got
+			break;
+		} else if (ret != 0) {
+			ioq_destroy(ioq);
+			errno = ret;
+			return NULL;
+		}
+		++ioq->nthreads;
+	}
+
+	return ioq;
+
+fail_submitted:
+	pthread_cond_destroy(&ioq->submitted);
+fail_mutex:
+	pthread_mutex_destroy(&ioq->mutex);
+fail_free:
+	free(ioq);
+	errno = ret;
+	return NULL;
+}
+
+size_t ioq_capacity(const struct ioq *ioq) {
+	struct ioq *mut = (struct ioq *)ioq;
+
+	pthread_mutex_lock(&mut->mutex);
+	size_t ret = ioq->depth - ioq->size;
+	pthread_mutex_unlock(&mut->mutex);
+
+	return ret;
+}
+
+/** Allocate a new request. */
+static struct ioq_ent *ioq_ent_new(struct ioq *ioq, enum ioq_op op, void *ptr) {
+	if (ioq_capacity(ioq) == 0) {
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	struct ioq_ent *ent = malloc(sizeof(*ent));
+	if (!ent) {
+		return NULL;
+	}
+
+	ent->op = op;
+	ent->ret = -1;
+	ent->error = 0;
+	ent->ptr = ptr;
+	ent->dfd = -1;
+	ent->path = NULL;
+	ent->dir = NULL;
+	ent->at_flags = 0;
+	ent->stat_flags = 0;
+	ent->stat_fields = 0;
+	ent->nstat = 0;
+	ent->dirents = NULL;
+	ent->ndirents = 0;
+	return ent;
+}
+
+/** Submit a request to the worker threads. */
+static void ioq_submit(struct ioq *ioq, struct ioq_ent *ent) {
+	pthread_mutex_lock(&ioq->mutex);
+	ioq_list_push(&ioq->pending, ent);
+	++ioq->size;
+	pthread_cond_signal(&ioq->submitted);
+	pthread_mutex_unlock(&ioq->mutex);
+}
+
+int ioq_opendir(struct ioq *ioq, int dfd, const char *path, void *ptr) {
+	struct ioq_ent *ent = ioq_ent_new(ioq, IOQ_OPENDIR, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	ent->dfd = dfd;
+	ent->path = path;
+	ioq_submit(ioq, ent);
+	return 0;
+}
+
+int ioq_opendir_stat(struct ioq *ioq, int dfd, const char *path, enum bfs_stat_flags flags, enum bfs_stat_field fields, size_t nstat, void *ptr) {
+	struct ioq_ent *ent = ioq_ent_new(ioq, IOQ_OPENDIR, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	ent->dfd = dfd;
+	ent->path = path;
+	ent->stat_flags = flags;
+	ent->stat_fields = fields;
+	ent->nstat = nstat;
+	ioq_submit(ioq, ent);
+	return 0;
+}
+
+int ioq_close(struct ioq *ioq, int fd, void *ptr) {
+	struct ioq_ent *ent = ioq_ent_new(ioq, IOQ_CLOSE, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	ent->dfd = fd;
+	ioq_submit(ioq, ent);
+	return 0;
+}
+
+int ioq_closedir(struct ioq *ioq, struct bfs_dir *dir, void *ptr) {
+	struct ioq_ent *ent = ioq_ent_new(ioq, IOQ_CLOSEDIR, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	ent->dir = dir;
+	ioq_submit(ioq, ent);
+	return 0;
+}
+
+int ioq_unlinkat(struct ioq *ioq, int dfd, const char *path, int flags, void *ptr) {
+	struct ioq_ent *ent = ioq_ent_new(ioq, IOQ_UNLINKAT, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	ent->dfd = dfd;
+	ent->path = path;
+	ent->at_flags = flags;
+	ioq_submit(ioq, ent);
+	return 0;
+}
+
+/** Pop a ready entry, optionally blocking. */
+static struct ioq_ent *ioq_pop_impl(struct ioq *ioq, bool block) {
+	pthread_mutex_lock(&ioq->mutex);
+
+	struct ioq_ent *ent;
+	while (true) {
+		ent = ioq_list_pop(&ioq->ready);
+		if (ent || !block || ioq->size == 0) {
+			break;
+		}
+		pthread_cond_wait(&ioq->completed, &ioq->mutex);
+	}
+
+	if (ent) {
+		--ioq->size;
+	}
+
+	pthread_mutex_unlock(&ioq->mutex);
+	return ent;
+}
+
+struct ioq_ent *ioq_pop(struct ioq *ioq) {
+	return ioq_pop_impl(ioq, true);
+}
+
+struct ioq_ent *ioq_trypop(struct ioq *ioq) {
+	return ioq_pop_impl(ioq, false);
+}
+
+void ioq_free(struct ioq *ioq, struct ioq_ent *ent) {
+	free(ent);
+}
+
+void ioq_cancel(struct ioq *ioq) {
+	pthread_mutex_lock(&ioq->mutex);
+	ioq->cancel = true;
+	pthread_mutex_unlock(&ioq->mutex);
+}
+
+void ioq_destroy(struct ioq *ioq) {
+	if (!ioq) {
+		return;
+	}
+
+	pthread_mutex_lock(&ioq->mutex);
+	assert(ioq->size == 0);
+	ioq->stop = true;
+	pthread_cond_broadcast(&ioq->submitted);
+	pthread_mutex_unlock(&ioq->mutex);
+
+	for (size_t i = 0; i < ioq->nthreads; ++i) {
+		pthread_join(ioq->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&ioq->completed);
+	pthread_cond_destroy(&ioq->submitted);
+	pthread_mutex_destroy(&ioq->mutex);
+	free(ioq);
+}
@@ -0,0 +1,252 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+/**
+ * An asynchronous I/O queue, backed by a pool of worker threads.
+ */
+
+#ifndef BFS_IOQ_H
+#define BFS_IOQ_H
+
+#include "dir.h"
+#include "stat.h"
+#include <stddef.h>
+
+/**
+ * A queue of asynchronous I/O operations.
+ */
+struct ioq;
+
+/**
+ * I/O queue operations.
+ */
+enum ioq_op {
+	/** ioq_opendir(). */
+	IOQ_OPENDIR,
+	/** ioq_close(). */
+	IOQ_CLOSE,
+	/** ioq_closedir(). */
+	IOQ_CLOSEDIR,
+	/** ioq_unlinkat(). */
+	IOQ_UNLINKAT,
+};
+
+/**
+ * A directory entry read ahead of time, along with its bfs_stat() info.
+ */
+struct ioq_dirent {
+	/** The directory entry. */
+	struct bfs_dirent de;
+	/** The return value of bfs_stat(). */
+	int ret;
+	/** The error code, if bfs_stat() failed. */
+	int error;
+	/** The bfs_stat() buffer, if bfs_stat() succeeded. */
+	struct bfs_stat buf;
+};
+
+/**
+ * An entry in an I/O queue.
+ */
+struct ioq_ent {
+	/** The next entry in the list. */
+	struct ioq_ent *next;
+
+	/** The I/O operation. */
+	enum ioq_op op;
+	/** The return value of the operation. */
+	int ret;
+	/** The error code, if the operation failed. */
+	int error;
+
+	/** Arbitrary user data. */
+	void *ptr;
+
+	/** The base directory for the operation, or the fd for IOQ_CLOSE. */
+	int dfd;
+	/** The path to operate on, relative to dfd. */
+	const char *path;
+	/** The opened directory for IOQ_OPENDIR, or the one to close for IOQ_CLOSEDIR. */
+	struct bfs_dir *dir;
+	/** The unlinkat() flags for IOQ_UNLINKAT. */
+	int at_flags;
+
+	/** The bfs_stat() flags for prefetched entries. */
+	enum bfs_stat_flags stat_flags;
+	/** The bfs_stat() fields for prefetched entries. */
+	enum bfs_stat_field stat_fields;
+	/** The maximum number of entries to prefetch. */
+	size_t nstat;
+	/** The prefetched entries, which must be free()'d by the caller. */
+	struct ioq_dirent *dirents;
+	/** The number of prefetched entries. */
+	size_t ndirents;
+};
+
+/**
+ * Create an I/O queue.
+ *
+ * @param depth
+ *         The maximum number of pending operations.
+ * @param nthreads
+ *         The number of background threads.  If some of them can't be
+ *         started, the queue makes do with the ones that were.
+ * @return
+ *         The new I/O queue, or NULL on failure.
+ */
+struct ioq *ioq_create(size_t depth, size_t nthreads);
+
+/**
+ * Check the remaining capacity of a queue.
+ *
+ * @return
+ *         The number of operations that may be submitted before the queue is
+ *         full.
+ */
+size_t ioq_capacity(const struct ioq *ioq);
+
+/**
+ * Asynchronous bfs_opendir().  The directory will also be polled with
+ * bfs_polldir(), so the first batch of entries is ready when it is read.
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param dfd
+ *         The base file descriptor, which must stay open until the operation
+ *         completes.
+ * @param path
+ *         The path to open, relative to dfd.  Must stay valid until the
+ *         operation completes.
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure (EAGAIN if the queue is full).
+ */
+int ioq_opendir(struct ioq *ioq, int dfd, const char *path, void *ptr);
+
+/**
+ * Like ioq_opendir(), but also read up to nstat of the already-buffered
+ * entries, and bfs_stat() them.  They are returned in ent->dirents, and their
+ * names stay valid until the next bfs_readdir() call on the directory.
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param dfd
+ *         The base file descriptor, which must stay open until the operation
+ *         completes.
+ * @param path
+ *         The path to open, relative to dfd.  Must stay valid until the
+ *         operation completes.
+ * @param flags
+ *         The flags to pass to bfs_stat().
+ * @param fields
+ *         The fields to ask bfs_stat() for.
+ * @param nstat
+ *         The maximum number of entries to prefetch.
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure (EAGAIN if the queue is full).
+ */
+int ioq_opendir_stat(struct ioq *ioq, int dfd, const char *path, enum bfs_stat_flags flags, enum bfs_stat_field fields, size_t nstat, void *ptr);
+
+/**
+ * Asynchronous close().  Unlike other operations, closes are never cancelled.
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param fd
+ *         The file descriptor to close.
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure (EAGAIN if the queue is full).
+ */
+int ioq_close(struct ioq *ioq, int fd, void *ptr);
+
+/**
+ * Asynchronous bfs_closedir().  Unlike other operations, closes are never
+ * cancelled.
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param dir
+ *         The directory to close.
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure (EAGAIN if the queue is full).
+ */
+int ioq_closedir(struct ioq *ioq, struct bfs_dir *dir, void *ptr);
+
+/**
+ * Asynchronous unlinkat().  Like closes, unlinks are never cancelled.
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param dfd
+ *         The base file descriptor, which must stay open until the operation
+ *         completes.
+ * @param path
+ *         The path to unlink, relative to dfd.  Must stay valid until the
+ *         operation completes.
+ * @param flags
+ *         The flags to pass to unlinkat().
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure (EAGAIN if the queue is full).
+ */
+int ioq_unlinkat(struct ioq *ioq, int dfd, const char *path, int flags, void *ptr);
+
+/**
+ * Wait for a completed operation.
+ *
+ * @param ioq
+ *         The I/O queue to check.
+ * @return
+ *         The next completed operation, or NULL if no operations are pending.
+ */
+struct ioq_ent *ioq_pop(struct ioq *ioq);
+
+/**
+ * Check for a completed operation without blocking.
+ *
+ * @param ioq
+ *         The I/O queue to check.
+ * @return
+ *         The next completed operation, or NULL if none are ready yet.
+ */
+struct ioq_ent *ioq_trypop(struct ioq *ioq);
+
+/**
+ * Free a completed operation returned by ioq_pop().
+ */
+void ioq_free(struct ioq *ioq, struct ioq_ent *ent);
+
+/**
+ * Cancel any opens that have not started yet.  They will still be returned by
+ * ioq_pop(), but with error == EINTR.
+ */
+void ioq_cancel(struct ioq *ioq);
+
+/**
+ * Stop and destroy an I/O queue.  All pending operations must have been
+ * popped already.
+ */
+void ioq_destroy(struct ioq *ioq);
+
+#endif // BFS_IOQ_H
@@ -34,6 +34,7 @@
  *
  * - Utilities:
  *     - bfs.h         (constants about bfs itself)
+ *     - alloc.[ch]    (arena allocators)
  *     - bar.[ch]      (a terminal status bar)
  *     - color.[ch]    (for pretty terminal colors)
  *     - darray.[ch]   (a dynamic array library)
@@ -41,8 +42,11 @@
  *     - dir.[ch]      (a directory API facade)
  *     - dstring.[ch]  (a dynamic string library)
  *     - fsade.[ch]    (a facade over non-standard filesystem features)
+ *     - glob.[ch]     (compiled fnmatch() patterns)
+ *     - ioq.[ch]      (an asynchronous I/O queue)
  *     - mtab.[ch]     (parses the system's mount table)
  *     - pwcache.[ch]  (a cache for the user/group tables)
+ *     - snapshot.[ch] (persistent directory snapshots)
  *     - stat.[ch]     (wraps stat(), or statx() on Linux)
  *     - trie.[ch]     (a trie set/map implementation)
  *     - typo.[ch]     (fuzzy matching for typos)
@@ -22,6 +22,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -42,6 +43,9 @@
 #	include <mntent.h>
 #	include <paths.h>
 #	include <stdio.h>
+#	if __linux__
+#		define BFS_MOUNTINFO 1
+#	endif
 #elif BFS_MNTINFO
 #	include <sys/mount.h>
 #	include <sys/ucred.h>
@@ -58,6 +62,10 @@ struct bfs_mtab_entry {
 	char *path;
 	/** The filesystem type. */
 	char *type;
+	/** The device ID of the mounted filesystem, if known. */
+	dev_t dev;
+	/** Whether the device ID is known. */
+	bool has_dev;
 };
 
 struct bfs_mtab {
@@ -65,20 +73,28 @@ struct bfs_mtab {
 	struct bfs_mtab_entry *entries;
 	/** The basenames of every mount point. */
 	struct trie names;
-
-	/** A map from device ID to fstype (populated lazily). */
-	struct trie types;
-	/** Whether the types map has been populated. */
+	/** The full paths of every mount point. */
+	struct trie paths;
+
+	/** A hash table from device IDs to entries (populated lazily). */
+	struct bfs_mtab_entry **types;
+	/** The size of the types table, minus one. */
+	size_t types_mask;
+	/** Whether the types table has been populated. */
 	bool types_filled;
+	/** Whether the types table is keyed by stat()ing every mount point. */
+	bool types_stat;
 };
 
 /**
  * Add an entry to the mount table.
  */
-static int bfs_mtab_add(struct bfs_mtab *mtab, const char *path, const char *type) {
+static int bfs_mtab_add(struct bfs_mtab *mtab, const char *path, const char *type, const dev_t *dev) {
 	struct bfs_mtab_entry entry = {
 		.path = strdup(path),
 		.type = strdup(type),
+		.dev = dev ? *dev : 0,
+		.has_dev = dev,
 	};
 
 	if (!entry.path || !entry.type) {
@@ -93,6 +109,10 @@ static int bfs_mtab_add(struct bfs_mtab *mtab, const char *path, const char *typ
 		goto fail;
 	}
 
+	if (!trie_insert_str(&mtab->paths, path)) {
+		goto fail;
+	}
+
 	return 0;
 
 fail_entry:
@@ -102,7 +122,125 @@ fail:
 	return -1;
 }
 
-struct bfs_mtab *bfs_mtab_parse(void) {
+#if BFS_MOUNTINFO
+
+/**
+ * Decode the octal escapes (\040 etc.) in a /proc/self/mountinfo field, in
+ * place.
+ */
+static void mountinfo_unescape(char *str) {
+	char *out = str;
+	for (const char *in = str; *in; ++out) {
+		if (in[0] == '\\'
+		    && in[1] >= '0' && in[1] <= '3'
+		    && in[2] >= '0' && in[2] <= '7'
+		    && in[3] >= '0' && in[3] <= '7') {
+			*out = ((in[1] - '0') << 6) | ((in[2] - '0') << 3) | (in[3] - '0');
+			in += 4;
+		} else {
+			*out = *in++;
+		}
+	}
+	*out = '\0';
+}
+
+/**
+ * Split the next space-separated field off of a mountinfo line.
+ */
+static char *mountinfo_field(char **line) {
+	char *field = *line;
+	if (!field) {
+		return NULL;
+	}
+
+	char *space = strchr(field, ' ');
+	if (space) {
+		*space = '\0';
+		*line = space + 1;
+	} else {
+		*line = NULL;
+	}
+	return field;
+}
+
+/**
+ * Parse one line of /proc/self/mountinfo, which looks like
+ *
+ *     36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw
+ *
+ * See proc(5).  Unlike /proc/mounts, this includes the device ID, so the mount
+ * points themselves never need to be stat()ed.
+ */
+static int mountinfo_parse_line(struct bfs_mtab *mtab, char *line) {
+	mountinfo_field(&line); // mount ID
+	mountinfo_field(&line); // parent ID
+	char *devstr = mountinfo_field(&line);
+	mountinfo_field(&line); // root
+	char *path = mountinfo_field(&line);
+	mountinfo_field(&line); // mount options
+
+	// Skip the optional fields, terminated by a single hyphen
+	char *field;
+	do {
+		field = mountinfo_field(&line);
+	} while (field && strcmp(field, "-") != 0);
+
+	char *type = mountinfo_field(&line);
+	if (!devstr || !path || !type) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	unsigned int ma, mi;
+	if (sscanf(devstr, "%u:%u", &ma, &mi) != 2) {
+		errno = EINVAL;
+		return -1;
+	}
+	dev_t dev = bfs_makedev(ma, mi);
+
+	mountinfo_unescape(path);
+	mountinfo_unescape(type);
+	return bfs_mtab_add(mtab, path, type, &dev);
+}
+
+/**
+ * Fill the mount table from /proc/self/mountinfo.
+ */
+static int mountinfo_parse(struct bfs_mtab *mtab) {
+	FILE *file = xfopen("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+	if (!file) {
+		return -1;
+	}
+
+	int ret = 0;
+	while (true) {
+		char *line = xgetdelim(file, '\n');
+		if (!line) {
+			if (errno) {
+				ret = -1;
+			}
+			break;
+		}
+
+		ret = mountinfo_parse_line(mtab, line);
+		free(line);
+		if (ret != 0) {
+			break;
+		}
+	}
+
+	int error = errno;
+	fclose(file);
+	errno = error;
+	return ret;
+}
+
+#endif // BFS_MOUNTINFO
+
+/**
+ * Allocate an empty mount table.
+ */
+static struct bfs_mtab *bfs_mtab_new(void) {
 	struct bfs_mtab *mtab = malloc(sizeof(*mtab));
 	if (!mtab) {
 		return NULL;
@@ -110,13 +248,28 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 
 	mtab->entries = NULL;
 	trie_init(&mtab->names);
-	trie_init(&mtab->types);
+	trie_init(&mtab->paths);
+	mtab->types = NULL;
+	mtab->types_mask = 0;
 	mtab->types_filled = false;
+	mtab->types_stat = false;
+	return mtab;
+}
+
+/**
+ * Parse the mount table with the platform's generic API.
+ */
+static struct bfs_mtab *bfs_mtab_parse_generic(void) {
+	struct bfs_mtab *mtab = bfs_mtab_new();
+	if (!mtab) {
+		return NULL;
+	}
 
 	int error = 0;
 
 #if BFS_MNTENT
 
+
 	FILE *file = setmntent(_PATH_MOUNTED, "r");
 	if (!file) {
 		// In case we're in a chroot or something with /proc but no /etc/mtab
@@ -129,7 +282,7 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 
 	struct mntent *mnt;
 	while ((mnt = getmntent(file))) {
-		if (bfs_mtab_add(mtab, mnt->mnt_dir, mnt->mnt_type) != 0) {
+		if (bfs_mtab_add(mtab, mnt->mnt_dir, mnt->mnt_type, NULL) != 0) {
 			error = errno;
 			endmntent(file);
 			goto fail;
@@ -154,7 +307,7 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 	}
 
 	for (bfs_statfs *mnt = mntbuf; mnt < mntbuf + size; ++mnt) {
-		if (bfs_mtab_add(mtab, mnt->f_mntonname, mnt->f_fstypename) != 0) {
+		if (bfs_mtab_add(mtab, mnt->f_mntonname, mnt->f_fstypename, NULL) != 0) {
 			error = errno;
 			goto fail;
 		}
@@ -170,7 +323,7 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 
 	struct mnttab mnt;
 	while (getmntent(file, &mnt) == 0) {
-		if (bfs_mtab_add(mtab, mnt.mnt_mountp, mnt.mnt_fstype) != 0) {
+		if (bfs_mtab_add(mtab, mnt.mnt_mountp, mnt.mnt_fstype, NULL) != 0) {
 			error = errno;
 			fclose(file);
 			goto fail;
@@ -194,35 +347,118 @@ fail:
 	return NULL;
 }
 
+struct bfs_mtab *bfs_mtab_parse(void) {
+#if BFS_MOUNTINFO
+	struct bfs_mtab *mtab = bfs_mtab_new();
+	if (!mtab) {
+		return NULL;
+	}
+
+	if (mountinfo_parse(mtab) == 0) {
+		return mtab;
+	}
+
+	// Fall back to getmntent(), e.g. if /proc isn't mounted
+	bfs_mtab_free(mtab);
+#endif
+
+	return bfs_mtab_parse_generic();
+}
+
+/** Hash a device ID for the types table. */
+static size_t bfs_mtab_hash(dev_t dev) {
+	uint64_t hash = (uint64_t)dev * 0x9E3779B97F4A7C15ULL;
+	return hash ^ (hash >> 32);
+}
+
 static void bfs_mtab_fill_types(struct bfs_mtab *mtab) {
-	for (size_t i = 0; i < darray_length(mtab->entries); ++i) {
+	mtab->types_filled = true;
+	mtab->types_stat = true;
+
+	size_t count = darray_length(mtab->entries);
+	if (count == 0) {
+		return;
+	}
+
+	// Keep the load factor at or below 1/2
+	size_t size = 1;
+	while (size < 2*count) {
+		size *= 2;
+	}
+
+	mtab->types = calloc(size, sizeof(*mtab->types));
+	if (!mtab->types) {
+		return;
+	}
+	mtab->types_mask = size - 1;
+
+	for (size_t i = 0; i < count; ++i) {
 		struct bfs_mtab_entry *entry = &mtab->entries[i];
 
-		struct bfs_stat sb;
-		if (bfs_stat(AT_FDCWD, entry->path, BFS_STAT_NOFOLLOW | BFS_STAT_NOSYNC, &sb) != 0) {
-			continue;
+		if (entry->has_dev) {
+			mtab->types_stat = false;
+		} else {
+			struct bfs_stat sb;
+			if (bfs_stat(AT_FDCWD, entry->path, BFS_STAT_NOFOLLOW | BFS_STAT_NOSYNC, &sb) != 0) {
+				continue;
+			}
+			entry->dev = sb.dev;
+			entry->has_dev = true;
 		}
 
-		struct trie_leaf *leaf = trie_insert_mem(&mtab->types, &sb.dev, sizeof(sb.dev));
-		if (leaf) {
-			leaf->value = entry->type;
+		// Later mounts hide earlier ones with the same device ID
+		size_t j = bfs_mtab_hash(entry->dev) & mtab->types_mask;
+		while (mtab->types[j] && mtab->types[j]->dev != entry->dev) {
+			j = (j + 1) & mtab->types_mask;
 		}
+		mtab->types[j] = entry;
 	}
+}
 
-	mtab->types_filled = true;
+/** Look up a device ID in the types table. */
+static const char *bfs_mtab_find_type(const struct bfs_mtab *mtab, dev_t dev) {
+	if (!mtab->types) {
+		return NULL;
+	}
+
+	size_t i = bfs_mtab_hash(dev) & mtab->types_mask;
+	for (const struct bfs_mtab_entry *entry; (entry = mtab->types[i]); i = (i + 1) & mtab->types_mask) {
+		if (entry->dev == dev) {
+			return entry->type;
+		}
+	}
+
+	return NULL;
+}
+
+/** Rebuild the types table from a stat() of every mount point. */
+static void bfs_mtab_restat_types(struct bfs_mtab *mtab) {
+	for (size_t i = 0; i < darray_length(mtab->entries); ++i) {
+		mtab->entries[i].has_dev = false;
+	}
+
+	free(mtab->types);
+	mtab->types = NULL;
+	mtab->types_mask = 0;
+	bfs_mtab_fill_types(mtab);
 }
 
 const char *bfs_fstype(const struct bfs_mtab *mtab, const struct bfs_stat *statbuf) {
+	struct bfs_mtab *mut = (struct bfs_mtab *)mtab;
 	if (!mtab->types_filled) {
-		bfs_mtab_fill_types((struct bfs_mtab *)mtab);
+		bfs_mtab_fill_types(mut);
 	}
 
-	const struct trie_leaf *leaf = trie_find_mem(&mtab->types, &statbuf->dev, sizeof(statbuf->dev));
-	if (leaf) {
-		return leaf->value;
-	} else {
-		return "unknown";
+	const char *type = bfs_mtab_find_type(mtab, statbuf->dev);
+	if (!type && !mtab->types_stat) {
+		// mountinfo has the device ID of each superblock, which isn't
+		// always st_dev (e.g. for btrfs subvolumes), so fall back to
+		// stat()ing the mount points like the generic code does
+		bfs_mtab_restat_types(mut);
+		type = bfs_mtab_find_type(mtab, statbuf->dev);
 	}
+
+	return type ? type : "unknown";
 }
 
 bool bfs_might_be_mount(const struct bfs_mtab *mtab, const char *path) {
@@ -230,9 +466,14 @@ bool bfs_might_be_mount(const struct bfs_mtab *mtab, const char *path) {
 	return trie_find_str(&mtab->names, name);
 }
 
+bool bfs_is_mount_path(const struct bfs_mtab *mtab, const char *path) {
+	return trie_find_str(&mtab->paths, path);
+}
+
 void bfs_mtab_free(struct bfs_mtab *mtab) {
 	if (mtab) {
-		trie_destroy(&mtab->types);
+		free(mtab->types);
+		trie_destroy(&mtab->paths);
 		trie_destroy(&mtab->names);
 
 		for (size_t i = 0; i < darray_length(mtab->entries); ++i) {
@@ -63,6 +63,18 @@ const char *bfs_fstype(const struct bfs_mtab *mtab, const struct bfs_stat *statb
  */
 bool bfs_might_be_mount(const struct bfs_mtab *mtab, const char *path);
 
+/**
+ * Check if a path is exactly a mount point.
+ *
+ * @param mtab
+ *         The current mount table.
+ * @param path
+ *         The canonical (absolute, symlink-free) path to check.
+ * @return
+ *         Whether the path is a mount point.
+ */
+bool bfs_is_mount_path(const struct bfs_mtab *mtab, const char *path);
+
 /**
  * Free a mount table.
  */
@@ -26,7 +26,8 @@
  * expression is evaluated, given that it returns true (state->facts_when_true)
  * or false (state->facts_when_true).  Additionally, state->facts_when_impure
  * records the possible data flow facts before any expressions with side effects
- * are evaluated.
+ * are evaluated.  -O2 also factors pure tests out of disjunctions, and lets
+ * repeated pure subexpressions share one memoized result per file.
  *
  * -O3: expression re-ordering to reduce expected cost.  In an expression like
  * (-foo -and -bar), if both -foo and -bar are pure (no side effects), they can
@@ -36,23 +37,34 @@
  *
  * -O4/-Ofast: aggressive optimizations that may affect correctness in corner
  * cases.  The main effect is to use facts_when_impure to determine if any side-
- * effects are reachable at all, and skipping the traversal if not.
+ * effects are reachable at all, and skipping the traversal if not.  -O4 also
+ * samples the actual cost and success rate of each expression during the
+ * traversal, and periodically re-orders the expression tree using those
+ * measurements instead of the static estimates (see bfs_reoptimize()).
+ *
+ * With -opt-profile, the measurements are saved at the end of the run, and used
+ * to seed the static estimates of the next run.
  */
 
 #include "opt.h"
 #include "color.h"
 #include "ctx.h"
+#include "darray.h"
 #include "diag.h"
+#include "dstring.h"
 #include "eval.h"
 #include "expr.h"
+#include "glob.h"
 #include "pwcache.h"
 #include "util.h"
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -146,6 +158,8 @@ enum range_type {
 	INUM_RANGE,
 	/** Hard link count. */
 	LINKS_RANGE,
+	/** Modification time, in seconds since the epoch. */
+	MTIME_RANGE,
 	/** File size. */
 	SIZE_RANGE,
 	/** User ID. */
@@ -244,6 +258,9 @@ static void facts_init(struct opt_facts *facts) {
 		range->max = LLONG_MAX;
 	}
 
+	// ... except for times, which can be before the epoch
+	facts->ranges[MTIME_RANGE].min = LLONG_MIN;
+
 	for (int i = 0; i < PRED_TYPES; ++i) {
 		facts->preds[i] = PRED_UNKNOWN;
 	}
@@ -353,6 +370,53 @@ static struct bfs_expr *extract_child_expr(struct bfs_expr *expr, struct bfs_exp
 	return ret;
 }
 
+/**
+ * Check if two expressions always evaluate the same way.  Besides the command
+ * line arguments, this compares any state that the parser captured from
+ * earlier options, like -daystart or -regextype.
+ */
+static bool expr_equal(const struct bfs_expr *lhs, const struct bfs_expr *rhs) {
+	if (lhs == rhs) {
+		return true;
+	}
+
+	if (lhs->eval_fn != rhs->eval_fn) {
+		return false;
+	}
+
+	if (bfs_expr_has_children(lhs)) {
+		if (!lhs->lhs != !rhs->lhs) {
+			return false;
+		} else if (lhs->lhs && !expr_equal(lhs->lhs, rhs->lhs)) {
+			return false;
+		} else {
+			return expr_equal(lhs->rhs, rhs->rhs);
+		}
+	}
+
+	if (lhs->argc != rhs->argc) {
+		return false;
+	}
+	for (size_t i = 0; i < lhs->argc; ++i) {
+		if (strcmp(lhs->argv[i], rhs->argv[i]) != 0) {
+			return false;
+		}
+	}
+
+	bfs_eval_fn *eval_fn = lhs->eval_fn;
+	if (eval_fn == eval_newer || eval_fn == eval_time || eval_fn == eval_used) {
+		return lhs->stat_field == rhs->stat_field
+			&& lhs->reftime.tv_sec == rhs->reftime.tv_sec
+			&& lhs->reftime.tv_nsec == rhs->reftime.tv_nsec;
+	} else if (eval_fn == eval_regex) {
+		return lhs->regex_type == rhs->regex_type;
+	} else if (eval_fn == eval_samefile) {
+		return lhs->dev == rhs->dev && lhs->ino == rhs->ino;
+	} else {
+		return true;
+	}
+}
+
 /**
  * Negate an expression.
  */
@@ -581,6 +645,105 @@ fail:
 	return NULL;
 }
 
+/** Check if an expression is a -name test, or a fused set of them. */
+static bool is_name_expr(const struct bfs_expr *expr) {
+	return expr->eval_fn == eval_name || expr->eval_fn == eval_name_set;
+}
+
+/** Add the patterns from a -name expression to a glob set. */
+static int add_name_patterns(struct bfs_globset *set, const struct bfs_expr *expr) {
+	for (size_t i = 1; i < expr->argc; ++i) {
+		if (bfs_globset_add(set, expr->argv[i]) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Fuse -name A -o -name B into a single pattern set test.
+ */
+static struct bfs_expr *fuse_names(const struct opt_state *state, struct bfs_expr *expr) {
+	struct bfs_expr *lhs = expr->lhs;
+	struct bfs_expr *rhs = expr->rhs;
+
+	size_t argc = lhs->argc + rhs->argc - 1;
+	char **argv = malloc(argc*sizeof(*argv));
+	if (!argv) {
+		bfs_perror(state->ctx, "malloc()");
+		goto fail;
+	}
+	memcpy(argv, lhs->argv, lhs->argc*sizeof(*argv));
+	memcpy(argv + lhs->argc, rhs->argv + 1, (rhs->argc - 1)*sizeof(*argv));
+
+	struct bfs_expr *ret = bfs_expr_new(eval_name_set, argc, argv);
+	if (!ret) {
+		free(argv);
+		goto fail;
+	}
+
+	if (lhs->eval_fn == eval_name_set) {
+		ret->globset = lhs->globset;
+		lhs->globset = NULL;
+	} else {
+		ret->globset = bfs_globset_new(bfs_glob_flags(lhs->glob));
+		if (!ret->globset || add_name_patterns(ret->globset, lhs) != 0) {
+			goto fail_set;
+		}
+	}
+
+	if (add_name_patterns(ret->globset, rhs) != 0) {
+		goto fail_set;
+	}
+
+	ret->pure = true;
+	ret->cost = lhs->cost > rhs->cost ? lhs->cost : rhs->cost;
+	ret->probability = lhs->probability + rhs->probability - lhs->probability*rhs->probability;
+
+	opt_debug(state, 2, "pattern fusion: %pe <==> %pe\n", expr, ret);
+	bfs_expr_free(expr);
+	return ret;
+
+fail_set:
+	bfs_perror(state->ctx, "bfs_globset_add()");
+	bfs_expr_free(ret);
+fail:
+	bfs_expr_free(expr);
+	return NULL;
+}
+
+/**
+ * Hoist a pure test shared by both sides of a disjunction:
+ *
+ *     (X -a A) -o (X -a B) <==> X -a (A -o B)
+ *
+ * X is evaluated at most once either way, since it is pure and comes first.
+ */
+static struct bfs_expr *factor_or_expr(const struct opt_state *state, struct bfs_expr *expr) {
+	struct bfs_expr *lhs = expr->lhs;
+	struct bfs_expr *rhs = expr->rhs;
+
+	bool debug = opt_debug(state, 2, "factoring: %pe <==> ", expr);
+
+	// Re-use the -o node for (A -o B), and the left -a node for the result
+	expr->lhs = lhs->rhs;
+	expr->rhs = rhs->rhs;
+	rhs->rhs = NULL;
+	bfs_expr_free(rhs);
+
+	lhs->rhs = optimize_or_expr(state, expr);
+	if (!lhs->rhs) {
+		bfs_expr_free(lhs);
+		return NULL;
+	}
+
+	struct bfs_expr *ret = optimize_and_expr(state, lhs);
+	if (debug && ret) {
+		cfprintf(state->ctx->cerr, "%pe\n", ret);
+	}
+	return ret;
+}
+
 /** Optimize a disjunction. */
 static struct bfs_expr *optimize_or_expr(const struct opt_state *state, struct bfs_expr *expr) {
 	assert(expr->eval_fn == eval_or);
@@ -615,6 +778,12 @@ static struct bfs_expr *optimize_or_expr(const struct opt_state *state, struct b
 			return extract_child_expr(expr, &expr->rhs);
 		} else if (lhs->eval_fn == eval_not && rhs->eval_fn == eval_not) {
 			return de_morgan(state, expr, expr->lhs->argv);
+		} else if (optlevel >= 2 && is_name_expr(lhs) && is_name_expr(rhs) && strcmp(lhs->argv[0], rhs->argv[0]) == 0) {
+			return fuse_names(state, expr);
+		} else if (optlevel >= 2
+			   && lhs->eval_fn == eval_and && rhs->eval_fn == eval_and
+			   && lhs->lhs->pure && expr_equal(lhs->lhs, rhs->lhs)) {
+			return factor_or_expr(state, expr);
 		}
 	}
 
@@ -795,8 +964,10 @@ static void infer_gid_facts(struct opt_state *state, const struct bfs_expr *expr
 	struct range *range = &state->facts_when_true.ranges[GID_RANGE];
 	if (groups && range->min == range->max) {
 		gid_t gid = range->min;
-		bool nogroup = !bfs_getgrgid(groups, gid);
-		constrain_pred(&state->facts_when_true.preds[NOGROUP_PRED], nogroup);
+		int exists = bfs_groups_exist(groups, gid);
+		if (exists >= 0) {
+			constrain_pred(&state->facts_when_true.preds[NOGROUP_PRED], !exists);
+		}
 	}
 }
 
@@ -808,8 +979,10 @@ static void infer_uid_facts(struct opt_state *state, const struct bfs_expr *expr
 	struct range *range = &state->facts_when_true.ranges[UID_RANGE];
 	if (users && range->min == range->max) {
 		uid_t uid = range->min;
-		bool nouser = !bfs_getpwuid(users, uid);
-		constrain_pred(&state->facts_when_true.preds[NOUSER_PRED], nouser);
+		int exists = bfs_users_exist(users, uid);
+		if (exists >= 0) {
+			constrain_pred(&state->facts_when_true.preds[NOUSER_PRED], !exists);
+		}
 	}
 }
 
@@ -820,6 +993,71 @@ static void infer_samefile_facts(struct opt_state *state, const struct bfs_expr
 	constrain_max(range_when_true, expr->ino);
 }
 
+/** Infer data flow facts about a -newer or -since expression. */
+static void infer_newer_facts(struct opt_state *state, const struct bfs_expr *expr) {
+	if (expr->stat_field != BFS_STAT_MTIME) {
+		return;
+	}
+
+	// time > reftime implies time.tv_sec >= reftime.tv_sec, and vice versa
+	long long reftime = expr->reftime.tv_sec;
+	constrain_min(&state->facts_when_true.ranges[MTIME_RANGE], reftime);
+	constrain_max(&state->facts_when_false.ranges[MTIME_RANGE], reftime);
+}
+
+/** Infer data flow facts about a -[m]{min,time} expression. */
+static void infer_time_facts(struct opt_state *state, const struct bfs_expr *expr) {
+	if (expr->stat_field != BFS_STAT_MTIME) {
+		return;
+	}
+
+	long long unit;
+	switch (expr->time_unit) {
+	case BFS_SECONDS:
+		unit = 1;
+		break;
+	case BFS_MINUTES:
+		unit = 60;
+		break;
+	case BFS_DAYS:
+		unit = 60*60*24;
+		break;
+	default:
+		return;
+	}
+
+	// Keep the arithmetic below from overflowing
+	long long limit = LLONG_MAX/4;
+	long long reftime = expr->reftime.tv_sec;
+	long long n = expr->num;
+	if (reftime < -limit || reftime > limit || n < -limit/unit + 1 || n > limit/unit - 1) {
+		return;
+	}
+
+	// eval_time() compares diff = (reftime - time)/unit, rounded towards zero.
+	// diff < k implies time.tv_sec >= reftime - k*unit, and diff > k implies
+	// time.tv_sec <= reftime - k*unit.
+	struct range *range_when_true = &state->facts_when_true.ranges[MTIME_RANGE];
+	struct range *range_when_false = &state->facts_when_false.ranges[MTIME_RANGE];
+
+	switch (expr->int_cmp) {
+	case BFS_INT_EQUAL:
+		constrain_min(range_when_true, reftime - (n + 1)*unit);
+		constrain_max(range_when_true, reftime - (n - 1)*unit);
+		break;
+
+	case BFS_INT_LESS:
+		constrain_min(range_when_true, reftime - n*unit);
+		constrain_max(range_when_false, reftime - (n - 1)*unit);
+		break;
+
+	case BFS_INT_GREATER:
+		constrain_max(range_when_true, reftime - n*unit);
+		constrain_min(range_when_false, reftime - (n + 1)*unit);
+		break;
+	}
+}
+
 /** Infer data flow facts about a -type expression. */
 static void infer_type_facts(struct opt_state *state, const struct bfs_expr *expr) {
 	state->facts_when_true.types &= expr->num;
@@ -868,6 +1106,8 @@ static struct bfs_expr *optimize_expr_recursive(struct opt_state *state, struct
 		infer_icmp_facts(state, expr, INUM_RANGE);
 	} else if (expr->eval_fn == eval_links) {
 		infer_icmp_facts(state, expr, LINKS_RANGE);
+	} else if (expr->eval_fn == eval_newer) {
+		infer_newer_facts(state, expr);
 	} else if (expr->eval_fn == eval_nogroup) {
 		infer_pred_facts(state, NOGROUP_PRED);
 	} else if (expr->eval_fn == eval_nouser) {
@@ -878,6 +1118,8 @@ static struct bfs_expr *optimize_expr_recursive(struct opt_state *state, struct
 		infer_icmp_facts(state, expr, SIZE_RANGE);
 	} else if (expr->eval_fn == eval_sparse) {
 		infer_pred_facts(state, SPARSE_PRED);
+	} else if (expr->eval_fn == eval_time) {
+		infer_time_facts(state, expr);
 	} else if (expr->eval_fn == eval_type) {
 		infer_type_facts(state, expr);
 	} else if (expr->eval_fn == eval_uid) {
@@ -1027,6 +1269,327 @@ static struct bfs_expr *optimize_expr(struct opt_state *state, struct bfs_expr *
 	return expr;
 }
 
+/** The number of samples needed before a measurement is trusted. */
+#define MIN_SAMPLES 32
+
+/**
+ * Update an expression's estimated cost and probability from measurements.
+ * Only leaves use their measured time as their cost, since the cost of a
+ * compound expression is derived from its children.
+ */
+static void set_measured(struct bfs_expr *expr, size_t evaluations, size_t successes, size_t timed, double nsec) {
+	if (evaluations >= MIN_SAMPLES && !expr->always_true && !expr->always_false) {
+		expr->probability = (double)successes / evaluations;
+	}
+
+	if (timed >= MIN_SAMPLES && !bfs_expr_has_children(expr)) {
+		expr->cost = nsec / timed;
+	}
+}
+
+/**
+ * A measured expression in an optimizer profile.
+ */
+struct opt_record {
+	/** The expression's encoded command line arguments (a dstring). */
+	char *key;
+	/** The number of evaluations. */
+	size_t evaluations;
+	/** The number of successful evaluations. */
+	size_t successes;
+	/** The number of timed evaluations. */
+	size_t timed;
+	/** The total time of the timed evaluations, in nanoseconds. */
+	unsigned long long nsec;
+};
+
+/**
+ * The optimizer profile is a text file, starting with PROFILE_MAGIC, followed
+ * by one line per expression:
+ *
+ *     EVALUATIONS SUCCESSES TIMED NANOSECONDS ARGC LEN:ARG...
+ *
+ * Each argument is prefixed by its length so it may contain any character.
+ */
+struct bfs_opt_profile {
+	/** The records (a darray). */
+	struct opt_record *records;
+};
+
+/** The first line of an optimizer profile. */
+#define PROFILE_MAGIC "bfs-opt-profile 1\n"
+
+/** Encode an expression's arguments as a profile key. */
+static char *profile_key(const struct bfs_expr *expr) {
+	char *key = dstrprintf("%zu", expr->argc);
+	if (!key) {
+		return NULL;
+	}
+
+	for (size_t i = 0; i < expr->argc; ++i) {
+		const char *arg = expr->argv[i];
+		if (dstrcatf(&key, " %zu:", strlen(arg)) != 0 || dstrcat(&key, arg) != 0) {
+			dstrfree(key);
+			return NULL;
+		}
+	}
+
+	return key;
+}
+
+/** Find the record with a given key. */
+static struct opt_record *profile_find(const struct bfs_opt_profile *profile, const char *key) {
+	for (size_t i = 0; i < darray_length(profile->records); ++i) {
+		struct opt_record *record = &profile->records[i];
+		if (strcmp(record->key, key) == 0) {
+			return record;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Read a record from an optimizer profile.
+ *
+ * @return
+ *         1 if a record was read, 0 at the end of the file, or -1 on error
+ *         (EINVAL if the profile is malformed).
+ */
+static int profile_read_record(FILE *file, struct opt_record *record) {
+	size_t argc;
+	int ret = fscanf(file, "%zu %zu %zu %llu %zu", &record->evaluations, &record->successes, &record->timed, &record->nsec, &argc);
+	if (ret == EOF && !ferror(file)) {
+		return 0;
+	} else if (ret != 5) {
+		goto invalid;
+	}
+
+	record->key = dstrprintf("%zu", argc);
+	if (!record->key) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < argc; ++i) {
+		size_t len;
+		char colon;
+		if (fscanf(file, " %zu%c", &len, &colon) != 2 || colon != ':') {
+			goto invalid_key;
+		}
+
+		if (dstrcatf(&record->key, " %zu:", len) != 0) {
+			goto fail;
+		}
+
+		size_t start = dstrlen(record->key);
+		if (dstresize(&record->key, start + len) != 0) {
+			goto fail;
+		}
+		if (fread(record->key + start, 1, len, file) != len) {
+			goto invalid_key;
+		}
+	}
+
+	if (getc(file) != '\n') {
+		goto invalid_key;
+	}
+
+	return 1;
+
+invalid_key:
+	dstrfree(record->key);
+invalid:
+	if (!ferror(file)) {
+		errno = EINVAL;
+	}
+	return -1;
+
+fail:
+	dstrfree(record->key);
+	return -1;
+}
+
+/** Load ctx->opt_profile from ctx->opt_profile_path, if it exists. */
+static int profile_load(struct bfs_ctx *ctx) {
+	const char *path = ctx->opt_profile_path;
+
+	struct bfs_opt_profile *profile = malloc(sizeof(*profile));
+	if (!profile) {
+		bfs_perror(ctx, "malloc()");
+		return -1;
+	}
+	profile->records = NULL;
+	ctx->opt_profile = profile;
+
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		if (errno == ENOENT) {
+			// The first run creates the profile
+			return 0;
+		}
+		goto fail;
+	}
+
+	char magic[sizeof(PROFILE_MAGIC)];
+	if (!fgets(magic, sizeof(magic), file) || strcmp(magic, PROFILE_MAGIC) != 0) {
+		if (!ferror(file)) {
+			errno = EINVAL;
+		}
+		goto fail_file;
+	}
+
+	while (true) {
+		struct opt_record record;
+		int ret = profile_read_record(file, &record);
+		if (ret < 0) {
+			goto fail_file;
+		} else if (ret == 0) {
+			break;
+		}
+
+		if (DARRAY_PUSH(&profile->records, &record) != 0) {
+			dstrfree(record.key);
+			goto fail_file;
+		}
+	}
+
+	fclose(file);
+	return 0;
+
+fail_file: ;
+	int error = errno;
+	fclose(file);
+	errno = error;
+fail:
+	if (errno == EINVAL) {
+		bfs_error(ctx, "'%s': Not a valid optimizer profile.\n", path);
+	} else {
+		bfs_error(ctx, "'%s': %m.\n", path);
+	}
+	return -1;
+}
+
+/** Seed the estimates of an expression's leaves from the profile. */
+static void profile_apply(const struct opt_state *state, const struct bfs_opt_profile *profile, struct bfs_expr *expr) {
+	if (bfs_expr_has_children(expr)) {
+		if (expr->lhs) {
+			profile_apply(state, profile, expr->lhs);
+		}
+		if (expr->rhs) {
+			profile_apply(state, profile, expr->rhs);
+		}
+		return;
+	}
+
+	char *key = profile_key(expr);
+	if (!key) {
+		// The profile is only a hint
+		return;
+	}
+
+	const struct opt_record *record = profile_find(profile, key);
+	dstrfree(key);
+	if (!record) {
+		return;
+	}
+
+	bool debug = opt_debug(state, 3, "profile: %pe (~${ylw}%g${rs} ~${ylw}%g%%${rs}) --> ", expr, expr->cost, 100.0*expr->probability);
+	set_measured(expr, record->evaluations, record->successes, record->timed, record->nsec);
+	if (debug) {
+		cfprintf(state->ctx->cerr, "(~${ylw}%g${rs} ~${ylw}%g%%${rs})\n", expr->cost, 100.0*expr->probability);
+	}
+}
+
+/**
+ * Compute the bfs_stat() fields that an expression needs.  The basic fields
+ * are assumed to be needed by anything, but the sizes and times are only asked
+ * for when something looks at them.
+ */
+static enum bfs_stat_field expr_stat_fields(const struct bfs_expr *expr) {
+	if (bfs_expr_has_children(expr)) {
+		enum bfs_stat_field fields = 0;
+		if (expr->lhs) {
+			fields |= expr_stat_fields(expr->lhs);
+		}
+		if (expr->rhs) {
+			fields |= expr_stat_fields(expr->rhs);
+		}
+		return fields;
+	}
+
+	enum bfs_stat_field fields = BFS_STAT_BASIC;
+	if (expr->eval_fn == eval_empty || expr->eval_fn == eval_size) {
+		fields |= BFS_STAT_SIZE;
+	} else if (expr->eval_fn == eval_sparse || expr->eval_fn == eval_summarize) {
+		fields |= BFS_STAT_SIZE | BFS_STAT_BLOCKS;
+	} else if (expr->eval_fn == eval_newer || expr->eval_fn == eval_time) {
+		fields |= expr->stat_field;
+	} else if (expr->eval_fn == eval_used) {
+		fields |= BFS_STAT_ATIME | BFS_STAT_CTIME;
+	} else if (expr->eval_fn == eval_fls) {
+		fields |= BFS_STAT_SIZE | BFS_STAT_BLOCKS | BFS_STAT_MTIME;
+	} else if (expr->eval_fn == eval_fprintf
+		   || expr->eval_fn == eval_fprintj
+		   || expr->eval_fn == eval_fprintb) {
+		fields = BFS_STAT_ALL;
+	}
+	return fields;
+}
+
+/** Collect the pure subexpressions that are worth memoizing. */
+static int collect_memo_exprs(struct bfs_expr *expr, struct bfs_expr ***exprs) {
+	if (expr->pure && expr->eval_fn != eval_true && expr->eval_fn != eval_false && expr->eval_fn != eval_not) {
+		if (DARRAY_PUSH(exprs, &expr) != 0) {
+			return -1;
+		}
+	}
+
+	if (bfs_expr_has_children(expr)) {
+		if (expr->lhs && collect_memo_exprs(expr->lhs, exprs) != 0) {
+			return -1;
+		}
+		return collect_memo_exprs(expr->rhs, exprs);
+	}
+
+	return 0;
+}
+
+/**
+ * Common subexpression elimination.  Pure subexpressions that occur more than
+ * once share a slot in a per-file memo table, so only the first occurrence is
+ * actually evaluated for each file.
+ */
+static int memoize_exprs(const struct opt_state *state, struct bfs_ctx *ctx) {
+	struct bfs_expr **exprs = NULL;
+	if (collect_memo_exprs(ctx->exclude, &exprs) != 0 || collect_memo_exprs(ctx->expr, &exprs) != 0) {
+		bfs_perror(ctx, "DARRAY_PUSH()");
+		darray_free(exprs);
+		return -1;
+	}
+
+	size_t nexprs = darray_length(exprs);
+	for (size_t i = 0; i < nexprs; ++i) {
+		struct bfs_expr *expr = exprs[i];
+		if (expr->memo) {
+			continue;
+		}
+
+		for (size_t j = i + 1; j < nexprs; ++j) {
+			struct bfs_expr *other = exprs[j];
+			if (!other->memo && expr_equal(expr, other)) {
+				if (!expr->memo) {
+					expr->memo = ++ctx->nmemo;
+					opt_debug(state, 2, "common subexpression: %pe\n", expr);
+				}
+				other->memo = expr->memo;
+			}
+		}
+	}
+
+	darray_free(exprs);
+	return 0;
+}
+
 int bfs_optimize(struct bfs_ctx *ctx) {
 	bfs_ctx_dump(ctx, DEBUG_OPT);
 
@@ -1039,6 +1602,17 @@ int bfs_optimize(struct bfs_ctx *ctx) {
 	};
 	facts_init(&state.facts);
 
+	if (ctx->opt_profile_path) {
+		if (profile_load(ctx) != 0) {
+			return -1;
+		}
+
+		if (ctx->optlevel >= 3) {
+			profile_apply(&state, ctx->opt_profile, ctx->exclude);
+			profile_apply(&state, ctx->opt_profile, ctx->expr);
+		}
+	}
+
 	ctx->exclude = optimize_expr(&state, ctx->exclude);
 	if (!ctx->exclude) {
 		return -1;
@@ -1084,5 +1658,168 @@ int bfs_optimize(struct bfs_ctx *ctx) {
 		opt_debug(&state, 4, "data flow: maxdepth --> %d\n", ctx->maxdepth);
 	}
 
+	const struct range *mtime_when_impure = &facts_when_impure.ranges[MTIME_RANGE];
+	if (ctx->assume_dir_mtime && !range_is_impossible(mtime_when_impure)) {
+		ctx->dir_mtime_min = mtime_when_impure->min;
+		if (ctx->dir_mtime_min != LLONG_MIN) {
+			bfs_debug(ctx, DEBUG_OPT, "data flow: prune directories with mtime < %lld\n", ctx->dir_mtime_min);
+		}
+	}
+
+	if (optlevel >= 2 && memoize_exprs(&state, ctx) != 0) {
+		return -1;
+	}
+
+	ctx->stat_fields = expr_stat_fields(ctx->exclude) | expr_stat_fields(ctx->expr);
+	if (ctx->top > 0) {
+		ctx->stat_fields |= ctx->top_field;
+	}
+
+	return 0;
+}
+
+/** Get the total of an elapsed time in nanoseconds. */
+static unsigned long long elapsed_nsec(const struct timespec *elapsed) {
+	return 1000000000ULL*elapsed->tv_sec + elapsed->tv_nsec;
+}
+
+/**
+ * Recompute the estimated cost and probability of every subexpression from
+ * the measurements taken so far.  Subexpressions without enough samples keep
+ * their previous estimates.
+ *
+ * Note that the measured probability of the right hand side of -and/-or is
+ * conditional on the result of the left hand side.  The swapped cost computed
+ * by reorder_expr_recursive() assumes independence, just like the static
+ * estimates do.
+ */
+static void measure_expr(struct bfs_expr *expr) {
+	if (!bfs_expr_has_children(expr)) {
+		set_measured(expr, expr->evaluations, expr->successes, expr->timed, elapsed_nsec(&expr->elapsed));
+		return;
+	}
+
+	struct bfs_expr *lhs = expr->lhs;
+	struct bfs_expr *rhs = expr->rhs;
+	if (lhs) {
+		measure_expr(lhs);
+	}
+	measure_expr(rhs);
+
+	if (expr->eval_fn == eval_not) {
+		expr->cost = rhs->cost;
+		expr->probability = 1.0 - rhs->probability;
+	} else if (expr->eval_fn == eval_and) {
+		expr->cost = lhs->cost + lhs->probability*rhs->cost;
+		expr->probability = lhs->probability*rhs->probability;
+	} else if (expr->eval_fn == eval_or) {
+		expr->cost = lhs->cost + (1 - lhs->probability)*rhs->cost;
+		expr->probability = lhs->probability + rhs->probability - lhs->probability*rhs->probability;
+	} else if (expr->eval_fn == eval_comma) {
+		expr->cost = lhs->cost + rhs->cost;
+		expr->probability = rhs->probability;
+	}
+
+	set_measured(expr, expr->evaluations, expr->successes, 0, 0.0);
+}
+
+void bfs_reoptimize(const struct bfs_ctx *ctx) {
+	struct opt_state state = {
+		.ctx = ctx,
+	};
+
+	opt_debug(&state, 4, "adaptive: re-ordering with measured costs\n");
+
+	measure_expr(ctx->exclude);
+	reorder_expr_recursive(&state, ctx->exclude);
+
+	measure_expr(ctx->expr);
+	reorder_expr_recursive(&state, ctx->expr);
+}
+
+/** Add the measurements of an expression's leaves to the profile. */
+static int profile_merge(struct bfs_opt_profile *profile, const struct bfs_expr *expr) {
+	if (bfs_expr_has_children(expr)) {
+		if (expr->lhs && profile_merge(profile, expr->lhs) != 0) {
+			return -1;
+		}
+		return profile_merge(profile, expr->rhs);
+	}
+
+	if (expr->evaluations == 0) {
+		return 0;
+	}
+
+	char *key = profile_key(expr);
+	if (!key) {
+		return -1;
+	}
+
+	struct opt_record *record = profile_find(profile, key);
+	if (record) {
+		dstrfree(key);
+	} else {
+		struct opt_record new_record = {
+			.key = key,
+		};
+		if (DARRAY_PUSH(&profile->records, &new_record) != 0) {
+			dstrfree(key);
+			return -1;
+		}
+		record = &profile->records[darray_length(profile->records) - 1];
+	}
+
+	record->evaluations += expr->evaluations;
+	record->successes += expr->successes;
+	record->timed += expr->timed;
+	record->nsec += elapsed_nsec(&expr->elapsed);
+	return 0;
+}
+
+int bfs_opt_profile_save(const struct bfs_ctx *ctx) {
+	struct bfs_opt_profile *profile = ctx->opt_profile;
+	if (!profile) {
+		// Optimization failed before the profile was loaded
+		return 0;
+	}
+
+	if (profile_merge(profile, ctx->exclude) != 0 || profile_merge(profile, ctx->expr) != 0) {
+		return -1;
+	}
+
+	FILE *file = fopen(ctx->opt_profile_path, "w");
+	if (!file) {
+		return -1;
+	}
+
+	fputs(PROFILE_MAGIC, file);
+	for (size_t i = 0; i < darray_length(profile->records); ++i) {
+		const struct opt_record *record = &profile->records[i];
+		fprintf(file, "%zu %zu %zu %llu ", record->evaluations, record->successes, record->timed, record->nsec);
+		fwrite(record->key, 1, dstrlen(record->key), file);
+		fputc('\n', file);
+	}
+
+	int error = ferror(file) ? EIO : 0;
+	if (fclose(file) != 0 && !error) {
+		error = errno;
+	}
+	if (error) {
+		errno = error;
+		return -1;
+	}
+
 	return 0;
 }
+
+void bfs_opt_profile_free(struct bfs_opt_profile *profile) {
+	if (!profile) {
+		return;
+	}
+
+	for (size_t i = 0; i < darray_length(profile->records); ++i) {
+		dstrfree(profile->records[i].key);
+	}
+	darray_free(profile->records);
+	free(profile);
+}
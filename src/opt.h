@@ -24,7 +24,8 @@
 struct bfs_ctx;
 
 /**
- * Apply optimizations to the command line.
+ * Apply optimizations to the command line.  If ctx->opt_profile_path is set,
+ * the optimizer profile is loaded from it first.
  *
  * @param ctx
  *         The bfs context to optimize.
@@ -33,5 +34,35 @@ struct bfs_ctx;
  */
 int bfs_optimize(struct bfs_ctx *ctx);
 
+/**
+ * Re-order the expression tree based on the costs and probabilities measured
+ * so far during evaluation.
+ *
+ * @param ctx
+ *         The bfs context being evaluated.
+ */
+void bfs_reoptimize(const struct bfs_ctx *ctx);
+
+/**
+ * Costs and probabilities measured by previous runs.
+ */
+struct bfs_opt_profile;
+
+/**
+ * Merge the measurements from this run into the optimizer profile, and write
+ * it to ctx->opt_profile_path.
+ *
+ * @param ctx
+ *         The bfs context that was evaluated.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_opt_profile_save(const struct bfs_ctx *ctx);
+
+/**
+ * Free an optimizer profile.
+ */
+void bfs_opt_profile_free(struct bfs_opt_profile *profile);
+
 #endif // BFS_OPT_H
 
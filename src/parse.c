@@ -33,9 +33,11 @@
 #include "exec.h"
 #include "expr.h"
 #include "fsade.h"
+#include "glob.h"
 #include "opt.h"
 #include "printf.h"
 #include "pwcache.h"
+#include "snapshot.h"
 #include "stat.h"
 #include "typo.h"
 #include "util.h"
@@ -109,6 +111,17 @@ void bfs_expr_free(struct bfs_expr *expr) {
 		bfs_printf_free(expr->printf);
 	} else if (expr->eval_fn == eval_regex) {
 		bfs_regfree(expr->regex);
+	} else if (expr->eval_fn == eval_name || expr->eval_fn == eval_path || expr->eval_fn == eval_lname) {
+		bfs_glob_free(expr->glob);
+	} else if (expr->eval_fn == eval_name_set) {
+		bfs_globset_free(expr->globset);
+		free(expr->argv);
+	} else if (expr->eval_fn == eval_chmod) {
+		darray_free(expr->chmod);
+	} else if (expr->eval_fn == eval_copy_to) {
+		if (expr->copy_fd >= 0) {
+			xclose(expr->copy_fd);
+		}
 	}
 
 	free(expr);
@@ -130,10 +143,12 @@ struct bfs_expr *bfs_expr_new(bfs_eval_fn *eval_fn, size_t argc, char **argv) {
 	expr->always_true = false;
 	expr->always_false = false;
 	expr->synthetic = false;
+	expr->memo = 0;
 	expr->cost = FAST_COST;
 	expr->probability = 0.5;
 	expr->evaluations = 0;
 	expr->successes = 0;
+	expr->timed = 0;
 	expr->elapsed.tv_sec = 0;
 	expr->elapsed.tv_nsec = 0;
 	return expr;
@@ -484,7 +499,12 @@ static int expr_open(struct parser_state *state, struct bfs_expr *expr, const ch
 		goto fail;
 	}
 
-	cfile = cfwrap(file, state->use_color ? ctx->colors : NULL, true);
+	const struct colors *colors = NULL;
+	if (state->use_color && isatty(fileno(file))) {
+		colors = bfs_ctx_colors(ctx);
+	}
+
+	cfile = cfwrap(file, colors, true);
 	if (!cfile) {
 		goto fail;
 	}
@@ -898,6 +918,8 @@ static void debug_help(CFILE *cfile) {
 	cfprintf(cfile, "  ${bld}search${rs}: Trace the filesystem traversal.\n");
 	cfprintf(cfile, "  ${bld}stat${rs}:   Trace all stat() calls.\n");
 	cfprintf(cfile, "  ${bld}tree${rs}:   Print the parse tree.\n");
+	cfprintf(cfile, "  ${bld}prof${rs}:   Print a JSON profiling report at exit, or on ${bld}SIGUSR1${rs}.\n");
+	cfprintf(cfile, "  ${bld}startup${rs}: Print the time spent starting up.\n");
 	cfprintf(cfile, "  ${bld}all${rs}:    All debug flags at once.\n");
 }
 
@@ -992,6 +1014,31 @@ static struct bfs_expr *parse_optlevel(struct parser_state *state, int arg1, int
 	return parse_nullary_flag(state);
 }
 
+/**
+ * Parse -jN, -j N.
+ */
+static struct bfs_expr *parse_jobs(struct parser_state *state, int arg1, int arg2) {
+	const char *flag = state->argv[0];
+	const char *arg = flag + 2;
+	size_t argc = 1;
+
+	if (!*arg) {
+		arg = state->argv[1];
+		if (!arg) {
+			parse_error(state, "${cyn}-j${rs} needs a value.\n");
+			return NULL;
+		}
+		argc = 2;
+	}
+
+	int *threads = &state->ctx->threads;
+	if (!parse_int(state, &state->argv[argc - 1], arg, threads, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	return parse_flag(state, argc);
+}
+
 /**
  * Parse -[PHL], -follow.
  */
@@ -1058,6 +1105,14 @@ static struct bfs_expr *parse_acl(struct parser_state *state, int flag, int arg2
 #endif
 }
 
+/**
+ * Parse -assume-dir-mtime.
+ */
+static struct bfs_expr *parse_assume_dir_mtime(struct parser_state *state, int arg1, int arg2) {
+	state->ctx->assume_dir_mtime = true;
+	return parse_nullary_option(state);
+}
+
 /**
  * Parse -[aBcm]?newer.
  */
@@ -1186,16 +1241,252 @@ static struct bfs_expr *parse_capable(struct parser_state *state, int flag, int
 #endif
 }
 
+/** Get the bits for a WHO character in a -chmod mode. */
+static mode_t parse_chmod_who(char c) {
+	switch (c) {
+	case 'u':
+		return 04700;
+	case 'g':
+		return 02070;
+	case 'o':
+		return 01007;
+	case 'a':
+		return 07777;
+	default:
+		return 0;
+	}
+}
+
+/** Get the bits for a PERM character in a -chmod mode. */
+static mode_t parse_chmod_perm(char c) {
+	switch (c) {
+	case 'r':
+		return 0444;
+	case 'w':
+		return 0222;
+	case 'x':
+		return 0111;
+	case 's':
+		return S_ISUID | S_ISGID;
+	case 't':
+		return S_ISVTX;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Parse a -chmod mode.  The grammar is the same as for -perm, but symbolic modes
+ * are kept as a list of clauses, since they may depend on each file's mode.
+ */
+static int parse_chmod_mode(const struct parser_state *state, struct bfs_expr *expr) {
+	const char *mode = expr->argv[1];
+
+	if (mode[0] >= '0' && mode[0] <= '9') {
+		unsigned int parsed;
+		if (!parse_int(state, NULL, mode, &parsed, 8 | IF_INT | IF_UNSIGNED | IF_QUIET)) {
+			goto fail;
+		}
+		if (parsed > 07777) {
+			goto fail;
+		}
+
+		// Like chmod(1), short octal modes only clear setuid/setgid on
+		// directories if they're set in the mode
+		mode_t mentioned = 07777;
+		if (strlen(mode) < 5) {
+			mentioned = (parsed & (S_ISUID | S_ISGID)) | S_ISVTX | 0777;
+		}
+
+		struct bfs_chmod_clause clause = {
+			.who = 07777,
+			.clear = 07777,
+			.mentioned = mentioned,
+			.op = '=',
+			.perms = parsed,
+		};
+		if (DARRAY_PUSH(&expr->chmod, &clause) != 0) {
+			parse_perror(state, "DARRAY_PUSH()");
+			return -1;
+		}
+		return 0;
+	}
+
+	// Like chmod(1), clauses without a WHO don't set bits in the umask, but
+	// '=' still clears everything
+	mode_t mask = umask(0);
+	umask(mask);
+
+	const char *i = mode;
+	while (true) {
+		mode_t who = 0;
+		for (mode_t bits; (bits = parse_chmod_who(*i)); ++i) {
+			who |= bits;
+		}
+
+		mode_t clear = who;
+		mode_t named = who;
+		if (who == 0) {
+			who = 07777 & ~mask;
+			clear = 07777;
+			named = 07777;
+		}
+
+		if (*i != '+' && *i != '-' && *i != '=') {
+			goto fail;
+		}
+
+		while (*i == '+' || *i == '-' || *i == '=') {
+			struct bfs_chmod_clause clause = {
+				.who = who,
+				.clear = clear,
+				.op = *i++,
+			};
+
+			if (*i == 'u' || *i == 'g' || *i == 'o') {
+				clause.copy = *i++;
+			} else {
+				for (mode_t bits; true; ++i) {
+					if (*i == 'X') {
+						clause.cond_exec = true;
+					} else if ((bits = parse_chmod_perm(*i))) {
+						clause.perms |= bits;
+					} else {
+						break;
+					}
+				}
+				clause.mentioned = clause.perms & named;
+			}
+
+			if (DARRAY_PUSH(&expr->chmod, &clause) != 0) {
+				parse_perror(state, "DARRAY_PUSH()");
+				return -1;
+			}
+		}
+
+		if (*i == ',') {
+			++i;
+		} else if (*i == '\0') {
+			return 0;
+		} else {
+			goto fail;
+		}
+	}
+
+fail:
+	parse_expr_error(state, expr, "Invalid mode.\n");
+	return -1;
+}
+
+/**
+ * Parse -chmod MODE.
+ */
+static struct bfs_expr *parse_chmod(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_action(state, eval_chmod);
+	if (!expr) {
+		return NULL;
+	}
+
+	expr->chmod = NULL;
+	if (parse_chmod_mode(state, expr) != 0) {
+		goto fail;
+	}
+
+	expr->cost = STAT_COST;
+	return expr;
+
+fail:
+	bfs_expr_free(expr);
+	return NULL;
+}
+
+/**
+ * Parse -chown [USER][:GROUP].
+ */
+static struct bfs_expr *parse_chown(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_action(state, eval_chown);
+	if (!expr) {
+		return NULL;
+	}
+
+	expr->chown_uid = -1;
+	expr->chown_gid = -1;
+
+	const char *spec = expr->argv[1];
+	const char *colon = strchr(spec, ':');
+	const char *group = colon ? colon + 1 : "";
+	char *user = strndup(spec, colon ? (size_t)(colon - spec) : strlen(spec));
+	if (!user) {
+		parse_perror(state, "strndup()");
+		goto fail;
+	}
+
+	long long id;
+	if (user[0]) {
+		const struct bfs_users *users = bfs_ctx_users(state->ctx);
+		if (!users) {
+			parse_expr_error(state, expr, "Couldn't parse the user table: %m.\n");
+			goto fail_user;
+		}
+
+		const struct passwd *pwd = bfs_getpwnam(users, user);
+		if (pwd) {
+			expr->chown_uid = pwd->pw_uid;
+			// Like chown(1), "USER:" means USER's login group
+			if (colon && !group[0]) {
+				expr->chown_gid = pwd->pw_gid;
+			}
+		} else if (parse_int(state, NULL, user, &id, IF_LONG_LONG | IF_UNSIGNED | IF_QUIET)) {
+			expr->chown_uid = id;
+		} else {
+			parse_expr_error(state, expr, "No such user.\n");
+			goto fail_user;
+		}
+	}
+
+	if (group[0]) {
+		const struct bfs_groups *groups = bfs_ctx_groups(state->ctx);
+		if (!groups) {
+			parse_expr_error(state, expr, "Couldn't parse the group table: %m.\n");
+			goto fail_user;
+		}
+
+		const struct group *grp = bfs_getgrnam(groups, group);
+		if (grp) {
+			expr->chown_gid = grp->gr_gid;
+		} else if (parse_int(state, NULL, group, &id, IF_LONG_LONG | IF_UNSIGNED | IF_QUIET)) {
+			expr->chown_gid = id;
+		} else {
+			parse_expr_error(state, expr, "No such group.\n");
+			goto fail_user;
+		}
+	}
+
+	if (expr->chown_uid == (uid_t)-1 && expr->chown_gid == (gid_t)-1) {
+		parse_expr_error(state, expr, "Expected ${bld}USER${rs}, ${bld}USER${rs}:${bld}GROUP${rs}, or :${bld}GROUP${rs}.\n");
+		goto fail_user;
+	}
+
+	free(user);
+	return expr;
+
+fail_user:
+	free(user);
+fail:
+	bfs_expr_free(expr);
+	return NULL;
+}
+
 /**
  * Parse -(no)?color.
  */
 static struct bfs_expr *parse_color(struct parser_state *state, int color, int arg2) {
 	struct bfs_ctx *ctx = state->ctx;
-	struct colors *colors = ctx->colors;
 
 	if (color) {
+		const struct colors *colors = bfs_ctx_colors(ctx);
 		if (!colors) {
-			parse_error(state, "%s.\n", strerror(ctx->colors_error));
+			parse_error(state, "%m.\n");
 			return NULL;
 		}
 
@@ -1248,6 +1539,30 @@ static struct bfs_expr *parse_daystart(struct parser_state *state, int arg1, int
 	return parse_nullary_option(state);
 }
 
+/**
+ * Parse -copy-to DIR.
+ */
+static struct bfs_expr *parse_copy_to(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_action(state, eval_copy_to);
+	if (!expr) {
+		return NULL;
+	}
+
+	expr->copy_fd = open(expr->argv[1], O_RDONLY | O_CLOEXEC | O_DIRECTORY);
+	if (expr->copy_fd < 0) {
+		parse_expr_error(state, expr, "%m.\n");
+		goto fail;
+	}
+
+	expr->persistent_fds = 1;
+	expr->ephemeral_fds = 2;
+	return expr;
+
+fail:
+	bfs_expr_free(expr);
+	return NULL;
+}
+
 /**
  * Parse -delete.
  */
@@ -1257,6 +1572,30 @@ static struct bfs_expr *parse_delete(struct parser_state *state, int arg1, int a
 	return parse_nullary_action(state, eval_delete);
 }
 
+/**
+ * Parse -delete-jobs N.
+ */
+static struct bfs_expr *parse_delete_jobs(struct parser_state *state, int arg1, int arg2) {
+	const char *arg = state->argv[0];
+	const char *value = state->argv[1];
+	if (!value) {
+		parse_error(state, "${blu}%s${rs} needs a value.\n", arg);
+		return NULL;
+	}
+
+	int *jobs = &state->ctx->delete_jobs;
+	if (!parse_int(state, &state->argv[1], value, jobs, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	if (*jobs == 0) {
+		parse_argv_error(state, &state->argv[1], 1, "At least one job is required.\n");
+		return NULL;
+	}
+
+	return parse_unary_option(state);
+}
+
 /**
  * Parse -d.
  */
@@ -1339,14 +1678,17 @@ static struct bfs_expr *parse_exec(struct parser_state *state, int flags, int ar
 
 	expr->exec = execbuf;
 
-	if (execbuf->flags & BFS_EXEC_MULTI) {
+	if (execbuf->flags & (BFS_EXEC_MULTI | BFS_EXEC_PIPE)) {
 		expr_set_always_true(expr);
 	} else {
 		expr->cost = 1000000.0;
 	}
 
+	// -pipe-to keeps a pipe open per job, see reserve_pipe_fds()
 	expr->ephemeral_fds = 2;
-	if (execbuf->flags & BFS_EXEC_CHDIR) {
+	if (execbuf->flags & BFS_EXEC_PIPE) {
+		expr->persistent_fds = 1;
+	} else if (execbuf->flags & BFS_EXEC_CHDIR) {
 		if (execbuf->flags & BFS_EXEC_MULTI) {
 			expr->persistent_fds = 1;
 		} else {
@@ -1361,6 +1703,30 @@ static struct bfs_expr *parse_exec(struct parser_state *state, int flags, int ar
 	return expr;
 }
 
+/**
+ * Parse -exec-jobs N.
+ */
+static struct bfs_expr *parse_exec_jobs(struct parser_state *state, int arg1, int arg2) {
+	const char *arg = state->argv[0];
+	const char *value = state->argv[1];
+	if (!value) {
+		parse_error(state, "${blu}%s${rs} needs a value.\n", arg);
+		return NULL;
+	}
+
+	int *jobs = &state->ctx->exec_jobs;
+	if (!parse_int(state, &state->argv[1], value, jobs, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	if (*jobs == 0) {
+		parse_argv_error(state, &state->argv[1], 1, "At least one job is required.\n");
+		return NULL;
+	}
+
+	return parse_unary_option(state);
+}
+
 /**
  * Parse -exit [STATUS].
  */
@@ -1559,6 +1925,25 @@ fail:
 	return NULL;
 }
 
+/**
+ * Parse -fprintb FILE.
+ */
+static struct bfs_expr *parse_fprintb(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_action(state, eval_fprintb);
+	if (expr) {
+		expr_set_always_true(expr);
+		expr->cost = PRINT_COST;
+		if (expr_open(state, expr, expr->argv[1]) != 0) {
+			goto fail;
+		}
+	}
+	return expr;
+
+fail:
+	bfs_expr_free(expr);
+	return NULL;
+}
+
 /**
  * Parse -fprintf FILE FORMAT.
  */
@@ -1601,6 +1986,25 @@ fail:
 	return NULL;
 }
 
+/**
+ * Parse -fprintj FILE.
+ */
+static struct bfs_expr *parse_fprintj(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_action(state, eval_fprintj);
+	if (expr) {
+		expr_set_always_true(expr);
+		expr->cost = PRINT_COST;
+		if (expr_open(state, expr, expr->argv[1]) != 0) {
+			goto fail;
+		}
+	}
+	return expr;
+
+fail:
+	bfs_expr_free(expr);
+	return NULL;
+}
+
 /**
  * Parse -fstype TYPE.
  */
@@ -1643,6 +2047,9 @@ static struct bfs_expr *parse_group(struct parser_state *state, int arg1, int ar
 		if (!parse_icmp(state, expr, 0)) {
 			goto fail;
 		}
+	} else if (errno) {
+		parse_expr_error(state, expr, "Couldn't look up the group: %m.\n");
+		goto fail;
 	} else {
 		parse_expr_error(state, expr, "No such group.\n");
 		goto fail;
@@ -1699,6 +2106,9 @@ static struct bfs_expr *parse_user(struct parser_state *state, int arg1, int arg
 		if (!parse_icmp(state, expr, 0)) {
 			goto fail;
 		}
+	} else if (errno) {
+		parse_expr_error(state, expr, "Couldn't look up the user: %m.\n");
+		goto fail;
 	} else {
 		parse_expr_error(state, expr, "No such user.\n");
 		goto fail;
@@ -1796,16 +2206,18 @@ static struct bfs_expr *parse_fnmatch(const struct parser_state *state, struct b
 		return NULL;
 	}
 
+	// bfs_expr_free() frees the glob, so make sure it's valid on every path
+	expr->glob = NULL;
+
+	int flags = 0;
 	if (casefold) {
 #ifdef FNM_CASEFOLD
-		expr->num = FNM_CASEFOLD;
+		flags = FNM_CASEFOLD;
 #else
 		parse_expr_error(state, expr, "Missing platform support.\n");
 		bfs_expr_free(expr);
 		return NULL;
 #endif
-	} else {
-		expr->num = 0;
 	}
 
 	// POSIX says, about fnmatch():
@@ -1827,7 +2239,18 @@ static struct bfs_expr *parse_fnmatch(const struct parser_state *state, struct b
 		return &bfs_false;
 	}
 
-	expr->cost = 400.0;
+	expr->glob = bfs_glob_compile(pattern, flags);
+	if (!expr->glob) {
+		parse_expr_error(state, expr, "%m.\n");
+		bfs_expr_free(expr);
+		return NULL;
+	}
+
+	if (bfs_glob_is_fnmatch(expr->glob)) {
+		expr->cost = 400.0;
+	} else {
+		expr->cost = FAST_COST;
+	}
 
 	if (strchr(pattern, '*')) {
 		expr->probability = 0.5;
@@ -2267,6 +2690,27 @@ fail:
 	return -1;
 }
 
+/**
+ * Parse -opt-profile FILE.
+ */
+static struct bfs_expr *parse_opt_profile(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_ctx *ctx = state->ctx;
+	const char *arg = state->argv[0];
+	const char *path = state->argv[1];
+	if (!path) {
+		parse_error(state, "${blu}%s${rs} needs a file.\n", arg);
+		return NULL;
+	}
+
+	if (ctx->opt_profile_path) {
+		parse_argv_error(state, state->argv, 2, "Only one optimizer profile can be used.\n");
+		return NULL;
+	}
+	ctx->opt_profile_path = path;
+
+	return parse_unary_option(state);
+}
+
 /**
  * Parse -perm MODE.
  */
@@ -2333,6 +2777,17 @@ static struct bfs_expr *parse_print0(struct parser_state *state, int arg1, int a
 	return expr;
 }
 
+/**
+ * Parse -printb.
+ */
+static struct bfs_expr *parse_printb(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_nullary_action(state, eval_fprintb);
+	if (expr) {
+		init_print_expr(state, expr);
+	}
+	return expr;
+}
+
 /**
  * Parse -printf FORMAT.
  */
@@ -2353,7 +2808,18 @@ static struct bfs_expr *parse_printf(struct parser_state *state, int arg1, int a
 }
 
 /**
- * Parse -printx.
+ * Parse -printj.
+ */
+static struct bfs_expr *parse_printj(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_nullary_action(state, eval_fprintj);
+	if (expr) {
+		init_print_expr(state, expr);
+	}
+	return expr;
+}
+
+/**
+ * Parse -printx.
  */
 static struct bfs_expr *parse_printx(struct parser_state *state, int arg1, int arg2) {
 	struct bfs_expr *expr = parse_nullary_action(state, eval_fprintx);
@@ -2396,6 +2862,7 @@ static struct bfs_expr *parse_regex(struct parser_state *state, int flags, int a
 		goto fail;
 	}
 
+	expr->regex_type = state->regex_type;
 	if (bfs_regcomp(&expr->regex, expr->argv[1], state->regex_type, flags) != 0) {
 		if (!expr->regex) {
 			parse_perror(state, "bfs_regcomp()");
@@ -2420,6 +2887,92 @@ fail:
 	return NULL;
 }
 
+/**
+ * Parse -limit N.
+ */
+static struct bfs_expr *parse_limit(struct parser_state *state, int arg1, int arg2) {
+	const char *arg = state->argv[0];
+	const char *value = state->argv[1];
+	if (!value) {
+		parse_error(state, "${blu}%s${rs} needs a value.\n", arg);
+		return NULL;
+	}
+
+	int *limit = &state->ctx->limit;
+	if (!parse_int(state, &state->argv[1], value, limit, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	if (*limit == 0) {
+		parse_argv_error(state, &state->argv[1], 1, "The limit must be at least ${bld}1${rs}.\n");
+		return NULL;
+	}
+
+	return parse_unary_option(state);
+}
+
+/**
+ * Parse -queue-limit N.
+ */
+static struct bfs_expr *parse_queue_limit(struct parser_state *state, int arg1, int arg2) {
+	const char *arg = state->argv[0];
+	const char *value = state->argv[1];
+	if (!value) {
+		parse_error(state, "${blu}%s${rs} needs a value.\n", arg);
+		return NULL;
+	}
+
+	int *limit = &state->ctx->queue_limit;
+	if (!parse_int(state, &state->argv[1], value, limit, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	return parse_unary_option(state);
+}
+
+/**
+ * Parse -readdir-buffer MIN[,MAX].
+ */
+static struct bfs_expr *parse_readdir_buffer(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_ctx *ctx = state->ctx;
+
+	const char *arg = state->argv[0];
+	const char *value = state->argv[1];
+	if (!value) {
+		parse_error(state, "${blu}%s${rs} needs a value.\n", arg);
+		return NULL;
+	}
+
+	int min, max;
+	const char *tail = parse_int(state, &state->argv[1], value, &min, IF_INT | IF_UNSIGNED | IF_PARTIAL_OK);
+	if (!tail) {
+		return NULL;
+	}
+
+	if (*tail == ',') {
+		if (!parse_int(state, &state->argv[1], tail + 1, &max, IF_INT | IF_UNSIGNED)) {
+			return NULL;
+		}
+	} else if (*tail) {
+		parse_argv_error(state, &state->argv[1], 1, "Expected ${bld}MIN${rs}[,${bld}MAX${rs}].\n");
+		return NULL;
+	} else {
+		max = min > ctx->readdir_max ? min : ctx->readdir_max;
+	}
+
+	if (min < 1) {
+		parse_argv_error(state, &state->argv[1], 1, "The buffer size must be at least ${bld}1${rs} KiB.\n");
+		return NULL;
+	} else if (max < min) {
+		parse_argv_error(state, &state->argv[1], 1, "${bld}MAX${rs} must be at least ${bld}MIN${rs}.\n");
+		return NULL;
+	}
+
+	ctx->readdir_min = min;
+	ctx->readdir_max = max;
+	return parse_unary_option(state);
+}
+
 /**
  * Parse -E.
  */
@@ -2428,6 +2981,30 @@ static struct bfs_expr *parse_regex_extended(struct parser_state *state, int arg
 	return parse_nullary_flag(state);
 }
 
+/**
+ * Parse -root-jobs N.
+ */
+static struct bfs_expr *parse_root_jobs(struct parser_state *state, int arg1, int arg2) {
+	const char *arg = state->argv[0];
+	const char *value = state->argv[1];
+	if (!value) {
+		parse_error(state, "${blu}%s${rs} needs a value.\n", arg);
+		return NULL;
+	}
+
+	int *jobs = &state->ctx->root_jobs;
+	if (!parse_int(state, &state->argv[1], value, jobs, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	if (*jobs == 0) {
+		parse_argv_error(state, &state->argv[1], 1, "At least one job is required.\n");
+		return NULL;
+	}
+
+	return parse_unary_option(state);
+}
+
 /**
  * Parse -regextype TYPE.
  */
@@ -2581,6 +3158,190 @@ fail:
 	return NULL;
 }
 
+/**
+ * Parse -shard K/N.
+ */
+static struct bfs_expr *parse_shard(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_ctx *ctx = state->ctx;
+
+	const char *arg = state->argv[0];
+	const char *value = state->argv[1];
+	if (!value) {
+		parse_error(state, "${blu}%s${rs} needs a value.\n", arg);
+		return NULL;
+	}
+
+	int index, count;
+	const char *tail = parse_int(state, &state->argv[1], value, &index, IF_INT | IF_UNSIGNED | IF_PARTIAL_OK);
+	if (!tail) {
+		return NULL;
+	}
+
+	if (*tail != '/') {
+		parse_argv_error(state, &state->argv[1], 1, "Expected ${bld}K/N${rs}.\n");
+		return NULL;
+	}
+
+	if (!parse_int(state, &state->argv[1], tail + 1, &count, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	if (index < 1 || index > count) {
+		parse_argv_error(state, &state->argv[1], 1, "The shard must be between 1 and ${bld}N${rs}.\n");
+		return NULL;
+	}
+
+	ctx->shard_index = index - 1;
+	ctx->shard_count = count;
+	return parse_unary_option(state);
+}
+
+/**
+ * Parse -shard-depth N.
+ */
+static struct bfs_expr *parse_shard_depth(struct parser_state *state, int arg1, int arg2) {
+	const char *arg = state->argv[0];
+	const char *value = state->argv[1];
+	if (!value) {
+		parse_error(state, "${blu}%s${rs} needs a value.\n", arg);
+		return NULL;
+	}
+
+	int *depth = &state->ctx->shard_depth;
+	if (!parse_int(state, &state->argv[1], value, depth, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	return parse_unary_option(state);
+}
+
+/**
+ * Parse -summarize FIELD[,FIELD...].
+ */
+static struct bfs_expr *parse_summarize(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_ctx *ctx = state->ctx;
+	if (ctx->nsummary_fields > 0) {
+		parse_argv_error(state, state->argv, 1, "Only one ${blu}-summarize${rs} is supported.\n");
+		return NULL;
+	}
+
+	struct bfs_expr *expr = parse_unary_action(state, eval_summarize);
+	if (!expr) {
+		return NULL;
+	}
+
+	unsigned int seen = 0;
+	const char *field = expr->argv[1];
+	while (true) {
+		size_t len = strcspn(field, ",");
+
+		enum bfs_summary_field value;
+		if (len == strlen("size") && strncmp(field, "size", len) == 0) {
+			value = BFS_SUMMARY_SIZE;
+		} else if (len == strlen("count") && strncmp(field, "count", len) == 0) {
+			value = BFS_SUMMARY_COUNT;
+		} else if (len == strlen("blocks") && strncmp(field, "blocks", len) == 0) {
+			value = BFS_SUMMARY_BLOCKS;
+		} else {
+			parse_expr_error(state, expr, "Expected a comma-separated list of ${bld}size${rs}, ${bld}count${rs}, or ${bld}blocks${rs}.\n");
+			goto fail;
+		}
+
+		if (seen & (1U << value)) {
+			parse_expr_error(state, expr, "Each field may only be given once.\n");
+			goto fail;
+		}
+		seen |= 1U << value;
+		ctx->summary_fields[ctx->nsummary_fields++] = value;
+
+		field += len;
+		if (*field == '\0') {
+			break;
+		}
+		++field;
+	}
+
+	// Totals are printed after everything beneath a directory
+	ctx->flags |= BFTW_POST_ORDER;
+	state->depth_arg = expr->argv;
+	expr->cost = PRINT_COST;
+	return expr;
+
+fail:
+	ctx->nsummary_fields = 0;
+	bfs_expr_free(expr);
+	return NULL;
+}
+
+/**
+ * Parse -summarize-depth N.
+ */
+static struct bfs_expr *parse_summarize_depth(struct parser_state *state, int arg1, int arg2) {
+	const char *arg = state->argv[0];
+	const char *value = state->argv[1];
+	if (!value) {
+		parse_error(state, "${blu}%s${rs} needs a value.\n", arg);
+		return NULL;
+	}
+
+	int *depth = &state->ctx->summary_depth;
+	if (!parse_int(state, &state->argv[1], value, depth, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	return parse_unary_option(state);
+}
+
+/**
+ * Parse -top K.
+ */
+static struct bfs_expr *parse_top(struct parser_state *state, int arg1, int arg2) {
+	const char *arg = state->argv[0];
+	const char *value = state->argv[1];
+	if (!value) {
+		parse_error(state, "${blu}%s${rs} needs a value.\n", arg);
+		return NULL;
+	}
+
+	int *top = &state->ctx->top;
+	if (!parse_int(state, &state->argv[1], value, top, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	if (*top == 0) {
+		parse_argv_error(state, &state->argv[1], 1, "At least one file must be kept.\n");
+		return NULL;
+	}
+
+	return parse_unary_option(state);
+}
+
+/**
+ * Parse -by size|mtime|atime.
+ */
+static struct bfs_expr *parse_by(struct parser_state *state, int arg1, int arg2) {
+	const char *arg = state->argv[0];
+	const char *value = state->argv[1];
+	if (!value) {
+		parse_error(state, "${blu}%s${rs} needs a value.\n", arg);
+		return NULL;
+	}
+
+	enum bfs_stat_field *field = &state->ctx->top_field;
+	if (strcmp(value, "size") == 0) {
+		*field = BFS_STAT_SIZE;
+	} else if (strcmp(value, "mtime") == 0) {
+		*field = BFS_STAT_MTIME;
+	} else if (strcmp(value, "atime") == 0) {
+		*field = BFS_STAT_ATIME;
+	} else {
+		parse_argv_error(state, &state->argv[1], 1, "Expected ${bld}size${rs}, ${bld}mtime${rs}, or ${bld}atime${rs}.\n");
+		return NULL;
+	}
+
+	return parse_unary_option(state);
+}
+
 /**
  * Parse -size N[cwbkMGTP]?.
  */
@@ -2642,6 +3403,68 @@ fail:
 	return NULL;
 }
 
+/**
+ * Parse -snapshot(-check) FILE.
+ */
+static struct bfs_expr *parse_snapshot(struct parser_state *state, int check, int arg2) {
+	struct bfs_ctx *ctx = state->ctx;
+	const char *arg = state->argv[0];
+	const char *path = state->argv[1];
+	if (!path) {
+		parse_error(state, "${blu}%s${rs} needs a file.\n", arg);
+		return NULL;
+	}
+
+	if (ctx->snapshot) {
+		parse_argv_error(state, state->argv, 2, "Only one snapshot can be read.\n");
+		return NULL;
+	}
+
+	ctx->snapshot = bfs_snap_open(path);
+	if (!ctx->snapshot) {
+		if (errno == EINVAL) {
+			parse_argv_error(state, state->argv, 2, "Not a valid snapshot.\n");
+		} else {
+			parse_argv_error(state, state->argv, 2, "%m.\n");
+		}
+		return NULL;
+	}
+	ctx->snapshot_path = path;
+
+	if (check) {
+		ctx->flags |= BFTW_SNAPSHOT_CHECK;
+	}
+
+	return parse_unary_option(state);
+}
+
+/**
+ * Parse -snapshot-save FILE.
+ */
+static struct bfs_expr *parse_snapshot_save(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_ctx *ctx = state->ctx;
+	const char *arg = state->argv[0];
+	const char *path = state->argv[1];
+	if (!path) {
+		parse_error(state, "${blu}%s${rs} needs a file.\n", arg);
+		return NULL;
+	}
+
+	if (ctx->snapshot_save) {
+		parse_argv_error(state, state->argv, 2, "Only one snapshot can be saved.\n");
+		return NULL;
+	}
+
+	ctx->snapshot_save = bfs_snap_create(path);
+	if (!ctx->snapshot_save) {
+		parse_argv_error(state, state->argv, 2, "%m.\n");
+		return NULL;
+	}
+	ctx->snapshot_save_path = path;
+
+	return parse_unary_option(state);
+}
+
 /**
  * Parse -sparse.
  */
@@ -2661,6 +3484,13 @@ static struct bfs_expr *parse_status(struct parser_state *state, int arg1, int a
 	return parse_nullary_option(state);
 }
 
+/**
+ * Parse -touch.
+ */
+static struct bfs_expr *parse_touch(struct parser_state *state, int arg1, int arg2) {
+	return parse_nullary_action(state, eval_touch);
+}
+
 /**
  * Parse -x?type [bcdpflsD].
  */
@@ -2950,6 +3780,8 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 	cfprintf(cout, "      Turn on a debugging flag (see ${cyn}-D${rs} ${bld}help${rs})\n");
 	cfprintf(cout, "  ${cyn}-O${bld}N${rs}\n");
 	cfprintf(cout, "      Enable optimization level ${bld}N${rs} (default: ${bld}3${rs})\n");
+	cfprintf(cout, "  ${cyn}-j${bld}N${rs}\n");
+	cfprintf(cout, "      Open and read directories with ${bld}N${rs} background threads (default: ${bld}0${rs})\n");
 	cfprintf(cout, "  ${cyn}-S${rs} ${bld}bfs${rs}|${bld}dfs${rs}|${bld}ids${rs}|${bld}eds${rs}\n");
 	cfprintf(cout, "      Use ${bld}b${rs}readth-${bld}f${rs}irst/${bld}d${rs}epth-${bld}f${rs}irst/${bld}i${rs}terative/${bld}e${rs}xponential ${bld}d${rs}eepening ${bld}s${rs}earch\n");
 	cfprintf(cout, "      (default: ${cyn}-S${rs} ${bld}bfs${rs})\n\n");
@@ -2977,14 +3809,22 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 
 	cfprintf(cout, "${bld}Options:${rs}\n\n");
 
+	cfprintf(cout, "  ${blu}-assume-dir-mtime${rs}\n");
+	cfprintf(cout, "      Assume that no file is newer than its parent directory, and skip directories\n");
+	cfprintf(cout, "      too old for anything beneath them to match a ${blu}-mtime${rs}/${blu}-newer${rs} test\n");
 	cfprintf(cout, "  ${blu}-color${rs}\n");
 	cfprintf(cout, "  ${blu}-nocolor${rs}\n");
 	cfprintf(cout, "      Turn colors on or off (default: ${blu}-color${rs} if outputting to a terminal,\n");
 	cfprintf(cout, "      ${blu}-nocolor${rs} otherwise)\n");
 	cfprintf(cout, "  ${blu}-daystart${rs}\n");
 	cfprintf(cout, "      Measure times relative to the start of today\n");
+	cfprintf(cout, "  ${blu}-delete-jobs${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Use ${bld}N${rs} background threads for ${blu}-delete${rs} (default: ${bld}1${rs}, no threads)\n");
 	cfprintf(cout, "  ${blu}-depth${rs}\n");
 	cfprintf(cout, "      Search in post-order (descendents first)\n");
+	cfprintf(cout, "  ${blu}-exec-jobs${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Run up to ${bld}N${rs} ${blu}-exec${rs}/${blu}-execdir${rs} ${bld}...${rs} ${blu}{} +${rs} or ${blu}-pipe-to${rs} commands at once\n");
+	cfprintf(cout, "      (default: ${bld}1${rs})\n");
 	cfprintf(cout, "  ${blu}-files0-from${rs} ${bld}FILE${rs}\n");
 	cfprintf(cout, "      Search the NUL ('\\0')-separated paths from ${bld}FILE${rs} (${bld}-${rs} for standard input).\n");
 	cfprintf(cout, "  ${blu}-follow${rs}\n");
@@ -2993,6 +3833,8 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 	cfprintf(cout, "  ${blu}-noignore_readdir_race${rs}\n");
 	cfprintf(cout, "      Whether to report an error if ${ex}bfs${rs} detects that the file tree is modified\n");
 	cfprintf(cout, "      during the search (default: ${blu}-noignore_readdir_race${rs})\n");
+	cfprintf(cout, "  ${blu}-limit${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Stop searching once ${bld}N${rs} files have matched the expression\n");
 	cfprintf(cout, "  ${blu}-maxdepth${rs} ${bld}N${rs}\n");
 	cfprintf(cout, "  ${blu}-mindepth${rs} ${bld}N${rs}\n");
 	cfprintf(cout, "      Ignore files deeper/shallower than ${bld}N${rs}\n");
@@ -3003,10 +3845,38 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 	cfprintf(cout, "      Exclude hidden files\n");
 	cfprintf(cout, "  ${blu}-noleaf${rs}\n");
 	cfprintf(cout, "      Ignored; for compatibility with GNU find\n");
+	cfprintf(cout, "  ${blu}-opt-profile${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Use the costs measured by previous runs to optimize the expression, and save\n");
+	cfprintf(cout, "      the costs measured by this run\n");
+	cfprintf(cout, "  ${blu}-queue-limit${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Switch to depth-first order while more than ${bld}N${rs} directories are queued, to\n");
+	cfprintf(cout, "      bound memory use on very wide trees (default: unlimited)\n");
+	cfprintf(cout, "  ${blu}-readdir-buffer${rs} ${bld}MIN${rs}[,${bld}MAX${rs}]\n");
+	cfprintf(cout, "      Read directories with buffers of ${bld}MIN${rs} to ${bld}MAX${rs} KiB, growing them for big\n");
+	cfprintf(cout, "      directories (default: ${bld}8,1024${rs})\n");
 	cfprintf(cout, "  ${blu}-regextype${rs} ${bld}TYPE${rs}\n");
 	cfprintf(cout, "      Use ${bld}TYPE${rs}-flavored regexes (default: ${bld}posix-basic${rs}; see ${blu}-regextype${rs} ${bld}help${rs})\n");
+	cfprintf(cout, "  ${blu}-root-jobs${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Search up to ${bld}N${rs} root paths at once in separate processes, grouping the\n");
+	cfprintf(cout, "      output by root (default: ${bld}1${rs})\n");
+	cfprintf(cout, "  ${blu}-shard${rs} ${bld}K/N${rs}\n");
+	cfprintf(cout, "      Split the search into ${bld}N${rs} disjoint shards, and only search shard ${bld}K${rs}\n");
+	cfprintf(cout, "  ${blu}-shard-depth${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Assign files to shards by their ancestor at depth ${bld}N${rs} (default: ${bld}1${rs})\n");
+	cfprintf(cout, "  ${blu}-snapshot${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Read directories from a snapshot instead of the file system, where they exist\n");
+	cfprintf(cout, "  ${blu}-snapshot-check${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Like ${blu}-snapshot${rs}, but re-read any directories that have changed since\n");
+	cfprintf(cout, "      the snapshot was saved\n");
+	cfprintf(cout, "  ${blu}-snapshot-save${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Save every directory that was read completely into a snapshot\n");
 	cfprintf(cout, "  ${blu}-status${rs}\n");
 	cfprintf(cout, "      Display a status bar while searching\n");
+	cfprintf(cout, "  ${blu}-summarize-depth${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Only print ${blu}-summarize${rs} totals for directories at most ${bld}N${rs} levels deep\n");
+	cfprintf(cout, "  ${blu}-top${rs} ${bld}K${rs} [${blu}-by${rs} ${bld}size${rs}|${bld}mtime${rs}|${bld}atime${rs}]\n");
+	cfprintf(cout, "      Only output the ${bld}K${rs} files with the biggest sizes or newest times, best first,\n");
+	cfprintf(cout, "      once the search is done (default: ${blu}-by${rs} ${bld}size${rs})\n");
 	cfprintf(cout, "  ${blu}-unique${rs}\n");
 	cfprintf(cout, "      Skip any files that have already been seen\n");
 	cfprintf(cout, "  ${blu}-warn${rs}\n");
@@ -3114,6 +3984,12 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 
 	cfprintf(cout, "${bld}Actions:${rs}\n\n");
 
+	cfprintf(cout, "  ${blu}-chmod${rs} ${bld}MODE${rs}\n");
+	cfprintf(cout, "      Change the file's permissions, like ${ex}chmod${rs} (symbolic links are skipped)\n");
+	cfprintf(cout, "  ${blu}-chown${rs} ${bld}[USER][:GROUP]${rs}\n");
+	cfprintf(cout, "      Change the file's owner and/or group, like ${ex}chown${rs}\n");
+	cfprintf(cout, "  ${blu}-copy-to${rs} ${bld}DIR${rs}\n");
+	cfprintf(cout, "      Copy regular files into ${bld}DIR${rs}, like ${ex}cp${rs} ${bld}FILE DIR${rs}\n");
 	cfprintf(cout, "  ${blu}-delete${rs}\n");
 	cfprintf(cout, "  ${blu}-rm${rs}\n");
 	cfprintf(cout, "      Delete any found files (implies ${blu}-depth${rs})\n");
@@ -3133,19 +4009,29 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 	cfprintf(cout, "  ${blu}-fls${rs} ${bld}FILE${rs}\n");
 	cfprintf(cout, "  ${blu}-fprint${rs} ${bld}FILE${rs}\n");
 	cfprintf(cout, "  ${blu}-fprint0${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "  ${blu}-fprintb${rs} ${bld}FILE${rs}\n");
 	cfprintf(cout, "  ${blu}-fprintf${rs} ${bld}FILE${rs} ${bld}FORMAT${rs}\n");
-	cfprintf(cout, "      Like ${blu}-ls${rs}/${blu}-print${rs}/${blu}-print0${rs}/${blu}-printf${rs}, but write to ${bld}FILE${rs} instead of standard\n"
-	               "      output\n");
+	cfprintf(cout, "  ${blu}-fprintj${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Like ${blu}-ls${rs}/${blu}-print${rs}/${blu}-print0${rs}/${blu}-printb${rs}/${blu}-printf${rs}/${blu}-printj${rs}, but write to\n"
+	               "      ${bld}FILE${rs} instead of standard output\n");
 	cfprintf(cout, "  ${blu}-ls${rs}\n");
 	cfprintf(cout, "      List files like ${ex}ls${rs} ${bld}-dils${rs}\n");
+	cfprintf(cout, "  ${blu}-pipe-to${rs} ${bld}command ... ;${rs}\n");
+	cfprintf(cout, "      Write the paths to the standard input of one long-running command, separated\n");
+	cfprintf(cout, "      by null characters ('\\0')\n");
 	cfprintf(cout, "  ${blu}-print${rs}\n");
 	cfprintf(cout, "      Print the path to the found file\n");
 	cfprintf(cout, "  ${blu}-print0${rs}\n");
 	cfprintf(cout, "      Like ${blu}-print${rs}, but use the null character ('\\0') as a separator rather than\n");
 	cfprintf(cout, "      newlines\n");
+	cfprintf(cout, "  ${blu}-printb${rs}\n");
+	cfprintf(cout, "      Print the path and metadata of the found file as a binary record (see ${ex}man${rs}\n");
+	cfprintf(cout, "      ${bld}bfs${rs})\n");
 	cfprintf(cout, "  ${blu}-printf${rs} ${bld}FORMAT${rs}\n");
 	cfprintf(cout, "      Print according to a format string (see ${ex}man${rs} ${bld}find${rs}).  The additional format\n");
 	cfprintf(cout, "      directives %%w and %%W${bld}k${rs} for printing file birth times are supported.\n");
+	cfprintf(cout, "  ${blu}-printj${rs}\n");
+	cfprintf(cout, "      Print the path and metadata of the found file as a line of JSON\n");
 	cfprintf(cout, "  ${blu}-printx${rs}\n");
 	cfprintf(cout, "      Like ${blu}-print${rs}, but escape whitespace and quotation characters, to make the\n");
 	cfprintf(cout, "      output safe for ${ex}xargs${rs}.  Consider using ${blu}-print0${rs} and ${ex}xargs${rs} ${bld}-0${rs} instead.\n");
@@ -3153,6 +4039,11 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 	cfprintf(cout, "      Don't descend into this directory\n");
 	cfprintf(cout, "  ${blu}-quit${rs}\n");
 	cfprintf(cout, "      Quit immediately\n");
+	cfprintf(cout, "  ${blu}-summarize${rs} ${bld}size${rs},${bld}count${rs},${bld}blocks${rs}\n");
+	cfprintf(cout, "      Add the file to the totals of every directory above it, and print each\n");
+	cfprintf(cout, "      directory's totals followed by its path once everything beneath it is done\n");
+	cfprintf(cout, "  ${blu}-touch${rs}\n");
+	cfprintf(cout, "      Set the file's access and modification times to now, like ${ex}touch${rs}\n");
 	cfprintf(cout, "  ${blu}-version${rs}\n");
 	cfprintf(cout, "      Print version information\n");
 	cfprintf(cout, "  ${blu}-help${rs}\n");
@@ -3220,20 +4111,27 @@ static const struct table_entry parse_table[] = {
 	{"-and", T_OPERATOR},
 	{"-anewer", T_TEST, parse_newer, BFS_STAT_ATIME},
 	{"-asince", T_TEST, parse_since, BFS_STAT_ATIME},
+	{"-assume-dir-mtime", T_OPTION, parse_assume_dir_mtime},
 	{"-atime", T_TEST, parse_time, BFS_STAT_ATIME},
+	{"-by", T_OPTION, parse_by},
 	{"-capable", T_TEST, parse_capable},
+	{"-chmod", T_ACTION, parse_chmod},
+	{"-chown", T_ACTION, parse_chown},
 	{"-cmin", T_TEST, parse_min, BFS_STAT_CTIME},
 	{"-cnewer", T_TEST, parse_newer, BFS_STAT_CTIME},
 	{"-color", T_OPTION, parse_color, true},
+	{"-copy-to", T_ACTION, parse_copy_to},
 	{"-csince", T_TEST, parse_since, BFS_STAT_CTIME},
 	{"-ctime", T_TEST, parse_time, BFS_STAT_CTIME},
 	{"-d", T_FLAG, parse_depth},
 	{"-daystart", T_OPTION, parse_daystart},
 	{"-delete", T_ACTION, parse_delete},
+	{"-delete-jobs", T_OPTION, parse_delete_jobs},
 	{"-depth", T_OPTION, parse_depth_n},
 	{"-empty", T_TEST, parse_empty},
 	{"-exclude", T_OPERATOR},
 	{"-exec", T_ACTION, parse_exec, 0},
+	{"-exec-jobs", T_OPTION, parse_exec_jobs},
 	{"-execdir", T_ACTION, parse_exec, BFS_EXEC_CHDIR},
 	{"-executable", T_TEST, parse_access, X_OK},
 	{"-exit", T_ACTION, parse_exit},
@@ -3245,7 +4143,9 @@ static const struct table_entry parse_table[] = {
 	{"-follow", T_OPTION, parse_follow, BFTW_FOLLOW_ALL, true},
 	{"-fprint", T_ACTION, parse_fprint},
 	{"-fprint0", T_ACTION, parse_fprint0},
+	{"-fprintb", T_ACTION, parse_fprintb},
 	{"-fprintf", T_ACTION, parse_fprintf},
+	{"-fprintj", T_ACTION, parse_fprintj},
 	{"-fstype", T_TEST, parse_fstype},
 	{"-gid", T_TEST, parse_group},
 	{"-group", T_TEST, parse_group},
@@ -3258,6 +4158,8 @@ static const struct table_entry parse_table[] = {
 	{"-ipath", T_TEST, parse_path, true},
 	{"-iregex", T_TEST, parse_regex, BFS_REGEX_ICASE},
 	{"-iwholename", T_TEST, parse_path, true},
+	{"-j", T_FLAG, parse_jobs, 0, 0, true},
+	{"-limit", T_OPTION, parse_limit},
 	{"-links", T_TEST, parse_links},
 	{"-lname", T_TEST, parse_lname, false},
 	{"-ls", T_ACTION, parse_ls},
@@ -3282,25 +4184,41 @@ static const struct table_entry parse_table[] = {
 	{"-o", T_OPERATOR},
 	{"-ok", T_ACTION, parse_exec, BFS_EXEC_CONFIRM},
 	{"-okdir", T_ACTION, parse_exec, BFS_EXEC_CONFIRM | BFS_EXEC_CHDIR},
+	{"-opt-profile", T_OPTION, parse_opt_profile},
 	{"-or", T_OPERATOR},
 	{"-path", T_TEST, parse_path, false},
 	{"-perm", T_TEST, parse_perm},
+	{"-pipe-to", T_ACTION, parse_exec, BFS_EXEC_PIPE},
 	{"-print", T_ACTION, parse_print},
 	{"-print0", T_ACTION, parse_print0},
+	{"-printb", T_ACTION, parse_printb},
 	{"-printf", T_ACTION, parse_printf},
+	{"-printj", T_ACTION, parse_printj},
 	{"-printx", T_ACTION, parse_printx},
 	{"-prune", T_ACTION, parse_prune},
+	{"-queue-limit", T_OPTION, parse_queue_limit},
 	{"-quit", T_ACTION, parse_quit},
 	{"-readable", T_TEST, parse_access, R_OK},
+	{"-readdir-buffer", T_OPTION, parse_readdir_buffer},
 	{"-regex", T_TEST, parse_regex, 0},
 	{"-regextype", T_OPTION, parse_regextype},
 	{"-rm", T_ACTION, parse_delete},
+	{"-root-jobs", T_OPTION, parse_root_jobs},
 	{"-s", T_FLAG, parse_s},
 	{"-samefile", T_TEST, parse_samefile},
+	{"-shard", T_OPTION, parse_shard},
+	{"-shard-depth", T_OPTION, parse_shard_depth},
 	{"-since", T_TEST, parse_since, BFS_STAT_MTIME},
 	{"-size", T_TEST, parse_size},
+	{"-snapshot", T_OPTION, parse_snapshot, false},
+	{"-snapshot-check", T_OPTION, parse_snapshot, true},
+	{"-snapshot-save", T_OPTION, parse_snapshot_save},
 	{"-sparse", T_TEST, parse_sparse},
 	{"-status", T_OPTION, parse_status},
+	{"-summarize", T_ACTION, parse_summarize},
+	{"-summarize-depth", T_OPTION, parse_summarize_depth},
+	{"-top", T_OPTION, parse_top},
+	{"-touch", T_ACTION, parse_touch},
 	{"-true", T_TEST, parse_const, true},
 	{"-type", T_TEST, parse_type, false},
 	{"-uid", T_TEST, parse_user},
@@ -3610,6 +4528,32 @@ static struct bfs_expr *parse_expr(struct parser_state *state) {
 /**
  * Parse the top-level expression.
  */
+/**
+ * Reserve a file descriptor for each -pipe-to job, now that all of -exec-jobs
+ * has been parsed.
+ *
+ * @return
+ *         The number of descriptors added to the expression.
+ */
+static int reserve_pipe_fds(const struct bfs_ctx *ctx, struct bfs_expr *expr) {
+	int extra = 0;
+	if (bfs_expr_has_children(expr)) {
+		if (expr->lhs) {
+			extra += reserve_pipe_fds(ctx, expr->lhs);
+		}
+		if (expr->rhs) {
+			extra += reserve_pipe_fds(ctx, expr->rhs);
+		}
+	} else if (expr->eval_fn == eval_exec && (expr->exec->flags & BFS_EXEC_PIPE)) {
+		extra = ctx->exec_jobs - expr->persistent_fds;
+	}
+
+	if (extra != 0) {
+		expr->persistent_fds += extra;
+	}
+	return extra;
+}
+
 static struct bfs_expr *parse_whole_expr(struct parser_state *state) {
 	if (skip_paths(state) != 0) {
 		return NULL;
@@ -3670,6 +4614,7 @@ static struct bfs_expr *parse_whole_expr(struct parser_state *state) {
 		goto fail;
 	}
 
+	reserve_pipe_fds(state->ctx, expr);
 	return expr;
 
 fail:
@@ -3706,6 +4651,10 @@ void bfs_ctx_dump(const struct bfs_ctx *ctx, enum debug_flags flag) {
 		cfprintf(cerr, "${cyn}-O${bld}%d${rs} ", ctx->optlevel);
 	}
 
+	if (ctx->threads != 0) {
+		cfprintf(cerr, "${cyn}-j${bld}%d${rs} ", ctx->threads);
+	}
+
 	const char *strategy = NULL;
 	switch (ctx->strategy) {
 	case BFTW_BFS:
@@ -3750,17 +4699,29 @@ void bfs_ctx_dump(const struct bfs_ctx *ctx, enum debug_flags flag) {
 		cfprintf(cerr, "${mag}%s${rs} ", path);
 	}
 
+	if (ctx->assume_dir_mtime) {
+		cfprintf(cerr, "${blu}-assume-dir-mtime${rs} ");
+	}
 	if (ctx->cout->colors) {
 		cfprintf(cerr, "${blu}-color${rs} ");
 	} else {
 		cfprintf(cerr, "${blu}-nocolor${rs} ");
 	}
+	if (ctx->delete_jobs != 1) {
+		cfprintf(cerr, "${blu}-delete-jobs${rs} ${bld}%d${rs} ", ctx->delete_jobs);
+	}
 	if (ctx->flags & BFTW_POST_ORDER) {
 		cfprintf(cerr, "${blu}-depth${rs} ");
 	}
+	if (ctx->exec_jobs != 1) {
+		cfprintf(cerr, "${blu}-exec-jobs${rs} ${bld}%d${rs} ", ctx->exec_jobs);
+	}
 	if (ctx->ignore_races) {
 		cfprintf(cerr, "${blu}-ignore_readdir_race${rs} ");
 	}
+	if (ctx->limit != 0) {
+		cfprintf(cerr, "${blu}-limit${rs} ${bld}%d${rs} ", ctx->limit);
+	}
 	if (ctx->mindepth != 0) {
 		cfprintf(cerr, "${blu}-mindepth${rs} ${bld}%d${rs} ", ctx->mindepth);
 	}
@@ -3770,9 +4731,44 @@ void bfs_ctx_dump(const struct bfs_ctx *ctx, enum debug_flags flag) {
 	if (ctx->flags & BFTW_SKIP_MOUNTS) {
 		cfprintf(cerr, "${blu}-mount${rs} ");
 	}
+	if (ctx->opt_profile_path) {
+		cfprintf(cerr, "${blu}-opt-profile${rs} ${bld}%s${rs} ", ctx->opt_profile_path);
+	}
+	if (ctx->queue_limit != 0) {
+		cfprintf(cerr, "${blu}-queue-limit${rs} ${bld}%d${rs} ", ctx->queue_limit);
+	}
+	if (ctx->readdir_min != BFS_DIR_BUF_MIN >> 10 || ctx->readdir_max != BFS_DIR_BUF_MAX >> 10) {
+		cfprintf(cerr, "${blu}-readdir-buffer${rs} ${bld}%d,%d${rs} ", ctx->readdir_min, ctx->readdir_max);
+	}
+	if (ctx->root_jobs != 1) {
+		cfprintf(cerr, "${blu}-root-jobs${rs} ${bld}%d${rs} ", ctx->root_jobs);
+	}
+	if (ctx->shard_count != 1) {
+		cfprintf(cerr, "${blu}-shard${rs} ${bld}%d/%d${rs} ", ctx->shard_index + 1, ctx->shard_count);
+		cfprintf(cerr, "${blu}-shard-depth${rs} ${bld}%d${rs} ", ctx->shard_depth);
+	}
+	if (ctx->snapshot_path) {
+		const char *arg = (ctx->flags & BFTW_SNAPSHOT_CHECK) ? "-snapshot-check" : "-snapshot";
+		cfprintf(cerr, "${blu}%s${rs} ${bld}%s${rs} ", arg, ctx->snapshot_path);
+	}
+	if (ctx->snapshot_save_path) {
+		cfprintf(cerr, "${blu}-snapshot-save${rs} ${bld}%s${rs} ", ctx->snapshot_save_path);
+	}
+	if (ctx->top != 0) {
+		const char *by = "size";
+		if (ctx->top_field == BFS_STAT_MTIME) {
+			by = "mtime";
+		} else if (ctx->top_field == BFS_STAT_ATIME) {
+			by = "atime";
+		}
+		cfprintf(cerr, "${blu}-top${rs} ${bld}%d${rs} ${blu}-by${rs} ${bld}%s${rs} ", ctx->top, by);
+	}
 	if (ctx->status) {
 		cfprintf(cerr, "${blu}-status${rs} ");
 	}
+	if (ctx->summary_depth >= 0) {
+		cfprintf(cerr, "${blu}-summarize-depth${rs} ${bld}%d${rs} ", ctx->summary_depth);
+	}
 	if (ctx->unique) {
 		cfprintf(cerr, "${blu}-unique${rs} ");
 	}
@@ -3827,7 +4823,72 @@ static int parse_gettime(const struct bfs_ctx *ctx, struct timespec *ts) {
 #endif
 }
 
+/** The stdio buffer size for standard output, when it's not a terminal. */
+#define BFS_STDOUT_BUFSIZ (64 * 1024)
+
+/**
+ * Set up standard output.  Non-terminals get a big buffer (pipes and sockets
+ * get a background writer later, see bfs_ctx_start_writer()).
+ */
+static CFILE *open_stdout(const struct colors *colors) {
+	if (!isatty(STDOUT_FILENO)) {
+		setvbuf(stdout, NULL, _IOFBF, BFS_STDOUT_BUFSIZ);
+	}
+	return cfwrap(stdout, colors, false);
+}
+
+/**
+ * Timestamps for -D startup.
+ */
+struct startup_times {
+	/** When bfs_parse_cmdline() was called. */
+	struct timespec start;
+	/** When the context and standard streams were set up. */
+	struct timespec init;
+	/** When the command line was parsed. */
+	struct timespec parse;
+	/** When the expression was optimized. */
+	struct timespec opt;
+};
+
+#if _POSIX_MONOTONIC_CLOCK > 0
+#	define BFS_STARTUP_CLOCK CLOCK_MONOTONIC
+#elif _POSIX_TIMERS > 0
+#	define BFS_STARTUP_CLOCK CLOCK_REALTIME
+#endif
+
+/**
+ * Read the clock for -D startup, or zero if it's unavailable.
+ */
+static void startup_gettime(struct timespec *ts) {
+#ifdef BFS_STARTUP_CLOCK
+	if (clock_gettime(BFS_STARTUP_CLOCK, ts) == 0) {
+		return;
+	}
+#endif
+	ts->tv_sec = 0;
+	ts->tv_nsec = 0;
+}
+
+/** Get the milliseconds between two timestamps. */
+static double startup_ms(const struct timespec *start, const struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1.0e3 + (end->tv_nsec - start->tv_nsec) / 1.0e6;
+}
+
+/**
+ * Dump the startup times for -D startup.
+ */
+static void dump_startup(const struct bfs_ctx *ctx, const struct startup_times *times) {
+	bfs_debug(ctx, DEBUG_STARTUP, "init:     %g ms\n", startup_ms(&times->start, &times->init));
+	bfs_debug(ctx, DEBUG_STARTUP, "parse:    %g ms\n", startup_ms(&times->init, &times->parse));
+	bfs_debug(ctx, DEBUG_STARTUP, "optimize: %g ms\n", startup_ms(&times->parse, &times->opt));
+	bfs_debug(ctx, DEBUG_STARTUP, "total:    %g ms\n", startup_ms(&times->start, &times->opt));
+}
+
 struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
+	struct startup_times times;
+	startup_gettime(&times.start);
+
 	struct bfs_ctx *ctx = bfs_ctx_new();
 	if (!ctx) {
 		perror("bfs_new_ctx()");
@@ -3856,18 +4917,23 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		use_color = COLOR_NEVER;
 	}
 
-	ctx->colors = parse_colors();
-	if (!ctx->colors) {
-		ctx->colors_error = errno;
+	bool stdin_tty = isatty(STDIN_FILENO);
+	bool stdout_tty = isatty(STDOUT_FILENO);
+	bool stderr_tty = isatty(STDERR_FILENO);
+
+	// Only parse $LS_COLORS up front if someone will see them
+	const struct colors *colors = NULL;
+	if (use_color && (stdout_tty || stderr_tty)) {
+		colors = bfs_ctx_colors(ctx);
 	}
 
-	ctx->cerr = cfwrap(stderr, use_color ? ctx->colors : NULL, false);
+	ctx->cerr = cfwrap(stderr, colors, false);
 	if (!ctx->cerr) {
 		perror("cfwrap()");
 		goto fail;
 	}
 
-	ctx->cout = cfwrap(stdout, use_color ? ctx->colors : NULL, false);
+	ctx->cout = open_stdout(colors);
 	if (!ctx->cout) {
 		bfs_perror(ctx, "cfwrap()");
 		goto fail;
@@ -3878,10 +4944,6 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		goto fail;
 	}
 
-	bool stdin_tty = isatty(STDIN_FILENO);
-	bool stdout_tty = isatty(STDOUT_FILENO);
-	bool stderr_tty = isatty(STDERR_FILENO);
-
 	if (getenv("POSIXLY_CORRECT")) {
 		ctx->posixly_correct = true;
 	} else {
@@ -3919,6 +4981,8 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		goto fail;
 	}
 
+	startup_gettime(&times.init);
+
 	ctx->exclude = &bfs_false;
 	ctx->expr = parse_whole_expr(&state);
 	if (!ctx->expr) {
@@ -3929,10 +4993,14 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		}
 	}
 
+	startup_gettime(&times.parse);
+
 	if (bfs_optimize(ctx) != 0) {
 		goto fail;
 	}
 
+	startup_gettime(&times.opt);
+
 	if (darray_length(ctx->paths) == 0) {
 		if (!state.implicit_root) {
 			parse_argv_error(&state, state.files0_arg, 2, "No root paths specified.\n");
@@ -3949,6 +5017,7 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 
 	bfs_ctx_dump(ctx, DEBUG_TREE);
 	dump_costs(ctx);
+	dump_startup(ctx, &times);
 
 done:
 	return ctx;
@@ -24,6 +24,7 @@
 #include "dstring.h"
 #include "expr.h"
 #include "mtab.h"
+#include "prof.h"
 #include "pwcache.h"
 #include "stat.h"
 #include "util.h"
@@ -40,55 +41,151 @@
 #include <time.h>
 
 /**
- * A function implementing a printf directive.
+ * A function implementing a printf directive.  Directives append their output
+ * to cfile->buffer, which is written all at once by bfs_printf().
  */
 typedef int bfs_printf_fn(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf);
 
 /**
- * A single printf directive like %f or %#4m.  The whole format string is stored
- * as a darray of these.
+ * Memoized formatting for time directives, since many files share the same
+ * timestamp to within a second.
+ */
+struct bfs_printf_time {
+	/** Whether the memoized strings are valid. */
+	bool valid;
+	/** The second they were formatted for. */
+	time_t sec;
+	/** The part of the output before the nanoseconds. */
+	char prefix[256];
+	/** The part of the output after the nanoseconds. */
+	char suffix[16];
+};
+
+/**
+ * A single printf directive like %f or %#4m.  The whole format string is
+ * compiled to a flat darray of these.
  */
 struct bfs_printf {
 	/** The printing function to invoke. */
 	bfs_printf_fn *fn;
 	/** String data associated with this directive. */
 	char *str;
+	/** Whether this directive has no flags, width, or precision. */
+	bool plain;
 	/** The stat field to print. */
 	enum bfs_stat_field stat_field;
 	/** Character data associated with this directive. */
 	char c;
 	/** Some data used by the directive. */
 	const void *ptr;
+	/** Memoized output for time directives. */
+	struct bfs_printf_time *time;
 };
 
-/** Print some text as-is. */
-static int bfs_printf_literal(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
-	size_t len = dstrlen(directive->str);
-	if (fwrite(directive->str, 1, len, cfile->file) == len) {
-		return 0;
+int bfs_printf_write(CFILE *cfile) {
+	size_t len = dstrlen(cfile->buffer);
+	bfs_prof_output(len);
+	int ret = fwrite(cfile->buffer, 1, len, cfile->file) == len ? 0 : -1;
+	dstresize(&cfile->buffer, 0);
+	return ret;
+}
+
+/** Append a string, with the directive's flags, width, and precision. */
+static int bfs_printf_str(CFILE *cfile, const struct bfs_printf *directive, const char *str) {
+	if (directive->plain) {
+		return dstrcat(&cfile->buffer, str);
 	} else {
-		return -1;
+		return dstrcatf(&cfile->buffer, directive->str, str);
 	}
 }
 
+const char *bfs_printf_utoa(char buf[BFS_PRINTF_UINT_SIZE], uintmax_t n) {
+	char *str = buf + BFS_PRINTF_UINT_SIZE;
+	*--str = '\0';
+	do {
+		*--str = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	return str;
+}
+
+/** Append an unsigned integer, formatted like a string. */
+static int bfs_printf_uint(CFILE *cfile, const struct bfs_printf *directive, uintmax_t n) {
+	char buf[BFS_PRINTF_UINT_SIZE];
+	return bfs_printf_str(cfile, directive, bfs_printf_utoa(buf, n));
+}
+
+/** Print some text as-is. */
+static int bfs_printf_literal(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
+	return dstrdcat(&cfile->buffer, directive->str);
+}
+
 /** \c: flush */
 static int bfs_printf_flush(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
+	if (bfs_printf_write(cfile) != 0) {
+		return -1;
+	}
 	return fflush(cfile->file);
 }
 
 /** Check if we can safely colorize this directive. */
 static bool should_color(CFILE *cfile, const struct bfs_printf *directive) {
-	return cfile->colors && strcmp(directive->str, "%s") == 0;
+	return cfile->colors && directive->plain;
+}
+
+/** Get the timestamp a time directive refers to. */
+static const struct timespec *bfs_printf_timespec(const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
+	const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+	if (!statbuf) {
+		return NULL;
+	}
+
+	return bfs_stat_time(statbuf, directive->stat_field);
 }
 
 /**
- * Print a value to a temporary buffer before formatting it.
+ * Append a time, reusing the memoized formatting if the second hasn't changed.
+ *
+ * @param nsec
+ *         Whether to print nanoseconds between the prefix and suffix.
  */
-#define BFS_PRINTF_BUF(buf, format, ...)				\
-	char buf[256];							\
-	int ret = snprintf(buf, sizeof(buf), format, __VA_ARGS__);	\
-	assert(ret >= 0 && (size_t)ret < sizeof(buf));			\
-	(void)ret
+static int bfs_printf_time(CFILE *cfile, const struct bfs_printf *directive, const struct timespec *ts, bool nsec) {
+	const struct bfs_printf_time *time = directive->time;
+
+	if (!nsec) {
+		return bfs_printf_str(cfile, directive, time->prefix);
+	}
+
+	// GNU find prints nanoseconds with an extra trailing 0
+	char buf[sizeof(time->prefix) + sizeof(time->suffix) + 11];
+	size_t len = strlen(time->prefix);
+	memcpy(buf, time->prefix, len);
+
+	char *str = buf + len;
+	*str++ = '.';
+	long ns = ts->tv_nsec;
+	for (int i = 8; i >= 0; --i) {
+		str[i] = '0' + ns % 10;
+		ns /= 10;
+	}
+	str += 9;
+	*str++ = '0';
+
+	strcpy(str, time->suffix);
+	return bfs_printf_str(cfile, directive, buf);
+}
+
+/** Check whether a memoized time can be reused. */
+static bool bfs_printf_memoized(const struct bfs_printf *directive, const struct timespec *ts) {
+	struct bfs_printf_time *time = directive->time;
+	if (time->valid && time->sec == ts->tv_sec) {
+		return true;
+	}
+
+	time->valid = false;
+	time->sec = ts->tv_sec;
+	return false;
+}
 
 /** %a, %c, %t: ctime() */
 static int bfs_printf_ctime(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
@@ -96,44 +193,55 @@ static int bfs_printf_ctime(CFILE *cfile, const struct bfs_printf *directive, co
 	static const char *days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
 	static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
 
-	const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
-	if (!statbuf) {
-		return -1;
-	}
-
-	const struct timespec *ts = bfs_stat_time(statbuf, directive->stat_field);
+	const struct timespec *ts = bfs_printf_timespec(directive, ftwbuf);
 	if (!ts) {
 		return -1;
 	}
 
-	struct tm tm;
-	if (xlocaltime(&ts->tv_sec, &tm) != 0) {
-		return -1;
-	}
+	if (!bfs_printf_memoized(directive, ts)) {
+		struct tm tm;
+		if (xlocaltime(&ts->tv_sec, &tm) != 0) {
+			return -1;
+		}
 
-	BFS_PRINTF_BUF(buf, "%s %s %2d %.2d:%.2d:%.2d.%09ld0 %4d",
-	               days[tm.tm_wday],
-	               months[tm.tm_mon],
-	               tm.tm_mday,
-	               tm.tm_hour,
-	               tm.tm_min,
-	               tm.tm_sec,
-	               (long)ts->tv_nsec,
-	               1900 + tm.tm_year);
+		struct bfs_printf_time *time = directive->time;
+		snprintf(time->prefix, sizeof(time->prefix), "%s %s %2d %.2d:%.2d:%.2d",
+		         days[tm.tm_wday],
+		         months[tm.tm_mon],
+		         tm.tm_mday,
+		         tm.tm_hour,
+		         tm.tm_min,
+		         tm.tm_sec);
+		snprintf(time->suffix, sizeof(time->suffix), " %4d", 1900 + tm.tm_year);
+		time->valid = true;
+	}
 
-	return fprintf(cfile->file, directive->str, buf);
+	return bfs_printf_time(cfile, directive, ts, true);
 }
 
 /** %A, %B/%W, %C, %T: strftime() */
 static int bfs_printf_strftime(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
-	const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
-	if (!statbuf) {
+	const struct timespec *ts = bfs_printf_timespec(directive, ftwbuf);
+	if (!ts) {
 		return -1;
 	}
 
-	const struct timespec *ts = bfs_stat_time(statbuf, directive->stat_field);
-	if (!ts) {
-		return -1;
+	bool nsec = strchr("@+ST", directive->c);
+
+	if (directive->c == '@') {
+		// No need to convert to local time
+		struct bfs_printf_time *time = directive->time;
+		if (ts->tv_sec >= 0) {
+			char buf[BFS_PRINTF_UINT_SIZE];
+			strcpy(time->prefix, bfs_printf_utoa(buf, ts->tv_sec));
+		} else {
+			snprintf(time->prefix, sizeof(time->prefix), "%lld", (long long)ts->tv_sec);
+		}
+		return bfs_printf_time(cfile, directive, ts, nsec);
+	}
+
+	if (bfs_printf_memoized(directive, ts)) {
+		return bfs_printf_time(cfile, directive, ts, nsec);
 	}
 
 	struct tm tm;
@@ -141,55 +249,53 @@ static int bfs_printf_strftime(CFILE *cfile, const struct bfs_printf *directive,
 		return -1;
 	}
 
+	struct bfs_printf_time *time = directive->time;
+	char *buf = time->prefix;
+	size_t size = sizeof(time->prefix);
 	int ret;
-	char buf[256];
 	char format[] = "% ";
 	switch (directive->c) {
 	// Non-POSIX strftime() features
-	case '@':
-		ret = snprintf(buf, sizeof(buf), "%lld.%09ld0", (long long)ts->tv_sec, (long)ts->tv_nsec);
-		break;
 	case '+':
-		ret = snprintf(buf, sizeof(buf), "%4d-%.2d-%.2d+%.2d:%.2d:%.2d.%09ld0",
+		ret = snprintf(buf, size, "%4d-%.2d-%.2d+%.2d:%.2d:%.2d",
 		               1900 + tm.tm_year,
 		               tm.tm_mon + 1,
 		               tm.tm_mday,
 		               tm.tm_hour,
 		               tm.tm_min,
-		               tm.tm_sec,
-		               (long)ts->tv_nsec);
+		               tm.tm_sec);
 		break;
 	case 'k':
-		ret = snprintf(buf, sizeof(buf), "%2d", tm.tm_hour);
+		ret = snprintf(buf, size, "%2d", tm.tm_hour);
 		break;
 	case 'l':
-		ret = snprintf(buf, sizeof(buf), "%2d", (tm.tm_hour + 11)%12 + 1);
+		ret = snprintf(buf, size, "%2d", (tm.tm_hour + 11)%12 + 1);
 		break;
 	case 's':
-		ret = snprintf(buf, sizeof(buf), "%lld", (long long)ts->tv_sec);
+		ret = snprintf(buf, size, "%lld", (long long)ts->tv_sec);
 		break;
 	case 'S':
-		ret = snprintf(buf, sizeof(buf), "%.2d.%09ld0", tm.tm_sec, (long)ts->tv_nsec);
+		ret = snprintf(buf, size, "%.2d", tm.tm_sec);
 		break;
 	case 'T':
-		ret = snprintf(buf, sizeof(buf), "%.2d:%.2d:%.2d.%09ld0",
+		ret = snprintf(buf, size, "%.2d:%.2d:%.2d",
 			       tm.tm_hour,
 			       tm.tm_min,
-			       tm.tm_sec,
-			       (long)ts->tv_nsec);
+			       tm.tm_sec);
 		break;
 
 	// POSIX strftime() features
 	default:
 		format[1] = directive->c;
-		ret = strftime(buf, sizeof(buf), format, &tm);
+		ret = strftime(buf, size, format, &tm);
 		break;
 	}
 
-	assert(ret >= 0 && (size_t)ret < sizeof(buf));
+	assert(ret >= 0 && (size_t)ret < size);
 	(void)ret;
 
-	return fprintf(cfile->file, directive->str, buf);
+	time->valid = true;
+	return bfs_printf_time(cfile, directive, ts, nsec);
 }
 
 /** %b: blocks */
@@ -200,13 +306,17 @@ static int bfs_printf_b(CFILE *cfile, const struct bfs_printf *directive, const
 	}
 
 	uintmax_t blocks = ((uintmax_t)statbuf->blocks*BFS_STAT_BLKSIZE + 511)/512;
-	BFS_PRINTF_BUF(buf, "%ju", blocks);
-	return fprintf(cfile->file, directive->str, buf);
+	return bfs_printf_uint(cfile, directive, blocks);
 }
 
 /** %d: depth */
 static int bfs_printf_d(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
-	return fprintf(cfile->file, directive->str, (intmax_t)ftwbuf->depth);
+	if (directive->plain) {
+		char buf[BFS_PRINTF_UINT_SIZE];
+		return dstrcat(&cfile->buffer, bfs_printf_utoa(buf, ftwbuf->depth));
+	} else {
+		return dstrcatf(&cfile->buffer, directive->str, (intmax_t)ftwbuf->depth);
+	}
 }
 
 /** %D: device */
@@ -216,16 +326,15 @@ static int bfs_printf_D(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->dev);
-	return fprintf(cfile->file, directive->str, buf);
+	return bfs_printf_uint(cfile, directive, statbuf->dev);
 }
 
 /** %f: file name */
 static int bfs_printf_f(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
 	if (should_color(cfile, directive)) {
-		return cfprintf(cfile, "%pF", ftwbuf);
+		return cbuff(cfile, "%pF", ftwbuf);
 	} else {
-		return fprintf(cfile->file, directive->str, ftwbuf->path + ftwbuf->nameoff);
+		return bfs_printf_str(cfile, directive, ftwbuf->path + ftwbuf->nameoff);
 	}
 }
 
@@ -237,7 +346,7 @@ static int bfs_printf_F(CFILE *cfile, const struct bfs_printf *directive, const
 	}
 
 	const char *type = bfs_fstype(directive->ptr, statbuf);
-	return fprintf(cfile->file, directive->str, type);
+	return bfs_printf_str(cfile, directive, type);
 }
 
 /** %G: gid */
@@ -247,8 +356,7 @@ static int bfs_printf_G(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->gid);
-	return fprintf(cfile->file, directive->str, buf);
+	return bfs_printf_uint(cfile, directive, statbuf->gid);
 }
 
 /** %g: group name */
@@ -264,7 +372,7 @@ static int bfs_printf_g(CFILE *cfile, const struct bfs_printf *directive, const
 		return bfs_printf_G(cfile, directive, ftwbuf);
 	}
 
-	return fprintf(cfile->file, directive->str, grp->gr_name);
+	return bfs_printf_str(cfile, directive, grp->gr_name);
 }
 
 /** %h: leading directories */
@@ -278,6 +386,10 @@ static int bfs_printf_h(CFILE *cfile, const struct bfs_printf *directive, const
 			--len;
 		}
 
+		if (directive->plain && !cfile->colors) {
+			return dstrncat(&cfile->buffer, ftwbuf->path, len);
+		}
+
 		buf = copy = strndup(ftwbuf->path, len);
 	} else if (ftwbuf->path[0] == '/') {
 		buf = "/";
@@ -291,9 +403,9 @@ static int bfs_printf_h(CFILE *cfile, const struct bfs_printf *directive, const
 
 	int ret;
 	if (should_color(cfile, directive)) {
-		ret = cfprintf(cfile, "${di}%s${rs}", buf);
+		ret = cbuff(cfile, "${di}%s${rs}", buf);
 	} else {
-		ret = fprintf(cfile->file, directive->str, buf);
+		ret = bfs_printf_str(cfile, directive, buf);
 	}
 
 	free(copy);
@@ -304,12 +416,12 @@ static int bfs_printf_h(CFILE *cfile, const struct bfs_printf *directive, const
 static int bfs_printf_H(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
 	if (should_color(cfile, directive)) {
 		if (ftwbuf->depth == 0) {
-			return cfprintf(cfile, "%pP", ftwbuf);
+			return cbuff(cfile, "%pP", ftwbuf);
 		} else {
-			return cfprintf(cfile, "${di}%s${rs}", ftwbuf->root);
+			return cbuff(cfile, "${di}%s${rs}", ftwbuf->root);
 		}
 	} else {
-		return fprintf(cfile->file, directive->str, ftwbuf->root);
+		return bfs_printf_str(cfile, directive, ftwbuf->root);
 	}
 }
 
@@ -320,8 +432,7 @@ static int bfs_printf_i(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->ino);
-	return fprintf(cfile->file, directive->str, buf);
+	return bfs_printf_uint(cfile, directive, statbuf->ino);
 }
 
 /** %k: 1K blocks */
@@ -332,32 +443,25 @@ static int bfs_printf_k(CFILE *cfile, const struct bfs_printf *directive, const
 	}
 
 	uintmax_t blocks = ((uintmax_t)statbuf->blocks*BFS_STAT_BLKSIZE + 1023)/1024;
-	BFS_PRINTF_BUF(buf, "%ju", blocks);
-	return fprintf(cfile->file, directive->str, buf);
+	return bfs_printf_uint(cfile, directive, blocks);
 }
 
 /** %l: link target */
 static int bfs_printf_l(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
-	char *buf = NULL;
 	const char *target = "";
 
 	if (ftwbuf->type == BFS_LNK) {
 		if (should_color(cfile, directive)) {
-			return cfprintf(cfile, "%pL", ftwbuf);
+			return cbuff(cfile, "%pL", ftwbuf);
 		}
 
-		const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
-		size_t len = statbuf ? statbuf->size : 0;
-
-		target = buf = xreadlinkat(ftwbuf->at_fd, ftwbuf->at_path, len);
+		target = bftw_readlink(ftwbuf);
 		if (!target) {
 			return -1;
 		}
 	}
 
-	int ret = fprintf(cfile->file, directive->str, target);
-	free(buf);
-	return ret;
+	return bfs_printf_str(cfile, directive, target);
 }
 
 /** %m: mode */
@@ -367,7 +471,7 @@ static int bfs_printf_m(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	return fprintf(cfile->file, directive->str, (unsigned int)(statbuf->mode & 07777));
+	return dstrcatf(&cfile->buffer, directive->str, (unsigned int)(statbuf->mode & 07777));
 }
 
 /** %M: symbolic mode */
@@ -379,7 +483,7 @@ static int bfs_printf_M(CFILE *cfile, const struct bfs_printf *directive, const
 
 	char buf[11];
 	xstrmode(statbuf->mode, buf);
-	return fprintf(cfile->file, directive->str, buf);
+	return bfs_printf_str(cfile, directive, buf);
 }
 
 /** %n: link count */
@@ -389,16 +493,15 @@ static int bfs_printf_n(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->nlink);
-	return fprintf(cfile->file, directive->str, buf);
+	return bfs_printf_uint(cfile, directive, statbuf->nlink);
 }
 
 /** %p: full path */
 static int bfs_printf_p(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
 	if (should_color(cfile, directive)) {
-		return cfprintf(cfile, "%pP", ftwbuf);
+		return cbuff(cfile, "%pP", ftwbuf);
 	} else {
-		return fprintf(cfile->file, directive->str, ftwbuf->path);
+		return bfs_printf_str(cfile, directive, ftwbuf->path);
 	}
 }
 
@@ -417,9 +520,9 @@ static int bfs_printf_P(CFILE *cfile, const struct bfs_printf *directive, const
 		struct BFTW copybuf = *ftwbuf;
 		copybuf.path += offset;
 		copybuf.nameoff -= offset;
-		return cfprintf(cfile, "%pP", &copybuf);
+		return cbuff(cfile, "%pP", &copybuf);
 	} else {
-		return fprintf(cfile->file, directive->str, ftwbuf->path + offset);
+		return bfs_printf_str(cfile, directive, ftwbuf->path + offset);
 	}
 }
 
@@ -430,8 +533,7 @@ static int bfs_printf_s(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->size);
-	return fprintf(cfile->file, directive->str, buf);
+	return bfs_printf_uint(cfile, directive, statbuf->size);
 }
 
 /** %S: sparseness */
@@ -447,7 +549,7 @@ static int bfs_printf_S(CFILE *cfile, const struct bfs_printf *directive, const
 	} else {
 		sparsity = (double)BFS_STAT_BLKSIZE*statbuf->blocks/statbuf->size;
 	}
-	return fprintf(cfile->file, directive->str, sparsity);
+	return dstrcatf(&cfile->buffer, directive->str, sparsity);
 }
 
 /** %U: uid */
@@ -457,8 +559,7 @@ static int bfs_printf_U(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->uid);
-	return fprintf(cfile->file, directive->str, buf);
+	return bfs_printf_uint(cfile, directive, statbuf->uid);
 }
 
 /** %u: user name */
@@ -474,7 +575,7 @@ static int bfs_printf_u(CFILE *cfile, const struct bfs_printf *directive, const
 		return bfs_printf_U(cfile, directive, ftwbuf);
 	}
 
-	return fprintf(cfile->file, directive->str, pwd->pw_name);
+	return bfs_printf_str(cfile, directive, pwd->pw_name);
 }
 
 static const char *bfs_printf_type(enum bfs_type type) {
@@ -503,7 +604,7 @@ static const char *bfs_printf_type(enum bfs_type type) {
 /** %y: type */
 static int bfs_printf_y(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
 	const char *type = bfs_printf_type(ftwbuf->type);
-	return fprintf(cfile->file, directive->str, type);
+	return bfs_printf_str(cfile, directive, type);
 }
 
 /** %Y: target type */
@@ -535,7 +636,7 @@ static int bfs_printf_Y(CFILE *cfile, const struct bfs_printf *directive, const
 		}
 	}
 
-	int ret = fprintf(cfile->file, directive->str, type);
+	int ret = bfs_printf_str(cfile, directive, type);
 	if (error != 0) {
 		ret = -1;
 		errno = error;
@@ -861,12 +962,23 @@ int bfs_printf_parse(const struct bfs_ctx *ctx, struct bfs_expr *expr, const cha
 				goto directive_error;
 			}
 
+			if (directive.stat_field) {
+				directive.time = malloc(sizeof(*directive.time));
+				if (!directive.time) {
+					bfs_perror(ctx, "malloc()");
+					goto directive_error;
+				}
+				directive.time->valid = false;
+				directive.time->suffix[0] = '\0';
+			}
+
 			if (must_be_numeric && strcmp(specifier, "s") == 0) {
 				bfs_expr_error(ctx, expr);
 				bfs_error(ctx, "Invalid flags '%s' for string format '%%%c'.\n", directive.str + 1, c);
 				goto directive_error;
 			}
 
+			directive.plain = dstrlen(directive.str) == 1;
 			if (dstrcat(&directive.str, specifier) != 0) {
 				bfs_perror(ctx, "dstrcat()");
 				goto directive_error;
@@ -879,6 +991,7 @@ int bfs_printf_parse(const struct bfs_ctx *ctx, struct bfs_expr *expr, const cha
 			continue;
 
 		directive_error:
+			free(directive.time);
 			dstrfree(directive.str);
 			goto error;
 		}
@@ -905,22 +1018,30 @@ error:
 }
 
 int bfs_printf(CFILE *cfile, const struct bfs_printf *format, const struct BFTW *ftwbuf) {
+	assert(dstrlen(cfile->buffer) == 0);
+
 	int ret = 0, error = 0;
 
 	for (size_t i = 0; i < darray_length(format); ++i) {
 		const struct bfs_printf *directive = &format[i];
-		if (directive->fn(cfile, directive, ftwbuf) < 0) {
+		if (directive->fn(cfile, directive, ftwbuf) != 0) {
 			ret = -1;
 			error = errno;
 		}
 	}
 
+	if (bfs_printf_write(cfile) != 0) {
+		ret = -1;
+		error = errno;
+	}
+
 	errno = error;
 	return ret;
 }
 
 void bfs_printf_free(struct bfs_printf *format) {
 	for (size_t i = 0; i < darray_length(format); ++i) {
+		free(format[i].time);
 		dstrfree(format[i].str);
 	}
 	darray_free(format);
@@ -22,6 +22,7 @@
 #define BFS_PRINTF_H
 
 #include "color.h"
+#include <stdint.h>
 
 struct BFTW;
 struct bfs_ctx;
@@ -65,4 +66,29 @@ int bfs_printf(CFILE *cfile, const struct bfs_printf *format, const struct BFTW
  */
 void bfs_printf_free(struct bfs_printf *format);
 
+/** The size of a buffer big enough for any uintmax_t in decimal. */
+#define BFS_PRINTF_UINT_SIZE (3 * sizeof(uintmax_t) + 1)
+
+/**
+ * Format an unsigned integer in decimal.
+ *
+ * @param buf
+ *         The buffer to format into.
+ * @param n
+ *         The number to format.
+ * @return
+ *         The formatted number, which ends at the end of buf.
+ */
+const char *bfs_printf_utoa(char buf[BFS_PRINTF_UINT_SIZE], uintmax_t n);
+
+/**
+ * Write out and clear a CFILE's output buffer, all at once.
+ *
+ * @param cfile
+ *         The CFILE to write.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_printf_write(CFILE *cfile);
+
 #endif // BFS_PRINTF_H
@@ -0,0 +1,198 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+#include "prof.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#if _POSIX_MONOTONIC_CLOCK > 0
+#	define BFS_PROF_CLOCK CLOCK_MONOTONIC
+#else
+#	define BFS_PROF_CLOCK CLOCK_REALTIME
+#endif
+
+/** The number of histogram buckets (the last one holds anything >= 2^38 ns). */
+#define BFS_PROF_BUCKETS 40
+
+/** Statistics for a single phase. */
+struct bfs_prof_stats {
+	/** The number of operations. */
+	atomic_ullong count;
+	/** The total time taken, in nanoseconds. */
+	atomic_ullong ns;
+	/** Bucket i counts operations that took less than 2^i ns (but not less than 2^(i-1)). */
+	atomic_ullong hist[BFS_PROF_BUCKETS];
+};
+
+/** Whether profiling is enabled. */
+static bool prof_enabled = false;
+/** When profiling started. */
+static struct timespec prof_epoch;
+/** The per-phase statistics. */
+static struct bfs_prof_stats prof_stats[BFS_PROF_NPHASES];
+/** The number of bytes of output. */
+static atomic_ullong prof_bytes;
+/** Set by the SIGUSR1 handler. */
+static volatile sig_atomic_t prof_signalled = 0;
+
+/** SIGUSR1 handler. */
+static void prof_handler(int sig) {
+	prof_signalled = 1;
+}
+
+void bfs_prof_enable(void) {
+	prof_enabled = true;
+	clock_gettime(BFS_PROF_CLOCK, &prof_epoch);
+
+	struct sigaction sa = {
+		.sa_handler = prof_handler,
+		.sa_flags = SA_RESTART,
+	};
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+}
+
+bool bfs_prof_begin(struct timespec *start) {
+	if (!prof_enabled) {
+		return false;
+	}
+
+	return clock_gettime(BFS_PROF_CLOCK, start) == 0;
+}
+
+/** Get the nanoseconds between two times. */
+static unsigned long long prof_ns(const struct timespec *start, const struct timespec *end) {
+	long long ns = (long long)(end->tv_sec - start->tv_sec) * 1000000000LL;
+	ns += end->tv_nsec - start->tv_nsec;
+	return ns > 0 ? ns : 0;
+}
+
+void bfs_prof_end(enum bfs_prof_phase phase, const struct timespec *start) {
+	// Don't clobber errno from the profiled operation
+	int error = errno;
+	struct timespec end;
+	int ret = clock_gettime(BFS_PROF_CLOCK, &end);
+	errno = error;
+	if (ret != 0) {
+		return;
+	}
+
+	unsigned long long ns = prof_ns(start, &end);
+
+	size_t bucket = 0;
+	while (bucket < BFS_PROF_BUCKETS - 1 && (ns >> bucket)) {
+		++bucket;
+	}
+
+	struct bfs_prof_stats *stats = &prof_stats[phase];
+	atomic_fetch_add_explicit(&stats->count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&stats->ns, ns, memory_order_relaxed);
+	atomic_fetch_add_explicit(&stats->hist[bucket], 1, memory_order_relaxed);
+}
+
+void bfs_prof_output(size_t bytes) {
+	if (prof_enabled) {
+		atomic_fetch_add_explicit(&prof_bytes, bytes, memory_order_relaxed);
+	}
+}
+
+bool bfs_prof_requested(void) {
+	if (prof_signalled) {
+		prof_signalled = 0;
+		return true;
+	} else {
+		return false;
+	}
+}
+
+/** Get the JSON key for a phase. */
+static const char *prof_phase_name(enum bfs_prof_phase phase) {
+	switch (phase) {
+	case BFS_PROF_OPEN:
+		return "open";
+	case BFS_PROF_READDIR:
+		return "readdir";
+	case BFS_PROF_STAT:
+		return "stat";
+	case BFS_PROF_CALLBACK:
+		return "callback";
+	case BFS_PROF_OUTPUT:
+		return "output";
+	case BFS_PROF_EXEC:
+		return "exec_wait";
+	case BFS_PROF_NPHASES:
+		break;
+	}
+
+	return "???";
+}
+
+/** Print a duration in nanoseconds as fractional seconds. */
+static int prof_print_secs(FILE *file, unsigned long long ns) {
+	return fprintf(file, "%llu.%09llu", ns / 1000000000ULL, ns % 1000000000ULL);
+}
+
+int bfs_prof_dump(FILE *file) {
+	struct timespec now;
+	if (clock_gettime(BFS_PROF_CLOCK, &now) != 0) {
+		return -1;
+	}
+
+	int ret = 0;
+	ret |= fprintf(file, "{\"elapsed\":");
+	ret |= prof_print_secs(file, prof_ns(&prof_epoch, &now));
+	ret |= fprintf(file, ",\"output_bytes\":%llu,\"phases\":{", (unsigned long long)atomic_load(&prof_bytes));
+
+	for (int i = 0; i < BFS_PROF_NPHASES; ++i) {
+		struct bfs_prof_stats *stats = &prof_stats[i];
+		ret |= fprintf(file, "%s\"%s\":{\"count\":%llu,\"time\":",
+		               i == 0 ? "" : ",",
+		               prof_phase_name(i),
+		               (unsigned long long)atomic_load(&stats->count));
+		ret |= prof_print_secs(file, atomic_load(&stats->ns));
+
+		// [upper bound in ns, count] for each non-empty bucket
+		ret |= fprintf(file, ",\"histogram\":[");
+		bool first = true;
+		for (size_t j = 0; j < BFS_PROF_BUCKETS; ++j) {
+			unsigned long long count = atomic_load(&stats->hist[j]);
+			if (count == 0) {
+				continue;
+			}
+
+			if (j == BFS_PROF_BUCKETS - 1) {
+				ret |= fprintf(file, "%s[null,%llu]", first ? "" : ",", count);
+			} else {
+				ret |= fprintf(file, "%s[%llu,%llu]", first ? "" : ",", 1ULL << j, count);
+			}
+			first = false;
+		}
+		ret |= fprintf(file, "]}");
+	}
+
+	ret |= fprintf(file, "}}\n");
+	if (ret < 0 || fflush(file) != 0) {
+		return -1;
+	}
+	return 0;
+}
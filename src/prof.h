@@ -0,0 +1,99 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+/**
+ * A lightweight profiler for the phases of a search, for -D prof.
+ *
+ * Each phase tracks the number of operations, the total time they took, and a
+ * histogram of their latencies in power-of-two nanosecond buckets.  The report
+ * is printed as JSON when the search finishes, or on SIGUSR1.
+ */
+
+#ifndef BFS_PROF_H
+#define BFS_PROF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * The profiled phases.
+ */
+enum bfs_prof_phase {
+	/** Opening directories. */
+	BFS_PROF_OPEN,
+	/** Reading directory entries (getdents() etc.). */
+	BFS_PROF_READDIR,
+	/** bfs_stat() calls (statx() etc.). */
+	BFS_PROF_STAT,
+	/** Evaluating the expression for each file (including output/exec). */
+	BFS_PROF_CALLBACK,
+	/** Printing actions like -print and -printf. */
+	BFS_PROF_OUTPUT,
+	/** Waiting for -exec commands to finish. */
+	BFS_PROF_EXEC,
+	/** The number of phases. */
+	BFS_PROF_NPHASES,
+};
+
+/**
+ * Turn on profiling, and install a SIGUSR1 handler to request reports.  Must be
+ * called before any background threads are started.
+ */
+void bfs_prof_enable(void);
+
+/**
+ * Start timing an operation.
+ *
+ * @param[out] start
+ *         Filled in with the start time.
+ * @return
+ *         Whether profiling is enabled (if not, don't call bfs_prof_end()).
+ */
+bool bfs_prof_begin(struct timespec *start);
+
+/**
+ * Finish timing an operation.
+ *
+ * @param phase
+ *         The phase the operation belongs to.
+ * @param start
+ *         The start time from bfs_prof_begin().
+ */
+void bfs_prof_end(enum bfs_prof_phase phase, const struct timespec *start);
+
+/**
+ * Count some bytes of output.
+ */
+void bfs_prof_output(size_t bytes);
+
+/**
+ * Check whether a report was requested with SIGUSR1 since the last call.
+ */
+bool bfs_prof_requested(void);
+
+/**
+ * Print a profiling report as JSON.
+ *
+ * @param file
+ *         The file to print to.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_prof_dump(FILE *file);
+
+#endif // BFS_PROF_H
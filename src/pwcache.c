@@ -21,21 +21,144 @@
 #include <grp.h>
 #include <pwd.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+/**
+ * Check whether an errno value from getpw*() or getgr*() just means that the
+ * entry doesn't exist.  POSIX leaves errno unchanged in that case, but some
+ * implementations set it to one of these values anyway.
+ */
+static bool pwcache_not_found(int error) {
+	return error == 0 || error == ENOENT || error == ESRCH || error == EBADF || error == EPERM;
+}
+
+/**
+ * Look up a cached entry.
+ *
+ * @param trie
+ *         The map to search.
+ * @param key
+ *         The key to look up.
+ * @param length
+ *         The length of the key.
+ * @param[out] result
+ *         Set to the cached entry, or NULL if it is known not to exist.
+ * @return
+ *         Whether the key was cached.
+ */
+static bool pwcache_find(const struct trie *trie, const void *key, size_t length, void **result) {
+	const struct trie_leaf *leaf = trie_find_mem(trie, key, length);
+	if (leaf) {
+		*result = leaf->value;
+		errno = 0;
+		return true;
+	} else {
+		return false;
+	}
+}
+
+/**
+ * Memoize an entry (or its absence, if entry is NULL) under a key.  Entries are
+ * only remembered under the key they were looked up by, since names and IDs
+ * don't have to be unique.
+ *
+ * @return
+ *         0 on success, -1 on failure.
+ */
+static int pwcache_remember(struct trie *trie, const void *key, size_t length, void *entry) {
+	struct trie_leaf *leaf = trie_insert_mem(trie, key, length);
+	if (!leaf) {
+		return -1;
+	}
+
+	leaf->value = entry;
+	return 0;
+}
+
+/** The number of IDs covered by each word of an id_bitmap. */
+#define ID_BITMAP_WORD 32
+
+/** The largest ID (exclusive) that an id_bitmap will cover. */
+#define ID_BITMAP_MAX ((uintmax_t)1 << 20)
+
+/**
+ * A bitmap recording which small IDs are known to exist, so repeated existence
+ * checks (-nouser, -nogroup) are a single bit test.  Each 64-bit word holds a
+ * "known" bit and an "exists" bit for ID_BITMAP_WORD consecutive IDs.
+ */
+struct id_bitmap {
+	/** The bitmap words. */
+	uint64_t *words;
+	/** The number of words. */
+	size_t nwords;
+};
+
+/**
+ * Check an ID in the bitmap.
+ *
+ * @return
+ *         1 if the ID exists, 0 if it doesn't, or -1 if it's not known yet.
+ */
+static int id_bitmap_get(const struct id_bitmap *bitmap, uintmax_t id) {
+	uintmax_t i = id / ID_BITMAP_WORD;
+	if (i >= bitmap->nwords) {
+		return -1;
+	}
+
+	uint64_t word = bitmap->words[i];
+	unsigned int bit = id % ID_BITMAP_WORD;
+	if (!(word & (UINT64_C(1) << bit))) {
+		return -1;
+	}
+	return (word >> (bit + ID_BITMAP_WORD)) & 1;
+}
+
+/**
+ * Record whether an ID exists.  IDs that are too large, or that the bitmap
+ * can't grow to hold, are simply not recorded.
+ */
+static void id_bitmap_set(struct id_bitmap *bitmap, uintmax_t id, bool exists) {
+	if (id >= ID_BITMAP_MAX) {
+		return;
+	}
+
+	size_t i = id / ID_BITMAP_WORD;
+	if (i >= bitmap->nwords) {
+		size_t nwords = bitmap->nwords ? bitmap->nwords : 64;
+		while (nwords <= i) {
+			nwords *= 2;
+		}
+
+		uint64_t *words = realloc(bitmap->words, nwords*sizeof(*words));
+		if (!words) {
+			return;
+		}
+		memset(words + bitmap->nwords, 0, (nwords - bitmap->nwords)*sizeof(*words));
+		bitmap->words = words;
+		bitmap->nwords = nwords;
+	}
+
+	unsigned int bit = id % ID_BITMAP_WORD;
+	bitmap->words[i] |= UINT64_C(1) << bit;
+	if (exists) {
+		bitmap->words[i] |= UINT64_C(1) << (bit + ID_BITMAP_WORD);
+	}
+}
+
 struct bfs_users {
-	/** The array of passwd entries. */
-	struct passwd *entries;
-	/** A map from usernames to entries. */
+	/** The passwd entries that have been looked up so far. */
+	struct passwd **entries;
+	/** A map from usernames to entries (NULL for nonexistent users). */
 	struct trie by_name;
-	/** A map from UIDs to entries. */
+	/** A map from UIDs to entries (NULL for nonexistent users). */
 	struct trie by_uid;
+	/** Which UIDs are known to exist. */
+	struct id_bitmap uid_bitmap;
 };
 
-struct bfs_users *bfs_users_parse(void) {
-	int error;
-
+struct bfs_users *bfs_users_new(void) {
 	struct bfs_users *users = malloc(sizeof(*users));
 	if (!users) {
 		return NULL;
@@ -44,99 +167,155 @@ struct bfs_users *bfs_users_parse(void) {
 	users->entries = NULL;
 	trie_init(&users->by_name);
 	trie_init(&users->by_uid);
+	users->uid_bitmap.words = NULL;
+	users->uid_bitmap.nwords = 0;
+	return users;
+}
 
-	setpwent();
+/** Free a copied passwd entry. */
+static void free_passwd(struct passwd *ent) {
+	if (ent) {
+		free(ent->pw_shell);
+		free(ent->pw_dir);
+		free(ent->pw_name);
+		free(ent);
+	}
+}
 
-	while (true) {
-		errno = 0;
-		struct passwd *ent = getpwent();
-		if (!ent) {
-			if (errno) {
-				error = errno;
-				goto fail_end;
-			} else {
-				break;
-			}
-		}
+/**
+ * Copy a passwd entry returned by getpw*() into the cache.
+ *
+ * @return
+ *         The cached copy, or NULL on failure.
+ */
+static struct passwd *users_add(struct bfs_users *users, const struct passwd *ent) {
+	struct passwd *copy = malloc(sizeof(*copy));
+	if (!copy) {
+		return NULL;
+	}
 
-		if (DARRAY_PUSH(&users->entries, ent) != 0) {
-			error = errno;
-			goto fail_end;
-		}
+	*copy = *ent;
+	copy->pw_name = strdup(ent->pw_name);
+	copy->pw_dir = strdup(ent->pw_dir);
+	copy->pw_shell = strdup(ent->pw_shell);
+	if (!copy->pw_name || !copy->pw_dir || !copy->pw_shell) {
+		goto fail;
+	}
 
-		ent = users->entries + darray_length(users->entries) - 1;
-		ent->pw_name = strdup(ent->pw_name);
-		ent->pw_dir = strdup(ent->pw_dir);
-		ent->pw_shell = strdup(ent->pw_shell);
-		if (!ent->pw_name || !ent->pw_dir || !ent->pw_shell) {
-			error = ENOMEM;
-			goto fail_end;
-		}
+	if (DARRAY_PUSH(&users->entries, &copy) != 0) {
+		goto fail;
 	}
 
-	endpwent();
+	return copy;
 
-	for (size_t i = 0; i < darray_length(users->entries); ++i) {
-		struct passwd *entry = &users->entries[i];
-		struct trie_leaf *leaf = trie_insert_str(&users->by_name, entry->pw_name);
-		if (leaf) {
-			if (!leaf->value) {
-				leaf->value = entry;
-			}
-		} else {
-			error = errno;
-			goto fail_free;
+fail:
+	free_passwd(copy);
+	return NULL;
+}
+
+/**
+ * Handle the result of getpwnam()/getpwuid().
+ *
+ * @param users
+ *         The user table.
+ * @param ent
+ *         The result of the lookup.
+ * @param name
+ *         The name that was looked up, or NULL for a UID lookup.
+ * @param uid
+ *         The UID that was looked up, if name is NULL.
+ * @return
+ *         The cached entry, or NULL if it doesn't exist (with errno == 0) or
+ *         on failure.
+ */
+static const struct passwd *users_lookup_done(struct bfs_users *users, const struct passwd *ent, const char *name, uid_t uid) {
+	if (!ent) {
+		if (!pwcache_not_found(errno)) {
+			// Don't remember transient errors
+			return NULL;
 		}
 
-		leaf = trie_insert_mem(&users->by_uid, &entry->pw_uid, sizeof(entry->pw_uid));
-		if (leaf) {
-			if (!leaf->value) {
-				leaf->value = entry;
-			}
+		int ret;
+		if (name) {
+			ret = pwcache_remember(&users->by_name, name, strlen(name) + 1, NULL);
 		} else {
-			error = errno;
-			goto fail_free;
+			ret = pwcache_remember(&users->by_uid, &uid, sizeof(uid), NULL);
+		}
+		if (ret != 0) {
+			return NULL;
 		}
+
+		errno = 0;
+		return NULL;
 	}
 
-	return users;
+	struct passwd *copy = users_add(users, ent);
+	if (!copy) {
+		return NULL;
+	}
 
-fail_end:
-	endpwent();
-fail_free:
-	bfs_users_free(users);
-	errno = error;
-	return NULL;
+	int ret;
+	if (name) {
+		ret = pwcache_remember(&users->by_name, name, strlen(name) + 1, copy);
+	} else {
+		ret = pwcache_remember(&users->by_uid, &uid, sizeof(uid), copy);
+	}
+	if (ret != 0) {
+		return NULL;
+	}
+
+	return copy;
 }
 
 const struct passwd *bfs_getpwnam(const struct bfs_users *users, const char *name) {
-	const struct trie_leaf *leaf = trie_find_str(&users->by_name, name);
-	if (leaf) {
-		return leaf->value;
-	} else {
-		return NULL;
+	void *result;
+	if (pwcache_find(&users->by_name, name, strlen(name) + 1, &result)) {
+		return result;
 	}
+
+	errno = 0;
+	const struct passwd *ent = getpwnam(name);
+	return users_lookup_done((struct bfs_users *)users, ent, name, 0);
 }
 
 const struct passwd *bfs_getpwuid(const struct bfs_users *users, uid_t uid) {
-	const struct trie_leaf *leaf = trie_find_mem(&users->by_uid, &uid, sizeof(uid));
-	if (leaf) {
-		return leaf->value;
+	void *result;
+	if (pwcache_find(&users->by_uid, &uid, sizeof(uid), &result)) {
+		return result;
+	}
+
+	errno = 0;
+	const struct passwd *ent = getpwuid(uid);
+	return users_lookup_done((struct bfs_users *)users, ent, NULL, uid);
+}
+
+int bfs_users_exist(const struct bfs_users *users, uid_t uid) {
+	int ret = id_bitmap_get(&users->uid_bitmap, uid);
+	if (ret >= 0) {
+		return ret;
+	}
+
+	if (bfs_getpwuid(users, uid)) {
+		ret = 1;
+	} else if (errno == 0) {
+		ret = 0;
 	} else {
-		return NULL;
+		return -1;
 	}
+
+	struct bfs_users *mut = (struct bfs_users *)users;
+	id_bitmap_set(&mut->uid_bitmap, uid, ret);
+	return ret;
 }
 
 void bfs_users_free(struct bfs_users *users) {
 	if (users) {
+		free(users->uid_bitmap.words);
 		trie_destroy(&users->by_uid);
 		trie_destroy(&users->by_name);
 
 		for (size_t i = 0; i < darray_length(users->entries); ++i) {
-			struct passwd *entry = &users->entries[i];
-			free(entry->pw_shell);
-			free(entry->pw_dir);
-			free(entry->pw_name);
+			free_passwd(users->entries[i]);
 		}
 		darray_free(users->entries);
 
@@ -145,14 +324,42 @@ void bfs_users_free(struct bfs_users *users) {
 }
 
 struct bfs_groups {
-	/** The array of group entries. */
-	struct group *entries;
-	/** A map from group names to entries. */
+	/** The group entries that have been looked up so far. */
+	struct group **entries;
+	/** A map from group names to entries (NULL for nonexistent groups). */
 	struct trie by_name;
-	/** A map from GIDs to entries. */
+	/** A map from GIDs to entries (NULL for nonexistent groups). */
 	struct trie by_gid;
+	/** Which GIDs are known to exist. */
+	struct id_bitmap gid_bitmap;
 };
 
+struct bfs_groups *bfs_groups_new(void) {
+	struct bfs_groups *groups = malloc(sizeof(*groups));
+	if (!groups) {
+		return NULL;
+	}
+
+	groups->entries = NULL;
+	trie_init(&groups->by_name);
+	trie_init(&groups->by_gid);
+	groups->gid_bitmap.words = NULL;
+	groups->gid_bitmap.nwords = 0;
+	return groups;
+}
+
+/** Free a copied group entry. */
+static void free_group(struct group *ent) {
+	if (ent) {
+		for (size_t i = 0; i < darray_length(ent->gr_mem); ++i) {
+			free(ent->gr_mem[i]);
+		}
+		darray_free(ent->gr_mem);
+		free(ent->gr_name);
+		free(ent);
+	}
+}
+
 /**
  * struct group::gr_mem isn't properly aligned on macOS, so do this to avoid
  * ASAN warnings.
@@ -164,127 +371,140 @@ static char *next_gr_mem(void **gr_mem) {
 	return mem;
 }
 
-struct bfs_groups *bfs_groups_parse(void) {
-	int error;
-
-	struct bfs_groups *groups = malloc(sizeof(*groups));
-	if (!groups) {
+/**
+ * Copy a group entry returned by getgr*() into the cache.
+ *
+ * @return
+ *         The cached copy, or NULL on failure.
+ */
+static struct group *groups_add(struct bfs_groups *groups, const struct group *ent) {
+	struct group *copy = malloc(sizeof(*copy));
+	if (!copy) {
 		return NULL;
 	}
 
-	groups->entries = NULL;
-	trie_init(&groups->by_name);
-	trie_init(&groups->by_gid);
+	*copy = *ent;
+	copy->gr_mem = NULL;
 
-	setgrent();
-
-	while (true) {
-		errno = 0;
-		struct group *ent = getgrent();
-		if (!ent) {
-			if (errno) {
-				error = errno;
-				goto fail_end;
-			} else {
-				break;
-			}
-		}
+	copy->gr_name = strdup(ent->gr_name);
+	if (!copy->gr_name) {
+		goto fail;
+	}
 
-		if (DARRAY_PUSH(&groups->entries, ent) != 0) {
-			error = errno;
-			goto fail_end;
+	void *members = ent->gr_mem;
+	for (char *mem = next_gr_mem(&members); mem; mem = next_gr_mem(&members)) {
+		char *dup = strdup(mem);
+		if (!dup) {
+			goto fail;
 		}
-		ent = groups->entries + darray_length(groups->entries) - 1;
-
-		void *members = ent->gr_mem;
-		ent->gr_mem = NULL;
 
-		ent->gr_name = strdup(ent->gr_name);
-		if (!ent->gr_name) {
-			error = errno;
-			goto fail_end;
+		if (DARRAY_PUSH(&copy->gr_mem, &dup) != 0) {
+			free(dup);
+			goto fail;
 		}
+	}
 
-		for (char *mem = next_gr_mem(&members); mem; mem = next_gr_mem(&members)) {
-			char *dup = strdup(mem);
-			if (!dup) {
-				error = errno;
-				goto fail_end;
-			}
-
-			if (DARRAY_PUSH(&ent->gr_mem, &dup) != 0) {
-				error = errno;
-				free(dup);
-				goto fail_end;
-			}
-		}
+	if (DARRAY_PUSH(&groups->entries, &copy) != 0) {
+		goto fail;
 	}
 
-	endgrent();
+	return copy;
 
-	for (size_t i = 0; i < darray_length(groups->entries); ++i) {
-		struct group *entry = &groups->entries[i];
-		struct trie_leaf *leaf = trie_insert_str(&groups->by_name, entry->gr_name);
-		if (leaf) {
-			if (!leaf->value) {
-				leaf->value = entry;
-			}
-		} else {
-			error = errno;
-			goto fail_free;
+fail:
+	free_group(copy);
+	return NULL;
+}
+
+/**
+ * Handle the result of getgrnam()/getgrgid().  See users_lookup_done().
+ */
+static const struct group *groups_lookup_done(struct bfs_groups *groups, const struct group *ent, const char *name, gid_t gid) {
+	if (!ent) {
+		if (!pwcache_not_found(errno)) {
+			return NULL;
 		}
 
-		leaf = trie_insert_mem(&groups->by_gid, &entry->gr_gid, sizeof(entry->gr_gid));
-		if (leaf) {
-			if (!leaf->value) {
-				leaf->value = entry;
-			}
+		int ret;
+		if (name) {
+			ret = pwcache_remember(&groups->by_name, name, strlen(name) + 1, NULL);
 		} else {
-			error = errno;
-			goto fail_free;
+			ret = pwcache_remember(&groups->by_gid, &gid, sizeof(gid), NULL);
+		}
+		if (ret != 0) {
+			return NULL;
 		}
+
+		errno = 0;
+		return NULL;
 	}
 
-	return groups;
+	struct group *copy = groups_add(groups, ent);
+	if (!copy) {
+		return NULL;
+	}
 
-fail_end:
-	endgrent();
-fail_free:
-	bfs_groups_free(groups);
-	errno = error;
-	return NULL;
+	int ret;
+	if (name) {
+		ret = pwcache_remember(&groups->by_name, name, strlen(name) + 1, copy);
+	} else {
+		ret = pwcache_remember(&groups->by_gid, &gid, sizeof(gid), copy);
+	}
+	if (ret != 0) {
+		return NULL;
+	}
+
+	return copy;
 }
 
 const struct group *bfs_getgrnam(const struct bfs_groups *groups, const char *name) {
-	const struct trie_leaf *leaf = trie_find_str(&groups->by_name, name);
-	if (leaf) {
-		return leaf->value;
-	} else {
-		return NULL;
+	void *result;
+	if (pwcache_find(&groups->by_name, name, strlen(name) + 1, &result)) {
+		return result;
 	}
+
+	errno = 0;
+	const struct group *ent = getgrnam(name);
+	return groups_lookup_done((struct bfs_groups *)groups, ent, name, 0);
 }
 
 const struct group *bfs_getgrgid(const struct bfs_groups *groups, gid_t gid) {
-	const struct trie_leaf *leaf = trie_find_mem(&groups->by_gid, &gid, sizeof(gid));
-	if (leaf) {
-		return leaf->value;
+	void *result;
+	if (pwcache_find(&groups->by_gid, &gid, sizeof(gid), &result)) {
+		return result;
+	}
+
+	errno = 0;
+	const struct group *ent = getgrgid(gid);
+	return groups_lookup_done((struct bfs_groups *)groups, ent, NULL, gid);
+}
+
+int bfs_groups_exist(const struct bfs_groups *groups, gid_t gid) {
+	int ret = id_bitmap_get(&groups->gid_bitmap, gid);
+	if (ret >= 0) {
+		return ret;
+	}
+
+	if (bfs_getgrgid(groups, gid)) {
+		ret = 1;
+	} else if (errno == 0) {
+		ret = 0;
 	} else {
-		return NULL;
+		return -1;
 	}
+
+	struct bfs_groups *mut = (struct bfs_groups *)groups;
+	id_bitmap_set(&mut->gid_bitmap, gid, ret);
+	return ret;
 }
 
 void bfs_groups_free(struct bfs_groups *groups) {
 	if (groups) {
+		free(groups->gid_bitmap.words);
 		trie_destroy(&groups->by_gid);
 		trie_destroy(&groups->by_name);
 
 		for (size_t i = 0; i < darray_length(groups->entries); ++i) {
-			struct group *entry = &groups->entries[i];
-			for (size_t j = 0; j < darray_length(entry->gr_mem); ++j) {
-				free(entry->gr_mem[j]);
-			}
-			darray_free(entry->gr_mem);
-			free(entry->gr_name);
+			free_group(groups->entries[i]);
 		}
 		darray_free(groups->entries);
 
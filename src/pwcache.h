@@ -16,6 +16,11 @@
 
 /**
  * A caching wrapper for /etc/{passwd,group}.
+ *
+ * Entries are looked up individually the first time they are needed, rather
+ * than by enumerating the whole database up front, which can be very slow with
+ * network directories like LDAP.  Both positive and negative results are
+ * remembered.
  */
 
 #ifndef BFS_PWCACHE_H
@@ -30,12 +35,12 @@
 struct bfs_users;
 
 /**
- * Parse the user table.
+ * Create an empty user table.
  *
  * @return
- *         The parsed user table, or NULL on failure.
+ *         The new user table, or NULL on failure.
  */
-struct bfs_users *bfs_users_parse(void);
+struct bfs_users *bfs_users_new(void);
 
 /**
  * Get a user entry by name.
@@ -45,7 +50,8 @@ struct bfs_users *bfs_users_parse(void);
  * @param name
  *         The username to look up.
  * @return
- *         The matching user, or NULL if not found.
+ *         The matching user, or NULL if not found (with errno == 0) or on
+ *         failure.
  */
 const struct passwd *bfs_getpwnam(const struct bfs_users *users, const char *name);
 
@@ -57,10 +63,24 @@ const struct passwd *bfs_getpwnam(const struct bfs_users *users, const char *nam
  * @param uid
  *         The ID to look up.
  * @return
- *         The matching user, or NULL if not found.
+ *         The matching user, or NULL if not found (with errno == 0) or on
+ *         failure.
  */
 const struct passwd *bfs_getpwuid(const struct bfs_users *users, uid_t uid);
 
+/**
+ * Check whether a user exists.  This is faster than bfs_getpwuid() for
+ * repeated queries, since small UIDs are remembered in a bitmap.
+ *
+ * @param users
+ *         The user table.
+ * @param uid
+ *         The ID to check.
+ * @return
+ *         1 if the user exists, 0 if it doesn't, or -1 on failure.
+ */
+int bfs_users_exist(const struct bfs_users *users, uid_t uid);
+
 /**
  * Free a user table.
  *
@@ -75,12 +95,12 @@ void bfs_users_free(struct bfs_users *users);
 struct bfs_groups;
 
 /**
- * Parse the group table.
+ * Create an empty group table.
  *
  * @return
- *         The parsed group table, or NULL on failure.
+ *         The new group table, or NULL on failure.
  */
-struct bfs_groups *bfs_groups_parse(void);
+struct bfs_groups *bfs_groups_new(void);
 
 /**
  * Get a group entry by name.
@@ -90,7 +110,8 @@ struct bfs_groups *bfs_groups_parse(void);
  * @param name
  *         The group name to look up.
  * @return
- *         The matching group, or NULL if not found.
+ *         The matching group, or NULL if not found (with errno == 0) or on
+ *         failure.
  */
 const struct group *bfs_getgrnam(const struct bfs_groups *groups, const char *name);
 
@@ -99,13 +120,27 @@ const struct group *bfs_getgrnam(const struct bfs_groups *groups, const char *na
  *
  * @param groups
  *         The group table.
- * @param uid
+ * @param gid
  *         The ID to look up.
  * @return
- *         The matching group, or NULL if not found.
+ *         The matching group, or NULL if not found (with errno == 0) or on
+ *         failure.
  */
 const struct group *bfs_getgrgid(const struct bfs_groups *groups, gid_t gid);
 
+/**
+ * Check whether a group exists.  This is faster than bfs_getgrgid() for
+ * repeated queries, since small GIDs are remembered in a bitmap.
+ *
+ * @param groups
+ *         The group table.
+ * @param gid
+ *         The ID to check.
+ * @return
+ *         1 if the group exists, 0 if it doesn't, or -1 on failure.
+ */
+int bfs_groups_exist(const struct bfs_groups *groups, gid_t gid);
+
 /**
  * Free a group table.
  *
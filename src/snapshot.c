@@ -0,0 +1,706 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+/**
+ * The snapshot file layout is
+ *
+ *     struct snap_header
+ *     struct bfs_snap_dir (repeated)
+ *     struct snap_slot[tablesize]
+ *
+ * where each directory record is
+ *
+ *     struct bfs_snap_dir
+ *     char path[pathlen + 1]
+ *     struct bfs_snap_ent ents[nents]
+ *     char names[]
+ *
+ * with every part padded to a multiple of 8 bytes.
+ */
+
+#include "snapshot.h"
+#include "darray.h"
+#include "dir.h"
+#include "dstring.h"
+#include "stat.h"
+#include "trie.h"
+#include "util.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/** The magic number at the start of every snapshot. */
+static const char SNAP_MAGIC[8] = "bfssnap";
+
+/** The current version of the format. */
+#define SNAP_VERSION 1
+
+/** The snapshot file header. */
+struct snap_header {
+	/** SNAP_MAGIC. */
+	char magic[8];
+	/** SNAP_VERSION. */
+	uint32_t version;
+	/** sizeof(struct bfs_snap_ent), to catch snapshots from other hosts. */
+	uint32_t entsize;
+	/** The number of directory records. */
+	uint64_t ndirs;
+	/** The offset of the hash table. */
+	uint64_t table;
+	/** The number of hash table slots (a power of two). */
+	uint64_t tablesize;
+	/** When the snapshot was started (seconds). */
+	int64_t sec;
+	/** When the snapshot was started (nanoseconds). */
+	int64_t nsec;
+};
+
+/** A hash table slot. */
+struct snap_slot {
+	/** The hash of the directory's path. */
+	uint64_t hash;
+	/** The offset of the directory record, or 0 for empty slots. */
+	uint64_t offset;
+};
+
+/** bfs_stat() info, with fixed-size fields. */
+struct snap_stat {
+	uint32_t mask;
+	uint32_t mode;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t nlink;
+	uint32_t uid;
+	uint32_t gid;
+	int64_t size;
+	int64_t blocks;
+	uint64_t rdev;
+	uint64_t attrs;
+	/** atime, btime, ctime, mtime. */
+	int64_t sec[4];
+	uint32_t nsec[4];
+};
+
+struct bfs_snap_dir {
+	/** The total size of this record. */
+	uint64_t size;
+	/** The length of the path. */
+	uint64_t pathlen;
+	/** The number of entries. */
+	uint64_t nents;
+	/** The directory's own stat() info. */
+	struct snap_stat stat;
+};
+
+struct bfs_snap_ent {
+	/** The offset of the name, relative to this entry. */
+	uint32_t name;
+	/** The file type. */
+	int32_t type;
+	/** The lstat() info (mask == 0 if unavailable). */
+	struct snap_stat stat;
+};
+
+/** Round up to a multiple of 8. */
+static size_t snap_align(size_t size) {
+	return (size + 7) & ~(size_t)7;
+}
+
+/** FNV-1a hash of a path. */
+static uint64_t snap_hash(const char *path, size_t len) {
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= (unsigned char)path[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
+/** Convert a bfs_stat to its on-disk form. */
+static void snap_stat_pack(const struct bfs_stat *buf, struct snap_stat *sbuf) {
+	memset(sbuf, 0, sizeof(*sbuf));
+	if (!buf) {
+		return;
+	}
+
+	sbuf->mask = buf->mask;
+	sbuf->mode = buf->mode;
+	sbuf->dev = buf->dev;
+	sbuf->ino = buf->ino;
+	sbuf->nlink = buf->nlink;
+	sbuf->uid = buf->uid;
+	sbuf->gid = buf->gid;
+	sbuf->size = buf->size;
+	sbuf->blocks = buf->blocks;
+	sbuf->rdev = buf->rdev;
+	sbuf->attrs = buf->attrs;
+
+	const struct timespec *times[] = {&buf->atime, &buf->btime, &buf->ctime, &buf->mtime};
+	for (size_t i = 0; i < 4; ++i) {
+		sbuf->sec[i] = times[i]->tv_sec;
+		sbuf->nsec[i] = times[i]->tv_nsec;
+	}
+}
+
+/** Convert the on-disk form back to a bfs_stat. */
+static void snap_stat_unpack(const struct snap_stat *sbuf, struct bfs_stat *buf) {
+	buf->mask = sbuf->mask;
+	buf->mode = sbuf->mode;
+	buf->dev = sbuf->dev;
+	buf->ino = sbuf->ino;
+	buf->nlink = sbuf->nlink;
+	buf->uid = sbuf->uid;
+	buf->gid = sbuf->gid;
+	buf->size = sbuf->size;
+	buf->blocks = sbuf->blocks;
+	buf->rdev = sbuf->rdev;
+	buf->attrs = sbuf->attrs;
+
+	struct timespec *times[] = {&buf->atime, &buf->btime, &buf->ctime, &buf->mtime};
+	for (size_t i = 0; i < 4; ++i) {
+		times[i]->tv_sec = sbuf->sec[i];
+		times[i]->tv_nsec = sbuf->nsec[i];
+	}
+}
+
+struct bfs_snap_writer {
+	/** The final path of the snapshot. */
+	char *path;
+	/** The temporary path being written. */
+	char *tmppath;
+	/** The temporary file. */
+	FILE *file;
+	/** The current write offset. */
+	uint64_t offset;
+	/** The first error that occurred, if any. */
+	int error;
+	/** When the snapshot was started. */
+	struct timespec time;
+
+	/** The hash table slots for the committed records (a darray). */
+	struct snap_slot *slots;
+	/** The paths of the committed records. */
+	struct trie dirs;
+
+	/** Whether a directory is being recorded. */
+	bool active;
+	/** The current directory's path. */
+	char *dirpath;
+	/** The current directory's stat() info. */
+	struct snap_stat dirstat;
+	/** The current directory's entries (a darray). */
+	struct bfs_snap_ent *ents;
+	/** The current directory's entry names. */
+	char *names;
+};
+
+/** Write some bytes to a snapshot, padded to a multiple of 8. */
+static int snap_write(struct bfs_snap_writer *writer, const void *data, size_t size) {
+	static const char zeros[8] = {0};
+	size_t padding = snap_align(size) - size;
+
+	if (fwrite(data, 1, size, writer->file) != size) {
+		goto fail;
+	}
+	if (padding > 0 && fwrite(zeros, 1, padding, writer->file) != padding) {
+		goto fail;
+	}
+
+	writer->offset += size + padding;
+	return 0;
+
+fail:
+	writer->error = errno ? errno : EIO;
+	return -1;
+}
+
+struct bfs_snap_writer *bfs_snap_create(const char *path) {
+	struct bfs_snap_writer *writer = malloc(sizeof(*writer));
+	if (!writer) {
+		return NULL;
+	}
+
+	writer->path = dstrdup(path);
+	writer->tmppath = dstrprintf("%s.XXXXXX", path);
+	writer->file = NULL;
+	writer->offset = 0;
+	writer->error = 0;
+	writer->slots = NULL;
+	trie_init(&writer->dirs);
+	writer->active = false;
+	writer->dirpath = dstralloc(0);
+	writer->ents = NULL;
+	writer->names = dstralloc(0);
+	if (!writer->path || !writer->tmppath || !writer->dirpath || !writer->names) {
+		goto fail;
+	}
+
+	if (clock_gettime(CLOCK_REALTIME, &writer->time) != 0) {
+		goto fail;
+	}
+
+	int fd = mkstemp(writer->tmppath);
+	if (fd < 0) {
+		goto fail;
+	}
+
+	// mkstemp() uses mode 0600, but snapshots should be created like any
+	// other output file
+	mode_t mask = umask(0);
+	umask(mask);
+	if (fchmod(fd, 0666 & ~mask) == 0) {
+		writer->file = fdopen(fd, "wb");
+	}
+	if (!writer->file) {
+		int error = errno;
+		unlink(writer->tmppath);
+		xclose(fd);
+		errno = error;
+		goto fail;
+	}
+
+	// Write a placeholder header, filled in by bfs_snap_finish()
+	struct snap_header header = {0};
+	if (snap_write(writer, &header, sizeof(header)) != 0) {
+		int error = writer->error;
+		bfs_snap_free(writer);
+		errno = error;
+		return NULL;
+	}
+
+	return writer;
+
+fail:
+	dstrfree(writer->names);
+	dstrfree(writer->dirpath);
+	dstrfree(writer->tmppath);
+	dstrfree(writer->path);
+	free(writer);
+	return NULL;
+}
+
+int bfs_snap_begin(struct bfs_snap_writer *writer, const char *path, const struct bfs_stat *statbuf) {
+	assert(!writer->active);
+
+	if (writer->error) {
+		errno = writer->error;
+		return -1;
+	}
+
+	// Iterative deepening reads the same directories more than once
+	if (trie_find_str(&writer->dirs, path)) {
+		errno = EEXIST;
+		return -1;
+	}
+
+	if (dstresize(&writer->dirpath, 0) != 0 || dstrcat(&writer->dirpath, path) != 0) {
+		return -1;
+	}
+
+	snap_stat_pack(statbuf, &writer->dirstat);
+	darray_free(writer->ents);
+	writer->ents = NULL;
+	dstresize(&writer->names, 0);
+
+	writer->active = true;
+	return 0;
+}
+
+int bfs_snap_add(struct bfs_snap_writer *writer, const struct bfs_dirent *de, const struct bfs_stat *statbuf) {
+	assert(writer->active);
+
+	struct bfs_snap_ent ent;
+	// Temporarily store the offset into the names buffer
+	ent.name = dstrlen(writer->names);
+	ent.type = statbuf ? bfs_mode_to_type(statbuf->mode) : de->type;
+	snap_stat_pack(statbuf, &ent.stat);
+
+	if (dstrcat(&writer->names, de->name) != 0 || dstrapp(&writer->names, '\0') != 0) {
+		goto fail;
+	}
+
+	if (DARRAY_PUSH(&writer->ents, &ent) != 0) {
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	bfs_snap_abort(writer);
+	return -1;
+}
+
+int bfs_snap_commit(struct bfs_snap_writer *writer) {
+	assert(writer->active);
+	writer->active = false;
+
+	if (writer->error) {
+		errno = writer->error;
+		return -1;
+	}
+
+	size_t pathlen = dstrlen(writer->dirpath);
+	size_t nents = darray_length(writer->ents);
+	size_t entsize = nents * sizeof(struct bfs_snap_ent);
+	size_t namesize = dstrlen(writer->names);
+
+	// Make the name offsets relative to each entry
+	size_t names = entsize;
+	for (size_t i = 0; i < nents; ++i) {
+		size_t rel = names + writer->ents[i].name - i * sizeof(struct bfs_snap_ent);
+		if (rel > UINT32_MAX) {
+			errno = EOVERFLOW;
+			return -1;
+		}
+		writer->ents[i].name = rel;
+	}
+
+	struct bfs_snap_dir dir = {
+		.size = sizeof(dir) + snap_align(pathlen + 1) + entsize + snap_align(namesize),
+		.pathlen = pathlen,
+		.nents = nents,
+		.stat = writer->dirstat,
+	};
+
+	struct snap_slot slot = {
+		.hash = snap_hash(writer->dirpath, pathlen),
+		.offset = writer->offset,
+	};
+	if (DARRAY_PUSH(&writer->slots, &slot) != 0 || !trie_insert_str(&writer->dirs, writer->dirpath)) {
+		writer->error = errno;
+		return -1;
+	}
+
+	if (snap_write(writer, &dir, sizeof(dir)) != 0
+	    || snap_write(writer, writer->dirpath, pathlen + 1) != 0
+	    || (entsize > 0 && snap_write(writer, writer->ents, entsize) != 0)
+	    || (namesize > 0 && snap_write(writer, writer->names, namesize) != 0)) {
+		errno = writer->error;
+		return -1;
+	}
+
+	return 0;
+}
+
+void bfs_snap_abort(struct bfs_snap_writer *writer) {
+	writer->active = false;
+}
+
+/** Write the hash table and the final header. */
+static int snap_write_table(struct bfs_snap_writer *writer) {
+	size_t ndirs = darray_length(writer->slots);
+
+	// Keep the load factor at most 1/2
+	size_t tablesize = 1;
+	while (tablesize < 2 * ndirs) {
+		tablesize *= 2;
+	}
+
+	struct snap_slot *table = calloc(tablesize, sizeof(*table));
+	if (!table) {
+		writer->error = errno;
+		return -1;
+	}
+
+	for (size_t i = 0; i < ndirs; ++i) {
+		const struct snap_slot *slot = &writer->slots[i];
+		size_t j = slot->hash & (tablesize - 1);
+		while (table[j].offset != 0) {
+			j = (j + 1) & (tablesize - 1);
+		}
+		table[j] = *slot;
+	}
+
+	struct snap_header header = {
+		.version = SNAP_VERSION,
+		.entsize = sizeof(struct bfs_snap_ent),
+		.ndirs = ndirs,
+		.table = writer->offset,
+		.tablesize = tablesize,
+		.sec = writer->time.tv_sec,
+		.nsec = writer->time.tv_nsec,
+	};
+	memcpy(header.magic, SNAP_MAGIC, sizeof(header.magic));
+
+	int ret = snap_write(writer, table, tablesize * sizeof(*table));
+	free(table);
+	if (ret != 0) {
+		return -1;
+	}
+
+	if (fseek(writer->file, 0, SEEK_SET) != 0) {
+		writer->error = errno;
+		return -1;
+	}
+
+	return snap_write(writer, &header, sizeof(header));
+}
+
+int bfs_snap_finish(struct bfs_snap_writer *writer) {
+	if (writer->active) {
+		bfs_snap_abort(writer);
+	}
+
+	if (!writer->file && !writer->error) {
+		// Already finished
+		writer->error = EINVAL;
+	}
+
+	if (!writer->error) {
+		snap_write_table(writer);
+	}
+
+	if (!writer->error && fclose(writer->file) != 0) {
+		writer->error = errno;
+	}
+	writer->file = NULL;
+
+	if (!writer->error && rename(writer->tmppath, writer->path) != 0) {
+		writer->error = errno;
+	}
+
+	if (writer->error) {
+		errno = writer->error;
+		return -1;
+	}
+	return 0;
+}
+
+void bfs_snap_free(struct bfs_snap_writer *writer) {
+	if (!writer) {
+		return;
+	}
+
+	if (writer->file) {
+		fclose(writer->file);
+		unlink(writer->tmppath);
+	} else if (writer->error) {
+		unlink(writer->tmppath);
+	}
+
+	dstrfree(writer->names);
+	darray_free(writer->ents);
+	dstrfree(writer->dirpath);
+	trie_destroy(&writer->dirs);
+	darray_free(writer->slots);
+	dstrfree(writer->tmppath);
+	dstrfree(writer->path);
+	free(writer);
+}
+
+struct bfs_snap {
+	/** The mapped snapshot file. */
+	const char *base;
+	/** The size of the mapping. */
+	size_t size;
+	/** The file header. */
+	const struct snap_header *header;
+	/** The hash table. */
+	const struct snap_slot *table;
+};
+
+/** Get the path of a directory record. */
+static const char *snap_dir_path(const struct bfs_snap_dir *dir) {
+	return (const char *)(dir + 1);
+}
+
+/** Get the entries of a directory record. */
+static const struct bfs_snap_ent *snap_dir_ents(const struct bfs_snap_dir *dir) {
+	return (const struct bfs_snap_ent *)(snap_dir_path(dir) + snap_align(dir->pathlen + 1));
+}
+
+/** Check that a record is within bounds and well-formed. */
+static bool snap_dir_valid(const struct bfs_snap *snap, uint64_t offset) {
+	if (offset < sizeof(struct snap_header) || offset > snap->header->table || offset % 8 != 0) {
+		return false;
+	}
+
+	uint64_t avail = snap->header->table - offset;
+	if (avail < sizeof(struct bfs_snap_dir)) {
+		return false;
+	}
+
+	const struct bfs_snap_dir *dir = (const struct bfs_snap_dir *)(snap->base + offset);
+	if (dir->size > avail
+	    || dir->pathlen >= dir->size
+	    || dir->nents > dir->size / sizeof(struct bfs_snap_ent)
+	    || sizeof(*dir) + snap_align(dir->pathlen + 1) + dir->nents * sizeof(struct bfs_snap_ent) > dir->size) {
+		return false;
+	}
+
+	if (snap_dir_path(dir)[dir->pathlen] != '\0') {
+		return false;
+	}
+
+	const char *end = (const char *)dir + dir->size;
+	const struct bfs_snap_ent *ents = snap_dir_ents(dir);
+	const char *names = (const char *)(ents + dir->nents);
+	for (uint64_t i = 0; i < dir->nents; ++i) {
+		const struct bfs_snap_ent *ent = &ents[i];
+		if (ent->type < BFS_UNKNOWN || ent->type > BFS_WHT) {
+			return false;
+		}
+
+		// Names must lie after the entries, and end inside the record
+		const char *name = (const char *)ent + ent->name;
+		if (ent->name > (size_t)(end - (const char *)ent) || name < names) {
+			return false;
+		}
+		if (!memchr(name, '\0', end - name)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+struct bfs_snap *bfs_snap_open(const char *path) {
+	struct bfs_snap *snap = malloc(sizeof(*snap));
+	if (!snap) {
+		return NULL;
+	}
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		goto fail;
+	}
+
+	struct stat statbuf;
+	if (fstat(fd, &statbuf) != 0) {
+		goto fail_close;
+	}
+
+	if ((uint64_t)statbuf.st_size < sizeof(struct snap_header)) {
+		errno = EINVAL;
+		goto fail_close;
+	}
+
+	snap->size = statbuf.st_size;
+	void *base = mmap(NULL, snap->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		goto fail_close;
+	}
+	snap->base = base;
+	xclose(fd);
+
+	const struct snap_header *header = base;
+	if (memcmp(header->magic, SNAP_MAGIC, sizeof(header->magic)) != 0
+	    || header->version != SNAP_VERSION
+	    || header->entsize != sizeof(struct bfs_snap_ent)
+	    || header->tablesize == 0
+	    || (header->tablesize & (header->tablesize - 1)) != 0
+	    || header->table > snap->size
+	    || header->tablesize > (snap->size - header->table) / sizeof(struct snap_slot)) {
+		munmap(base, snap->size);
+		free(snap);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	snap->header = header;
+	snap->table = (const struct snap_slot *)(snap->base + header->table);
+
+	// Check every record up front, so lookups can trust them
+	for (uint64_t i = 0; i < header->tablesize; ++i) {
+		uint64_t offset = snap->table[i].offset;
+		if (offset != 0 && !snap_dir_valid(snap, offset)) {
+			bfs_snap_close(snap);
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+
+	return snap;
+
+fail_close:
+	xclose(fd);
+fail:
+	free(snap);
+	return NULL;
+}
+
+size_t bfs_snap_count(const struct bfs_snap *snap) {
+	return snap->header->ndirs;
+}
+
+void bfs_snap_time(const struct bfs_snap *snap, struct timespec *time) {
+	time->tv_sec = snap->header->sec;
+	time->tv_nsec = snap->header->nsec;
+}
+
+const struct bfs_snap_dir *bfs_snap_find(const struct bfs_snap *snap, const char *path) {
+	size_t len = strlen(path);
+	uint64_t hash = snap_hash(path, len);
+	uint64_t mask = snap->header->tablesize - 1;
+
+	for (uint64_t i = hash & mask, n = 0; n <= mask; i = (i + 1) & mask, ++n) {
+		const struct snap_slot *slot = &snap->table[i];
+		if (slot->offset == 0) {
+			break;
+		}
+		if (slot->hash != hash) {
+			continue;
+		}
+
+		const struct bfs_snap_dir *dir = (const struct bfs_snap_dir *)(snap->base + slot->offset);
+		if (dir->pathlen == len && memcmp(snap_dir_path(dir), path, len) == 0) {
+			return dir;
+		}
+	}
+
+	return NULL;
+}
+
+void bfs_snap_dir_stat(const struct bfs_snap_dir *dir, struct bfs_stat *buf) {
+	snap_stat_unpack(&dir->stat, buf);
+}
+
+size_t bfs_snap_dir_size(const struct bfs_snap_dir *dir) {
+	return dir->nents;
+}
+
+const struct bfs_snap_ent *bfs_snap_dir_read(const struct bfs_snap_dir *dir, size_t i, struct bfs_dirent *de) {
+	assert(i < dir->nents);
+
+	const struct bfs_snap_ent *ent = &snap_dir_ents(dir)[i];
+	de->type = ent->type;
+	de->name = (const char *)ent + ent->name;
+	return ent;
+}
+
+int bfs_snap_ent_stat(const struct bfs_snap_ent *ent, struct bfs_stat *buf) {
+	if (ent->stat.mask == 0) {
+		return -1;
+	}
+
+	snap_stat_unpack(&ent->stat, buf);
+	return 0;
+}
+
+void bfs_snap_close(struct bfs_snap *snap) {
+	if (snap) {
+		munmap((void *)snap->base, snap->size);
+		free(snap);
+	}
+}
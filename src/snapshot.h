@@ -0,0 +1,197 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+/**
+ * Directory snapshots, for answering repeated queries without re-reading the
+ * file system.
+ *
+ * A snapshot file holds one record per directory, containing the directory's
+ * own bfs_stat() info along with the names, types, and lstat() info of all its
+ * entries.  A hash table at the end of the file maps paths to records, so the
+ * file can be memory-mapped and queried without any parsing up front.  The
+ * format is specific to the host that wrote it.
+ */
+
+#ifndef BFS_SNAPSHOT_H
+#define BFS_SNAPSHOT_H
+
+#include "dir.h"
+#include "stat.h"
+#include <stddef.h>
+#include <time.h>
+
+/**
+ * A snapshot being written.
+ */
+struct bfs_snap_writer;
+
+/**
+ * Start writing a snapshot.  The data goes to a temporary file, which only
+ * replaces the given path when bfs_snap_finish() succeeds.
+ *
+ * @param path
+ *         The path to write the snapshot to.
+ * @return
+ *         The new snapshot writer, or NULL on failure.
+ */
+struct bfs_snap_writer *bfs_snap_create(const char *path);
+
+/**
+ * Start recording a directory.
+ *
+ * @param writer
+ *         The snapshot writer.
+ * @param path
+ *         The path to the directory.
+ * @param statbuf
+ *         The directory's own bfs_stat() info.
+ * @return
+ *         0 on success, -1 on failure (EEXIST if the directory was already
+ *         recorded).
+ */
+int bfs_snap_begin(struct bfs_snap_writer *writer, const char *path, const struct bfs_stat *statbuf);
+
+/**
+ * Record an entry of the current directory.
+ *
+ * @param writer
+ *         The snapshot writer.
+ * @param de
+ *         The directory entry.
+ * @param statbuf
+ *         The entry's lstat() info, or NULL if unavailable.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_snap_add(struct bfs_snap_writer *writer, const struct bfs_dirent *de, const struct bfs_stat *statbuf);
+
+/**
+ * Finish recording the current directory.
+ *
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_snap_commit(struct bfs_snap_writer *writer);
+
+/**
+ * Discard the current directory, e.g. because it couldn't be read completely.
+ */
+void bfs_snap_abort(struct bfs_snap_writer *writer);
+
+/**
+ * Finish writing a snapshot, and move it into place.
+ *
+ * @return
+ *         0 on success, -1 on failure (including any earlier write failures).
+ */
+int bfs_snap_finish(struct bfs_snap_writer *writer);
+
+/**
+ * Free a snapshot writer.  If the snapshot wasn't successfully finished, the
+ * temporary file is deleted.
+ */
+void bfs_snap_free(struct bfs_snap_writer *writer);
+
+/**
+ * A snapshot opened for reading.
+ */
+struct bfs_snap;
+
+/**
+ * A directory record in a snapshot.
+ */
+struct bfs_snap_dir;
+
+/**
+ * An entry in a directory record.
+ */
+struct bfs_snap_ent;
+
+/**
+ * Open a snapshot for reading.
+ *
+ * @param path
+ *         The path to the snapshot file.
+ * @return
+ *         The opened snapshot, or NULL on failure (EINVAL if it is not a valid
+ *         snapshot).
+ */
+struct bfs_snap *bfs_snap_open(const char *path);
+
+/**
+ * Get the number of directories in a snapshot.
+ */
+size_t bfs_snap_count(const struct bfs_snap *snap);
+
+/**
+ * Get the time that a snapshot was started.
+ */
+void bfs_snap_time(const struct bfs_snap *snap, struct timespec *time);
+
+/**
+ * Look up a directory in a snapshot.
+ *
+ * @param snap
+ *         The snapshot to search.
+ * @param path
+ *         The path to the directory, exactly as it was recorded.
+ * @return
+ *         The directory record, or NULL if it wasn't recorded.
+ */
+const struct bfs_snap_dir *bfs_snap_find(const struct bfs_snap *snap, const char *path);
+
+/**
+ * Get the recorded bfs_stat() info for a directory itself.
+ */
+void bfs_snap_dir_stat(const struct bfs_snap_dir *dir, struct bfs_stat *buf);
+
+/**
+ * Get the number of entries in a directory record.
+ */
+size_t bfs_snap_dir_size(const struct bfs_snap_dir *dir);
+
+/**
+ * Get an entry from a directory record.
+ *
+ * @param dir
+ *         The directory record.
+ * @param i
+ *         The index of the entry, less than bfs_snap_dir_size().
+ * @param[out] de
+ *         The directory entry to populate.
+ * @return
+ *         The snapshot entry, for bfs_snap_ent_stat().
+ */
+const struct bfs_snap_ent *bfs_snap_dir_read(const struct bfs_snap_dir *dir, size_t i, struct bfs_dirent *de);
+
+/**
+ * Get the recorded lstat() info for an entry.
+ *
+ * @param ent
+ *         The snapshot entry.
+ * @param[out] buf
+ *         The stat buffer to fill.
+ * @return
+ *         0 on success, or -1 if no info was recorded.
+ */
+int bfs_snap_ent_stat(const struct bfs_snap_ent *ent, struct bfs_stat *buf);
+
+/**
+ * Close a snapshot.
+ */
+void bfs_snap_close(struct bfs_snap *snap);
+
+#endif // BFS_SNAPSHOT_H
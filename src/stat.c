@@ -15,10 +15,12 @@
  ****************************************************************************/
 
 #include "stat.h"
+#include "prof.h"
 #include "util.h"
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <string.h>
 #include <sys/types.h>
@@ -188,8 +190,44 @@ static int bfs_statx(int at_fd, const char *at_path, int at_flags, unsigned int
 /**
  * bfs_stat() implementation backed by statx().
  */
-static int bfs_statx_impl(int at_fd, const char *at_path, int at_flags, enum bfs_stat_flags flags, struct bfs_stat *buf) {
-	unsigned int mask = STATX_BASIC_STATS | STATX_BTIME;
+static int bfs_statx_impl(int at_fd, const char *at_path, int at_flags, enum bfs_stat_flags flags, enum bfs_stat_field fields, struct bfs_stat *buf) {
+	// Only ask for what's needed, since e.g. sizes and times can force
+	// expensive attribute revalidation on network file systems
+	unsigned int mask = STATX_TYPE;
+	if (fields & BFS_STAT_INO) {
+		mask |= STATX_INO;
+	}
+	if (fields & BFS_STAT_MODE) {
+		mask |= STATX_MODE;
+	}
+	if (fields & BFS_STAT_NLINK) {
+		mask |= STATX_NLINK;
+	}
+	if (fields & BFS_STAT_GID) {
+		mask |= STATX_GID;
+	}
+	if (fields & BFS_STAT_UID) {
+		mask |= STATX_UID;
+	}
+	if (fields & BFS_STAT_SIZE) {
+		mask |= STATX_SIZE;
+	}
+	if (fields & BFS_STAT_BLOCKS) {
+		mask |= STATX_BLOCKS;
+	}
+	if (fields & BFS_STAT_ATIME) {
+		mask |= STATX_ATIME;
+	}
+	if (fields & BFS_STAT_BTIME) {
+		mask |= STATX_BTIME;
+	}
+	if (fields & BFS_STAT_CTIME) {
+		mask |= STATX_CTIME;
+	}
+	if (fields & BFS_STAT_MTIME) {
+		mask |= STATX_MTIME;
+	}
+
 	struct statx xbuf;
 	int ret = bfs_statx(at_fd, at_path, at_flags, mask, &xbuf);
 
@@ -202,8 +240,9 @@ static int bfs_statx_impl(int at_fd, const char *at_path, int at_flags, enum bfs
 		return ret;
 	}
 
-	// Callers shouldn't have to check anything except the times
-	const unsigned int guaranteed = STATX_BASIC_STATS ^ (STATX_ATIME | STATX_CTIME | STATX_MTIME);
+	// Callers shouldn't have to check anything they asked for except the
+	// times
+	const unsigned int guaranteed = mask & STATX_BASIC_STATS & ~(STATX_ATIME | STATX_CTIME | STATX_MTIME);
 	if ((xbuf.stx_mask & guaranteed) != guaranteed) {
 		errno = ENOTSUP;
 		return -1;
@@ -290,12 +329,13 @@ static int bfs_statx_impl(int at_fd, const char *at_path, int at_flags, enum bfs
 /**
  * Allows calling stat with custom at_flags.
  */
-static int bfs_stat_explicit(int at_fd, const char *at_path, int at_flags, enum bfs_stat_flags flags, struct bfs_stat *buf) {
+static int bfs_stat_explicit(int at_fd, const char *at_path, int at_flags, enum bfs_stat_flags flags, enum bfs_stat_field fields, struct bfs_stat *buf) {
 #if HAVE_BFS_STATX
-	static bool has_statx = true;
+	// Atomic, since bfs_stat() may be called from background threads
+	static atomic_bool has_statx = true;
 
 	if (has_statx) {
-		int ret = bfs_statx_impl(at_fd, at_path, at_flags, flags, buf);
+		int ret = bfs_statx_impl(at_fd, at_path, at_flags, flags, fields, buf);
 		// EPERM is commonly returned in a seccomp() sandbox that does
 		// not allow statx()
 		if (ret != 0 && (errno == ENOSYS || errno == EPERM)) {
@@ -309,7 +349,8 @@ static int bfs_stat_explicit(int at_fd, const char *at_path, int at_flags, enum
 	return bfs_stat_impl(at_fd, at_path, at_flags, flags, buf);
 }
 
-int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct bfs_stat *buf) {
+/** bfs_stat() without profiling. */
+static int bfs_stat_unprofiled(int at_fd, const char *at_path, enum bfs_stat_flags flags, enum bfs_stat_field fields, struct bfs_stat *buf) {
 	int at_flags = 0;
 	if (flags & BFS_STAT_NOFOLLOW) {
 		at_flags |= AT_SYMLINK_NOFOLLOW;
@@ -322,15 +363,15 @@ int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct b
 #endif
 
 	if (at_path) {
-		return bfs_stat_explicit(at_fd, at_path, at_flags, flags, buf);
+		return bfs_stat_explicit(at_fd, at_path, at_flags, flags, fields, buf);
 	}
 
 	// Check __GNU__ to work around https://lists.gnu.org/archive/html/bug-hurd/2021-12/msg00001.html
 #if defined(AT_EMPTY_PATH) && !__GNU__
-	static bool has_at_ep = true;
+	static atomic_bool has_at_ep = true;
 	if (has_at_ep) {
 		at_flags |= AT_EMPTY_PATH;
-		int ret = bfs_stat_explicit(at_fd, "", at_flags, flags, buf);
+		int ret = bfs_stat_explicit(at_fd, "", at_flags, flags, fields, buf);
 		if (ret != 0 && errno == EINVAL) {
 			has_at_ep = false;
 		} else {
@@ -348,6 +389,21 @@ int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct b
 	}
 }
 
+int bfs_stat_fields(int at_fd, const char *at_path, enum bfs_stat_flags flags, enum bfs_stat_field fields, struct bfs_stat *buf) {
+	struct timespec start;
+	if (!bfs_prof_begin(&start)) {
+		return bfs_stat_unprofiled(at_fd, at_path, flags, fields, buf);
+	}
+
+	int ret = bfs_stat_unprofiled(at_fd, at_path, flags, fields, buf);
+	bfs_prof_end(BFS_PROF_STAT, &start);
+	return ret;
+}
+
+int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct bfs_stat *buf) {
+	return bfs_stat_fields(at_fd, at_path, flags, BFS_STAT_ALL, buf);
+}
+
 const struct timespec *bfs_stat_time(const struct bfs_stat *buf, enum bfs_stat_field field) {
 	if (!(buf->mask & field)) {
 		errno = ENOTSUP;
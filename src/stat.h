@@ -54,6 +54,22 @@ enum bfs_stat_field {
 	BFS_STAT_MTIME  = 1 << 14,
 };
 
+/** All of the bfs_stat fields. */
+#define BFS_STAT_ALL ((enum bfs_stat_field)((BFS_STAT_MTIME << 1) - 1))
+
+/**
+ * The fields that identify a file and its type, which are needed to walk the
+ * file tree at all.
+ */
+#define BFS_STAT_IDENTITY ((enum bfs_stat_field)(BFS_STAT_DEV | BFS_STAT_INO | BFS_STAT_TYPE))
+
+/**
+ * The fields that are cheap to get on every file system.  The sizes and times
+ * are left out, since they may require revalidation over the network.
+ */
+#define BFS_STAT_BASIC ((enum bfs_stat_field)(BFS_STAT_IDENTITY | BFS_STAT_MODE | BFS_STAT_NLINK \
+	| BFS_STAT_GID | BFS_STAT_UID | BFS_STAT_RDEV | BFS_STAT_ATTRS))
+
 /**
  * Get the human-readable name of a bfs_stat field.
  */
@@ -137,6 +153,15 @@ struct bfs_stat {
  */
 int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct bfs_stat *buf);
 
+/**
+ * Like bfs_stat(), but only asks for some of the fields.  Other fields may be
+ * filled in anyway; check buf->mask.
+ *
+ * @param fields
+ *         The fields that are needed.
+ */
+int bfs_stat_fields(int at_fd, const char *at_path, enum bfs_stat_flags flags, enum bfs_stat_field fields, struct bfs_stat *buf);
+
 /**
  * Get a particular time field from a bfs_stat() buffer.
  */
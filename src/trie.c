@@ -70,13 +70,18 @@
  * bit is used to tell pointers to internal nodes apart from pointers to leaves.
  *
  * This implementation tests a whole nibble (half byte/hex digit) at every
- * branch, so the bitmap takes up 16 bits.  The remainder of a machine word is
- * used to hold the offset, which severely constrains its range on 32-bit
- * platforms.  As a workaround, we store relative instead of absolute offsets,
- * and insert intermediate singleton "jump" nodes when necessary.
+ * branch, so the bitmap takes up 16 bits.  A few more bits hold the capacity of
+ * the children array, and the remainder of a machine word is used to hold the
+ * offset, which severely constrains its range on 32-bit platforms.  As a
+ * workaround, we store relative instead of absolute offsets, and insert
+ * intermediate singleton "jump" nodes when necessary.
+ *
+ * Internal nodes are allocated from a per-trie varena, which keeps them packed
+ * together in memory and avoids a malloc() call for every insertion.
  */
 
 #include "trie.h"
+#include "alloc.h"
 #include "util.h"
 #include <assert.h>
 #include <limits.h>
@@ -91,9 +96,11 @@
 
 /** Number of bits for the sparse array bitmap, aka the range of a nibble. */
 #define BITMAP_BITS 16
+/** Number of bits for the log2 of the children array capacity. */
+#define ORDER_BITS 3
 /** The number of remaining bits in a word, to hold the offset. */
-#define OFFSET_BITS (sizeof(size_t)*CHAR_BIT - BITMAP_BITS)
-/** The highest representable offset (only 64k on a 32-bit architecture). */
+#define OFFSET_BITS (sizeof(size_t)*CHAR_BIT - BITMAP_BITS - ORDER_BITS)
+/** The highest representable offset (only 8k on a 32-bit architecture). */
 #define OFFSET_MAX (((size_t)1 << OFFSET_BITS) - 1)
 
 /**
@@ -107,6 +114,11 @@ struct trie_node {
 	 */
 	size_t bitmap : BITMAP_BITS;
 
+	/**
+	 * The capacity of the children array is 1 << order.
+	 */
+	size_t order : ORDER_BITS;
+
 	/**
 	 * The offset into the key in nibbles.  This is relative to the parent
 	 * node, to support offsets larger than OFFSET_MAX.
@@ -154,6 +166,7 @@ static uintptr_t trie_encode_node(const struct trie_node *node) {
 
 void trie_init(struct trie *trie) {
 	trie->root = 0;
+	VARENA_INIT(&trie->nodes, struct trie_node, children);
 }
 
 /** Compute the popcount (Hamming weight) of a bitmap. */
@@ -329,16 +342,60 @@ static struct trie_leaf *new_trie_leaf(const void *key, size_t length) {
 	return leaf;
 }
 
-/** Compute the size of a trie node with a certain number of children. */
-static size_t trie_node_size(unsigned int size) {
+/** Get the smallest order whose capacity fits a number of children. */
+static unsigned int trie_order(unsigned int size) {
 	// Empty nodes aren't supported
 	assert(size > 0);
-	// Node size must be a power of two
-	assert((size & (size - 1)) == 0);
 
-	return BFS_FLEX_SIZEOF(struct trie_node, children, size);
+	unsigned int order = 0;
+	while ((1U << order) < size) {
+		++order;
+	}
+	return order;
+}
+
+/** Allocate a trie node with room for 1 << order children. */
+static struct trie_node *trie_node_alloc(struct trie *trie, unsigned int order) {
+	struct trie_node *node = varena_alloc(&trie->nodes, (size_t)1 << order);
+	if (node) {
+		node->order = order;
+	}
+	return node;
+}
+
+/** Free a trie node. */
+static void trie_node_free(struct trie *trie, struct trie_node *node) {
+	varena_free(&trie->nodes, node, (size_t)1 << node->order);
+}
+
+/** Move a node to an allocation of a different capacity. */
+static struct trie_node *trie_node_resize(struct trie *trie, struct trie_node *node, unsigned int order) {
+	unsigned int size = trie_popcount(node->bitmap);
+	assert(size <= (1U << order));
+
+	struct trie_node *ret = trie_node_alloc(trie, order);
+	if (!ret) {
+		return NULL;
+	}
+
+	ret->bitmap = node->bitmap;
+	ret->offset = node->offset;
+	memcpy(ret->children, node->children, size*sizeof(node->children[0]));
+
+	trie_node_free(trie, node);
+	return ret;
 }
 
+/**
+ * Whether trie_key_mismatch() can locate a mismatch within a word directly,
+ * which needs a little-endian byte order and a count-trailing-zeros builtin.
+ */
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#	define TRIE_SWAR 1
+#else
+#	define TRIE_SWAR 0
+#endif
+
 /** Find the offset of the first nibble that differs between two keys. */
 static size_t trie_key_mismatch(const void *key1, const void *key2, size_t length) {
 	const unsigned char *bytes1 = key1;
@@ -348,8 +405,21 @@ static size_t trie_key_mismatch(const void *key1, const void *key2, size_t lengt
 	const size_t chunk = sizeof(size_t);
 
 	for (; i + chunk <= length; i += chunk) {
-		if (memcmp(bytes1 + i, bytes2 + i, chunk) != 0) {
+		size_t word1, word2;
+		memcpy(&word1, bytes1 + i, chunk);
+		memcpy(&word2, bytes2 + i, chunk);
+		size_t diff = word1 ^ word2;
+		if (diff) {
+#if TRIE_SWAR
+			// The lowest set bit of the difference is in the first
+			// mismatched byte, and tells us which nibble differs
+			unsigned int bit = __builtin_ctzll(diff);
+			i += bit / CHAR_BIT;
+			offset = (bit % CHAR_BIT) >= 4;
+			return offset | (i << 1);
+#else
 			break;
+#endif
 		}
 	}
 
@@ -387,13 +457,13 @@ static size_t trie_key_mismatch(const void *key1, const void *key2, size_t lengt
  *      | Z
  *      +--->...
  */
-static struct trie_leaf *trie_node_insert(uintptr_t *ptr, const void *key, size_t length, size_t offset) {
+static struct trie_leaf *trie_node_insert(struct trie *trie, uintptr_t *ptr, const void *key, size_t length, size_t offset) {
 	struct trie_node *node = trie_decode_node(*ptr);
 	unsigned int size = trie_popcount(node->bitmap);
 
-	// Double the capacity every power of two
-	if ((size & (size - 1)) == 0) {
-		node = realloc(node, trie_node_size(2*size));
+	// Double the capacity when the node is full
+	if (size == (1U << node->order)) {
+		node = trie_node_resize(trie, node, node->order + 1);
 		if (!node) {
 			return NULL;
 		}
@@ -446,12 +516,12 @@ static struct trie_leaf *trie_node_insert(uintptr_t *ptr, const void *key, size_
  *           | Y
  *           +--->key
  */
-static uintptr_t *trie_jump(uintptr_t *ptr, const char *key, size_t *offset) {
+static uintptr_t *trie_jump(struct trie *trie, uintptr_t *ptr, const char *key, size_t *offset) {
 	// We only ever need to jump to leaf nodes, since internal nodes are
 	// guaranteed to be within OFFSET_MAX anyway
 	assert(trie_is_leaf(*ptr));
 
-	struct trie_node *node = malloc(trie_node_size(1));
+	struct trie_node *node = trie_node_alloc(trie, 0);
 	if (!node) {
 		return NULL;
 	}
@@ -484,19 +554,19 @@ static uintptr_t *trie_jump(uintptr_t *ptr, const char *key, size_t *offset) {
  *      | Y
  *      +--->key
  */
-static struct trie_leaf *trie_split(uintptr_t *ptr, const void *key, size_t length, struct trie_leaf *rep, size_t offset, size_t mismatch) {
+static struct trie_leaf *trie_split(struct trie *trie, uintptr_t *ptr, const void *key, size_t length, struct trie_leaf *rep, size_t offset, size_t mismatch) {
 	unsigned char key_nibble = trie_key_nibble(key, mismatch);
 	unsigned char rep_nibble = trie_key_nibble(rep->key, mismatch);
 	assert(key_nibble != rep_nibble);
 
-	struct trie_node *node = malloc(trie_node_size(2));
+	struct trie_node *node = trie_node_alloc(trie, 1);
 	if (!node) {
 		return NULL;
 	}
 
 	struct trie_leaf *leaf = new_trie_leaf(key, length);
 	if (!leaf) {
-		free(node);
+		trie_node_free(trie, node);
 		return NULL;
 	}
 
@@ -553,22 +623,166 @@ struct trie_leaf *trie_insert_mem(struct trie *trie, const void *key, size_t len
 			ptr = &node->children[index];
 		} else {
 			assert(offset == mismatch);
-			return trie_node_insert(ptr, key, length, offset);
+			return trie_node_insert(trie, ptr, key, length, offset);
 		}
 	}
 
 	while (mismatch - offset > OFFSET_MAX) {
-		ptr = trie_jump(ptr, key, &offset);
+		ptr = trie_jump(trie, ptr, key, &offset);
 		if (!ptr) {
 			return NULL;
 		}
 	}
 
-	return trie_split(ptr, key, length, rep, offset, mismatch);
+	return trie_split(trie, ptr, key, length, rep, offset, mismatch);
+}
+
+/**
+ * A key to insert with trie_build().
+ */
+struct trie_build_key {
+	/** The key itself. */
+	const void *key;
+	/** The length of the key. */
+	size_t length;
+	/** The index of the key in the original array. */
+	size_t index;
+};
+
+/**
+ * Recursively build a subtrie from a range of keys.  The parent node is at
+ * offset, and the keys all agree on every nibble before start.
+ */
+static int trie_build_range(struct trie *trie, uintptr_t *ptr, struct trie_build_key *keys, struct trie_build_key *scratch, size_t nkeys, size_t offset, size_t start, struct trie_leaf **leaves) {
+	const struct trie_build_key *first = &keys[0];
+
+	// Find the first nibble where any key differs from the first one
+	const unsigned char *first_bytes = first->key;
+	size_t skip = start >> 1;
+	size_t mismatch = SIZE_MAX;
+	for (size_t i = 1; i < nkeys; ++i) {
+		const struct trie_build_key *other = &keys[i];
+		const unsigned char *other_bytes = other->key;
+		size_t limit = first->length < other->length ? first->length : other->length;
+		size_t m = trie_key_mismatch(first_bytes + skip, other_bytes + skip, limit - skip) + (skip << 1);
+		if ((m >> 1) < limit && m < mismatch) {
+			mismatch = m;
+			if (mismatch == start) {
+				// Can't do any better than this
+				break;
+			}
+		}
+	}
+
+	if (mismatch == SIZE_MAX) {
+		// All the keys are the same
+		struct trie_leaf *leaf = new_trie_leaf(first->key, first->length);
+		if (!leaf) {
+			return -1;
+		}
+		*ptr = trie_encode_leaf(leaf);
+
+		if (leaves) {
+			for (size_t i = 0; i < nkeys; ++i) {
+				leaves[keys[i].index] = leaf;
+			}
+		}
+		return 0;
+	}
+
+	while (mismatch - offset > OFFSET_MAX) {
+		struct trie_node *node = trie_node_alloc(trie, 0);
+		if (!node) {
+			return -1;
+		}
+
+		offset += OFFSET_MAX;
+		node->offset = OFFSET_MAX;
+		node->bitmap = 1 << trie_key_nibble(first->key, offset);
+		*ptr = trie_encode_node(node);
+		ptr = node->children;
+	}
+
+	// Counting sort the keys by their nibble at the mismatch
+	size_t counts[BITMAP_BITS] = {0};
+	for (size_t i = 0; i < nkeys; ++i) {
+		++counts[trie_key_nibble(keys[i].key, mismatch)];
+	}
+
+	size_t starts[BITMAP_BITS];
+	unsigned int bitmap = 0;
+	size_t total = 0;
+	for (unsigned int i = 0; i < BITMAP_BITS; ++i) {
+		starts[i] = total;
+		total += counts[i];
+		if (counts[i]) {
+			bitmap |= 1U << i;
+		}
+	}
+
+	for (size_t i = 0; i < nkeys; ++i) {
+		scratch[starts[trie_key_nibble(keys[i].key, mismatch)]++] = keys[i];
+	}
+	memcpy(keys, scratch, nkeys*sizeof(*keys));
+
+	unsigned int size = trie_popcount(bitmap);
+	struct trie_node *node = trie_node_alloc(trie, trie_order(size));
+	if (!node) {
+		return -1;
+	}
+	node->bitmap = bitmap;
+	node->offset = mismatch - offset;
+	*ptr = trie_encode_node(node);
+
+	// Initialize the children in case a recursive call fails
+	for (unsigned int i = 0; i < size; ++i) {
+		node->children[i] = 0;
+	}
+
+	uintptr_t *child = node->children;
+	for (unsigned int i = 0; i < BITMAP_BITS; ++i) {
+		if (counts[i]) {
+			size_t first_key = starts[i] - counts[i];
+			if (trie_build_range(trie, child, keys + first_key, scratch, counts[i], mismatch, mismatch + 1, leaves) != 0) {
+				return -1;
+			}
+			++child;
+		}
+	}
+
+	return 0;
+}
+
+int trie_build(struct trie *trie, const void *const *keys, const size_t *lengths, size_t nkeys, struct trie_leaf **leaves) {
+	assert(!trie->root);
+
+	if (nkeys == 0) {
+		return 0;
+	}
+
+	struct trie_build_key *array = malloc(2*nkeys*sizeof(*array));
+	if (!array) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < nkeys; ++i) {
+		array[i].key = keys[i];
+		array[i].length = lengths ? lengths[i] : strlen(keys[i]) + 1;
+		array[i].index = i;
+	}
+
+	int ret = trie_build_range(trie, &trie->root, array, array + nkeys, nkeys, 0, 0, leaves);
+	free(array);
+
+	if (ret != 0) {
+		trie_destroy(trie);
+		trie_init(trie);
+	}
+	return ret;
 }
 
 /** Free a chain of singleton nodes. */
-static void trie_free_singletons(uintptr_t ptr) {
+static void trie_free_singletons(struct trie *trie, uintptr_t ptr) {
 	while (!trie_is_leaf(ptr)) {
 		struct trie_node *node = trie_decode_node(ptr);
 
@@ -576,7 +790,7 @@ static void trie_free_singletons(uintptr_t ptr) {
 		assert((node->bitmap & (node->bitmap - 1)) == 0);
 
 		ptr = node->children[0];
-		free(node);
+		trie_node_free(trie, node);
 	}
 
 	free(trie_decode_leaf(ptr));
@@ -599,7 +813,7 @@ static void trie_free_singletons(uintptr_t ptr) {
  *       v
  *     other
  */
-static int trie_collapse_node(uintptr_t *parent, struct trie_node *parent_node, unsigned int child_index) {
+static int trie_collapse_node(struct trie *trie, uintptr_t *parent, struct trie_node *parent_node, unsigned int child_index) {
 	uintptr_t other = parent_node->children[child_index ^ 1];
 	if (!trie_is_leaf(other)) {
 		struct trie_node *other_node = trie_decode_node(other);
@@ -611,7 +825,7 @@ static int trie_collapse_node(uintptr_t *parent, struct trie_node *parent_node,
 	}
 
 	*parent = other;
-	free(parent_node);
+	trie_node_free(trie, parent_node);
 	return 0;
 }
 
@@ -644,19 +858,19 @@ void trie_remove(struct trie *trie, struct trie_leaf *leaf) {
 	assert(trie_decode_leaf(*child) == leaf);
 
 	if (!parent) {
-		trie_free_singletons(trie->root);
+		trie_free_singletons(trie, trie->root);
 		trie->root = 0;
 		return;
 	}
 
 	struct trie_node *node = trie_decode_node(*parent);
 	child = node->children + child_index;
-	trie_free_singletons(*child);
+	trie_free_singletons(trie, *child);
 
 	node->bitmap ^= child_bit;
 	unsigned int parent_size = trie_popcount(node->bitmap);
 	assert(parent_size > 0);
-	if (parent_size == 1 && trie_collapse_node(parent, node, child_index) == 0) {
+	if (parent_size == 1 && trie_collapse_node(trie, parent, node, child_index) == 0) {
 		return;
 	}
 
@@ -664,30 +878,37 @@ void trie_remove(struct trie *trie, struct trie_leaf *leaf) {
 		memmove(child, child + 1, (parent_size - child_index)*sizeof(*child));
 	}
 
-	if ((parent_size & (parent_size - 1)) == 0) {
-		node = realloc(node, trie_node_size(parent_size));
+	unsigned int order = trie_order(parent_size);
+	if (order < node->order) {
+		node = trie_node_resize(trie, node, order);
 		if (node) {
 			*parent = trie_encode_node(node);
 		}
 	}
 }
 
-/** Free an encoded pointer to a node. */
-static void free_trie_ptr(uintptr_t ptr) {
-	if (trie_is_leaf(ptr)) {
+/** Free the leaves under an encoded pointer. */
+static void trie_free_leaves(uintptr_t ptr) {
+	if (!ptr) {
+		// Left behind by a failed trie_build()
+		return;
+	} else if (trie_is_leaf(ptr)) {
 		free(trie_decode_leaf(ptr));
 	} else {
 		struct trie_node *node = trie_decode_node(ptr);
 		size_t size = trie_popcount(node->bitmap);
 		for (size_t i = 0; i < size; ++i) {
-			free_trie_ptr(node->children[i]);
+			trie_free_leaves(node->children[i]);
 		}
-		free(node);
 	}
 }
 
 void trie_destroy(struct trie *trie) {
 	if (trie->root) {
-		free_trie_ptr(trie->root);
+		trie_free_leaves(trie->root);
+		trie->root = 0;
 	}
+
+	// The nodes themselves are freed all at once
+	varena_destroy(&trie->nodes);
 }
@@ -17,6 +17,7 @@
 #ifndef BFS_TRIE_H
 #define BFS_TRIE_H
 
+#include "alloc.h"
 #include <stddef.h>
 #include <stdint.h>
 
@@ -24,7 +25,10 @@
  * A trie that holds a set of fixed- or variable-length strings.
  */
 struct trie {
+	/** The encoded root pointer. */
 	uintptr_t root;
+	/** The allocator for internal nodes. */
+	struct varena nodes;
 };
 
 /**
@@ -138,6 +142,27 @@ struct trie_leaf *trie_insert_str(struct trie *trie, const char *key);
  */
 struct trie_leaf *trie_insert_mem(struct trie *trie, const void *key, size_t length);
 
+/**
+ * Build a trie from a set of keys all at once.  This is faster than inserting
+ * them one at a time, and lays out each node at its final size.  As with
+ * trie_insert_mem(), no key may be a proper prefix of another.
+ *
+ * @param trie
+ *         The trie to build, which must be empty.
+ * @param keys
+ *         The keys to insert.
+ * @param lengths
+ *         The lengths of the keys in bytes, or NULL if they are all strings.
+ * @param nkeys
+ *         The number of keys.
+ * @param[out] leaves
+ *         If not NULL, filled in with the leaf for each key.  Duplicate keys
+ *         share the same leaf.
+ * @return
+ *         0 on success, or -1 on failure (leaving the trie empty).
+ */
+int trie_build(struct trie *trie, const void *const *keys, const size_t *lengths, size_t nkeys, struct trie_leaf **leaves);
+
 /**
  * Remove a leaf from a trie.
  *
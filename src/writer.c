@@ -0,0 +1,289 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+
+#include "writer.h"
+#include "util.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if __linux__ || __FreeBSD__
+#	define BFS_HAS_FOPENCOOKIE true
+#else
+#	define BFS_HAS_FOPENCOOKIE false
+#endif
+
+/** The size of the stdio buffer in front of the writer. */
+#define BFS_WRITER_BUFSIZ (64 * 1024)
+
+/** The size of the queue of data waiting to be written. */
+#define BFS_WRITER_QUEUE (1024 * 1024)
+
+struct bfs_writer {
+	/** Protects the rest of the fields. */
+	pthread_mutex_t mutex;
+	/** Signalled when data is queued, or the writer is stopping. */
+	pthread_cond_t queued;
+	/** Signalled when queued data has been written. */
+	pthread_cond_t written;
+
+	/** The ring buffer of queued data. */
+	char *queue;
+	/** The offset of the oldest queued byte. */
+	size_t head;
+	/** The number of queued bytes (including any being written right now). */
+	size_t len;
+
+	/** The first write error, if any. */
+	int error;
+	/** Whether the thread should exit once the queue is empty. */
+	bool stop;
+
+	/** The file descriptor to write to. */
+	int fd;
+	/** Whether to close fd at the end. */
+	bool close;
+	/** The stdio stream in front of the queue. */
+	FILE *file;
+	/** The writer thread. */
+	pthread_t thread;
+};
+
+FILE *bfs_writer_file(const struct bfs_writer *writer) {
+	return writer->file;
+}
+
+int bfs_writer_fd(const struct bfs_writer *writer) {
+	return writer->fd;
+}
+
+int bfs_writer_drain(struct bfs_writer *writer) {
+	pthread_mutex_lock(&writer->mutex);
+	while (writer->len > 0 && !writer->error) {
+		pthread_cond_wait(&writer->written, &writer->mutex);
+	}
+	int error = writer->error;
+	pthread_mutex_unlock(&writer->mutex);
+
+	if (error) {
+		errno = error;
+		return -1;
+	} else {
+		return 0;
+	}
+}
+
+#if BFS_HAS_FOPENCOOKIE
+
+/** The writer thread's main loop. */
+static void *bfs_writer_work(void *ptr) {
+	struct bfs_writer *writer = ptr;
+
+	pthread_mutex_lock(&writer->mutex);
+
+	while (true) {
+		while (writer->len == 0 && !writer->stop) {
+			pthread_cond_wait(&writer->queued, &writer->mutex);
+		}
+		if (writer->len == 0) {
+			break;
+		}
+
+		// The producer only appends after head + len, so the data we're
+		// writing stays put while we're unlocked
+		size_t head = writer->head;
+		size_t span = writer->len;
+		if (span > BFS_WRITER_QUEUE - head) {
+			span = BFS_WRITER_QUEUE - head;
+		}
+
+		pthread_mutex_unlock(&writer->mutex);
+		size_t nwritten = xwrite(writer->fd, writer->queue + head, span);
+		int error = errno;
+		pthread_mutex_lock(&writer->mutex);
+
+		if (nwritten == span) {
+			writer->head = (head + span) % BFS_WRITER_QUEUE;
+			writer->len -= span;
+		} else {
+			// Drop the rest of the output, like a failed fflush() would
+			writer->error = error ? error : EIO;
+			writer->head = 0;
+			writer->len = 0;
+		}
+
+		pthread_cond_broadcast(&writer->written);
+	}
+
+	pthread_mutex_unlock(&writer->mutex);
+	return NULL;
+}
+
+/** fopencookie() write function. */
+static ssize_t bfs_writer_write(void *cookie, const char *buf, size_t size) {
+	struct bfs_writer *writer = cookie;
+	size_t ret = 0;
+
+	pthread_mutex_lock(&writer->mutex);
+
+	while (ret < size) {
+		while (writer->len == BFS_WRITER_QUEUE && !writer->error) {
+			pthread_cond_wait(&writer->written, &writer->mutex);
+		}
+		if (writer->error) {
+			// The error will be reported by bfs_writer_drain(), so
+			// just drop the output rather than failing every write
+			ret = size;
+			break;
+		}
+
+		size_t tail = (writer->head + writer->len) % BFS_WRITER_QUEUE;
+		size_t n = BFS_WRITER_QUEUE - writer->len;
+		if (n > BFS_WRITER_QUEUE - tail) {
+			n = BFS_WRITER_QUEUE - tail;
+		}
+		if (n > size - ret) {
+			n = size - ret;
+		}
+
+		memcpy(writer->queue + tail, buf + ret, n);
+		writer->len += n;
+		ret += n;
+		pthread_cond_signal(&writer->queued);
+	}
+
+	pthread_mutex_unlock(&writer->mutex);
+	return ret;
+}
+
+/** Stop the thread and free the writer. */
+static int bfs_writer_destroy(struct bfs_writer *writer) {
+	pthread_mutex_lock(&writer->mutex);
+	writer->stop = true;
+	pthread_cond_signal(&writer->queued);
+	pthread_mutex_unlock(&writer->mutex);
+
+	pthread_join(writer->thread, NULL);
+
+	int ret = 0, error = writer->error;
+	if (error) {
+		ret = -1;
+	}
+
+	if (writer->close && xclose(writer->fd) != 0 && !error) {
+		ret = -1;
+		error = errno;
+	}
+
+	pthread_cond_destroy(&writer->written);
+	pthread_cond_destroy(&writer->queued);
+	pthread_mutex_destroy(&writer->mutex);
+	free(writer->queue);
+	free(writer);
+
+	errno = error;
+	return ret;
+}
+
+/** fopencookie() close function. */
+static int bfs_writer_close(void *cookie) {
+	return bfs_writer_destroy(cookie);
+}
+
+struct bfs_writer *bfs_writer_open(int fd, bool close) {
+	struct bfs_writer *writer = malloc(sizeof(*writer));
+	if (!writer) {
+		return NULL;
+	}
+
+	writer->queue = malloc(BFS_WRITER_QUEUE);
+	if (!writer->queue) {
+		goto fail;
+	}
+
+	writer->head = 0;
+	writer->len = 0;
+	writer->error = 0;
+	writer->stop = false;
+	writer->fd = fd;
+	writer->close = close;
+
+	int ret = pthread_mutex_init(&writer->mutex, NULL);
+	if (ret != 0) {
+		goto fail_queue;
+	}
+
+	ret = pthread_cond_init(&writer->queued, NULL);
+	if (ret != 0) {
+		goto fail_mutex;
+	}
+
+	ret = pthread_cond_init(&writer->written, NULL);
+	if (ret != 0) {
+		goto fail_queued;
+	}
+
+	ret = pthread_create(&writer->thread, NULL, bfs_writer_work, writer);
+	if (ret != 0) {
+		goto fail_written;
+	}
+
+	cookie_io_functions_t funcs = {
+		.write = bfs_writer_write,
+		.close = bfs_writer_close,
+	};
+	writer->file = fopencookie(writer, "w", funcs);
+	if (!writer->file) {
+		int error = errno;
+		writer->close = false;
+		bfs_writer_destroy(writer);
+		errno = error;
+		return NULL;
+	}
+
+	// Hand the writer big chunks at a time
+	setvbuf(writer->file, NULL, _IOFBF, BFS_WRITER_BUFSIZ);
+
+	return writer;
+
+fail_written:
+	pthread_cond_destroy(&writer->written);
+fail_queued:
+	pthread_cond_destroy(&writer->queued);
+fail_mutex:
+	pthread_mutex_destroy(&writer->mutex);
+fail_queue:
+	free(writer->queue);
+	errno = ret;
+fail:
+	free(writer);
+	return NULL;
+}
+
+#else // !BFS_HAS_FOPENCOOKIE
+
+struct bfs_writer *bfs_writer_open(int fd, bool close) {
+	errno = ENOTSUP;
+	return NULL;
+}
+
+#endif // !BFS_HAS_FOPENCOOKIE
@@ -0,0 +1,71 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+
+/**
+ * Background writer threads for output streams.
+ *
+ * A writer hands a stdio stream's output off to a dedicated thread, so that the
+ * main thread can keep searching while a slow consumer (like a pipe into
+ * another program) catches up.  Writes only block once a large queue fills up.
+ */
+
+#ifndef BFS_WRITER_H
+#define BFS_WRITER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * A background writer.
+ */
+struct bfs_writer;
+
+/**
+ * Start a background writer.
+ *
+ * @param fd
+ *         The file descriptor to write to.
+ * @param close
+ *         Whether to close fd when the stream is closed.
+ * @return
+ *         The new writer, or NULL on failure (ENOTSUP if this platform can't
+ *         create custom stdio streams).
+ */
+struct bfs_writer *bfs_writer_open(int fd, bool close);
+
+/**
+ * Get the stream that writes to a background writer.  Closing it with fclose()
+ * flushes everything, stops the thread, and frees the writer.
+ */
+FILE *bfs_writer_file(const struct bfs_writer *writer);
+
+/**
+ * Get the file descriptor a background writer writes to.
+ */
+int bfs_writer_fd(const struct bfs_writer *writer);
+
+/**
+ * Wait for everything queued so far to be written.  This does not flush the
+ * stdio buffer; call fflush() first.
+ *
+ * @return
+ *         0 on success, or -1 if any write has failed (with errno set to the
+ *         error from the write).
+ */
+int bfs_writer_drain(struct bfs_writer *writer);
+
+#endif // BFS_WRITER_H
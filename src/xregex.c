@@ -18,6 +18,7 @@
 #include "util.h"
 #include <assert.h>
 #include <errno.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -38,8 +39,351 @@ struct bfs_regex {
 	regex_t impl;
 	int err;
 #endif
+
+	/** Storage for the literals below. */
+	char *literals;
+	/** A literal that every match contains, or NULL. */
+	const char *infix;
+	size_t infix_len;
+	/** A literal that every whole-string match starts with, or NULL. */
+	const char *prefix;
+	size_t prefix_len;
+	/** A literal that every whole-string match ends with, or NULL. */
+	const char *suffix;
+	size_t suffix_len;
+	/** Whether the pattern is just the infix, possibly surrounded by .* */
+	bool pure;
+	/** Whether the pattern has a leading ^ or trailing $. */
+	bool anchored;
+};
+
+/**
+ * The kinds of top-level atoms in a regex, for literal extraction.
+ */
+enum regex_atom {
+	/** No atom (yet). */
+	REGEX_NONE,
+	/** A literal character, part of the current run. */
+	REGEX_LITERAL,
+	/** The sequence .* */
+	REGEX_DOTSTAR,
+	/** Anything else. */
+	REGEX_OTHER,
+};
+
+/**
+ * State for extracting literals from a regex.
+ */
+struct regex_scan {
+	/** The regex being analyzed. */
+	struct bfs_regex *regex;
+	/** The number of literal characters collected so far. */
+	size_t nliterals;
+	/** The start of the current run of literal characters. */
+	size_t run;
+	/** The previous top-level atom. */
+	enum regex_atom last;
+	/** The sequence of top-level atoms, as 'R'uns, 'D'otstars, and 'O'thers. */
+	char shape[4];
+	/** The length of the shape (possibly more than will fit). */
+	size_t nshape;
 };
 
+/** Record a top-level atom in the shape. */
+static void regex_scan_shape(struct regex_scan *scan, char atom) {
+	if (scan->nshape < sizeof(scan->shape)) {
+		scan->shape[scan->nshape] = atom;
+	}
+	++scan->nshape;
+}
+
+/** Finish the current run of literal characters, if any. */
+static void regex_scan_end_run(struct regex_scan *scan) {
+	struct bfs_regex *regex = scan->regex;
+	const char *run = regex->literals + scan->run;
+	size_t len = scan->nliterals - scan->run;
+
+	if (len > 0) {
+		if (scan->nshape == 0) {
+			regex->prefix = run;
+			regex->prefix_len = len;
+		}
+		if (len > regex->infix_len) {
+			regex->infix = run;
+			regex->infix_len = len;
+		}
+		regex_scan_shape(scan, 'R');
+	}
+
+	scan->run = scan->nliterals;
+}
+
+/** Add a top-level atom. */
+static void regex_scan_atom(struct regex_scan *scan, enum regex_atom atom, char c) {
+	if (atom == REGEX_LITERAL) {
+		scan->regex->literals[scan->nliterals++] = c;
+	} else {
+		regex_scan_end_run(scan);
+		if (atom == REGEX_DOTSTAR) {
+			regex_scan_shape(scan, 'D');
+		} else if (atom == REGEX_OTHER) {
+			regex_scan_shape(scan, 'O');
+		}
+	}
+	scan->last = atom;
+}
+
+/** Apply a quantifier to the previous top-level atom. */
+static void regex_scan_quantifier(struct regex_scan *scan) {
+	if (scan->last == REGEX_LITERAL) {
+		// The quantified character isn't required, so pull it out of the run
+		--scan->nliterals;
+	}
+	regex_scan_atom(scan, REGEX_OTHER, 0);
+}
+
+/** Get the length of the bracket expression at the start of a pattern, or 0 if it's malformed. */
+static size_t regex_bracket_len(const char *pattern) {
+	size_t i = 1;
+	if (pattern[i] == '^') {
+		++i;
+	}
+	if (pattern[i] == ']') {
+		++i;
+	}
+
+	while (pattern[i] != ']') {
+		if (!pattern[i]) {
+			return 0;
+		}
+
+		char delim = pattern[i + 1];
+		if (pattern[i] == '[' && (delim == ':' || delim == '.' || delim == '=')) {
+			const char *end = pattern + i + 2;
+			while (end[0] != delim || end[1] != ']') {
+				if (!end[0]) {
+					return 0;
+				}
+				++end;
+			}
+			i = end - pattern + 2;
+		} else {
+			++i;
+		}
+	}
+
+	return i + 1;
+}
+
+/** Get the length of a {m,n} interval's contents and closing brace, or 0 if it's malformed. */
+static size_t regex_interval_len(const char *pattern, bool extended) {
+	size_t i = 0;
+	while ((pattern[i] >= '0' && pattern[i] <= '9') || pattern[i] == ',') {
+		++i;
+	}
+	if (i == 0) {
+		return 0;
+	}
+
+	if (extended && pattern[i] == '}') {
+		return i + 1;
+	} else if (!extended && pattern[i] == '\\' && pattern[i + 1] == '}') {
+		return i + 2;
+	} else {
+		return 0;
+	}
+}
+
+/** Check if a regex token is a quantifier. */
+static bool regex_is_quantifier(const char *pattern, bool extended) {
+	switch (pattern[0]) {
+	case '*':
+		return true;
+	case '+':
+	case '?':
+	case '{':
+		return extended;
+	case '\\':
+		return !extended && (pattern[1] == '+' || pattern[1] == '?' || pattern[1] == '{');
+	default:
+		return false;
+	}
+}
+
+/**
+ * Extract literals from a POSIX basic or extended regex.  This errs on the
+ * side of caution: anything that isn't clearly a required literal character
+ * is treated as an opaque atom, and the whole analysis is abandoned for
+ * top-level alternations or anything malformed.
+ *
+ * @return
+ *         Whether the analysis succeeded.
+ */
+static bool regex_scan(struct regex_scan *scan, const char *pattern, bool extended) {
+	struct bfs_regex *regex = scan->regex;
+	size_t depth = 0;
+
+	for (size_t i = 0; pattern[i]; ++i) {
+		char c = pattern[i];
+		bool escaped = false;
+		if (c == '\\') {
+			c = pattern[++i];
+			if (!c) {
+				return false;
+			}
+			escaped = true;
+		}
+
+		// Operators that exist in this flavor
+		bool group_open = (c == '(') && (escaped != extended);
+		bool group_close = (c == ')') && (escaped != extended);
+		bool alternation = (c == '|') && (escaped != extended);
+		bool interval = (c == '{') && (escaped != extended);
+		bool quantifier = interval
+			|| (c == '*' && !escaped)
+			|| ((c == '+' || c == '?') && (escaped != extended));
+
+		if (group_open) {
+			if (depth++ == 0) {
+				regex_scan_atom(scan, REGEX_OTHER, 0);
+			}
+		} else if (group_close) {
+			if (depth == 0) {
+				return false;
+			}
+			--depth;
+		} else if (alternation) {
+			if (depth == 0) {
+				return false;
+			}
+		} else if (c == '[' && !escaped) {
+			size_t len = regex_bracket_len(pattern + i);
+			if (len == 0) {
+				return false;
+			}
+			i += len - 1;
+			if (depth == 0) {
+				regex_scan_atom(scan, REGEX_OTHER, 0);
+			}
+		} else if (quantifier) {
+			if (interval) {
+				size_t len = regex_interval_len(pattern + i + 1, extended);
+				if (len == 0) {
+					return false;
+				}
+				i += len;
+			}
+			if (depth == 0) {
+				regex_scan_quantifier(scan);
+			}
+		} else if (depth > 0) {
+			continue;
+		} else if (c == '^' && !escaped && i == 0) {
+			regex->anchored = true;
+		} else if (c == '$' && !escaped && !pattern[i + 1]) {
+			regex->anchored = true;
+		} else if (c == '.' && !escaped) {
+			if (pattern[i + 1] == '*' && !regex_is_quantifier(pattern + i + 2, extended)) {
+				regex_scan_atom(scan, REGEX_DOTSTAR, 0);
+				++i;
+			} else {
+				regex_scan_atom(scan, REGEX_OTHER, 0);
+			}
+		} else if ((unsigned char)c >= 0x80 || (c == '^' && !escaped) || (c == '$' && !escaped)) {
+			// Multi-byte characters and ambiguous anchors are opaque
+			regex_scan_atom(scan, REGEX_OTHER, 0);
+		} else if (escaped && !strchr(extended ? ".[]*^$\\+?(){}|" : ".[]*^$\\", c)) {
+			// Back-references, \w, \<, etc.
+			regex_scan_atom(scan, REGEX_OTHER, 0);
+		} else {
+			regex_scan_atom(scan, REGEX_LITERAL, c);
+		}
+	}
+
+	if (depth > 0) {
+		return false;
+	}
+
+	if (scan->nliterals > scan->run) {
+		regex->suffix = regex->literals + scan->run;
+		regex->suffix_len = scan->nliterals - scan->run;
+	}
+	regex_scan_end_run(scan);
+
+	return true;
+}
+
+/** Forget any extracted literals. */
+static void bfs_regex_clear_literals(struct bfs_regex *regex) {
+	free(regex->literals);
+	regex->literals = NULL;
+	regex->infix = NULL;
+	regex->infix_len = 0;
+	regex->prefix = NULL;
+	regex->prefix_len = 0;
+	regex->suffix = NULL;
+	regex->suffix_len = 0;
+	regex->pure = false;
+	regex->anchored = false;
+}
+
+/**
+ * Extract the literals from a regex, for rejecting non-matching strings early.
+ *
+ * @return
+ *         0 on success (even if nothing was extracted), -1 on failure.
+ */
+static int bfs_regex_literals(struct bfs_regex *regex, const char *pattern, enum bfs_regex_type type, enum bfs_regcomp_flags flags) {
+	regex->literals = NULL;
+	bfs_regex_clear_literals(regex);
+
+	if (flags & BFS_REGEX_ICASE) {
+		return 0;
+	}
+
+	bool extended;
+	switch (type) {
+	case BFS_REGEX_POSIX_BASIC:
+		extended = false;
+		break;
+	case BFS_REGEX_POSIX_EXTENDED:
+		extended = true;
+		break;
+	default:
+		return 0;
+	}
+
+	regex->literals = malloc(strlen(pattern) + 1);
+	if (!regex->literals) {
+		return -1;
+	}
+
+	struct regex_scan scan = {
+		.regex = regex,
+		.last = REGEX_NONE,
+	};
+
+	if (!regex_scan(&scan, pattern, extended)) {
+		bfs_regex_clear_literals(regex);
+		return 0;
+	}
+
+	if (scan.nshape <= sizeof(scan.shape)) {
+		const char *shape = scan.shape;
+		size_t n = scan.nshape;
+		if (n > 0 && shape[0] == 'D') {
+			++shape;
+			--n;
+		}
+		if (n > 0 && shape[n - 1] == 'D') {
+			--n;
+		}
+		regex->pure = n == 1 && shape[0] == 'R';
+	}
+
+	return 0;
+}
+
 #if BFS_WITH_ONIGURUMA
 /** Get (and initialize) the appropriate encoding for the current locale. */
 static int bfs_onig_encoding(OnigEncoding *penc) {
@@ -124,6 +468,10 @@ int bfs_regcomp(struct bfs_regex **preg, const char *pattern, enum bfs_regex_typ
 		return -1;
 	}
 
+	if (bfs_regex_literals(regex, pattern, type, flags) != 0) {
+		goto fail;
+	}
+
 #if BFS_WITH_ONIGURUMA
 	// onig_error_code_to_str() says
 	//
@@ -202,14 +550,67 @@ int bfs_regcomp(struct bfs_regex **preg, const char *pattern, enum bfs_regex_typ
 	return 0;
 
 fail:
+	free(regex->literals);
 	free(regex);
 	*preg = NULL;
 	return -1;
 }
 
+/** Check if . would match every character of a string. */
+static bool regex_is_plain(const char *str, size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		unsigned char c = str[i];
+		if (c >= 0x80 || c == '\n') {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Try to match a regex using only its literals.
+ *
+ * @return
+ *         1 for a match, 0 for no match, or -1 if the regex engine is needed.
+ */
+static int bfs_regex_literal_match(const struct bfs_regex *regex, const char *str, size_t len, enum bfs_regexec_flags flags) {
+	if (regex->infix && !memmem(str, len, regex->infix, regex->infix_len)) {
+		return 0;
+	}
+
+	if (flags & BFS_REGEX_ANCHOR) {
+		if (regex->prefix && (len < regex->prefix_len || memcmp(str, regex->prefix, regex->prefix_len) != 0)) {
+			return 0;
+		}
+
+		const char *end = str + len;
+		if (regex->suffix && (len < regex->suffix_len || memcmp(end - regex->suffix_len, regex->suffix, regex->suffix_len) != 0)) {
+			return 0;
+		}
+
+		if (regex->pure) {
+			if (regex->prefix && regex->suffix) {
+				// No .* on either side, so the string must be exactly the literal
+				return len == regex->infix_len;
+			} else if (regex_is_plain(str, len)) {
+				return 1;
+			}
+		}
+	} else if (regex->pure && !regex->anchored) {
+		return 1;
+	}
+
+	return -1;
+}
+
 int bfs_regexec(struct bfs_regex *regex, const char *str, enum bfs_regexec_flags flags) {
 	size_t len = strlen(str);
 
+	int literal = bfs_regex_literal_match(regex, str, len, flags);
+	if (literal >= 0) {
+		return literal;
+	}
+
 #if BFS_WITH_ONIGURUMA
 	const unsigned char *ustr = (const unsigned char *)str;
 	const unsigned char *end = ustr + len;
@@ -275,6 +676,7 @@ void bfs_regfree(struct bfs_regex *regex) {
 #else
 		regfree(&regex->impl);
 #endif
+		free(regex->literals);
 		free(regex);
 	}
 }
@@ -18,6 +18,9 @@
 #include "util.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -141,86 +144,91 @@ int bfs_spawn_addsetrlimit(struct bfs_spawn *ctx, int resource, const struct rli
 	}
 }
 
-/** Actually exec() the new process. */
-static void bfs_spawn_exec(const char *exe, const struct bfs_spawn *ctx, char **argv, char **envp, int pipefd[2]) {
-	int error;
-	const struct bfs_spawn_action *actions = ctx ? ctx->actions : NULL;
+/**
+ * Whether to spawn processes with vfork() when posix_spawn() can't be used.
+ * Linux's vfork() suspends only the calling thread and gives the child its own
+ * signal dispositions, which is all we rely on.
+ */
+#if __linux__
+#	define BFS_USE_VFORK true
+#else
+#	define BFS_USE_VFORK false
+#endif
 
-	xclose(pipefd[0]);
+/**
+ * Whether posix_spawn() reports exec() failures synchronously, so we can use it
+ * without changing our error reporting.  glibc does as of 2.24.
+ */
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 24)
+#	define BFS_USE_POSIX_SPAWN true
+#	include <spawn.h>
+#else
+#	define BFS_USE_POSIX_SPAWN false
+#endif
+
+/**
+ * Perform the spawn actions and exec() the new process, from the child.
+ *
+ * @param errfd
+ *         The write end of the error-reporting pipe, which will be moved out of
+ *         the way if necessary, or NULL if there isn't one.
+ * @return
+ *         The error that occurred (this function doesn't return on success).
+ */
+static int bfs_spawn_exec(const char *exe, const struct bfs_spawn *ctx, char **argv, char **envp, int *errfd) {
+	const struct bfs_spawn_action *actions = ctx ? ctx->actions : NULL;
 
 	for (const struct bfs_spawn_action *action = actions; action; action = action->next) {
-		// Move the error-reporting pipe out of the way if necessary...
-		if (action->out_fd == pipefd[1]) {
-			int fd = dup_cloexec(pipefd[1]);
-			if (fd < 0) {
-				goto fail;
+		if (errfd) {
+			// Move the error-reporting pipe out of the way if necessary...
+			if (action->out_fd == *errfd) {
+				int fd = dup_cloexec(*errfd);
+				if (fd < 0) {
+					return errno;
+				}
+				xclose(*errfd);
+				*errfd = fd;
 			}
-			xclose(pipefd[1]);
-			pipefd[1] = fd;
-		}
 
-		// ... and pretend the pipe doesn't exist
-		if (action->in_fd == pipefd[1]) {
-			errno = EBADF;
-			goto fail;
+			// ... and pretend the pipe doesn't exist
+			if (action->in_fd == *errfd) {
+				return EBADF;
+			}
 		}
 
 		switch (action->op) {
 		case BFS_SPAWN_CLOSE:
 			if (close(action->out_fd) != 0) {
-				goto fail;
+				return errno;
 			}
 			break;
 		case BFS_SPAWN_DUP2:
 			if (dup2(action->in_fd, action->out_fd) < 0) {
-				goto fail;
+				return errno;
 			}
 			break;
 		case BFS_SPAWN_FCHDIR:
 			if (fchdir(action->in_fd) != 0) {
-				goto fail;
+				return errno;
 			}
 			break;
 		case BFS_SPAWN_SETRLIMIT:
 			if (setrlimit(action->resource, &action->rlimit) != 0) {
-				goto fail;
+				return errno;
 			}
 			break;
 		}
 	}
 
 	execve(exe, argv, envp);
-
-fail:
-	error = errno;
-
-	// In case of a write error, the parent will still see that we exited
-	// unsuccessfully, but won't know why
-	(void) xwrite(pipefd[1], &error, sizeof(error));
-
-	xclose(pipefd[1]);
-	_Exit(127);
+	return errno;
 }
 
-pid_t bfs_spawn(const char *exe, const struct bfs_spawn *ctx, char **argv, char **envp) {
-	extern char **environ;
-	if (!envp) {
-		envp = environ;
-	}
-
-	enum bfs_spawn_flags flags = ctx ? ctx->flags : 0;
-	char *resolved = NULL;
-	if (flags & BFS_SPAWN_USEPATH) {
-		exe = resolved = bfs_spawn_resolve(exe);
-		if (!resolved) {
-			return -1;
-		}
-	}
-
+/** Spawn a process with fork(), reporting errors through a pipe. */
+static pid_t bfs_fork_spawn(const char *exe, const struct bfs_spawn *ctx, char **argv, char **envp) {
 	// Use a pipe to report errors from the child
 	int pipefd[2];
 	if (pipe_cloexec(pipefd) != 0) {
-		free(resolved);
 		return -1;
 	}
 
@@ -228,16 +236,23 @@ pid_t bfs_spawn(const char *exe, const struct bfs_spawn *ctx, char **argv, char
 	if (pid < 0) {
 		close_quietly(pipefd[1]);
 		close_quietly(pipefd[0]);
-		free(resolved);
 		return -1;
 	} else if (pid == 0) {
 		// Child
-		bfs_spawn_exec(exe, ctx, argv, envp, pipefd);
+		xclose(pipefd[0]);
+
+		int error = bfs_spawn_exec(exe, ctx, argv, envp, &pipefd[1]);
+
+		// In case of a write error, the parent will still see that we exited
+		// unsuccessfully, but won't know why
+		(void) xwrite(pipefd[1], &error, sizeof(error));
+
+		xclose(pipefd[1]);
+		_Exit(127);
 	}
 
 	// Parent
 	xclose(pipefd[1]);
-	free(resolved);
 
 	int error;
 	ssize_t nbytes = xread(pipefd[0], &error, sizeof(error));
@@ -252,6 +267,162 @@ pid_t bfs_spawn(const char *exe, const struct bfs_spawn *ctx, char **argv, char
 	return pid;
 }
 
+#if BFS_USE_VFORK
+
+/** Reset any caught signals to their default dispositions, from the child. */
+static void bfs_vfork_reset_signals(void) {
+	for (int sig = 1; sig < NSIG; ++sig) {
+		struct sigaction sa;
+		if (sigaction(sig, NULL, &sa) != 0) {
+			continue;
+		}
+
+		if (sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN) {
+			sa.sa_handler = SIG_DFL;
+			sa.sa_flags = 0;
+			sigaction(sig, &sa, NULL);
+		}
+	}
+}
+
+/**
+ * Spawn a process with vfork(), which avoids copying our page tables.  The
+ * child borrows our memory until it calls exec(), so it can report errors by
+ * simply storing them.
+ */
+static pid_t bfs_vfork_spawn(const char *exe, const struct bfs_spawn *ctx, char **argv, char **envp) {
+	// Block all signals, so our handlers never run in the child while it's
+	// sharing our memory
+	sigset_t new_mask, old_mask;
+	sigfillset(&new_mask);
+	int error = pthread_sigmask(SIG_SETMASK, &new_mask, &old_mask);
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+
+	volatile int child_error = 0;
+
+	pid_t pid = vfork();
+	if (pid == 0) {
+		// Child
+		bfs_vfork_reset_signals();
+		pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+		child_error = bfs_spawn_exec(exe, ctx, argv, envp, NULL);
+		_exit(127);
+	}
+
+	// Parent
+	error = pid < 0 ? errno : child_error;
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+	if (error != 0) {
+		if (pid > 0) {
+			int wstatus;
+			waitpid(pid, &wstatus, 0);
+		}
+		errno = error;
+		return -1;
+	}
+
+	return pid;
+}
+
+#endif // BFS_USE_VFORK
+
+#if BFS_USE_POSIX_SPAWN
+
+/** Check if posix_spawn() supports all the actions. */
+static bool bfs_posix_spawn_supported(const struct bfs_spawn *ctx) {
+	for (const struct bfs_spawn_action *action = ctx ? ctx->actions : NULL; action; action = action->next) {
+		switch (action->op) {
+		case BFS_SPAWN_CLOSE:
+		case BFS_SPAWN_DUP2:
+			break;
+		case BFS_SPAWN_FCHDIR:
+		case BFS_SPAWN_SETRLIMIT:
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Spawn a process with posix_spawn(). */
+static pid_t bfs_posix_spawn(const char *exe, const struct bfs_spawn *ctx, char **argv, char **envp) {
+	posix_spawn_file_actions_t actions;
+	int error = posix_spawn_file_actions_init(&actions);
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+
+	for (const struct bfs_spawn_action *action = ctx ? ctx->actions : NULL; action; action = action->next) {
+		if (action->op == BFS_SPAWN_CLOSE) {
+			error = posix_spawn_file_actions_addclose(&actions, action->out_fd);
+		} else {
+			error = posix_spawn_file_actions_adddup2(&actions, action->in_fd, action->out_fd);
+		}
+		if (error != 0) {
+			goto out;
+		}
+	}
+
+	pid_t pid;
+	error = posix_spawn(&pid, exe, &actions, NULL, argv, envp);
+
+out:
+	posix_spawn_file_actions_destroy(&actions);
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+	return pid;
+}
+
+#endif // BFS_USE_POSIX_SPAWN
+
+/** Spawn a process the fastest way that supports the requested actions. */
+static pid_t bfs_spawn_impl(const char *exe, const struct bfs_spawn *ctx, char **argv, char **envp) {
+	enum bfs_spawn_flags flags = ctx ? ctx->flags : 0;
+
+	if (!(flags & BFS_SPAWN_FORK)) {
+#if BFS_USE_POSIX_SPAWN
+		if (bfs_posix_spawn_supported(ctx)) {
+			return bfs_posix_spawn(exe, ctx, argv, envp);
+		}
+#endif
+
+#if BFS_USE_VFORK
+		return bfs_vfork_spawn(exe, ctx, argv, envp);
+#endif
+	}
+
+	return bfs_fork_spawn(exe, ctx, argv, envp);
+}
+
+pid_t bfs_spawn(const char *exe, const struct bfs_spawn *ctx, char **argv, char **envp) {
+	extern char **environ;
+	if (!envp) {
+		envp = environ;
+	}
+
+	enum bfs_spawn_flags flags = ctx ? ctx->flags : 0;
+	char *resolved = NULL;
+	if (flags & BFS_SPAWN_USEPATH) {
+		exe = resolved = bfs_spawn_resolve(exe);
+		if (!resolved) {
+			return -1;
+		}
+	}
+
+	pid_t pid = bfs_spawn_impl(exe, ctx, argv, envp);
+	int error = errno;
+	free(resolved);
+	errno = error;
+	return pid;
+}
+
 char *bfs_spawn_resolve(const char *exe) {
 	if (strchr(exe, '/')) {
 		return strdup(exe);
@@ -30,6 +30,8 @@
 enum bfs_spawn_flags {
 	/** Use the PATH variable to resolve the executable (like execvp()). */
 	BFS_SPAWN_USEPATH = 1 << 0,
+	/** Always use fork(), rather than a faster method like vfork(). */
+	BFS_SPAWN_FORK    = 1 << 1,
 };
 
 /**
@@ -91,7 +93,9 @@ int bfs_spawn_addfchdir(struct bfs_spawn *ctx, int fd);
 int bfs_spawn_addsetrlimit(struct bfs_spawn *ctx, int resource, const struct rlimit *rl);
 
 /**
- * Spawn a new process.
+ * Spawn a new process.  Uses posix_spawn() or vfork() where possible, to avoid
+ * the cost of fork() copying our page tables.  Errors from exec() in the child
+ * are still reported synchronously.
  *
  * @param exe
  *         The executable to run.
@@ -24,6 +24,69 @@
 /** Whether tzset() has been called. */
 static bool tz_is_set = false;
 
+/**
+ * A span of time over which the local UTC offset is known to be constant, so
+ * xlocaltime() can convert times inside it with plain arithmetic instead of
+ * going through the time zone rules every time.
+ */
+static struct {
+	/** Whether the span is valid. */
+	bool valid;
+	/** The first time in the span. */
+	time_t min;
+	/** The last time in the span. */
+	time_t max;
+	/** The offset from UTC, in seconds. */
+	long long offset;
+	/** A localtime_r() result from the span, for tm_isdst and friends. */
+	struct tm tm;
+} tz_span;
+
+/** Break down a number of seconds since the epoch, without any time zone. */
+static void civil_time(long long time, struct tm *tm) {
+	long long days = time / 86400;
+	long long secs = time % 86400;
+	if (secs < 0) {
+		secs += 86400;
+		--days;
+	}
+
+	tm->tm_hour = secs / 3600;
+	tm->tm_min = secs / 60 % 60;
+	tm->tm_sec = secs % 60;
+
+	tm->tm_wday = (days + 4) % 7;
+	if (tm->tm_wday < 0) {
+		tm->tm_wday += 7;
+	}
+
+	// Count years from March 1st, so leap days come at the end
+	// (see https://howardhinnant.github.io/date_algorithms.html)
+	long long z = days + 719468;
+	long long era = (z >= 0 ? z : z - 146096) / 146097;
+	long long doe = z - era * 146097;
+	long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	long long mp = (5 * doy + 2) / 153;
+	long long year = yoe + era * 400;
+
+	int mday = doy - (153 * mp + 2) / 5 + 1;
+	int mon = mp < 10 ? mp + 2 : mp - 10;
+	int yday;
+	if (mon < 2) {
+		++year;
+		yday = doy - 306;
+	} else {
+		bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+		yday = doy + 59 + leap;
+	}
+
+	tm->tm_year = year - 1900;
+	tm->tm_mon = mon;
+	tm->tm_mday = mday;
+	tm->tm_yday = yday;
+}
+
 int xlocaltime(const time_t *timep, struct tm *result) {
 	// Should be called before localtime_r() according to POSIX.1-2004
 	if (!tz_is_set) {
@@ -31,11 +94,46 @@ int xlocaltime(const time_t *timep, struct tm *result) {
 		tz_is_set = true;
 	}
 
-	if (localtime_r(timep, result)) {
+	time_t time = *timep;
+	if (tz_span.valid && time >= tz_span.min && time <= tz_span.max) {
+		*result = tz_span.tm;
+		civil_time((long long)time + tz_span.offset, result);
 		return 0;
-	} else {
+	}
+
+	if (!localtime_r(timep, result)) {
 		return -1;
 	}
+
+	struct tm tmp = *result;
+	time_t local;
+	if (xtimegm(&tmp, &local) != 0) {
+		return 0;
+	}
+	long long offset = (long long)local - (long long)time;
+
+	// Time zone transitions are months apart, so if we see the same offset
+	// within a day of the span, it must hold in between too
+	const time_t day = 24 * 60 * 60;
+	if (tz_span.valid
+	    && offset == tz_span.offset
+	    && result->tm_isdst == tz_span.tm.tm_isdst
+	    && time >= tz_span.min - day
+	    && time <= tz_span.max + day) {
+		if (time < tz_span.min) {
+			tz_span.min = time;
+		} else {
+			tz_span.max = time;
+		}
+	} else {
+		tz_span.valid = true;
+		tz_span.min = time;
+		tz_span.max = time;
+		tz_span.offset = offset;
+		tz_span.tm = *result;
+	}
+
+	return 0;
 }
 
 int xgmtime(const time_t *timep, struct tm *result) {
@@ -240,6 +240,8 @@ posix_tests=(
     test_name_bracket
     test_name_backslash
     test_name_double_backslash
+    test_name_or
+    test_name_or_root
 
     test_newer
     test_newer_link
@@ -279,6 +281,7 @@ posix_tests=(
 
     test_type_d
     test_type_f
+    test_type_f_name
     test_type_l
     test_H_type_l
     test_L_type_l
@@ -373,6 +376,7 @@ bsd_tests=(
     test_L_ilname
 
     test_iname
+    test_iname_or
 
     test_inum
 
@@ -492,6 +496,8 @@ gnu_tests=(
 
     test_empty
     test_empty_special
+    test_empty_depth
+    test_empty_delete
 
     test_exec_nothing
     test_exec_substring
@@ -616,6 +622,11 @@ gnu_tests=(
     test_printf_u_g_ulimit
     test_printf_l_nonlink
 
+    test_printj
+    test_printj_escapes
+    test_fprintj
+    test_printb
+
     test_quit
     test_quit_child
     test_quit_depth
@@ -692,16 +703,48 @@ bfs_tests=(
 
     test_D_multi
     test_D_all
+    test_D_prof
+    test_D_startup
 
     test_O0
     test_O1
     test_O2
     test_O3
+    test_O4_adaptive
     test_Ofast
+    test_factor
+    test_memo
+    test_memo_regextype
+    test_flatten
 
     test_S_bfs
     test_S_dfs
     test_S_ids
+    test_S_ids_opens
+
+    test_j
+    test_j_space
+    test_j_huge
+    test_j_invalid
+    test_j_stat
+    test_opt_profile
+    test_queue_limit
+    test_queue_limit_s
+    test_readdir_buffer
+    test_readdir_buffer_invalid
+    test_limit
+    test_limit_big
+    test_limit_zero
+    test_top
+    test_top_mtime
+    test_top_by_invalid
+    test_summarize
+    test_summarize_depth
+    test_summarize_unique
+    test_summarize_invalid
+    test_snapshot
+    test_snapshot_check
+    test_snapshot_save
 
     # Special forms
 
@@ -713,6 +756,17 @@ bfs_tests=(
 
     # Primaries
 
+    test_chmod
+    test_chmod_symbolic
+    test_chmod_X
+    test_chmod_copy
+    test_chmod_equals_umask
+    test_chmod_dir_setid
+    test_chmod_invalid
+
+    test_chown
+    test_chown_invalid
+
     test_color
     test_color_L
     test_color_rs_lc_rc_ec
@@ -748,11 +802,31 @@ bfs_tests=(
     test_color_star
     test_color_ls
 
+    test_copy_to
+    test_copy_to_self
+    test_copy_to_symlink
+    test_copy_to_missing
+
     test_exec_flush_fprint
     test_exec_flush_fprint_fail
 
     test_execdir_plus
 
+    test_delete_jobs
+    test_delete_jobs_nested
+    test_delete_jobs_zero
+
+    test_exec_jobs
+    test_exec_jobs_execdir
+    test_exec_jobs_status
+    test_exec_jobs_zero
+
+    test_pipe_to
+    test_pipe_to_jobs
+    test_pipe_to_status
+    test_pipe_to_early_exit
+    test_pipe_to_brace
+
     test_fprint_duplicate_stdout
     test_fprint_error_stdout
     test_fprint_error_stderr
@@ -789,10 +863,25 @@ bfs_tests=(
     test_printf_must_be_numeric
     test_printf_color
 
+    test_root_jobs
+    test_root_jobs_order
+    test_root_jobs_exec
+    test_root_jobs_zero
+
+    test_shard
+    test_shard_depth
+    test_shard_slash
+    test_shard_invalid
+
+    test_touch
+
+    test_assume_dir_mtime
+
     test_type_multi
 
     test_unique
     test_unique_depth
+    test_unique_depth_hardlink
     test_L_unique
     test_L_unique_loops
     test_L_unique_depth
@@ -1233,6 +1322,12 @@ function test_type_f() {
     bfs_diff basic -type f
 }
 
+function test_type_f_name() {
+    # Files that fail the leading pure tests are skipped, but their
+    # directories must still be searched
+    bfs_diff basic -type f -name 'ba*'
+}
+
 function test_type_l() {
     bfs_diff links/skip -type l
 }
@@ -1345,6 +1440,14 @@ function test_name_double_backslash() {
     bfs_diff weirdnames -name '\\'
 }
 
+function test_name_or() {
+    bfs_diff basic -name a -o -name 'f*' -o -name '*z' -o -name '[hi]' -o -name 'b*r'
+}
+
+function test_name_or_root() {
+    bfs_diff basic/g/ -name g -o -name h
+}
+
 function test_path() {
     bfs_diff basic -path 'basic/*f*'
 }
@@ -1381,6 +1484,19 @@ function test_empty_special() {
     bfs_diff rainbow -empty
 }
 
+function test_empty_depth() {
+    bfs_diff basic -depth -empty
+}
+
+function test_empty_delete() {
+    rm -rf scratch/*
+    mkdir -p scratch/foo/bar/baz
+
+    # Deleting baz empties bar, and so on
+    invoke_bfs scratch/foo -empty -delete
+    bfs_diff scratch
+}
+
 function test_gid() {
     bfs_diff basic -gid "$(id -g)"
 }
@@ -1615,6 +1731,11 @@ function test_iname() {
     bfs_diff basic -iname '*F*'
 }
 
+function test_iname_or() {
+    skip_if fail quiet invoke_bfs -quit -iname PATTERN
+    bfs_diff basic -iname A -o -iname '*Z' -o -iname 'F*'
+}
+
 function test_ipath() {
     skip_if fail quiet invoke_bfs -quit -ipath PATTERN
     bfs_diff basic -ipath 'basic/*F*'
@@ -1793,6 +1914,49 @@ function test_execdir_plus() {
     bfs_diff basic -execdir "$TESTS/sort-args.sh" {} +
 }
 
+function test_exec_jobs() {
+    bfs_diff basic -exec-jobs 4 -exec "$TESTS/sort-args.sh" {} +
+}
+
+function test_exec_jobs_execdir() {
+    # -execdir flushes once per directory, so several commands can overlap
+    local tree=$(invoke_bfs -D tree 2>&1 -quit)
+    skip_if eval '[[ "$tree" == *"-S dfs"* ]]'
+    bfs_diff basic -exec-jobs 4 -execdir "$TESTS/sort-args.sh" {} +
+}
+
+function test_exec_jobs_status() {
+    # Failures of background commands should still be reported in the exit status
+    bfs_diff basic -exec-jobs 4 -execdir false {} + -print
+    (($? == EX_BFS))
+}
+
+function test_exec_jobs_zero() {
+    fail quiet invoke_bfs basic -exec-jobs 0 -exec echo {} +
+}
+
+function test_pipe_to() {
+    bfs_diff basic -pipe-to tr '\0' '\n' \;
+}
+
+function test_pipe_to_jobs() {
+    bfs_diff basic -exec-jobs 4 -pipe-to tr '\0' '\n' \;
+}
+
+function test_pipe_to_status() {
+    bfs_diff basic -pipe-to false \; -print
+    (($? == EX_BFS))
+}
+
+function test_pipe_to_early_exit() {
+    # A command that stops reading early shouldn't kill us with SIGPIPE
+    invoke_bfs basic -pipe-to true \; -print >/dev/null
+}
+
+function test_pipe_to_brace() {
+    fail quiet invoke_bfs basic -pipe-to echo {} \;
+}
+
 function test_execdir_substring() {
     bfs_diff basic -execdir echo '-{}-' \;
 }
@@ -2079,6 +2243,179 @@ function test_okdir_plus_semicolon() {
     yes | quiet bfs_diff basic -okdir echo {} + \;
 }
 
+function test_chmod() {
+    rm -rf scratch/*
+    touchp scratch/foo/bar scratch/baz
+    chmod 600 scratch/foo/bar scratch/baz
+
+    invoke_bfs scratch -type f -chmod 640
+    bfs_diff scratch -perm 640
+}
+
+function test_chmod_symbolic() {
+    rm -rf scratch/*
+    touchp scratch/foo/bar scratch/baz
+    chmod 644 scratch/foo/bar scratch/baz
+
+    # 644 -> 744 -> 774 -> 770
+    invoke_bfs scratch -type f -chmod u+x,g=u,o-r
+    bfs_diff scratch -perm 770
+}
+
+function test_chmod_X() {
+    rm -rf scratch/*
+    touchp scratch/foo/bar scratch/baz
+    chmod 600 scratch/foo/bar scratch/baz
+    chmod 700 scratch scratch/foo
+
+    # Only directories (and files that were already executable) get X
+    invoke_bfs scratch -chmod go+X
+    bfs_diff scratch -perm 711
+}
+
+function test_chmod_copy() {
+    rm -rf scratch/*
+    touchp scratch/foo scratch/bar
+    chmod 640 scratch/foo scratch/bar
+
+    invoke_bfs scratch -type f -chmod o=g
+    bfs_diff scratch -perm 644
+}
+
+function test_chmod_equals_umask() {
+    rm -rf scratch/*
+    touchp scratch/foo
+    chmod 2770 scratch/foo
+
+    # Without a WHO, = clears every bit, then sets the ones outside the umask
+    (umask 022 && invoke_bfs scratch/foo -chmod =r)
+    bfs_diff scratch -type f -printf '%p %m\n'
+}
+
+function test_chmod_dir_setid() {
+    rm -rf scratch/*
+    mkdir scratch/{octal,copy,clear,cond,list,long}
+    chmod 2755 scratch/*
+
+    # Like chmod(1), directories keep setuid/setgid unless they're named
+    invoke_bfs scratch/octal -chmod 4755
+    invoke_bfs scratch/copy -chmod g=u
+    invoke_bfs scratch/clear -chmod go=
+    invoke_bfs scratch/cond -chmod a=rX
+    invoke_bfs scratch/list -chmod u=rwx,g=rx,o=
+    invoke_bfs scratch/long -chmod 00755
+    bfs_diff scratch -mindepth 1 -printf '%p %m\n'
+}
+
+function test_chmod_invalid() {
+    fail quiet invoke_bfs basic -chmod u+q
+}
+
+function test_chown() {
+    rm -rf scratch/*
+    touchp scratch/foo/bar
+
+    # We can always "change" a file to our own user and group
+    invoke_bfs scratch -chown "$(id -u):$(id -g)"
+    bfs_diff scratch -user "$(id -u)" -group "$(id -g)"
+}
+
+function test_chown_invalid() {
+    fail quiet invoke_bfs basic -chown :
+}
+
+function test_copy_to() {
+    rm -rf scratch/*
+    touchp scratch/src/foo scratch/src/bar/baz
+    echo hello >scratch/src/foo
+    mkdir scratch/dst
+
+    invoke_bfs scratch/src -type f -copy-to scratch/dst
+    cmp -s scratch/src/foo scratch/dst/foo || return 1
+    bfs_diff scratch/dst
+}
+
+function test_copy_to_self() {
+    rm -rf scratch/*
+    echo hello >scratch/foo
+
+    # Copying a file onto itself must not truncate it
+    fail quiet invoke_bfs scratch -type f -copy-to scratch
+    [ "$(cat scratch/foo)" = hello ]
+}
+
+function test_copy_to_symlink() {
+    rm -rf scratch/*
+    mkdir scratch/src scratch/dst
+    echo hello >scratch/src/foo
+    echo world >scratch/target
+    ln -s ../target scratch/dst/foo
+
+    # The destination must not be written through a symbolic link
+    fail quiet invoke_bfs scratch/src -type f -copy-to scratch/dst
+    [ "$(cat scratch/target)" = world ]
+}
+
+function test_copy_to_missing() {
+    fail quiet invoke_bfs basic -copy-to basic/nonexistent
+}
+
+function test_root_jobs() {
+    bfs_diff basic links loops -root-jobs 2
+}
+
+function test_root_jobs_order() {
+    # Each root's output should come out together, in order
+    diff -u <(invoke_bfs basic; invoke_bfs links; invoke_bfs loops) <(invoke_bfs basic links loops -root-jobs 2)
+}
+
+function test_root_jobs_exec() {
+    # Commands run for each root should write to that root's output
+    diff -u \
+        <(invoke_bfs basic -exec echo {} \;; invoke_bfs links -exec echo {} \;; invoke_bfs loops -exec echo {} \;) \
+        <(invoke_bfs basic links loops -root-jobs 3 -exec echo {} \;)
+}
+
+function test_root_jobs_zero() {
+    fail quiet invoke_bfs basic links -root-jobs 0
+}
+
+function test_shard() {
+    # Together, the shards should visit every file exactly once
+    diff -u <(invoke_bfs basic | sort) <(for k in 1 2 3; do invoke_bfs basic -shard $k/3; done | sort)
+}
+
+function test_shard_slash() {
+    # A trailing slash on the root shouldn't change the split
+    diff -u <(invoke_bfs basic -shard 1/2 | sort) <(invoke_bfs basic/ -shard 1/2 | sed 's|^basic/$|basic|' | sort)
+}
+
+function test_shard_depth() {
+    diff -u <(invoke_bfs basic links | sort) <(for k in 1 2; do invoke_bfs basic links -shard $k/2 -shard-depth 2; done | sort)
+}
+
+function test_shard_invalid() {
+    fail quiet invoke_bfs basic -shard 4/3
+}
+
+function test_touch() {
+    rm -rf scratch/*
+    touchp scratch/foo/bar scratch/baz
+    touch -t 199112140000 scratch/foo/bar scratch/baz
+
+    invoke_bfs scratch -name bar -touch
+    bfs_diff scratch -type f -newermt 2000-01-01
+}
+
+function test_assume_dir_mtime() {
+    rm -rf scratch/*
+    touchp scratch/old/new scratch/new/new scratch/new/old
+    touch -t 199112140000 scratch/old scratch/new/old
+
+    # scratch/old/new is skipped, since scratch/old is too old to contain it
+    bfs_diff scratch -assume-dir-mtime -newermt 2000-01-01
+}
+
 function test_delete() {
     rm -rf scratch/*
     touchp scratch/foo/bar/baz
@@ -2100,6 +2437,28 @@ function test_delete_many() {
     bfs_diff scratch
 }
 
+function test_delete_jobs() {
+    rm -rf scratch/*
+    mkdir -p scratch/foo/{a,b/c}
+    $TOUCH scratch/foo/{1..64} scratch/foo/a/{1..64} scratch/foo/b/c/{1..64}
+
+    invoke_bfs scratch/foo -delete-jobs 4 -delete
+    bfs_diff scratch
+}
+
+function test_delete_jobs_nested() {
+    rm -rf scratch/*
+    mkdir -p scratch/foo/a/b/c/d scratch/foo/e/f
+    $TOUCH scratch/foo/{1..16} scratch/foo/a/b/{1..16} scratch/foo/a/b/c/d/{1..16} scratch/foo/e/f/{1..16}
+
+    invoke_bfs scratch/foo -delete-jobs 4 -delete
+    bfs_diff scratch
+}
+
+function test_delete_jobs_zero() {
+    fail quiet invoke_bfs scratch -delete-jobs 0 -delete
+}
+
 function test_L_delete() {
     rm -rf scratch/*
     mkdir scratch/foo
@@ -2430,6 +2789,47 @@ function test_printf_l_nonlink() {
     bfs_diff links -printf '| %26p -> %-26l |\n'
 }
 
+function test_printj() {
+    rm -rf scratch/*
+    printf foo >scratch/foo
+    chmod 640 scratch/foo
+    TZ=UTC0 touch -t 200001010000 scratch/foo
+
+    local out
+    out="$(invoke_bfs scratch/foo -printj)" || return 1
+    [[ "$out" == '{"path":"scratch/foo","type":"f",'* ]] || return 1
+    [[ "$out" == *',"mode":416,'* ]] || return 1
+    [[ "$out" == *',"size":3,'* ]] || return 1
+    [[ "$out" == *',"mtime":946684800.000000000}' ]]
+}
+
+function test_printj_escapes() {
+    rm -rf scratch/*
+    touchp "scratch/a\"b\\c"
+    touchp "scratch/d
+e"
+
+    [ "$(invoke_bfs scratch -type f -printj | sed 's/,"type".*//' | sort)" = '{"path":"scratch/a\"b\\c"
+{"path":"scratch/d\ne"' ]
+}
+
+function test_fprintj() {
+    rm -rf scratch/*
+    invoke_bfs basic -fprintj scratch/out.json || return 1
+    [ "$(wc -l <scratch/out.json)" -eq "$(invoke_bfs basic | wc -l)" ]
+}
+
+function test_printb() {
+    rm -rf scratch/*
+    touchp scratch/foo
+
+    # 152 header bytes, plus the path
+    invoke_bfs scratch/foo -printb >"$TMP/printb.bin" || return 1
+    [ "$(wc -c <"$TMP/printb.bin")" -eq 163 ] || return 1
+    [ "$(head -c 4 "$TMP/printb.bin" | od -An -tu1 | tr -s ' ')" = " 159 0 0 0" ] || return 1
+    [ "$(tail -c 11 "$TMP/printb.bin")" = "scratch/foo" ]
+}
+
 function test_printf_incomplete_escape() {
     fail quiet invoke_bfs basic -printf '\'
 }
@@ -2901,6 +3301,10 @@ function test_unique_depth() {
     bfs_diff basic -unique -depth
 }
 
+function test_unique_depth_hardlink() {
+    bfs_diff links -unique -depth -type f
+}
+
 function test_L_unique() {
     bfs_diff -L links/{file,symlink,hardlink} -unique
 }
@@ -3177,6 +3581,21 @@ function test_D_all() {
     quiet bfs_diff -D all basic
 }
 
+function test_D_prof() {
+    local out
+    out="$(invoke_bfs basic -D prof -print 2>&1 >/dev/null)" || return 1
+    [[ "$out" == '{"elapsed":'*',"phases":{"open":{"count":'* ]] || return 1
+    [[ "$out" == *'"readdir":{"count":'*'"stat":{'*'"callback":{'*'"output":{'*'"exec_wait":{'*'}}' ]]
+}
+
+function test_D_startup() {
+    local out
+    out="$(invoke_bfs basic -D startup -print 2>&1 >/dev/null)" || return 1
+    for phase in init parse optimize total; do
+        [[ "$out" == *"-D startup: $phase:"*" ms"* ]] || return 1
+    done
+}
+
 function test_O0() {
     bfs_diff -O0 basic -not \( -type f -not -type f \)
 }
@@ -3193,10 +3612,40 @@ function test_O3() {
     bfs_diff -O3 basic -not \( -type f -not -type f \)
 }
 
+function test_O4_adaptive() {
+    rm -rf scratch/*
+    $TOUCH scratch/{1..1100}
+
+    # Enough files to re-order (-name 1* -name *9) with measured probabilities
+    bfs_diff -O4 scratch \( -name '1*' -name '*9' \) -o -links 5
+}
+
 function test_Ofast() {
     bfs_diff -Ofast basic -not \( -xtype f -not -xtype f \)
 }
 
+function test_factor() {
+    # (-name *o* -type f) -o (-name *o* -type d) <==> -name *o* ((-type f) -o (-type d))
+    bfs_diff basic \( -name '*o*' -type f \) -o \( -name '*o*' -type d \)
+}
+
+function test_memo() {
+    bfs_diff basic \( -name '*a*' -type f \) -o \( -type d -name '*a*' \) -o \( -type l -name '*a*' \)
+}
+
+function test_memo_regextype() {
+    # The two -regex tests look the same, but mean different things
+    bfs_diff basic -regex '.*/\(foo\)' -print -regextype posix-extended -regex '.*/\(foo\)' -printf 'ERE %p\n'
+}
+
+function test_flatten() {
+    local expr=(\( -name foo -o ! -type d , -name '*a*' \) ! \( -name bar -o \( -false , -true \) -name baz \) -printf 'A %p\n' -o -type d -printf 'D %p\n')
+
+    # -D rates needs the tree interpreter, so compare it to the flattened expression
+    invoke_bfs basic -D rates "${expr[@]}" 2>/dev/null | sort >"$TMP/test_flatten.out" || return 1
+    bfs_diff basic "${expr[@]}" && $DIFF -u "$TESTS/test_flatten.out" "$TMP/test_flatten.out"
+}
+
 function test_S() {
     invoke_bfs -S "$1" -s basic >"scratch/test_S_$1.out"
 
@@ -3219,6 +3668,164 @@ function test_S_ids() {
     test_S ids
 }
 
+function test_S_ids_opens() {
+    # Replayed listings shouldn't open any more directories than one walk
+    local bfs ids
+    bfs="$(invoke_bfs -j2 -S bfs basic -D search 2>&1 >/dev/null | grep cache_opens)" || return 1
+    ids="$(invoke_bfs -j2 -S ids basic -D search 2>&1 >/dev/null | grep cache_opens)" || return 1
+    [ "$bfs" = "$ids" ]
+}
+
+function test_j() {
+    bfs_diff -j4 basic
+}
+
+function test_j_space() {
+    bfs_diff -j 1 basic
+}
+
+function test_j_huge() {
+    # More threads than the queue can use shouldn't be an error
+    bfs_diff -j100000 basic
+}
+
+function test_j_invalid() {
+    fail quiet invoke_bfs -jfoo basic
+}
+
+function test_j_stat() {
+    bfs_diff -j2 links -type f -links 2
+}
+
+function test_queue_limit() {
+    bfs_diff basic -queue-limit 1
+}
+
+function test_queue_limit_s() {
+    invoke_bfs -S bfs -s basic -queue-limit 2 >"$TMP/test_queue_limit_s.out"
+
+    if [ "$UPDATE" ]; then
+        cp {"$TMP","$TESTS"}/test_queue_limit_s.out
+    else
+        $DIFF -u {"$TESTS","$TMP"}/test_queue_limit_s.out
+    fi
+}
+
+function test_limit() {
+    local count=$(invoke_bfs basic -limit 3 | wc -l)
+    ((count == 3))
+}
+
+function test_limit_big() {
+    bfs_diff basic -limit 1000
+}
+
+function test_limit_zero() {
+    fail quiet invoke_bfs basic -limit 0
+}
+
+function test_top() {
+    rm -rf scratch/*
+    local i
+    for i in 3 1 4 2 5; do
+        head -c "${i}00" /dev/zero >"scratch/$i"
+    done
+
+    # -top output is ordered, so don't sort it
+    invoke_bfs scratch -type f -top 3 -printf '%s %p\n' >"$TMP/test_top.out"
+
+    if [ "$UPDATE" ]; then
+        cp {"$TMP","$TESTS"}/test_top.out
+    else
+        $DIFF -u {"$TESTS","$TMP"}/test_top.out
+    fi
+}
+
+function test_top_mtime() {
+    invoke_bfs times -type f -top 2 -by mtime >"$TMP/test_top_mtime.out"
+
+    if [ "$UPDATE" ]; then
+        cp {"$TMP","$TESTS"}/test_top_mtime.out
+    else
+        $DIFF -u {"$TESTS","$TMP"}/test_top_mtime.out
+    fi
+}
+
+function test_top_by_invalid() {
+    fail quiet invoke_bfs basic -top 1 -by foo
+}
+
+function test_summarize() {
+    rm -rf scratch/*
+    mkdir -p scratch/foo/bar scratch/baz
+    head -c 100 /dev/zero >scratch/a
+    head -c 20 /dev/zero >scratch/foo/b
+    head -c 3 /dev/zero >scratch/foo/bar/c
+    head -c 4 /dev/zero >scratch/foo/bar/d
+
+    bfs_diff scratch -type f -summarize size,count
+}
+
+function test_summarize_depth() {
+    bfs_diff basic -summarize count -summarize-depth 1
+}
+
+function test_summarize_unique() {
+    bfs_diff links -unique -type f -summarize count
+}
+
+function test_summarize_invalid() {
+    fail quiet invoke_bfs basic -summarize size,bogus
+}
+
+function test_readdir_buffer() {
+    bfs_diff basic -readdir-buffer 1,2
+}
+
+function test_readdir_buffer_invalid() {
+    fail quiet invoke_bfs basic -readdir-buffer 4,2
+}
+
+function test_snapshot() {
+    rm -rf scratch/*
+    touchp scratch/foo/bar
+    touchp scratch/baz
+    invoke_bfs scratch -snapshot-save "$TMP/scratch.snap" -false || return 1
+
+    # The snapshot is trusted, so deleted files are still found
+    rm -r scratch/foo
+    bfs_diff scratch -snapshot "$TMP/scratch.snap"
+}
+
+function test_snapshot_check() {
+    rm -rf scratch/*
+    touchp scratch/foo/bar
+    touchp scratch/baz
+    touchp scratch/keep/old
+
+    # Backdate everything, so the records aren't too recent to be trusted
+    touch -t 199112140000 scratch scratch/foo scratch/keep
+    invoke_bfs scratch -snapshot-save "$TMP/scratch.snap" -false || return 1
+
+    # Changed directories are read again, and unchanged ones come from the
+    # snapshot
+    rm scratch/baz
+    touchp scratch/foo/qux
+    bfs_diff scratch -snapshot-check "$TMP/scratch.snap"
+}
+
+function test_opt_profile() {
+    rm -f "$TMP/opt.prof"
+
+    bfs_diff basic -opt-profile "$TMP/opt.prof" -type f -name '*a*' \
+        && [[ "$(head -n1 "$TMP/opt.prof")" == "bfs-opt-profile 1" ]] \
+        && bfs_diff basic -opt-profile "$TMP/opt.prof" -type f -name '*a*'
+}
+
+function test_snapshot_save() {
+    bfs_diff basic -snapshot-save "$TMP/basic.snap" && bfs_diff basic -snapshot "$TMP/basic.snap"
+}
+
 function test_exclude_name() {
     bfs_diff basic -exclude -name foo
 }
@@ -0,0 +1,94 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2020-2022 Tavian Barnes <tavianator@tavianator.com>        *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+#undef NDEBUG
+
+#include "../src/alloc.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct flexible {
+	size_t length;
+	char data[];
+};
+
+int main(void) {
+	// Fixed-size arena
+	struct arena arena;
+	ARENA_INIT(&arena, uint64_t);
+
+	uint64_t *ptrs[1000];
+	for (size_t i = 0; i < 1000; ++i) {
+		ptrs[i] = arena_alloc(&arena);
+		assert(ptrs[i]);
+		assert((uintptr_t)ptrs[i] % alignof(uint64_t) == 0);
+		*ptrs[i] = i;
+	}
+	assert(arena.live == 1000);
+
+	for (size_t i = 0; i < 1000; ++i) {
+		assert(*ptrs[i] == i);
+	}
+
+	for (size_t i = 0; i < 1000; i += 2) {
+		arena_free(&arena, ptrs[i]);
+	}
+	assert(arena.live == 500);
+	assert(arena.peak == 1000);
+
+	// Freed chunks get reused before growing
+	size_t bytes = arena.bytes;
+	for (size_t i = 0; i < 1000; i += 2) {
+		ptrs[i] = arena_alloc(&arena);
+		assert(ptrs[i]);
+	}
+	assert(arena.bytes == bytes);
+
+	arena_destroy(&arena);
+
+	// Flexible arrays
+	struct varena varena;
+	VARENA_INIT(&varena, struct flexible, data);
+
+	struct flexible *flexs[256];
+	for (size_t i = 0; i < 256; ++i) {
+		flexs[i] = varena_alloc(&varena, i + 1);
+		assert(flexs[i]);
+		assert((uintptr_t)flexs[i] % alignof(struct flexible) == 0);
+		flexs[i]->length = i;
+		memset(flexs[i]->data, 'a' + i % 26, i);
+		flexs[i]->data[i] = '\0';
+	}
+	assert(varena.live == 256);
+
+	for (size_t i = 0; i < 256; ++i) {
+		assert(flexs[i]->length == i);
+		assert(strlen(flexs[i]->data) == i);
+	}
+
+	for (size_t i = 0; i < 256; ++i) {
+		varena_free(&varena, flexs[i], i + 1);
+	}
+	assert(varena.live == 0);
+	assert(varena.peak == 256);
+	assert(varena_bytes(&varena) > 0);
+
+	varena_destroy(&varena);
+
+	return EXIT_SUCCESS;
+}
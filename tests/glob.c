@@ -0,0 +1,154 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+
+#undef NDEBUG
+
+#include "../src/glob.h"
+#include <assert.h>
+#include <fnmatch.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char *patterns[] = {
+	"",
+	"*",
+	"**",
+	"foo",
+	"foo*",
+	"*foo",
+	"*foo*",
+	"f*o",
+	"*.c",
+	"*.tar.gz",
+	"a*b*c",
+	"a*b*c*",
+	"*a*a*",
+	"ab*ba",
+	"*aa",
+	"\\*",
+	"\\*foo",
+	"foo\\*bar",
+	"f\\oo",
+	"*\\\\*",
+	"?",
+	"f?o",
+	"[ab]*",
+	"*[!.]",
+};
+
+static const char *strings[] = {
+	"",
+	"a",
+	"aa",
+	"aaa",
+	"ab",
+	"aba",
+	"abba",
+	"abc",
+	"abcabc",
+	"axbxc",
+	"acb",
+	"f",
+	"fo",
+	"foo",
+	"fooo",
+	"ffoo",
+	"foo.c",
+	"foo.c.c",
+	".c",
+	"c",
+	"x.tar.gz",
+	"tar.gz",
+	"*",
+	"*foo",
+	"foo*bar",
+	"foobar",
+	"a\\b",
+	"path/to/foo",
+};
+
+#define countof(array) (sizeof(array) / sizeof(array[0]))
+
+/** Check a glob set made of patterns[start, end) against fnmatch(). */
+static bool check_globset(size_t start, size_t end) {
+	bool ret = true;
+
+	struct bfs_globset *set = bfs_globset_new(0);
+	assert(set);
+	for (size_t i = start; i < end; ++i) {
+		assert(bfs_globset_add(set, patterns[i]) == 0);
+	}
+
+	for (size_t j = 0; j < countof(strings); ++j) {
+		const char *str = strings[j];
+
+		bool expected = false;
+		for (size_t i = start; i < end; ++i) {
+			if (fnmatch(patterns[i], str, 0) == 0) {
+				expected = true;
+			}
+		}
+
+		if (bfs_globset_match(set, str) != expected) {
+			fprintf(stderr, "Mismatch for patterns [%zu, %zu), string '%s'\n", start, end, str);
+			ret = false;
+		}
+	}
+
+	bfs_globset_free(set);
+	return ret;
+}
+
+int main(void) {
+	bool ret = true;
+
+	for (size_t i = 0; i < countof(patterns); ++i) {
+		const char *pattern = patterns[i];
+		struct bfs_glob *glob = bfs_glob_compile(pattern, 0);
+		assert(glob);
+
+		for (size_t j = 0; j < countof(strings); ++j) {
+			const char *str = strings[j];
+			bool expected = fnmatch(pattern, str, 0) == 0;
+			if (bfs_glob_match(glob, str) != expected) {
+				fprintf(stderr, "Mismatch for pattern '%s', string '%s'\n", pattern, str);
+				ret = false;
+			}
+		}
+
+		bfs_glob_free(glob);
+	}
+
+	for (size_t i = 0; i < countof(patterns); ++i) {
+		for (size_t j = i + 1; j <= countof(patterns) && j <= i + 4; ++j) {
+			ret &= check_globset(i, j);
+		}
+	}
+	ret &= check_globset(2, countof(patterns));
+
+	// Patterns with ? and [] are left to fnmatch()
+	struct bfs_glob *glob = bfs_glob_compile("f?o", 0);
+	assert(glob && bfs_glob_is_fnmatch(glob));
+	bfs_glob_free(glob);
+
+	glob = bfs_glob_compile("*.c", 0);
+	assert(glob && !bfs_glob_is_fnmatch(glob));
+	bfs_glob_free(glob);
+
+	return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
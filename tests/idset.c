@@ -0,0 +1,61 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2023 Tavian Barnes <tavianator@tavianator.com>        *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+
+#undef NDEBUG
+
+#include "../src/idset.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+int main(void) {
+	struct bfs_idset *set = bfs_idset_new();
+	assert(set);
+	assert(bfs_idset_size(set) == 0);
+
+	// Dense inodes on a few devices, enough to force the table to grow
+	for (dev_t dev = 1; dev <= 3; ++dev) {
+		for (ino_t ino = 0; ino < 10000; ++ino) {
+			assert(!bfs_idset_contains(set, dev, ino));
+			assert(bfs_idset_insert(set, dev, ino) == 1);
+			assert(bfs_idset_contains(set, dev, ino));
+		}
+	}
+	assert(bfs_idset_size(set) == 30000);
+
+	// Sparse inodes
+	for (ino_t ino = 1; ino < 1000; ++ino) {
+		assert(bfs_idset_insert(set, 4, ino * 1000003) == 1);
+	}
+	assert(bfs_idset_size(set) == 30999);
+
+	// Duplicates
+	for (dev_t dev = 1; dev <= 3; ++dev) {
+		for (ino_t ino = 0; ino < 10000; ino += 7) {
+			assert(bfs_idset_insert(set, dev, ino) == 0);
+		}
+	}
+	assert(bfs_idset_insert(set, 4, 1000003) == 0);
+	assert(bfs_idset_size(set) == 30999);
+
+	assert(!bfs_idset_contains(set, 4, 1000004));
+	assert(!bfs_idset_contains(set, 5, 0));
+	assert(!bfs_idset_contains(set, 1, 10000));
+
+	bfs_idset_free(set);
+	return EXIT_SUCCESS;
+}
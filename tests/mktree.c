@@ -0,0 +1,225 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2023 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+/**
+ * Generates synthetic directory trees for bench.sh.  The trees are the same
+ * for the same arguments, so results are comparable between runs.
+ *
+ * Usage: tests/mktree SHAPE NFILES DIR
+ *
+ * Shapes:
+ *   wide:  A shallow tree with very large directories
+ *   deep:  A long chain of nested directories with a few files each
+ *   small: A balanced tree of many small files with some contents
+ *   links: A balanced tree where a third of the entries are symlinks
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** The command name, for error messages. */
+static const char *cmd = "mktree";
+
+/** Print an error message and exit. */
+static void die(const char *what, const char *name) {
+	fprintf(stderr, "%s: %s('%s'): %s.\n", cmd, what, name, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+/** A deterministic pseudo-random number generator state. */
+static unsigned long long rng = 1;
+
+/** Get the next pseudo-random number. */
+static unsigned long next_random(void) {
+	rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+	return rng >> 33;
+}
+
+/** File name extensions, so -name patterns have something to match. */
+static const char *const exts[] = {".c", ".h", ".txt", ".o", ".md", ""};
+
+/** Create a regular file with some contents. */
+static void make_file(int dfd, size_t i, size_t size) {
+	char name[64];
+	const char *ext = exts[next_random() % (sizeof(exts) / sizeof(exts[0]))];
+	snprintf(name, sizeof(name), "f%zu%s", i, ext);
+
+	int fd = openat(dfd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		die("openat", name);
+	}
+
+	static const char data[4096] = {0};
+	while (size > 0) {
+		size_t chunk = size < sizeof(data) ? size : sizeof(data);
+		ssize_t ret = write(fd, data, chunk);
+		if (ret < 0) {
+			die("write", name);
+		}
+		size -= ret;
+	}
+
+	if (close(fd) != 0) {
+		die("close", name);
+	}
+}
+
+/** Create and open a subdirectory. */
+static int make_dir(int dfd, size_t i) {
+	char name[64];
+	snprintf(name, sizeof(name), "d%zu", i);
+
+	if (mkdirat(dfd, name, 0755) != 0 && errno != EEXIST) {
+		die("mkdirat", name);
+	}
+
+	int fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		die("openat", name);
+	}
+	return fd;
+}
+
+/** Create a symlink to a sibling or a parent. */
+static void make_link(int dfd, size_t i) {
+	char name[64], target[64];
+	snprintf(name, sizeof(name), "l%zu", i);
+
+	switch (next_random() % 3) {
+	case 0:
+		snprintf(target, sizeof(target), "f%zu.c", i > 0 ? i - 1 : 0);
+		break;
+	case 1:
+		snprintf(target, sizeof(target), "../d%lu", next_random() % 4);
+		break;
+	default:
+		snprintf(target, sizeof(target), "missing%zu", i);
+		break;
+	}
+
+	if (symlinkat(target, dfd, name) != 0 && errno != EEXIST) {
+		die("symlinkat", name);
+	}
+}
+
+/**
+ * Fill a balanced tree.
+ *
+ * @param dfd
+ *         The directory to fill.
+ * @param nfiles
+ *         The number of files to create beneath it.
+ * @param fanout
+ *         The number of subdirectories per directory.
+ * @param perdir
+ *         The number of entries to create directly in each directory.
+ * @param size
+ *         The size of each regular file.
+ * @param links
+ *         Whether to make some of the entries symlinks.
+ */
+static void fill_tree(int dfd, size_t nfiles, size_t fanout, size_t perdir, size_t size, bool links) {
+	size_t here = nfiles < perdir ? nfiles : perdir;
+	for (size_t i = 0; i < here; ++i) {
+		if (links && i % 3 == 2) {
+			make_link(dfd, i);
+		} else {
+			make_file(dfd, i, size);
+		}
+	}
+
+	nfiles -= here;
+	if (nfiles == 0) {
+		return;
+	}
+
+	size_t nsubdirs = fanout < nfiles ? fanout : nfiles;
+	for (size_t i = 0; i < nsubdirs; ++i) {
+		size_t share = nfiles / nsubdirs + (i < nfiles % nsubdirs);
+		int fd = make_dir(dfd, i);
+		fill_tree(fd, share, fanout, perdir, size, links);
+		close(fd);
+	}
+}
+
+/** The deepest chain to generate, to keep iterative deepening tractable. */
+#define MAX_DEPTH 256
+
+/** Fill a deep chain of directories. */
+static void fill_deep(int dfd, size_t nfiles) {
+	size_t perdir = (nfiles + MAX_DEPTH - 1) / MAX_DEPTH;
+	if (perdir < 4) {
+		perdir = 4;
+	}
+
+	dfd = dup(dfd);
+	while (nfiles > 0) {
+		for (size_t i = 0; i < perdir && nfiles > 0; ++i, --nfiles) {
+			make_file(dfd, i, 0);
+		}
+
+		int fd = make_dir(dfd, 0);
+		close(dfd);
+		dfd = fd;
+	}
+	close(dfd);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 0) {
+		cmd = argv[0];
+	}
+
+	if (argc != 4) {
+		fprintf(stderr, "Usage: %s SHAPE NFILES DIR\n", cmd);
+		return EXIT_FAILURE;
+	}
+
+	const char *shape = argv[1];
+	size_t nfiles = strtoul(argv[2], NULL, 10);
+	const char *path = argv[3];
+
+	if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+		die("mkdir", path);
+	}
+
+	int dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd < 0) {
+		die("open", path);
+	}
+
+	if (strcmp(shape, "wide") == 0) {
+		fill_tree(dfd, nfiles, 8, nfiles / 8 + 1, 0, false);
+	} else if (strcmp(shape, "deep") == 0) {
+		fill_deep(dfd, nfiles);
+	} else if (strcmp(shape, "small") == 0) {
+		fill_tree(dfd, nfiles, 16, 32, 256, false);
+	} else if (strcmp(shape, "links") == 0) {
+		fill_tree(dfd, nfiles, 8, 24, 0, true);
+	} else {
+		fprintf(stderr, "%s: Unknown shape '%s'.\n", cmd, shape);
+		return EXIT_FAILURE;
+	}
+
+	close(dfd);
+	return EXIT_SUCCESS;
+}
@@ -110,6 +110,36 @@ int main(void) {
 		}
 	}
 
+	// Bulk construction should agree with incremental insertion
+	struct trie built;
+	trie_init(&built);
+	struct trie_leaf **leaves = malloc((nkeys + 1)*sizeof(*leaves));
+	assert(leaves);
+	const void **bulk_keys = malloc((nkeys + 1)*sizeof(*bulk_keys));
+	assert(bulk_keys);
+	for (size_t i = 0; i < nkeys; ++i) {
+		bulk_keys[i] = keys[i];
+	}
+	bulk_keys[nkeys] = keys[0];
+	assert(trie_build(&built, bulk_keys, NULL, nkeys + 1, leaves) == 0);
+	assert(leaves[nkeys] == leaves[0]);
+
+	for (size_t i = 0; i < nkeys; ++i) {
+		struct trie_leaf *leaf = trie_find_str(&built, keys[i]);
+		assert(leaf == leaves[i]);
+		assert(strcmp(keys[i], leaf->key) == 0);
+		assert(trie_find_prefix(&built, keys[i]) == leaf);
+		assert(trie_insert_str(&built, keys[i]) == leaf);
+	}
+
+	for (size_t i = 0; i < nkeys; ++i) {
+		trie_remove(&built, trie_find_str(&built, keys[i]));
+	}
+	assert(!trie_first_leaf(&built));
+	trie_destroy(&built);
+	free(bulk_keys);
+	free(leaves);
+
 	// This tests the "jump" node handling on 32-bit platforms
 	size_t longsize = 1 << 20;
 	char *longstr = malloc(longsize);
@@ -127,6 +157,26 @@ int main(void) {
 	assert(!trie_find_mem(&trie, longstr, longsize));
 	assert(trie_insert_mem(&trie, longstr, longsize));
 
+	// Same for bulk construction
+	char *longstrs[2];
+	for (size_t i = 0; i < 2; ++i) {
+		longstrs[i] = malloc(longsize);
+		assert(longstrs[i]);
+		memset(longstrs[i], 0xAC, longsize);
+	}
+	longstrs[1][longsize - 1] = 0xAB;
+
+	const void *long_keys[] = {longstrs[0], longstrs[1]};
+	size_t long_lengths[] = {longsize, longsize};
+	trie_init(&built);
+	assert(trie_build(&built, long_keys, long_lengths, 2, NULL) == 0);
+	assert(trie_find_mem(&built, longstrs[0], longsize));
+	assert(trie_find_mem(&built, longstrs[1], longsize));
+	assert(!trie_find_mem(&built, longstr, longsize));
+	trie_destroy(&built);
+
+	free(longstrs[1]);
+	free(longstrs[0]);
 	free(longstr);
 	trie_destroy(&trie);
 	return EXIT_SUCCESS;
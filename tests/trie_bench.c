@@ -0,0 +1,127 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2023 Tavian Barnes <tavianator@tavianator.com>        *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+
+/**
+ * A microbenchmark for tries.  It times incremental insertion, bulk
+ * construction, exact lookups, and longest-prefix lookups over a synthetic set
+ * of path-like keys.
+ *
+ * Usage: tests/trie_bench [NKEYS]
+ */
+
+#include "../src/trie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** Get the time in seconds. */
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+/** Print a timing result. */
+static void report(const char *name, double start, size_t count) {
+	double elapsed = now() - start;
+	printf("%-16s %10.1f ns/key\n", name, 1.0e9 * elapsed / count);
+}
+
+int main(int argc, char *argv[]) {
+	size_t nkeys = 1000000;
+	if (argc > 1) {
+		nkeys = strtoul(argv[1], NULL, 10);
+	}
+	if (nkeys == 0) {
+		fprintf(stderr, "Usage: %s [NKEYS]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	char **keys = malloc(nkeys * sizeof(*keys));
+	if (!keys) {
+		perror("malloc()");
+		return EXIT_FAILURE;
+	}
+
+	// Pseudo-random path-like keys with shared prefixes
+	unsigned long state = 1;
+	for (size_t i = 0; i < nkeys; ++i) {
+		state = state * 6364136223846793005UL + 1442695040888963407UL;
+		char buf[64];
+		snprintf(buf, sizeof(buf), "/usr/share/%lu/%lu/%zu.txt", (state >> 60) & 0xF, (state >> 40) & 0xFF, i);
+		keys[i] = strdup(buf);
+		if (!keys[i]) {
+			perror("strdup()");
+			return EXIT_FAILURE;
+		}
+	}
+
+	struct trie trie;
+	trie_init(&trie);
+	double start = now();
+	for (size_t i = 0; i < nkeys; ++i) {
+		if (!trie_insert_str(&trie, keys[i])) {
+			perror("trie_insert_str()");
+			return EXIT_FAILURE;
+		}
+	}
+	report("insert", start, nkeys);
+
+	start = now();
+	size_t found = 0;
+	for (size_t i = 0; i < nkeys; ++i) {
+		found += !!trie_find_str(&trie, keys[i]);
+	}
+	report("find_str", start, nkeys);
+
+	start = now();
+	for (size_t i = 0; i < nkeys; ++i) {
+		found += !!trie_find_prefix(&trie, keys[i]);
+	}
+	report("find_prefix", start, nkeys);
+
+	start = now();
+	trie_destroy(&trie);
+	report("destroy", start, nkeys);
+
+	trie_init(&trie);
+	start = now();
+	if (trie_build(&trie, (const void *const *)keys, NULL, nkeys, NULL) != 0) {
+		perror("trie_build()");
+		return EXIT_FAILURE;
+	}
+	report("build", start, nkeys);
+
+	start = now();
+	for (size_t i = 0; i < nkeys; ++i) {
+		found += !!trie_find_str(&trie, keys[i]);
+	}
+	report("find_str (built)", start, nkeys);
+	trie_destroy(&trie);
+
+	if (found != 3 * nkeys) {
+		fprintf(stderr, "Lookups failed\n");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < nkeys; ++i) {
+		free(keys[i]);
+	}
+	free(keys);
+	return EXIT_SUCCESS;
+}
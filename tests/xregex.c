@@ -0,0 +1,188 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2026 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+
+#undef NDEBUG
+
+#include "../src/xregex.h"
+#include <assert.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The reference implementation is regexec(), which only matches the POSIX backend
+#if !BFS_WITH_ONIGURUMA
+
+static const char *patterns[] = {
+	"",
+	".*",
+	"foo",
+	".*foo",
+	"foo.*",
+	".*foo.*",
+	".*/foo/.*",
+	".*\\.log",
+	".*\\.log$",
+	"^foo",
+	"^foo$",
+	"foo$",
+	"fo*",
+	"fo*o",
+	"foo*",
+	"f.o",
+	".*.*foo",
+	"a.*b.*c",
+	"[ab]*c",
+	"[]]x",
+	"[[:alpha:]]+",
+	"a\\.b",
+	"a\\*b",
+	"a*b",
+	"*a",
+	"x\\{2\\}",
+	"x{2}",
+	"x\\+y",
+	"x+y",
+	"x\\?y",
+	"x?y",
+	"(ab)c",
+	"\\(ab\\)c",
+	"\\(ab\\)*c",
+	"(ab)*c",
+	"a|b",
+	"a\\|b",
+	"(a|b)c",
+	"\\(a\\|b\\)c",
+	"a{,2}b",
+	"$",
+	"^",
+	"a^b",
+	"a$b",
+	".*a$b",
+};
+
+static const char *strings[] = {
+	"",
+	"a",
+	"ab",
+	"abc",
+	"aabc",
+	"abab",
+	"ababc",
+	"ac",
+	"bc",
+	"c",
+	"f",
+	"fo",
+	"foo",
+	"fooo",
+	"xfoo",
+	"foox",
+	"xfoox",
+	"fxo",
+	"a/foo/b",
+	"/foo/",
+	"x.log",
+	".log",
+	"x.logx",
+	"xlog",
+	"a.b",
+	"axb",
+	"a*b",
+	"aab",
+	"*a",
+	"xx",
+	"xxx",
+	"xy",
+	"xxy",
+	"y",
+	"x+y",
+	"x?y",
+	"]x",
+	"a^b",
+	"a$b",
+	"foo\n.log",
+	"\xC3\xA9" "foo",
+	"foo\xFF",
+};
+
+#define countof(array) (sizeof(array) / sizeof(array[0]))
+
+/** Match a string with plain regexec(), the way bfs_regexec() would. */
+static int reference_match(regex_t *regex, const char *str, enum bfs_regexec_flags flags) {
+	regmatch_t match;
+	int ret = regexec(regex, str, 1, &match, 0);
+	if (ret == REG_NOMATCH) {
+		return 0;
+	}
+	assert(ret == 0);
+
+	if (flags & BFS_REGEX_ANCHOR) {
+		return match.rm_so == 0 && (size_t)match.rm_eo == strlen(str);
+	} else {
+		return 1;
+	}
+}
+
+/** Check one pattern against every string. */
+static bool check_pattern(const char *pattern, enum bfs_regex_type type, int cflags) {
+	struct bfs_regex *regex;
+	if (bfs_regcomp(&regex, pattern, type, 0) != 0) {
+		// Not every pattern is valid in every flavor
+		bfs_regfree(regex);
+		return true;
+	}
+
+	regex_t reference;
+	assert(regcomp(&reference, pattern, cflags) == 0);
+
+	bool ret = true;
+	for (size_t i = 0; i < countof(strings); ++i) {
+		const char *str = strings[i];
+		for (int flags = 0; flags <= BFS_REGEX_ANCHOR; flags += BFS_REGEX_ANCHOR) {
+			int expected = reference_match(&reference, str, flags);
+			int actual = bfs_regexec(regex, str, flags);
+			if (actual != expected) {
+				fprintf(stderr, "Mismatch for pattern '%s' (%s), string '%s', flags %d: expected %d, got %d\n",
+				        pattern, cflags ? "ERE" : "BRE", str, flags, expected, actual);
+				ret = false;
+			}
+		}
+	}
+
+	regfree(&reference);
+	bfs_regfree(regex);
+	return ret;
+}
+
+#endif // !BFS_WITH_ONIGURUMA
+
+int main(void) {
+#if BFS_WITH_ONIGURUMA
+	return EXIT_SUCCESS;
+#else
+	bool ret = true;
+
+	for (size_t i = 0; i < countof(patterns); ++i) {
+		ret &= check_pattern(patterns[i], BFS_REGEX_POSIX_BASIC, 0);
+		ret &= check_pattern(patterns[i], BFS_REGEX_POSIX_EXTENDED, REG_EXTENDED);
+	}
+
+	return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+#endif
+}
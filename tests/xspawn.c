@@ -0,0 +1,188 @@
+/****************************************************************************
+ * bfs                                                                      *
+ * Copyright (C) 2022 Tavian Barnes <tavianator@tavianator.com>             *
+ *                                                                          *
+ * Permission to use, copy, modify, and/or distribute this software for any *
+ * purpose with or without fee is hereby granted.                           *
+ *                                                                          *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+ ****************************************************************************/
+
+
+/**
+ * Checks for bfs_spawn(), and a microbenchmark for how many processes it can
+ * spawn per second.  Run
+ *
+ *     tests/xspawn --bench [N [MiB]]
+ *
+ * to time N spawns (default: 1000) with and without BFS_SPAWN_FORK, after
+ * growing the heap by MiB megabytes (default: 256) to show the cost of copying
+ * page tables.
+ */
+
+#undef NDEBUG
+
+#include "../src/xspawn.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Set up a spawn context like -exec does. */
+static void init_ctx(struct bfs_spawn *ctx, enum bfs_spawn_flags flags) {
+	assert(bfs_spawn_init(ctx) == 0);
+	assert(bfs_spawn_setflags(ctx, BFS_SPAWN_USEPATH | flags) == 0);
+
+	struct rlimit rl;
+	assert(getrlimit(RLIMIT_NOFILE, &rl) == 0);
+	assert(bfs_spawn_addsetrlimit(ctx, RLIMIT_NOFILE, &rl) == 0);
+}
+
+/** Wait for a process and return its exit status. */
+static int wait_status(pid_t pid) {
+	int wstatus;
+	assert(waitpid(pid, &wstatus, 0) == pid);
+	assert(WIFEXITED(wstatus));
+	return WEXITSTATUS(wstatus);
+}
+
+/** Spawn a process with its stdout redirected, and check its output. */
+static void check_output(struct bfs_spawn *ctx, char **argv, const char *expected) {
+	int pipefd[2];
+	assert(pipe(pipefd) == 0);
+	assert(bfs_spawn_adddup2(ctx, pipefd[1], STDOUT_FILENO) == 0);
+	assert(bfs_spawn_addclose(ctx, pipefd[1]) == 0);
+	assert(bfs_spawn_addclose(ctx, pipefd[0]) == 0);
+
+	pid_t pid = bfs_spawn(argv[0], ctx, argv, NULL);
+	assert(pid > 0);
+	close(pipefd[1]);
+
+	char buf[256];
+	size_t len = 0;
+	ssize_t ret;
+	while ((ret = read(pipefd[0], buf + len, sizeof(buf) - 1 - len)) > 0) {
+		len += ret;
+	}
+	assert(ret == 0);
+	buf[len] = '\0';
+	close(pipefd[0]);
+
+	assert(wait_status(pid) == 0);
+	if (strcmp(buf, expected) != 0) {
+		fprintf(stderr, "Expected '%s', got '%s'\n", expected, buf);
+		abort();
+	}
+}
+
+static void check_spawn(enum bfs_spawn_flags flags) {
+	struct bfs_spawn ctx;
+
+	// Plain spawn
+	char *true_argv[] = {"true", NULL};
+	init_ctx(&ctx, flags);
+	pid_t pid = bfs_spawn("true", &ctx, true_argv, NULL);
+	assert(pid > 0);
+	assert(wait_status(pid) == 0);
+	bfs_spawn_destroy(&ctx);
+
+	// exec() failures are reported synchronously
+	char *missing_argv[] = {"/nonexistent/bfs-xspawn", NULL};
+	init_ctx(&ctx, flags);
+	errno = 0;
+	assert(bfs_spawn(missing_argv[0], &ctx, missing_argv, NULL) < 0);
+	assert(errno == ENOENT);
+	bfs_spawn_destroy(&ctx);
+
+	// So are action failures
+	int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	assert(null_fd >= 0);
+	init_ctx(&ctx, flags);
+	assert(bfs_spawn_addfchdir(&ctx, null_fd) == 0);
+	errno = 0;
+	assert(bfs_spawn(true_argv[0], &ctx, true_argv, NULL) < 0);
+	assert(errno == ENOTDIR);
+	bfs_spawn_destroy(&ctx);
+	close(null_fd);
+
+	// Redirections, with and without other actions
+	char *echo_argv[] = {"echo", "hello", NULL};
+	assert(bfs_spawn_init(&ctx) == 0);
+	assert(bfs_spawn_setflags(&ctx, BFS_SPAWN_USEPATH | flags) == 0);
+	check_output(&ctx, echo_argv, "hello\n");
+	bfs_spawn_destroy(&ctx);
+
+	int root_fd = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	assert(root_fd >= 0);
+	char *pwd_argv[] = {"sh", "-c", "pwd", NULL};
+	init_ctx(&ctx, flags);
+	assert(bfs_spawn_addfchdir(&ctx, root_fd) == 0);
+	check_output(&ctx, pwd_argv, "/\n");
+	bfs_spawn_destroy(&ctx);
+	close(root_fd);
+}
+
+/** Get the current time in seconds. */
+static double now(void) {
+	struct timespec ts;
+	assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+/** Time how many spawns per second we can do. */
+static double bench_spawn(enum bfs_spawn_flags flags, long count) {
+	struct bfs_spawn ctx;
+	init_ctx(&ctx, flags);
+
+	char *argv[] = {"true", NULL};
+	double start = now();
+	for (long i = 0; i < count; ++i) {
+		pid_t pid = bfs_spawn(argv[0], &ctx, argv, NULL);
+		assert(pid > 0);
+		assert(wait_status(pid) == 0);
+	}
+	double elapsed = now() - start;
+
+	bfs_spawn_destroy(&ctx);
+	return count / elapsed;
+}
+
+static int bench(int argc, char *argv[]) {
+	long count = argc > 2 ? atol(argv[2]) : 1000;
+	long mib = argc > 3 ? atol(argv[3]) : 256;
+
+	// Touch every page, so the page tables are fully populated
+	size_t size = (size_t)mib << 20;
+	char *heap = malloc(size);
+	assert(size == 0 || heap);
+	memset(heap, 1, size);
+
+	printf("heap: %ld MiB\n", mib);
+	printf("bfs_spawn(): %.0f spawns/s\n", bench_spawn(0, count));
+	printf("fork(): %.0f spawns/s\n", bench_spawn(BFS_SPAWN_FORK, count));
+
+	free(heap);
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+		return bench(argc, argv);
+	}
+
+	check_spawn(0);
+	check_spawn(BFS_SPAWN_FORK);
+	return EXIT_SUCCESS;
+}
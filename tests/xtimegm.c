@@ -61,6 +61,29 @@ static void tm_print(FILE *file, const struct tm *tm) {
 		tm->tm_isdst ? (tm->tm_isdst < 0 ? " (DST?)" : " (DST)") : "");
 }
 
+/** Check that xlocaltime() agrees with localtime_r(). */
+static bool check_localtime(time_t time) {
+	struct tm tma, tmb;
+	if (!localtime_r(&time, &tma)) {
+		return true;
+	}
+	if (xlocaltime(&time, &tmb) != 0) {
+		printf("xlocaltime(%jd) failed\n", (intmax_t)time);
+		return false;
+	}
+
+	if (!tm_equal(&tma, &tmb)) {
+		printf("Input:        %jd\n", (intmax_t)time);
+		printf("localtime_r(): ");
+		tm_print(stdout, &tma);
+		printf("xlocaltime():  ");
+		tm_print(stdout, &tmb);
+		return false;
+	}
+
+	return true;
+}
+
 int main(void) {
 	if (setenv("TZ", "UTC0", true) != 0) {
 		perror("setenv()");
@@ -103,5 +126,31 @@ int main(void) {
 		}
 	}
 
+	// Use a time zone with daylight saving time, to test that xlocaltime()
+	// notices the transitions
+	if (setenv("TZ", "EST5EDT,M3.2.0,M11.1.0", true) != 0) {
+		perror("setenv()");
+		return EXIT_FAILURE;
+	}
+	tzset();
+
+	// Clustered times, crossing each transition in 2023
+	for (time_t t = 1672531200; t < 1704067200; t += 997) {
+		if (!check_localtime(t)) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	// A random walk, with steps of up to a year in either direction
+	unsigned long long rng = 1;
+	time_t t = 0;
+	for (int i = 0; i < 100000; ++i) {
+		rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+		t += (time_t)((rng >> 33) % (2 * 365 * 86400)) - 365 * 86400;
+		if (!check_localtime(t)) {
+			return EXIT_FAILURE;
+		}
+	}
+
 	return EXIT_SUCCESS;
 }